@@ -34,6 +34,7 @@
 
 #include "bench/benchmark.h"
 #include "common/client.h"
+#include "common/clientmux.h"
 #include "lib/configuration.h"
 #include "fastpaxos/client.h"
 #include "spec/client.h"
@@ -47,7 +48,7 @@
 static void
 Usage(const char *progName)
 {
-        fprintf(stderr, "usage: %s [-n requests] [-t threads] [-w warmup-secs] [-l latency-file] [-q dscp] [-d delay-ms] -c conf-file -m unreplicated|vr|fastpaxos|spec\n",
+        fprintf(stderr, "usage: %s [-n requests] [-t threads] [-w warmup-secs] [-l latency-file] [-q dscp] [-d delay-ms] [-M] -c conf-file -m unreplicated|vr|fastpaxos|spec\n",
                 progName);
         exit(1);
 }
@@ -66,6 +67,7 @@ int main(int argc, char **argv)
     int warmupSec = 0;
     int dscp = 0;
     uint64_t delay = 0;
+    bool multiplex = false;
     
     enum
     {
@@ -80,7 +82,7 @@ int main(int argc, char **argv)
 
     // Parse arguments
     int opt;
-    while ((opt = getopt(argc, argv, "c:d:q:l:m:n:t:w:")) != -1) {
+    while ((opt = getopt(argc, argv, "c:d:q:l:m:Mn:t:w:")) != -1) {
         switch (opt) {
         case 'c':
             configPath = optarg;
@@ -132,6 +134,10 @@ int main(int argc, char **argv)
             }
             break;
 
+        case 'M':
+            multiplex = true;
+            break;
+
         case 'n':
         {
             char *strtolPtr;
@@ -201,6 +207,11 @@ int main(int argc, char **argv)
     specpaxos::Configuration config(configStream);
     
     UDPTransport transport(0, 0, dscp);
+    // With -M, all the clients share one socket and timer
+    Transport *clientTransport = &transport;
+    if (multiplex) {
+        clientTransport = new specpaxos::ClientMux(&transport, config);
+    }
     std::vector<specpaxos::Client *> clients;
     std::vector<specpaxos::BenchmarkClient *> benchClients;
 
@@ -210,20 +221,20 @@ int main(int argc, char **argv)
         case PROTO_UNREPLICATED:
             client =
                 new specpaxos::unreplicated::UnreplicatedClient(config,
-                                                                &transport);
+                                                                clientTransport);
             break;
         
         case PROTO_VR:
-            client = new specpaxos::vr::VRClient(config, &transport);
+            client = new specpaxos::vr::VRClient(config, clientTransport);
             break;
 
         case PROTO_FASTPAXOS:
             client = new specpaxos::fastpaxos::FastPaxosClient(config,
-                                                               &transport);
+                                                               clientTransport);
             break;
 
         case PROTO_SPEC:
-            client = new specpaxos::spec::SpecClient(config, &transport);
+            client = new specpaxos::spec::SpecClient(config, clientTransport);
             break;
         
         default:
@@ -45,7 +45,7 @@
 static void
 Usage(const char *progName)
 {
-        fprintf(stderr, "usage: %s -c conf-file [-R] -i replica-index -m unreplicated|vr|fastpaxos|spec [-b batch-size] [-d packet-drop-rate] [-r packet-reorder-rate] [-q dscp]\n",
+        fprintf(stderr, "usage: %s -c conf-file [-R] -i replica-index -m unreplicated|vr|fastpaxos|spec [-b batch-size] [-w pipeline-depth] [-P fixed|adaptive] [-L target-batch-latency-us] [-D max-batch-delay-us] [-B max-batch-bytes] [-S target-commit-latency-us] [-O max-ops-per-sync] [-H] [-E] [-d packet-drop-rate] [-r packet-reorder-rate] [-q dscp]\n",
                 progName);
         exit(1);
 }
@@ -60,6 +60,17 @@ main(int argc, char **argv)
     double reorderRate = 0.0;
     int dscp = 0;
     int batchSize = 1;
+    int pipelineDepth = 1;
+    bool adaptiveBatching = false;
+    uint64_t batchTargetLatency = 500;
+    uint64_t batchMaxDelay =
+        specpaxos::vr::FixedBatchPolicy::DEFAULT_MAX_DELAY;
+    uint64_t batchMaxBytes = 65536;
+    uint64_t syncTargetLatency =
+        specpaxos::spec::SyncPolicy::DEFAULT_TARGET_LATENCY;
+    uint64_t syncMaxOps = specpaxos::spec::SyncPolicy::DEFAULT_MAX_OPS;
+    bool digestReplies = false;
+    bool execThread = false;
     bool recover;
     
     specpaxos::AppReplica *nullApp = new specpaxos::AppReplica();
@@ -75,7 +86,7 @@ main(int argc, char **argv)
 
     // Parse arguments
     int opt;
-    while ((opt = getopt(argc, argv, "b:c:d:i:m:q:r:R")) != -1) {
+    while ((opt = getopt(argc, argv, "b:B:c:d:D:EHi:L:m:O:P:q:r:RS:w:")) != -1) {
         switch (opt) {
         case 'b':
         {
@@ -91,6 +102,20 @@ main(int argc, char **argv)
             break;
         }
 
+        case 'B':
+        {
+            char *strtolPtr;
+            batchMaxBytes = strtoul(optarg, &strtolPtr, 10);
+            if ((*optarg == '\0') || (*strtolPtr != '\0')
+                || (batchMaxBytes < 1))
+            {
+                fprintf(stderr,
+                        "option -B requires a numeric arg\n");
+                Usage(argv[0]);
+            }
+            break;
+        }
+
         case 'c':
             configPath = optarg;
             break;
@@ -108,6 +133,27 @@ main(int argc, char **argv)
             break;
         }
 
+        case 'D':
+        {
+            char *strtolPtr;
+            batchMaxDelay = strtoul(optarg, &strtolPtr, 10);
+            if ((*optarg == '\0') || (*strtolPtr != '\0'))
+            {
+                fprintf(stderr,
+                        "option -D requires a numeric arg\n");
+                Usage(argv[0]);
+            }
+            break;
+        }
+
+        case 'E':
+            execThread = true;
+            break;
+
+        case 'H':
+            digestReplies = true;
+            break;
+
         case 'i':
         {
             char *strtolPtr;
@@ -121,6 +167,19 @@ main(int argc, char **argv)
             break;
         }
 
+        case 'L':
+        {
+            char *strtolPtr;
+            batchTargetLatency = strtoul(optarg, &strtolPtr, 10);
+            if ((*optarg == '\0') || (*strtolPtr != '\0'))
+            {
+                fprintf(stderr,
+                        "option -L requires a numeric arg\n");
+                Usage(argv[0]);
+            }
+            break;
+        }
+
         case 'm':
             if (strcasecmp(optarg, "unreplicated") == 0) {
                 proto = PROTO_UNREPLICATED;
@@ -136,6 +195,31 @@ main(int argc, char **argv)
             }
             break;
 
+        case 'O':
+        {
+            char *strtolPtr;
+            syncMaxOps = strtoul(optarg, &strtolPtr, 10);
+            if ((*optarg == '\0') || (*strtolPtr != '\0')
+                || (syncMaxOps < 1))
+            {
+                fprintf(stderr,
+                        "option -O requires a numeric arg\n");
+                Usage(argv[0]);
+            }
+            break;
+        }
+
+        case 'P':
+            if (strcasecmp(optarg, "fixed") == 0) {
+                adaptiveBatching = false;
+            } else if (strcasecmp(optarg, "adaptive") == 0) {
+                adaptiveBatching = true;
+            } else {
+                fprintf(stderr, "unknown batching policy '%s'\n", optarg);
+                Usage(argv[0]);
+            }
+            break;
+
         case 'q':
         {
             char *strtolPtr;
@@ -167,6 +251,33 @@ main(int argc, char **argv)
             recover = true;
             break;
 
+        case 'S':
+        {
+            char *strtolPtr;
+            syncTargetLatency = strtoul(optarg, &strtolPtr, 10);
+            if ((*optarg == '\0') || (*strtolPtr != '\0'))
+            {
+                fprintf(stderr,
+                        "option -S requires a numeric arg\n");
+                Usage(argv[0]);
+            }
+            break;
+        }
+
+        case 'w':
+        {
+            char *strtolPtr;
+            pipelineDepth = strtoul(optarg, &strtolPtr, 10);
+            if ((*optarg == '\0') || (*strtolPtr != '\0')
+                || (pipelineDepth < 1))
+            {
+                fprintf(stderr,
+                        "option -w requires a numeric arg\n");
+                Usage(argv[0]);
+            }
+            break;
+        }
+
         default:
             fprintf(stderr, "Unknown argument %s\n", argv[optind]);
             Usage(argv[0]);
@@ -189,6 +300,24 @@ main(int argc, char **argv)
     if ((proto != PROTO_VR) && (batchSize != 1)) {
         Warning("Batching enabled, but has no effect on non-VR protocols");
     }
+    if (adaptiveBatching && (batchSize == 1)) {
+        Warning("Adaptive batching enabled, but batch size limit is 1");
+    }
+    if ((proto != PROTO_VR) && (pipelineDepth != 1)) {
+        Warning("Pipelining enabled, but has no effect on non-VR protocols");
+    }
+    if ((proto != PROTO_SPEC) &&
+        ((syncTargetLatency !=
+          specpaxos::spec::SyncPolicy::DEFAULT_TARGET_LATENCY) ||
+         (syncMaxOps != specpaxos::spec::SyncPolicy::DEFAULT_MAX_OPS))) {
+        Warning("Sync options have no effect on non-SpecPaxos protocols");
+    }
+    if ((proto != PROTO_SPEC) && digestReplies) {
+        Warning("Digest replies have no effect on non-SpecPaxos protocols");
+    }
+    if ((proto != PROTO_VR) && (proto != PROTO_SPEC) && execThread) {
+        Warning("Execution thread is only supported for VR and SpecPaxos");
+    }
 
     // Load configuration
     std::ifstream configStream(configPath);
@@ -219,12 +348,28 @@ main(int argc, char **argv)
         break;
         
     case PROTO_VR:
+    {
+        specpaxos::vr::BatchPolicy *batchPolicy;
+        if (adaptiveBatching) {
+            batchPolicy =
+                new specpaxos::vr::AdaptiveBatchPolicy(batchSize,
+                                                       batchMaxBytes,
+                                                       batchTargetLatency,
+                                                       batchMaxDelay);
+        } else {
+            batchPolicy =
+                new specpaxos::vr::FixedBatchPolicy(batchSize,
+                                                    batchMaxDelay);
+        }
         replica = new specpaxos::vr::VRReplica(config, index,
                                                !recover,
                                                &transport,
-                                               batchSize,
-                                               nullApp);
+                                               batchPolicy,
+                                               nullApp,
+                                               pipelineDepth,
+                                               execThread);
         break;
+    }
 
     case PROTO_FASTPAXOS:
         replica = new specpaxos::fastpaxos::FastPaxosReplica(config,
@@ -235,9 +380,10 @@ main(int argc, char **argv)
         break;
         
     case PROTO_SPEC:
-        replica = new specpaxos::spec::SpecReplica(config, index,
-                                                   !recover,
-                                                   &transport, nullApp);
+        replica = new specpaxos::spec::SpecReplica(
+            config, index, !recover, &transport,
+            new specpaxos::spec::SyncPolicy(syncTargetLatency, syncMaxOps),
+            nullApp, digestReplies, execThread);
         break;
         
     default:
@@ -1,7 +1,7 @@
 d := $(dir $(lastword $(MAKEFILE_LIST)))
 
 SRCS += $(addprefix $(d), \
-	client.cc replica.cc log.cc)
+	client.cc clientmux.cc replica.cc log.cc lease.cc execthread.cc)
 
 PROTOS += $(addprefix $(d), \
 	    request.proto)
@@ -12,7 +12,14 @@ OBJS-client := $(o)client.o \
                $(LIB-message) $(LIB-configuration) $(LIB-transport) \
 	       $(LIB-request)
 
-OBJS-replica := $(o)replica.o $(o)log.o \
+OBJS-clientmux := $(o)clientmux.o $(OBJS-client)
+
+OBJS-lease := $(o)lease.o $(LIB-message) $(LIB-configuration)
+
+OBJS-execthread := $(o)execthread.o $(o)log.o $(LIB-message) \
+                   $(LIB-request) $(LIB-transport)
+
+OBJS-replica := $(o)replica.o $(o)log.o $(o)lease.o $(o)execthread.o \
                 $(LIB-message) $(LIB-request) \
                 $(LIB-configuration) $(LIB-udptransport)
 
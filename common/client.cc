@@ -30,6 +30,7 @@
 
 #include "common/client.h"
 #include "common/request.pb.h"
+#include "lib/assert.h"
 #include "lib/message.h"
 #include "lib/transport.h"
 
@@ -39,7 +40,8 @@ namespace specpaxos {
     
 Client::Client(const Configuration &config, Transport *transport,
                clientid_t clientid)
-    : config(config), transport(transport)
+    : config(config), transport(transport), window(1),
+      batchOps(1), batchDelay(0)
 {
     this->clientid = clientid;
 
@@ -58,7 +60,30 @@ Client::Client(const Configuration &config, Transport *transport,
 
 Client::~Client()
 {
+    transport->Unregister(this);
+}
+
+void
+Client::InvokeReadOnly(const string &request,
+                       continuation_t continuation)
+{
+    Invoke(request, continuation);
+}
 
+void
+Client::SetWindow(uint64_t window)
+{
+    ASSERT(window >= 1);
+    ASSERT(window <= MAX_WINDOW);
+    this->window = window;
+}
+
+void
+Client::SetBatching(uint32_t maxOps, uint64_t maxDelay)
+{
+    ASSERT(maxOps >= 1);
+    batchOps = maxOps;
+    batchDelay = maxDelay;
 }
     
 void
@@ -43,6 +43,7 @@ namespace specpaxos {
 
 typedef uint64_t clientid_t;
 #define FMT_CLIENTID "%" PRIx64
+#define FMT_CLIENTREQID "%" PRIu64
     
 class Client : public TransportReceiver
 {
@@ -51,6 +52,10 @@ public:
     typedef std::function<void (const string &)> timeout_continuation_t;
 
     static const uint32_t DEFAULT_UNLOGGED_OP_TIMEOUT = 1000; // milliseconds
+    // Largest window a client can use. Replicas rely on this to
+    // bound how far apart the outstanding requests from one client
+    // can be.
+    static const uint64_t MAX_WINDOW = 4096;
     
     Client(const Configuration &config, Transport *transport,
            clientid_t clientid = 0);
@@ -62,15 +67,35 @@ public:
                                 continuation_t continuation,
                                 timeout_continuation_t timeoutContinuation = nullptr,
                                 uint32_t timeout = DEFAULT_UNLOGGED_OP_TIMEOUT) = 0;
+    // Invoke a request that doesn't modify the application's state.
+    // Protocols with leader leases can serve it from the leader
+    // without logging it; the default is to Invoke it as usual.
+    virtual void InvokeReadOnly(const string &request,
+                                continuation_t continuation);
+    // Allow Invoke to have requests outstanding as long as they are
+    // within window of the oldest one that hasn't completed.
+    // Requests beyond that are held until earlier ones complete.
+    // Completions can happen in any order. The default is 1.
+    virtual void SetWindow(uint64_t window);
+    // Pack up to maxOps requests that the window allows us to send
+    // into one message, sending a partial batch once the oldest
+    // request in it has waited maxDelay microseconds. Only useful
+    // with a window larger than 1. Protocols that don't support
+    // batched requests ignore this.
+    virtual void SetBatching(uint32_t maxOps, uint64_t maxDelay);
     virtual void ReceiveMessage(const TransportAddress &remote,
                                 const string &type,
                                 const string &data);
+    clientid_t GetClientId() const { return clientid; }
     
 protected:
     Configuration config;
     Transport *transport;
     
     clientid_t clientid;
+    uint64_t window;
+    uint32_t batchOps;
+    uint64_t batchDelay;        // microseconds
 };
 
 } // namespace specpaxos
@@ -0,0 +1,247 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * clientmux.cc:
+ *   many client sessions sharing one transport endpoint
+ *
+ * Copyright 2013-2016 Dan R. K. Ports  <drkp@cs.washington.edu>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+
+#include "common/clientmux.h"
+#include "lib/assert.h"
+#include "lib/message.h"
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
+
+namespace specpaxos {
+
+using google::protobuf::internal::WireFormatLite;
+
+const int ClientMux::CLIENTID_FIELD;
+
+ClientMux::ClientMux(Transport *transport, const Configuration &config)
+    : transport(transport), config(config),
+      lastTimerId(0), armedTimer(0), armedDeadline(0)
+{
+    transport->Register(this, config, -1);
+}
+
+ClientMux::~ClientMux()
+{
+    if (armedTimer != 0) {
+        transport->CancelTimer(armedTimer);
+    }
+}
+
+void
+ClientMux::Register(TransportReceiver *receiver,
+                    const Configuration &config,
+                    int replicaIdx)
+{
+    ASSERT(replicaIdx == -1);
+    ASSERT(config == this->config);
+
+    Client *client = dynamic_cast<Client *>(receiver);
+    if (client == NULL) {
+        Panic("Only clients can register with a ClientMux");
+    }
+    if (!sessions.insert(std::make_pair(client->GetClientId(),
+                                        client)).second) {
+        Panic("Duplicate client ID " FMT_CLIENTID,
+              client->GetClientId());
+    }
+    receiver->SetAddress(GetAddress().clone());
+}
+
+void
+ClientMux::Unregister(TransportReceiver *receiver)
+{
+    Client *client = dynamic_cast<Client *>(receiver);
+    ASSERT(client != NULL);
+    sessions.erase(client->GetClientId());
+}
+
+bool
+ClientMux::SendMessage(TransportReceiver *src, const TransportAddress &dst,
+                       const ::google::protobuf::Message &m)
+{
+    return transport->SendMessage(this, dst, m);
+}
+
+bool
+ClientMux::SendMessageToReplica(TransportReceiver *src, int replicaIdx,
+                                const ::google::protobuf::Message &m)
+{
+    return transport->SendMessageToReplica(this, replicaIdx, m);
+}
+
+bool
+ClientMux::SendMessageToAll(TransportReceiver *src, const ::google::protobuf::Message &m)
+{
+    return transport->SendMessageToAll(this, m);
+}
+
+void
+ClientMux::Post(timer_callback_t cb)
+{
+    transport->Post(cb);
+}
+
+void
+ClientMux::Hold()
+{
+    transport->Hold();
+}
+
+void
+ClientMux::Release()
+{
+    transport->Release();
+}
+
+uint64_t
+ClientMux::Now()
+{
+    return transport->Now();
+}
+
+int
+ClientMux::Timer(uint64_t ms, timer_callback_t cb)
+{
+    int id = ++lastTimerId;
+    uint64_t when = transport->Now() + ms*1000;
+    timers[id] = deadlines.insert(std::make_pair(when,
+                                                 std::make_pair(id, cb)));
+    Arm();
+    return id;
+}
+
+bool
+ClientMux::CancelTimer(int id)
+{
+    auto it = timers.find(id);
+    if (it == timers.end()) {
+        return false;
+    }
+    deadlines.erase(it->second);
+    timers.erase(it);
+    // If it was the earliest, the armed timer just fires early and
+    // re-arms for the next one
+    return true;
+}
+
+void
+ClientMux::CancelAllTimers()
+{
+    deadlines.clear();
+    timers.clear();
+    if (armedTimer != 0) {
+        transport->CancelTimer(armedTimer);
+        armedTimer = 0;
+    }
+}
+
+/* Make sure the underlying timer goes off by the earliest deadline. */
+void
+ClientMux::Arm()
+{
+    if (deadlines.empty()) {
+        return;
+    }
+    uint64_t when = deadlines.begin()->first;
+    if (armedTimer != 0) {
+        if (armedDeadline <= when) {
+            return;
+        }
+        transport->CancelTimer(armedTimer);
+    }
+
+    // Transport timers have millisecond resolution; round up so we
+    // never wake before the deadline
+    uint64_t now = transport->Now();
+    uint64_t ms = (when > now) ? (when - now + 999) / 1000 : 0;
+    armedDeadline = when;
+    armedTimer = transport->Timer(ms, [this]() { Fire(); });
+}
+
+void
+ClientMux::Fire()
+{
+    armedTimer = 0;
+    uint64_t now = transport->Now();
+
+    while (!deadlines.empty() && (deadlines.begin()->first <= now)) {
+        auto it = deadlines.begin();
+        timer_callback_t cb = it->second.second;
+        timers.erase(it->second.first);
+        deadlines.erase(it);
+        // The callback might add or cancel timers
+        cb();
+    }
+
+    Arm();
+}
+
+bool
+ClientMux::ClientIdOf(const string &data, clientid_t &clientid)
+{
+    google::protobuf::io::CodedInputStream
+        in((const uint8_t *)data.data(), data.size());
+
+    uint32_t tag;
+    while ((tag = in.ReadTag()) != 0) {
+        if ((WireFormatLite::GetTagFieldNumber(tag) == CLIENTID_FIELD) &&
+            (WireFormatLite::GetTagWireType(tag) ==
+             WireFormatLite::WIRETYPE_VARINT)) {
+            return in.ReadVarint64((uint64_t *)&clientid);
+        }
+        if (!WireFormatLite::SkipField(&in, tag)) {
+            return false;
+        }
+    }
+    return false;
+}
+
+void
+ClientMux::ReceiveMessage(const TransportAddress &remote,
+                          const string &type, const string &data)
+{
+    clientid_t clientid;
+    if (!ClientIdOf(data, clientid)) {
+        Debug("Dropping %s message with no client ID", type.c_str());
+        return;
+    }
+
+    auto it = sessions.find(clientid);
+    if (it == sessions.end()) {
+        Debug("Dropping %s message for unknown client " FMT_CLIENTID,
+              type.c_str(), clientid);
+        return;
+    }
+    it->second->ReceiveMessage(remote, type, data);
+}
+
+} // namespace specpaxos
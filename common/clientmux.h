@@ -0,0 +1,118 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * clientmux.h:
+ *   many client sessions sharing one transport endpoint
+ *
+ * Copyright 2013-2016 Dan R. K. Ports  <drkp@cs.washington.edu>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+
+#ifndef _COMMON_CLIENTMUX_H_
+#define _COMMON_CLIENTMUX_H_
+
+#include "common/client.h"
+#include "lib/configuration.h"
+#include "lib/transport.h"
+
+#include <map>
+#include <unordered_map>
+
+namespace specpaxos {
+
+/*
+ * A Transport for client sessions that funnels them all through one
+ * endpoint on an underlying transport, so a process can host many
+ * logical clients with a single socket.
+ *
+ * Construct each session (a VRClient, SpecClient, etc.) with the
+ * ClientMux as its transport. Sessions send through the shared
+ * endpoint, and incoming messages are routed to the session named
+ * by their clientid field (field CLIENTID_FIELD of every message
+ * replicas send to clients). Messages for unknown sessions are
+ * dropped.
+ *
+ * Session timers are kept here, with deadlines in the underlying
+ * transport's clock (Now()), and a single timer on the underlying
+ * transport is armed for the earliest of them.
+ */
+class ClientMux : public Transport, public TransportReceiver
+{
+public:
+    ClientMux(Transport *transport, const Configuration &config);
+    ~ClientMux();
+
+    // Only clients can register, and only with config
+    void Register(TransportReceiver *receiver,
+                  const Configuration &config,
+                  int replicaIdx);
+    void Unregister(TransportReceiver *receiver);
+    bool SendMessage(TransportReceiver *src, const TransportAddress &dst,
+                     const ::google::protobuf::Message &m);
+    bool SendMessageToReplica(TransportReceiver *src, int replicaIdx,
+                              const ::google::protobuf::Message &m);
+    bool SendMessageToAll(TransportReceiver *src, const ::google::protobuf::Message &m);
+    int Timer(uint64_t ms, timer_callback_t cb);
+    bool CancelTimer(int id);
+    void CancelAllTimers();
+    void Post(timer_callback_t cb);
+    void Hold();
+    void Release();
+    uint64_t Now();
+
+    void ReceiveMessage(const TransportAddress &remote,
+                        const string &type, const string &data);
+
+    size_t NumSessions() const { return sessions.size(); }
+    size_t NumTimers() const { return timers.size(); }
+
+    static const int CLIENTID_FIELD = 15;
+
+    // Extract the clientid field from a serialized message without
+    // parsing the rest of it
+    static bool ClientIdOf(const string &data, clientid_t &clientid);
+
+private:
+    typedef std::multimap<uint64_t,
+                          std::pair<int, timer_callback_t> > deadlines_t;
+
+    Transport *transport;
+    Configuration config;
+    std::unordered_map<clientid_t, Client *> sessions;
+
+    // In microseconds of transport->Now()
+    deadlines_t deadlines;
+    std::unordered_map<int, deadlines_t::iterator> timers;
+    int lastTimerId;
+    // Timer on the underlying transport, and the deadline it is for
+    int armedTimer;
+    uint64_t armedDeadline;
+
+    void Arm();
+    void Fire();
+};
+
+} // namespace specpaxos
+
+#endif  /* _COMMON_CLIENTMUX_H_ */
@@ -0,0 +1,442 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * clienttable.h:
+ *   per-client session state (outstanding requests, replies,
+ *   address) kept by replicas to detect duplicate requests
+ *
+ * Copyright 2013-2016 Dan R. K. Ports  <drkp@cs.washington.edu>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+#ifndef _COMMON_CLIENTTABLE_H_
+#define _COMMON_CLIENTTABLE_H_
+
+#include "common/client.h"
+#include "lib/assert.h"
+#include "lib/message.h"
+#include "lib/transport.h"
+#include "lib/viewstamp.h"
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace specpaxos {
+
+/*
+ * The requests a replica is tracking for one client, keyed by
+ * clientreqid, each with some protocol-specific VALUE (e.g. the
+ * reply to resend if the client retries).
+ *
+ * A client can have several requests outstanding, so they can
+ * arrive, and be logged, in any order. Every request carries the ID
+ * up to which the client has gotten all of its replies, and a client
+ * never has requests outstanding more than Client::MAX_WINDOW apart.
+ * Anything at or below either bound is stale: the client can't be
+ * waiting for it any more, so it is dropped, and requests with those
+ * IDs are ignored.
+ */
+template <class VALUE>
+class RequestWindow
+{
+public:
+    RequestWindow() : floor(0), lastReqId(0), inlineEntry(0, VALUE()) { }
+
+    bool
+    IsStale(uint64_t reqid) const
+    {
+        return (reqid <= floor);
+    }
+
+    // Highest request ID seen
+    uint64_t
+    LastReqId() const
+    {
+        return lastReqId;
+    }
+
+    size_t
+    Size() const
+    {
+        return End() - Begin();
+    }
+
+    VALUE *
+    Find(uint64_t reqid)
+    {
+        entry_t *it = Position(reqid);
+        if ((it == End()) || (it->first != reqid)) {
+            return NULL;
+        }
+        return &it->second;
+    }
+
+    const VALUE *
+    Find(uint64_t reqid) const
+    {
+        return const_cast<RequestWindow *>(this)->Find(reqid);
+    }
+
+    // Start tracking a request that is neither stale nor already
+    // tracked. acked is the request's ackedreqid.
+    VALUE &
+    Insert(uint64_t reqid, uint64_t acked)
+    {
+        ASSERT(!IsStale(reqid));
+        ASSERT(Find(reqid) == NULL);
+
+        if (reqid > lastReqId) {
+            lastReqId = reqid;
+        }
+        uint64_t newFloor = std::min(acked, reqid-1);
+        if (lastReqId > Client::MAX_WINDOW) {
+            newFloor = std::max(newFloor, lastReqId - Client::MAX_WINDOW);
+        }
+        Advance(newFloor);
+
+        // Requests usually arrive in order
+        entry_t *it = End();
+        if ((it != Begin()) && ((it-1)->first > reqid)) {
+            it = Position(reqid);
+        }
+        return InsertAt(it, reqid)->second;
+    }
+
+    // Forget a request, e.g. because it was rolled back
+    void
+    Erase(uint64_t reqid)
+    {
+        entry_t *it = Position(reqid);
+        if ((it != End()) && (it->first == reqid)) {
+            EraseAt(it);
+        }
+    }
+
+    // Visit every tracked request in ID order
+    template <class F> void
+    ForEach(F f) const
+    {
+        for (const entry_t *it = Begin(); it != End(); ++it) {
+            f(it->first, it->second);
+        }
+    }
+
+private:
+    typedef std::pair<uint64_t, VALUE> entry_t;
+
+    uint64_t floor;
+    uint64_t lastReqId;
+    // Tracked requests, sorted by request ID. A client with a window
+    // of 1 never has more than one, so that one is kept inline, and
+    // the vector is only allocated once a client has had two at
+    // once. Request ID 0 is always stale, so it marks the inline
+    // entry as unused.
+    entry_t inlineEntry;
+    std::unique_ptr<std::vector<entry_t> > spill;
+
+    entry_t *
+    Begin()
+    {
+        return spill ? spill->data() : &inlineEntry;
+    }
+
+    entry_t *
+    End()
+    {
+        return spill ? spill->data() + spill->size()
+                     : &inlineEntry + (inlineEntry.first != 0);
+    }
+
+    const entry_t *
+    Begin() const
+    {
+        return const_cast<RequestWindow *>(this)->Begin();
+    }
+
+    const entry_t *
+    End() const
+    {
+        return const_cast<RequestWindow *>(this)->End();
+    }
+
+    entry_t *
+    Position(uint64_t reqid)
+    {
+        return std::lower_bound(
+            Begin(), End(), reqid,
+            [](const entry_t &e, uint64_t id) {
+                return e.first < id;
+            });
+    }
+
+    entry_t *
+    InsertAt(entry_t *pos, uint64_t reqid)
+    {
+        if (!spill) {
+            if (inlineEntry.first == 0) {
+                inlineEntry.first = reqid;
+                return &inlineEntry;
+            }
+            // Second request: move to the vector.
+            size_t i = pos - &inlineEntry;
+            spill.reset(new std::vector<entry_t>());
+            spill->reserve(2);
+            spill->push_back(std::move(inlineEntry));
+            inlineEntry = entry_t(0, VALUE());
+            pos = spill->data() + i;
+        }
+        size_t i = pos - spill->data();
+        spill->insert(spill->begin() + i, entry_t(reqid, VALUE()));
+        return &(*spill)[i];
+    }
+
+    void
+    EraseAt(entry_t *pos)
+    {
+        if (spill) {
+            spill->erase(spill->begin() + (pos - spill->data()));
+        } else {
+            inlineEntry = entry_t(0, VALUE());
+        }
+    }
+
+    void
+    Advance(uint64_t newFloor)
+    {
+        if (newFloor <= floor) {
+            return;
+        }
+        floor = newFloor;
+        entry_t *it = Begin();
+        while ((it != End()) && (it->first <= floor)) {
+            ++it;
+        }
+        if (!spill) {
+            if (it != Begin()) {
+                EraseAt(Begin());
+            }
+        } else {
+            spill->erase(spill->begin(), spill->begin() + (it - Begin()));
+        }
+    }
+};
+
+/*
+ * Open-addressing hash table from client ID to a protocol-specific
+ * ENTRY (usually a RequestWindow of the client's outstanding
+ * requests), together with the client's address.
+ *
+ * Each session records the opnum at which it was last active. Once
+ * the table fills up, sessions that have been idle for more than
+ * maxIdle operations are evicted instead of growing the table, as
+ * long as the canEvict predicate agrees (e.g. SpecPaxos cannot drop
+ * a client with speculative operations that might be rolled back).
+ * An evicted client that retries an old request will have it
+ * executed again, so maxIdle should be much longer than any client
+ * retry interval.
+ */
+template <class ENTRY>
+class ClientTable
+{
+public:
+    typedef std::function<bool (uint64_t clientid,
+                                const ENTRY &entry)> evict_predicate_t;
+
+    ClientTable(opnum_t maxIdle = DEFAULT_MAX_IDLE,
+                evict_predicate_t canEvict = nullptr)
+        : maxIdle(maxIdle), canEvict(canEvict), count(0)
+    {
+        slots.resize(INITIAL_CAPACITY);
+    }
+
+    size_t
+    Size() const
+    {
+        return count;
+    }
+
+    ENTRY *
+    Find(uint64_t clientid)
+    {
+        Slot *s = FindSlot(clientid);
+        return (s == NULL) ? NULL : &s->entry;
+    }
+
+    // Find the entry for clientid, creating an empty one if it
+    // doesn't exist, and mark the session active as of opnum now.
+    ENTRY &
+    Lookup(uint64_t clientid, opnum_t now)
+    {
+        Slot &s = FindOrInsert(clientid, now);
+        if (now > s.lastActive) {
+            s.lastActive = now;
+        }
+        return s.entry;
+    }
+
+    void
+    SetAddress(uint64_t clientid, const TransportAddress &addr,
+               opnum_t now)
+    {
+        Slot &s = FindOrInsert(clientid, now);
+        if (now > s.lastActive) {
+            s.lastActive = now;
+        }
+        s.address.reset(addr.clone());
+    }
+
+    // Returns NULL if we have never heard from the client directly
+    // (e.g. on a replica other than the one it sent its request to)
+    const TransportAddress *
+    GetAddress(uint64_t clientid)
+    {
+        Slot *s = FindSlot(clientid);
+        return (s == NULL) ? NULL : s->address.get();
+    }
+
+    static const opnum_t DEFAULT_MAX_IDLE = 1000000;
+
+private:
+    static const size_t INITIAL_CAPACITY = 64;
+
+    struct Slot
+    {
+        bool used;
+        uint64_t clientid;
+        opnum_t lastActive;
+        std::unique_ptr<TransportAddress> address;
+        ENTRY entry;
+
+        Slot() : used(false), clientid(0), lastActive(0), entry() { }
+    };
+
+    opnum_t maxIdle;
+    evict_predicate_t canEvict;
+    std::vector<Slot> slots;
+    size_t count;
+
+    static size_t
+    Hash(uint64_t clientid)
+    {
+        // Client IDs are usually random, but don't count on it
+        clientid ^= clientid >> 33;
+        clientid *= 0xff51afd7ed558ccdULL;
+        clientid ^= clientid >> 33;
+        return clientid;
+    }
+
+    Slot *
+    FindSlot(uint64_t clientid)
+    {
+        size_t mask = slots.size()-1;
+        for (size_t i = Hash(clientid) & mask; ; i = (i+1) & mask) {
+            Slot &s = slots[i];
+            if (!s.used) {
+                return NULL;
+            }
+            if (s.clientid == clientid) {
+                return &s;
+            }
+        }
+    }
+
+    Slot &
+    FindOrInsert(uint64_t clientid, opnum_t now)
+    {
+        Slot *s = FindSlot(clientid);
+        if (s != NULL) {
+            return *s;
+        }
+
+        // Keep the load factor under 3/4
+        if ((count+1)*4 > slots.size()*3) {
+            Rebuild(now);
+        }
+
+        size_t mask = slots.size()-1;
+        size_t i;
+        for (i = Hash(clientid) & mask; slots[i].used; i = (i+1) & mask);
+
+        Slot &n = slots[i];
+        n.used = true;
+        n.clientid = clientid;
+        n.lastActive = now;
+        n.address.reset();
+        n.entry = ENTRY();
+        count++;
+        return n;
+    }
+
+    bool
+    IsIdle(const Slot &s, opnum_t now) const
+    {
+        return ((maxIdle > 0) &&
+                (s.lastActive + maxIdle < now) &&
+                (!canEvict || canEvict(s.clientid, s.entry)));
+    }
+
+    // Evict idle sessions, then grow the table if it is still too
+    // full. Either way, every surviving entry is rehashed.
+    void
+    Rebuild(opnum_t now)
+    {
+        size_t live = 0;
+        for (const Slot &s : slots) {
+            if (s.used && !IsIdle(s, now)) {
+                live++;
+            }
+        }
+
+        size_t capacity = slots.size();
+        while ((live+1)*2 > capacity) {
+            capacity *= 2;
+        }
+
+        if (live < count) {
+            Debug("Evicting %zu idle client sessions", count-live);
+        }
+
+        std::vector<Slot> old(capacity);
+        old.swap(slots);
+        count = 0;
+        size_t mask = slots.size()-1;
+        for (Slot &s : old) {
+            if (!s.used || IsIdle(s, now)) {
+                continue;
+            }
+            size_t i;
+            for (i = Hash(s.clientid) & mask; slots[i].used;
+                 i = (i+1) & mask);
+            slots[i] = std::move(s);
+            count++;
+        }
+        ASSERT(count == live);
+    }
+};
+
+}      // namespace specpaxos
+
+#endif  // _COMMON_CLIENTTABLE_H_
@@ -0,0 +1,235 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * execthread.cc:
+ *   runs application upcalls on a thread of their own
+ *
+ * Copyright 2013-2016 Dan R. K. Ports  <drkp@cs.washington.edu>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+
+
+#include "common/execthread.h"
+
+#include "lib/assert.h"
+#include "lib/message.h"
+
+namespace specpaxos {
+
+const size_t ExecThread::DEFAULT_DEPTH;
+
+ExecThread::ExecThread(Transport *transport, AppReplica *app,
+                       size_t depth)
+    : transport(transport), app(app),
+      requests(depth), completions(depth),
+      inFlight(0), held(false), alive(new bool(true)),
+      stopping(false), sleeping(false), notified(false)
+{
+    thread = std::thread([this]() { ThreadMain(); });
+}
+
+ExecThread::~ExecThread()
+{
+    {
+        std::lock_guard<std::mutex> l(lock);
+        stopping = true;
+        wakeup.notify_one();
+    }
+    thread.join();
+    *alive = false;
+    if (held) {
+        transport->Release();
+    }
+
+    Job *job;
+    while (requests.Pop(job)) {
+        delete job;
+    }
+    while (completions.Pop(job)) {
+        delete job;
+    }
+    for (Job *j : backlog) {
+        delete j;
+    }
+}
+
+void
+ExecThread::Execute(opnum_t opnum, const string &op, done_t done)
+{
+    Job *job = new Job();
+    job->type = JOB_EXECUTE;
+    job->opnum = opnum;
+    job->op = op;
+    job->done = done;
+    Submit(job);
+}
+
+void
+ExecThread::Commit(opnum_t opnum)
+{
+    Job *job = new Job();
+    job->type = JOB_COMMIT;
+    job->opnum = opnum;
+    Submit(job);
+}
+
+void
+ExecThread::Rollback(opnum_t current, opnum_t to, Log &log)
+{
+    Job *job = new Job();
+    job->type = JOB_ROLLBACK;
+    job->opnum = current;
+    job->to = to;
+    job->log.reset(new Log(false, to+1));
+    for (opnum_t i = to+1; i <= current; i++) {
+        const LogEntry *entry = log.Find(i);
+        ASSERT(entry != NULL);
+        job->log->Append(entry->viewstamp, entry->request, entry->state);
+    }
+    Submit(job);
+}
+
+void
+ExecThread::ExecuteUnlogged(const string &op, done_t done)
+{
+    Job *job = new Job();
+    job->type = JOB_UNLOGGED;
+    job->opnum = 0;
+    job->op = op;
+    job->done = done;
+    Submit(job);
+}
+
+size_t
+ExecThread::Outstanding() const
+{
+    return inFlight + backlog.size();
+}
+
+void
+ExecThread::Submit(Job *job)
+{
+    backlog.push_back(job);
+    Flush();
+}
+
+// Move as much of the backlog as will fit into requests, and wake
+// the execution thread if it is waiting for work
+void
+ExecThread::Flush()
+{
+    bool pushed = false;
+    while (!backlog.empty() && (inFlight < requests.Capacity())) {
+        bool ok = requests.Push(backlog.front());
+        ASSERT(ok);
+        backlog.pop_front();
+        inFlight++;
+        pushed = true;
+    }
+    if (!held && (inFlight > 0)) {
+        // We'll be owed a completion
+        transport->Hold();
+        held = true;
+    }
+
+    // Pairs with the fence in ThreadMain: either it sees what we
+    // pushed before it sleeps, or we see that it is sleeping
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (pushed && sleeping) {
+        std::lock_guard<std::mutex> l(lock);
+        wakeup.notify_one();
+    }
+}
+
+void
+ExecThread::RunCompletions()
+{
+    notified = false;
+
+    Job *job;
+    while (completions.Pop(job)) {
+        inFlight--;
+        if (job->done) {
+            job->done(job->result);
+        }
+        delete job;
+    }
+    Flush();
+    if (held && (inFlight == 0)) {
+        transport->Release();
+        held = false;
+    }
+}
+
+void
+ExecThread::ThreadMain()
+{
+    while (true) {
+        Job *job;
+        if (!requests.Pop(job)) {
+            std::unique_lock<std::mutex> l(lock);
+            sleeping = true;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            wakeup.wait(l, [this]() {
+                    return stopping || !requests.Empty();
+                });
+            sleeping = false;
+            if (stopping) {
+                return;
+            }
+            continue;
+        }
+
+        switch (job->type) {
+        case JOB_EXECUTE:
+            app->ReplicaUpcall(job->opnum, job->op, job->result);
+            break;
+        case JOB_COMMIT:
+            app->CommitUpcall(job->opnum);
+            break;
+        case JOB_ROLLBACK:
+            app->RollbackUpcall(job->opnum, job->to,
+                                RollbackOps(*job->log, job->opnum, job->to));
+            break;
+        case JOB_UNLOGGED:
+            app->UnloggedUpcall(job->op, job->result);
+            break;
+        default:
+            NOT_REACHABLE();
+        }
+
+        bool ok = completions.Push(job);
+        ASSERT(ok);
+        if (!notified.exchange(true)) {
+            std::shared_ptr<bool> a = alive;
+            transport->Post([this, a]() {
+                    if (*a) {
+                        RunCompletions();
+                    }
+                });
+        }
+    }
+}
+
+} // namespace specpaxos
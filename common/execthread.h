@@ -0,0 +1,150 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * execthread.h:
+ *   runs application upcalls on a thread of their own
+ *
+ * Copyright 2013-2016 Dan R. K. Ports  <drkp@cs.washington.edu>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+
+
+#ifndef _COMMON_EXECTHREAD_H_
+#define _COMMON_EXECTHREAD_H_
+
+#include "common/replica.h"
+#include "lib/spscqueue.h"
+#include "lib/transport.h"
+#include "lib/viewstamp.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace specpaxos {
+
+/*
+ * Runs a replica's application upcalls on a separate thread, so an
+ * expensive operation doesn't hold up message processing and timers
+ * on the transport's thread.
+ *
+ * The replica submits work through a lock-free single-producer
+ * single-consumer queue; the execution thread runs it strictly in
+ * submission order and hands each job back through a second queue.
+ * Completion callbacks, which usually send the reply, run on the
+ * transport's thread (via Transport::Post). All methods must be
+ * called from the transport's thread.
+ *
+ * Since unlogged upcalls go through the same queue, they see the
+ * effects of every operation submitted before them. LeaderUpcall is
+ * still made directly by the replica, so an application that uses
+ * it must not touch state that ReplicaUpcall modifies.
+ *
+ * Rollback copies the operations being undone out of the replica's
+ * log, which will have changed by the time the execution thread
+ * gets to them. A protocol that rolls back must also keep in mind
+ * that completions of operations it has since rolled back can still
+ * arrive, before those of anything submitted after the rollback.
+ */
+class ExecThread
+{
+public:
+    typedef std::function<void (const string &result)> done_t;
+
+    ExecThread(Transport *transport, AppReplica *app,
+               size_t depth = DEFAULT_DEPTH);
+    // Waits for the operation in progress, if any; anything else
+    // still queued is dropped without running its completion.
+    ~ExecThread();
+
+    void Execute(opnum_t opnum, const string &op, done_t done);
+    void Commit(opnum_t opnum);
+    // Undo operations current down to to+1, which must still be in
+    // log
+    void Rollback(opnum_t current, opnum_t to, Log &log);
+    void ExecuteUnlogged(const string &op, done_t done);
+    // Jobs submitted whose completions haven't run yet
+    size_t Outstanding() const;
+
+    // Jobs in flight before further ones are held back on the
+    // transport's thread
+    static const size_t DEFAULT_DEPTH = 1024;
+
+private:
+    enum JobType {
+        JOB_EXECUTE,
+        JOB_COMMIT,
+        JOB_ROLLBACK,
+        JOB_UNLOGGED
+    };
+    struct Job
+    {
+        JobType type;
+        opnum_t opnum;
+        string op;
+        string result;
+        done_t done;
+        // For a rollback, the operations undone
+        opnum_t to;
+        std::unique_ptr<Log> log;
+    };
+
+    Transport *transport;
+    AppReplica *app;
+    SPSCQueue<Job *> requests;
+    SPSCQueue<Job *> completions;
+    // Jobs waiting for room in requests, and the number of jobs in
+    // requests or completions, all owned by the transport's thread.
+    // Keeping inFlight within the queues' capacity means the
+    // execution thread never finds completions full.
+    std::deque<Job *> backlog;
+    size_t inFlight;
+    // Whether we have a Transport::Hold() outstanding, which we do
+    // whenever inFlight > 0
+    bool held;
+    // Cleared when we are destroyed, so callbacks already posted to
+    // the transport know not to touch us
+    std::shared_ptr<bool> alive;
+
+    std::atomic<bool> stopping;
+    std::atomic<bool> sleeping;
+    // A call to RunCompletions has been posted and hasn't started yet
+    std::atomic<bool> notified;
+    std::mutex lock;
+    std::condition_variable wakeup;
+    std::thread thread;
+
+    void Submit(Job *job);
+    void Flush();
+    void RunCompletions();
+    void ThreadMain();
+};
+
+} // namespace specpaxos
+
+#endif  /* _COMMON_EXECTHREAD_H_ */
@@ -0,0 +1,104 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * lease.cc:
+ *   leader leases, which let a leader serve reads without logging them
+ *
+ * Copyright 2013-2016 Dan R. K. Ports  <drkp@cs.washington.edu>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+
+#include "common/lease.h"
+
+#include "lib/assert.h"
+#include "lib/message.h"
+
+#include <algorithm>
+#include <functional>
+
+namespace specpaxos {
+
+const uint64_t LeaderLease::DEFAULT_DURATION;
+const uint64_t LeaderLease::DRIFT_DIVISOR;
+
+LeaderLease::LeaderLease(const Configuration &config, int myIdx,
+                         uint64_t duration)
+    : myIdx(myIdx), required(config.QuorumSize()-1),
+      duration(duration), grants(config.n, 0), promisedUntil(0)
+{
+    ASSERT(duration > 0);
+}
+
+void
+LeaderLease::Granted(int replicaIdx, uint64_t start)
+{
+    ASSERT(replicaIdx >= 0);
+    ASSERT((size_t)replicaIdx < grants.size());
+    if (replicaIdx == myIdx) {
+        return;
+    }
+    uint64_t expiry = start + duration - duration/DRIFT_DIVISOR;
+    grants[replicaIdx] = std::max(grants[replicaIdx], expiry);
+}
+
+void
+LeaderLease::Clear()
+{
+    std::fill(grants.begin(), grants.end(), 0);
+}
+
+uint64_t
+LeaderLease::Expiry() const
+{
+    if (required == 0) {
+        // Nobody else to ask
+        return UINT64_MAX;
+    }
+
+    // Until the required'th most recent acknowledgment runs out
+    std::vector<uint64_t> sorted(grants);
+    std::nth_element(sorted.begin(), sorted.begin() + (required-1),
+                     sorted.end(), std::greater<uint64_t>());
+    return sorted[required-1];
+}
+
+bool
+LeaderLease::Valid(uint64_t now) const
+{
+    return (now < Expiry());
+}
+
+void
+LeaderLease::Grant(uint64_t now)
+{
+    promisedUntil = std::max(promisedUntil, now + duration);
+}
+
+bool
+LeaderLease::Promised(uint64_t now) const
+{
+    return (now < promisedUntil);
+}
+
+} // namespace specpaxos
@@ -0,0 +1,96 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * lease.h:
+ *   leader leases, which let a leader serve reads without logging them
+ *
+ * Copyright 2013-2016 Dan R. K. Ports  <drkp@cs.washington.edu>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+
+#ifndef _COMMON_LEASE_H_
+#define _COMMON_LEASE_H_
+
+#include "lib/configuration.h"
+
+#include <stdint.h>
+#include <vector>
+
+namespace specpaxos {
+
+/*
+ * A time-bounded promise from a quorum that no other replica will
+ * become leader, so the leader knows its state is current and can
+ * answer reads on its own.
+ *
+ * The leader stamps each message it wants acknowledged with its own
+ * clock (Transport::Now()), and followers echo the stamp back. A follower that
+ * acknowledges a message promises not to take part in a view change
+ * for duration after receiving it (Grant/Promised). The leader then
+ * holds the lease until duration after the stamp of the latest
+ * message acknowledged by a quorum, counting itself, less an
+ * allowance for clock rate drift. Since stamps are taken before the
+ * followers receive the message, the leader's lease always runs out
+ * before their promises do, and a new view can't form until then.
+ *
+ * duration should be well under the view change timeout, or the
+ * lease will hold up view changes after the leader fails. All times
+ * are in microseconds.
+ */
+class LeaderLease
+{
+public:
+    LeaderLease(const Configuration &config, int myIdx,
+                uint64_t duration = DEFAULT_DURATION);
+
+    // Leader: replicaIdx acknowledged a message stamped start
+    void Granted(int replicaIdx, uint64_t start);
+    // Leader: forget all acknowledgments, e.g. on leaving the view
+    void Clear();
+    // Leader: when the lease runs out; 0 if we don't hold one
+    uint64_t Expiry() const;
+    bool Valid(uint64_t now) const;
+
+    // Follower: we are acknowledging a message received at now
+    void Grant(uint64_t now);
+    // Follower: are we still bound by a promise?
+    bool Promised(uint64_t now) const;
+
+    static const uint64_t DEFAULT_DURATION = 2000000;
+    // Clocks may run this much (1/16) slower than real time
+    static const uint64_t DRIFT_DIVISOR = 16;
+
+private:
+    int myIdx;
+    size_t required;
+    uint64_t duration;
+    // When the latest acknowledgment from each replica runs out, or
+    // 0 if there isn't one
+    std::vector<uint64_t> grants;
+    uint64_t promisedUntil;
+};
+
+} // namespace specpaxos
+
+#endif  /* _COMMON_LEASE_H_ */
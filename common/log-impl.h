@@ -34,22 +34,37 @@
 template <class T> void
 Log::Dump(opnum_t from, T out)
 {
-    for (opnum_t i = std::max(from, start);
-         i <= LastOpnum(); i++) {
+    DumpChunk(from, SIZE_MAX, out);
+}
 
+template <class T> opnum_t
+Log::DumpChunk(opnum_t from, size_t maxBytes, T out)
+{
+    // Always include at least one entry, even if it is larger than
+    // the limit, so that a chunked transfer can make progress.
+    size_t bytes = 0;
+    opnum_t i;
+    for (i = std::max(from, start); i <= LastOpnum(); i++) {
         const LogEntry *entry = Find(i);
         ASSERT(entry != NULL);
-        
+
+        bytes += entry->request.ByteSizeLong();
+        if ((bytes > maxBytes) && (i > std::max(from, start))) {
+            break;
+        }
+
         auto elem = out->Add();
         elem->set_view(entry->viewstamp.view);
         elem->set_opnum(entry->viewstamp.opnum);
         elem->set_state(entry->state);
         elem->set_hash(entry->hash);
-        *(elem->mutable_request()) = entry->request;        
+        *(elem->mutable_request()) = entry->request;
     }
+
+    return i-1;
 }
 
-template <class iter> void
+template <class iter> opnum_t
 Log::Install(iter start, iter end)
 {
     // Find the first divergence in the log
@@ -76,10 +91,13 @@ Log::Install(iter start, iter end)
     }
 
     // Install the new log entries
+    opnum_t firstNew = LastOpnum()+1;
     for (; it != end; it++) {
         viewstamp_t vs = { it->view(), it->opnum() };
         Append(vs, it->request(), LOG_STATE_PREPARED);
     }
+
+    return firstNew;
 }
 
 #endif  /* _COMMON_LOG_IMPL_H_ */
@@ -38,6 +38,7 @@
 #include "lib/viewstamp.h"
 
 #include <map>
+#include <stdint.h>
 #include <google/protobuf/message.h>
 
 namespace specpaxos {
@@ -61,13 +62,12 @@ public:
         Request request;
         string hash;
         // Speculative client table stuff
-        opnum_t prevClientReqOpnum;
         ::google::protobuf::Message *replyMessage;
     
         LogEntry() { replyMessage = NULL; }
         LogEntry(const LogEntry &x)
             : viewstamp(x.viewstamp), state(x.state), request(x.request),
-              hash(x.hash), prevClientReqOpnum(x.prevClientReqOpnum)
+              hash(x.hash)
             {
                 if (x.replyMessage) {
                     replyMessage = x.replyMessage->New();
@@ -100,7 +100,9 @@ public:
     opnum_t FirstOpnum() const;
     bool Empty() const;
     template <class T> void Dump(opnum_t from, T out);
-    template <class iter> void Install(iter start, iter end);
+    template <class T> opnum_t DumpChunk(opnum_t from, size_t maxBytes,
+                                         T out);
+    template <class iter> opnum_t Install(iter start, iter end);
     const string &LastHash() const;
 
     static string ComputeHash(string lastHash, const LogEntry &entry);
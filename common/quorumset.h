@@ -32,6 +32,12 @@
 #ifndef _COMMON_QUORUMSET_H_
 #define _COMMON_QUORUMSET_H_
 
+#include "lib/assert.h"
+#include "lib/viewstamp.h"
+
+#include <map>
+#include <vector>
+
 namespace specpaxos {
     
 template <class IDTYPE, class MSGTYPE>
@@ -53,8 +59,7 @@ public:
     void
     Clear(IDTYPE vs)
     {
-        std::map<int, MSGTYPE> &vsmessages = messages[vs];
-        vsmessages.clear();
+        messages.erase(vs);
     }
 
     int
@@ -112,6 +117,155 @@ private:
     std::map<IDTYPE, std::map<int, MSGTYPE> > messages;
 };
 
+/*
+ * A QuorumSet specialized for per-operation acknowledgments
+ * (PrepareOK, SyncReply) where a quorum for an opnum makes all
+ * earlier opnums moot.
+ *
+ * Votes are tracked in a fixed ring of slots indexed by opnum, each
+ * holding a bitmask of the replicas that have voted and, if the
+ * caller needs one, a small per-replica value (e.g. a log hash)
+ * instead of the whole message. Nothing is allocated after
+ * construction, and checking for a quorum is a popcount.
+ *
+ * Opnums below the watermark are discarded. If two live opnums map
+ * to the same slot, the newer one wins; a quorum for it covers the
+ * older one anyway.
+ */
+template <class VALUE = char>
+class BitmaskQuorumSet
+{
+    struct Slot
+    {
+        opnum_t id;
+        uint64_t mask;
+    };
+    
+public:
+    BitmaskQuorumSet(int numRequired, int numReplicas,
+                     int numSlots = DEFAULT_SLOTS)
+        : numRequired(numRequired), numReplicas(numReplicas),
+          slots(numSlots), values(numSlots * numReplicas),
+          watermark(0)
+    {
+        ASSERT(numReplicas <= 64);
+        Clear();
+    }
+
+    void
+    Clear()
+    {
+        for (Slot &s : slots) {
+            s.id = 0;
+            s.mask = 0;
+        }
+    }
+
+    int
+    NumRequired() const
+    {
+        return numRequired;
+    }
+
+    // Number of replicas that have voted for id
+    int
+    Count(opnum_t id) const
+    {
+        const Slot *s = Find(id);
+        if (s == NULL) {
+            return 0;
+        }
+        return __builtin_popcountll(s->mask);
+    }
+
+    bool
+    CheckForQuorum(opnum_t id) const
+    {
+        return (Count(id) >= numRequired);
+    }
+
+    bool
+    AddAndCheckForQuorum(opnum_t id, int replicaIdx,
+                         const VALUE &value = VALUE())
+    {
+        ASSERT(replicaIdx < numReplicas);
+        if (id < watermark) {
+            return false;
+        }
+
+        size_t idx = id % slots.size();
+        Slot &s = slots[idx];
+        if ((s.id != id) || (s.mask == 0)) {
+            if ((s.mask != 0) && (s.id >= watermark) && (s.id > id)) {
+                // Slot is in use by a newer opnum
+                return false;
+            }
+            s.id = id;
+            s.mask = 0;
+        }
+
+        // As with QuorumSet, a duplicate replaces the old vote
+        s.mask |= (1ULL << replicaIdx);
+        values[idx * numReplicas + replicaIdx] = value;
+
+        return (__builtin_popcountll(s.mask) >= numRequired);
+    }
+
+    // Call f(replicaIdx, value) for each replica that voted for id
+    template <class F> void
+    ForEach(opnum_t id, F f) const
+    {
+        const Slot *s = Find(id);
+        if (s == NULL) {
+            return;
+        }
+        size_t idx = s - &slots[0];
+        for (int i = 0; i < numReplicas; i++) {
+            if (s->mask & (1ULL << i)) {
+                f(i, values[idx * numReplicas + i]);
+            }
+        }
+    }
+
+    // Discard all opnums below watermark, and ignore any later
+    // votes for them
+    void
+    SetWatermark(opnum_t watermark)
+    {
+        if (watermark > this->watermark) {
+            this->watermark = watermark;
+        }
+    }
+
+    opnum_t
+    Watermark() const
+    {
+        return watermark;
+    }
+
+    static const int DEFAULT_SLOTS = 1024;
+    
+private:
+    int numRequired;
+    int numReplicas;
+    std::vector<Slot> slots;
+    std::vector<VALUE> values;
+    opnum_t watermark;
+
+    const Slot *
+    Find(opnum_t id) const
+    {
+        if (id < watermark) {
+            return NULL;
+        }
+        const Slot &s = slots[id % slots.size()];
+        if ((s.id != id) || (s.mask == 0)) {
+            return NULL;
+        }
+        return &s;
+    }
+};
+
 }      // namespace specpaxos
 
 #endif  // _COMMON_QUORUMSET_H_
@@ -73,13 +73,11 @@ Replica::Rollback(opnum_t current, opnum_t to, Log &log)
     Debug("Making rollback-upcall from " FMT_OPNUM " to " FMT_OPNUM,
           current, to);
 
-    std::map<opnum_t, string> reqs;
-    for (opnum_t x = current; x > to; x--) {
-        reqs.insert(std::pair<opnum_t, string>(x,
-                                                log.Find(x)->request.op()));
-    }
+    ASSERT(current >= to);
+    ASSERT((current == to) || (log.Find(current) != NULL));
+    ASSERT((current == to) || (log.Find(to+1) != NULL));
     
-    app->RollbackUpcall(current, to, reqs);
+    app->RollbackUpcall(current, to, RollbackOps(log, current, to));
 }
 
 void
@@ -49,6 +49,52 @@ enum ReplicaStatus {
     STATUS_RECOVERING
 };
 
+// The operations undone by a rollback, newest first. This is a view
+// directly into the replica's log, so it is only valid for the
+// duration of the upcall; applications that need an operation later
+// must copy it.
+class RollbackOps
+{
+public:
+    struct Op
+    {
+        opnum_t opnum;
+        const string &op;
+    };
+    
+    class const_iterator
+    {
+    public:
+        const_iterator(Log *log, opnum_t opnum)
+            : log(log), opnum(opnum) { }
+        Op operator*() const {
+            return Op { opnum, log->Find(opnum)->request.op() };
+        }
+        const_iterator &operator++() { opnum--; return *this; }
+        bool operator==(const const_iterator &x) const {
+            return opnum == x.opnum;
+        }
+        bool operator!=(const const_iterator &x) const {
+            return opnum != x.opnum;
+        }
+    private:
+        Log *log;
+        opnum_t opnum;
+    };
+
+    RollbackOps(Log &log, opnum_t current, opnum_t to)
+        : log(&log), current(current), to(to) { }
+    const_iterator begin() const { return const_iterator(log, current); }
+    const_iterator end() const { return const_iterator(log, to); }
+    size_t size() const { return current - to; }
+    bool empty() const { return current == to; }
+    
+private:
+    Log *log;
+    opnum_t current;
+    opnum_t to;
+};
+
 class AppReplica
 {
 public:
@@ -59,10 +105,12 @@ public:
     // Invoke callback on all replicas
     virtual void ReplicaUpcall(opnum_t opnum, const string &str1, string &str2) { };
     // Rollback callback on failed speculative operations
-    virtual void RollbackUpcall(opnum_t current, opnum_t to, const std::map<opnum_t, string> &opMap) { };
+    virtual void RollbackUpcall(opnum_t current, opnum_t to, const RollbackOps &ops) { };
     // Commit callback to commit speculative operations
     virtual void CommitUpcall(opnum_t) { };
-    // Invoke call back for unreplicated operations run on only one replica
+    // Invoke call back for unreplicated operations run on only one
+    // replica, and for read-only operations a leader serves under a
+    // lease (common/lease.h)
     virtual void UnloggedUpcall(const string &str1, string &str2) { };
 };
 
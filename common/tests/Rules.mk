@@ -1,2 +1,37 @@
 d := $(dir $(lastword $(MAKEFILE_LIST)))
 
+GTEST_SRCS += $(addprefix $(d), \
+		clienttable-test.cc \
+		clientmux-test.cc \
+		execthread-test.cc \
+		lease-test.cc \
+		quorumset-test.cc \
+		versionedstate-test.cc)
+
+$(d)clienttable-test: $(o)clienttable-test.o $(LIB-transport) $(GTEST_MAIN)
+
+TEST_BINS += $(d)clienttable-test
+
+$(d)clientmux-test: $(o)clientmux-test.o $(OBJS-clientmux) \
+	$(LIB-simtransport) $(GTEST_MAIN)
+
+TEST_BINS += $(d)clientmux-test
+
+$(d)execthread-test: $(o)execthread-test.o $(OBJS-execthread) \
+	$(LIB-simtransport) $(GTEST_MAIN)
+
+TEST_BINS += $(d)execthread-test
+
+$(d)lease-test: $(o)lease-test.o $(OBJS-lease) $(GTEST_MAIN)
+
+TEST_BINS += $(d)lease-test
+
+$(d)quorumset-test: $(o)quorumset-test.o $(LIB-message) $(GTEST_MAIN)
+
+TEST_BINS += $(d)quorumset-test
+
+$(d)versionedstate-test: $(o)versionedstate-test.o \
+	$(OBJS-replica) \
+	$(GTEST_MAIN)
+
+TEST_BINS += $(d)versionedstate-test
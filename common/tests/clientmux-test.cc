@@ -0,0 +1,152 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * clientmux-test.cc:
+ *   test cases for multiplexed client sessions
+ *
+ * Copyright 2013-2016 Dan R. K. Ports  <drkp@cs.washington.edu>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+
+#include "common/clientmux.h"
+#include "lib/simtransport.h"
+
+#include <gtest/gtest.h>
+#include <vector>
+
+using namespace specpaxos;
+
+class TestClient : public Client
+{
+public:
+    TestClient(const Configuration &config, Transport *transport,
+               clientid_t clientid)
+        : Client(config, transport, clientid) { }
+    void Invoke(const string &request, continuation_t continuation) { }
+    void InvokeUnlogged(int replicaIdx, const string &request,
+                        continuation_t continuation,
+                        timeout_continuation_t timeoutContinuation,
+                        uint32_t timeout) { }
+};
+
+class NullReplica : public TransportReceiver
+{
+public:
+    void ReceiveMessage(const TransportAddress &remote,
+                        const string &type, const string &data) { }
+};
+
+// Counts the timers set on it
+class CountingTransport : public SimulatedTransport
+{
+public:
+    int timersSet = 0;
+
+    int Timer(uint64_t ms, timer_callback_t cb) {
+        timersSet++;
+        return SimulatedTransport::Timer(ms, cb);
+    }
+};
+
+class ClientMuxTest : public ::testing::Test
+{
+protected:
+    std::vector<ReplicaAddress> replicaAddrs =
+        { { "localhost", "12345" } };
+    Configuration config { 1, 0, replicaAddrs };
+    CountingTransport transport;
+    NullReplica replica;
+
+    virtual void SetUp() {
+        transport.Register(&replica, config, 0);
+    }
+};
+
+TEST(ClientMux, ClientIdOf)
+{
+    // Field 1 is "abc"; field 15 is 300
+    const char msg[] = { 0x0a, 0x03, 'a', 'b', 'c',
+                         0x78, (char)0xac, 0x02 };
+    clientid_t clientid = 0;
+    EXPECT_TRUE(ClientMux::ClientIdOf(string(msg, sizeof(msg)), clientid));
+    EXPECT_EQ(300, clientid);
+
+    EXPECT_FALSE(ClientMux::ClientIdOf(string(msg, 5), clientid));
+    // Truncated
+    EXPECT_FALSE(ClientMux::ClientIdOf(string(msg, 3), clientid));
+}
+
+TEST_F(ClientMuxTest, Sessions)
+{
+    ClientMux mux(&transport, config);
+    {
+        TestClient a(config, &mux, 1);
+        TestClient b(config, &mux, 2);
+        EXPECT_EQ(2, mux.NumSessions());
+    }
+    EXPECT_EQ(0, mux.NumSessions());
+}
+
+TEST_F(ClientMuxTest, Timers)
+{
+    ClientMux mux(&transport, config);
+    std::vector<int> fired;
+
+    mux.Timer(10, [&]() { fired.push_back(10); });
+    int id = mux.Timer(5, [&]() { fired.push_back(5); });
+    mux.Timer(3, [&]() {
+            fired.push_back(3);
+            mux.Timer(1, [&]() { fired.push_back(4); });
+        });
+    EXPECT_EQ(3, mux.NumTimers());
+    EXPECT_TRUE(mux.CancelTimer(id));
+    EXPECT_FALSE(mux.CancelTimer(id));
+
+    transport.Run();
+
+    EXPECT_EQ(std::vector<int>({3, 4, 10}), fired);
+    EXPECT_EQ(0, mux.NumTimers());
+}
+
+TEST_F(ClientMuxTest, TimerDeadlines)
+{
+    ClientMux mux(&transport, config);
+    std::vector<uint64_t> fired;
+    uint64_t start = transport.Now();
+
+    // A long timer only wakes the transport once, and each timer
+    // goes off exactly at its deadline
+    mux.Timer(1000, [&]() { fired.push_back(transport.Now() - start); });
+    mux.Timer(250, [&]() {
+            fired.push_back(transport.Now() - start);
+            mux.Timer(500, [&]() {
+                    fired.push_back(transport.Now() - start);
+                });
+        });
+
+    transport.Run();
+
+    EXPECT_EQ(std::vector<uint64_t>({250000, 750000, 1000000}), fired);
+    EXPECT_LE(transport.timersSet, 4);
+}
@@ -0,0 +1,193 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * clienttable-test.cc:
+ *   test cases for ClientTable
+ *
+ * Copyright 2013-2016 Dan R. K. Ports  <drkp@cs.washington.edu>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+#include "common/clienttable.h"
+
+#include <gtest/gtest.h>
+
+using namespace specpaxos;
+
+struct TestEntry
+{
+    uint64_t lastReqId;
+};
+
+class TestAddress : public TransportAddress
+{
+public:
+    TestAddress(int id) : id(id) { }
+    TestAddress *clone() const { return new TestAddress(id); }
+    int id;
+};
+
+TEST(ClientTable, Basic)
+{
+    ClientTable<TestEntry> t;
+    TestAddress addr(3);
+
+    EXPECT_EQ(NULL, t.Find(1));
+    EXPECT_EQ(0, t.Lookup(1, 1).lastReqId);
+    t.Lookup(1, 1).lastReqId = 5;
+    EXPECT_EQ(5, t.Find(1)->lastReqId);
+    EXPECT_EQ(1, t.Size());
+
+    EXPECT_EQ(NULL, t.GetAddress(1));
+    t.SetAddress(1, addr, 2);
+    ASSERT_NE((const TransportAddress *)NULL, t.GetAddress(1));
+    EXPECT_EQ(3, ((const TestAddress *)t.GetAddress(1))->id);
+}
+
+TEST(ClientTable, Grow)
+{
+    ClientTable<TestEntry> t;
+
+    for (uint64_t i = 0; i < 10000; i++) {
+        t.Lookup(i * 7919, i).lastReqId = i;
+    }
+    EXPECT_EQ(10000, t.Size());
+    for (uint64_t i = 0; i < 10000; i++) {
+        ASSERT_NE((TestEntry *)NULL, t.Find(i * 7919));
+        EXPECT_EQ(i, t.Find(i * 7919)->lastReqId);
+    }
+}
+
+TEST(ClientTable, EvictIdle)
+{
+    // Odd clients can't be evicted
+    ClientTable<TestEntry> t(100, [](uint64_t clientid, const TestEntry &e) {
+            return (clientid % 2) == 0;
+        });
+
+    for (uint64_t i = 0; i < 40; i++) {
+        t.Lookup(i, 0);
+    }
+
+    // Keep client 0 active; everyone else goes idle
+    for (opnum_t now = 1; now < 1000; now++) {
+        t.Lookup(0, now);
+        t.Lookup(1000+now, now);
+    }
+
+    EXPECT_NE((TestEntry *)NULL, t.Find(0));
+    for (uint64_t i = 1; i < 40; i++) {
+        if (i % 2 == 0) {
+            EXPECT_EQ(NULL, t.Find(i));
+        } else {
+            EXPECT_NE((TestEntry *)NULL, t.Find(i));
+        }
+    }
+    // Idle sessions were evicted rather than growing the table
+    // past 1024 slots
+    EXPECT_LT(t.Size(), 768);
+    EXPECT_NE((TestEntry *)NULL, t.Find(1999));
+}
+
+TEST(RequestWindow, OutOfOrder)
+{
+    RequestWindow<int> w;
+
+    w.Insert(3, 0) = 30;
+    w.Insert(1, 0) = 10;
+    w.Insert(2, 0) = 20;
+    EXPECT_EQ(3, w.Size());
+    EXPECT_EQ(3, w.LastReqId());
+    ASSERT_NE((int *)NULL, w.Find(2));
+    EXPECT_EQ(20, *w.Find(2));
+    EXPECT_EQ(NULL, w.Find(4));
+
+    std::vector<uint64_t> ids;
+    w.ForEach([&](uint64_t id, int v) { ids.push_back(id); });
+    EXPECT_EQ(std::vector<uint64_t>({1, 2, 3}), ids);
+
+    w.Erase(2);
+    EXPECT_EQ(NULL, w.Find(2));
+    EXPECT_FALSE(w.IsStale(2));
+}
+
+TEST(RequestWindow, Acked)
+{
+    RequestWindow<int> w;
+
+    for (uint64_t i = 1; i <= 4; i++) {
+        w.Insert(i, 0);
+    }
+    // The client has replies for 1 and 2
+    w.Insert(6, 2);
+    EXPECT_TRUE(w.IsStale(1));
+    EXPECT_TRUE(w.IsStale(2));
+    EXPECT_FALSE(w.IsStale(3));
+    EXPECT_EQ(NULL, w.Find(1));
+    EXPECT_NE((int *)NULL, w.Find(3));
+    EXPECT_EQ(3, w.Size());
+
+    // A late request with an old ack doesn't move the floor back
+    w.Insert(5, 1);
+    EXPECT_TRUE(w.IsStale(2));
+}
+
+TEST(RequestWindow, MaxWindow)
+{
+    RequestWindow<int> w;
+
+    w.Insert(1, 0);
+    w.Insert(Client::MAX_WINDOW + 2, 0);
+    EXPECT_TRUE(w.IsStale(1));
+    EXPECT_EQ(1, w.Size());
+}
+
+TEST(RequestWindow, WindowOfOne)
+{
+    // One request at a time, each acking the last
+    RequestWindow<int> w;
+
+    for (uint64_t i = 1; i <= 10; i++) {
+        w.Insert(i, i-1) = i;
+        EXPECT_EQ(1, w.Size());
+        ASSERT_NE((int *)NULL, w.Find(i));
+        EXPECT_EQ(i, *w.Find(i));
+        EXPECT_EQ(NULL, w.Find(i-1));
+    }
+
+    // A second outstanding request, inserted before the first
+    w.Erase(10);
+    EXPECT_EQ(0, w.Size());
+    w.Insert(12, 9) = 12;
+    w.Insert(11, 9) = 11;
+    std::vector<uint64_t> ids;
+    w.ForEach([&](uint64_t id, int v) {
+            EXPECT_EQ(id, v);
+            ids.push_back(id);
+        });
+    EXPECT_EQ(std::vector<uint64_t>({11, 12}), ids);
+
+    w.Insert(13, 12);
+    EXPECT_EQ(1, w.Size());
+    EXPECT_NE((int *)NULL, w.Find(13));
+}
@@ -0,0 +1,170 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * execthread-test.cc:
+ *   test cases for ExecThread
+ *
+ * Copyright 2013-2016 Dan R. K. Ports  <drkp@cs.washington.edu>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+
+#include "common/execthread.h"
+#include "lib/simtransport.h"
+
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+
+using namespace specpaxos;
+
+class ExecThreadTestApp : public AppReplica
+{
+public:
+    virtual void ReplicaUpcall(opnum_t opnum, const string &op,
+                               string &reply) {
+        ops.push_back(op);
+        reply = "reply: " + op;
+        threads.push_back(std::this_thread::get_id());
+    }
+    virtual void CommitUpcall(opnum_t opnum) {
+        committed.push_back(opnum);
+    }
+    virtual void RollbackUpcall(opnum_t current, opnum_t to,
+                                const RollbackOps &undone) {
+        for (const auto &op : undone) {
+            EXPECT_EQ(ops.back(), op.op);
+            ops.pop_back();
+        }
+        rolledBack.push_back(current - to);
+    }
+    virtual void UnloggedUpcall(const string &op, string &reply) {
+        // Say how many operations came before
+        reply = std::to_string(ops.size());
+    }
+
+    std::vector<string> ops;
+    std::vector<opnum_t> committed;
+    std::vector<opnum_t> rolledBack;
+    std::vector<std::thread::id> threads;
+};
+
+static void
+RunOps(size_t depth)
+{
+    const int N = 100;
+    SimulatedTransport transport;
+    ExecThreadTestApp app;
+    ExecThread exec(&transport, &app, depth);
+
+    std::vector<string> replies;
+    std::vector<string> unlogged;
+    std::thread::id me = std::this_thread::get_id();
+    for (int i = 1; i <= N; i++) {
+        exec.Execute(i, std::to_string(i), [&](const string &res) {
+                // Completions run on the transport's thread
+                EXPECT_EQ(me, std::this_thread::get_id());
+                replies.push_back(res);
+            });
+        exec.Commit(i);
+        if (i % 10 == 0) {
+            exec.ExecuteUnlogged("", [&](const string &res) {
+                    unlogged.push_back(res);
+                });
+        }
+    }
+    // The transport waits for every completion
+    transport.Run();
+    EXPECT_EQ(0u, exec.Outstanding());
+
+    ASSERT_EQ((size_t)N, replies.size());
+    ASSERT_EQ((size_t)N, app.committed.size());
+    for (int i = 1; i <= N; i++) {
+        EXPECT_EQ(std::to_string(i), app.ops[i-1]);
+        EXPECT_EQ("reply: " + std::to_string(i), replies[i-1]);
+        EXPECT_EQ((opnum_t)i, app.committed[i-1]);
+        EXPECT_NE(std::this_thread::get_id(), app.threads[i-1]);
+    }
+    ASSERT_EQ((size_t)N/10, unlogged.size());
+    for (int i = 0; i < N/10; i++) {
+        EXPECT_EQ(std::to_string((i+1)*10), unlogged[i]);
+    }
+}
+
+TEST(ExecThread, InOrder)
+{
+    RunOps(ExecThread::DEFAULT_DEPTH);
+}
+
+TEST(ExecThread, Backlog)
+{
+    // Most jobs have to wait on our side for room in the queue
+    RunOps(4);
+}
+
+TEST(ExecThread, Rollback)
+{
+    SimulatedTransport transport;
+    ExecThreadTestApp app;
+    ExecThread exec(&transport, &app);
+    Log log(false);
+
+    for (opnum_t i = 1; i <= 5; i++) {
+        Request req;
+        req.set_op(std::to_string(i));
+        log.Append(viewstamp_t(0, i), req, LOG_STATE_SPECULATIVE);
+        exec.Execute(i, req.op(), [](const string &res) { });
+    }
+    // The log changes before the thread gets to the rollback; it
+    // must undo the operations as they were
+    exec.Rollback(5, 2, log);
+    log.RemoveAfter(3);
+    for (opnum_t i = 3; i <= 4; i++) {
+        Request req;
+        req.set_op("new " + std::to_string(i));
+        log.Append(viewstamp_t(1, i), req, LOG_STATE_SPECULATIVE);
+        exec.Execute(i, req.op(), [](const string &res) { });
+    }
+    transport.Run();
+
+    EXPECT_EQ(std::vector<opnum_t>({ 3 }), app.rolledBack);
+    EXPECT_EQ(std::vector<string>({ "1", "2", "new 3", "new 4" }), app.ops);
+}
+
+TEST(ExecThread, Destroy)
+{
+    SimulatedTransport transport;
+    ExecThreadTestApp app;
+    bool ran = false;
+    {
+        ExecThread exec(&transport, &app, 4);
+        for (int i = 1; i <= 100; i++) {
+            exec.Execute(i, std::to_string(i),
+                         [&](const string &res) { ran = true; });
+        }
+    }
+
+    // Anything the thread posted before it stopped is ignored
+    transport.Run();
+    EXPECT_FALSE(ran);
+}
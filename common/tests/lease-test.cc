@@ -0,0 +1,107 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * lease-test.cc:
+ *   test cases for LeaderLease
+ *
+ * Copyright 2013-2016 Dan R. K. Ports  <drkp@cs.washington.edu>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+
+#include "common/lease.h"
+#include "lib/configuration.h"
+
+#include <gtest/gtest.h>
+
+using namespace specpaxos;
+
+static Configuration
+MakeConfig(int n, int f)
+{
+    std::vector<ReplicaAddress> addrs;
+    for (int i = 0; i < n; i++) {
+        addrs.push_back(ReplicaAddress("localhost",
+                                       std::to_string(12345+i)));
+    }
+    return Configuration(n, f, addrs);
+}
+
+TEST(LeaderLease, Quorum)
+{
+    Configuration config = MakeConfig(5, 2);
+    LeaderLease lease(config, 0, 1600);
+
+    EXPECT_EQ(0u, lease.Expiry());
+    EXPECT_FALSE(lease.Valid(0));
+
+    // Our own acknowledgment doesn't count, and one other replica
+    // isn't enough
+    lease.Granted(0, 1000);
+    lease.Granted(1, 1000);
+    EXPECT_FALSE(lease.Valid(1000));
+
+    // Two others make a quorum; the lease lasts until the older of
+    // their acknowledgments runs out, less the drift allowance
+    lease.Granted(2, 2000);
+    EXPECT_EQ(1000 + 1600 - 100, lease.Expiry());
+    EXPECT_TRUE(lease.Valid(2000));
+    EXPECT_FALSE(lease.Valid(2500));
+
+    // Renewals move it forward, but old stamps never move it back
+    lease.Granted(1, 3000);
+    EXPECT_EQ(2000 + 1500, lease.Expiry());
+    lease.Granted(1, 500);
+    EXPECT_EQ(2000 + 1500, lease.Expiry());
+    lease.Granted(3, 4000);
+    EXPECT_EQ(3000 + 1500, lease.Expiry());
+
+    lease.Clear();
+    EXPECT_FALSE(lease.Valid(3000));
+}
+
+TEST(LeaderLease, Promise)
+{
+    Configuration config = MakeConfig(3, 1);
+    LeaderLease lease(config, 1, 1600);
+
+    EXPECT_FALSE(lease.Promised(0));
+    lease.Grant(1000);
+    EXPECT_TRUE(lease.Promised(1000));
+    EXPECT_TRUE(lease.Promised(2599));
+    EXPECT_FALSE(lease.Promised(2600));
+
+    // The promise outlasts any lease the leader could compute from
+    // the same message, since the leader stamped it earlier
+    LeaderLease leader(config, 0, 1600);
+    leader.Granted(1, 900);
+    EXPECT_LT(leader.Expiry(), 2600u);
+}
+
+TEST(LeaderLease, SingleReplica)
+{
+    Configuration config = MakeConfig(1, 0);
+    LeaderLease lease(config, 0);
+
+    EXPECT_TRUE(lease.Valid(0));
+}
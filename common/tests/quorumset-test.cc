@@ -0,0 +1,101 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * quorumset-test.cc:
+ *   test cases for BitmaskQuorumSet
+ *
+ * Copyright 2013-2016 Dan R. K. Ports  <drkp@cs.washington.edu>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+#include "common/quorumset.h"
+
+#include <gtest/gtest.h>
+#include <string>
+
+using namespace specpaxos;
+using std::string;
+
+TEST(BitmaskQuorumSet, Basic)
+{
+    BitmaskQuorumSet<> q(2, 5);
+
+    EXPECT_FALSE(q.AddAndCheckForQuorum(1, 0));
+    EXPECT_FALSE(q.AddAndCheckForQuorum(1, 0));
+    EXPECT_EQ(1, q.Count(1));
+    EXPECT_TRUE(q.AddAndCheckForQuorum(1, 3));
+    EXPECT_TRUE(q.CheckForQuorum(1));
+    EXPECT_EQ(0, q.Count(2));
+
+    q.Clear();
+    EXPECT_EQ(0, q.Count(1));
+}
+
+TEST(BitmaskQuorumSet, Values)
+{
+    BitmaskQuorumSet<string> q(2, 3);
+    q.AddAndCheckForQuorum(7, 2, "b");
+    q.AddAndCheckForQuorum(7, 0, "a");
+    q.AddAndCheckForQuorum(8, 1, "c");
+
+    string seen;
+    q.ForEach(7, [&](int idx, const string &v) {
+            seen += std::to_string(idx) + v;
+        });
+    EXPECT_EQ("0a2b", seen);
+}
+
+TEST(BitmaskQuorumSet, Watermark)
+{
+    BitmaskQuorumSet<> q(2, 3, 4);
+
+    q.AddAndCheckForQuorum(1, 0);
+    q.AddAndCheckForQuorum(2, 0);
+    q.SetWatermark(2);
+    EXPECT_EQ(0, q.Count(1));
+    EXPECT_EQ(1, q.Count(2));
+    EXPECT_FALSE(q.AddAndCheckForQuorum(1, 1));
+    EXPECT_FALSE(q.AddAndCheckForQuorum(1, 2));
+
+    // The watermark never goes backwards
+    q.SetWatermark(1);
+    EXPECT_EQ(2, q.Watermark());
+}
+
+TEST(BitmaskQuorumSet, SlotReuse)
+{
+    BitmaskQuorumSet<> q(2, 3, 4);
+
+    // 2 and 6 share a slot; the newer one wins
+    q.AddAndCheckForQuorum(2, 0);
+    q.AddAndCheckForQuorum(6, 1);
+    EXPECT_EQ(0, q.Count(2));
+    EXPECT_EQ(1, q.Count(6));
+    EXPECT_FALSE(q.AddAndCheckForQuorum(2, 2));
+    EXPECT_TRUE(q.AddAndCheckForQuorum(6, 2));
+
+    // Once 6 is below the watermark, its slot is free again
+    q.SetWatermark(7);
+    EXPECT_FALSE(q.AddAndCheckForQuorum(10, 0));
+    EXPECT_TRUE(q.AddAndCheckForQuorum(10, 1));
+}
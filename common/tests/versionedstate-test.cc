@@ -0,0 +1,235 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * versionedstate-test.cc:
+ *   test cases for VersionedMap and VersionedAppReplica
+ *
+ * Copyright 2013-2016 Dan R. K. Ports  <drkp@cs.washington.edu>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+#include "common/log.h"
+#include "common/versionedstate.h"
+
+#include <gtest/gtest.h>
+#include <map>
+#include <stdlib.h>
+#include <string>
+
+using namespace specpaxos;
+using std::string;
+
+TEST(VersionedMap, PutGetErase)
+{
+    VersionedMap<string, string> m;
+    string v;
+
+    EXPECT_FALSE(m.Get("a", v));
+    m.Put("a", "1");
+    m.Put("b", "2");
+    EXPECT_EQ(2, m.Size());
+    EXPECT_TRUE(m.Get("a", v));
+    EXPECT_EQ("1", v);
+
+    m.Put("a", "3");
+    EXPECT_EQ(2, m.Size());
+    EXPECT_TRUE(m.Get("a", v));
+    EXPECT_EQ("3", v);
+
+    m.Erase("a");
+    m.Erase("c");
+    EXPECT_EQ(1, m.Size());
+    EXPECT_FALSE(m.Contains("a"));
+    EXPECT_TRUE(m.Contains("b"));
+}
+
+TEST(VersionedMap, Rollback)
+{
+    VersionedMap<string, int> m;
+    int v;
+
+    m.Put("x", 1);
+    m.Snapshot(1);
+    m.Put("x", 2);
+    m.Put("y", 2);
+    m.Snapshot(2);
+    m.Erase("x");
+    m.Snapshot(3);
+    EXPECT_FALSE(m.Contains("x"));
+
+    m.Rollback(2);
+    EXPECT_TRUE(m.Get("x", v));
+    EXPECT_EQ(2, v);
+    EXPECT_EQ(2, m.Size());
+
+    m.Rollback(1);
+    EXPECT_TRUE(m.Get("x", v));
+    EXPECT_EQ(1, v);
+    EXPECT_FALSE(m.Contains("y"));
+
+    // Unsnapshotted changes are discarded too
+    m.Put("z", 3);
+    m.Rollback(1);
+    EXPECT_FALSE(m.Contains("z"));
+
+    m.Rollback(0);
+    EXPECT_EQ(0, m.Size());
+}
+
+TEST(VersionedMap, Commit)
+{
+    VersionedMap<int, int> m;
+    int v;
+
+    for (int i = 1; i <= 10; i++) {
+        m.Put(i % 3, i);
+        m.Snapshot(i);
+    }
+    EXPECT_EQ(10, m.NumVersions());
+
+    m.Commit(6);
+    EXPECT_EQ(4, m.NumVersions());
+
+    // Rolling back to the committed point restores the state as of
+    // the last discarded version
+    m.Rollback(6);
+    EXPECT_EQ(0, m.NumVersions());
+    EXPECT_TRUE(m.Get(0, v));
+    EXPECT_EQ(6, v);
+    EXPECT_TRUE(m.Get(1, v));
+    EXPECT_EQ(4, v);
+    EXPECT_TRUE(m.Get(2, v));
+    EXPECT_EQ(5, v);
+}
+
+TEST(VersionedMap, MatchesStdMap)
+{
+    // Apply random updates, snapshotting each, then check that
+    // rolling back to each version restores exactly its contents.
+    const int NUM_OPS = 2000;
+    const int NUM_KEYS = 100;
+    
+    VersionedMap<int, int> m;
+    std::vector<std::map<int, int> > expected;
+    std::map<int, int> cur;
+    expected.push_back(cur);
+
+    srand(1);
+    for (int i = 1; i <= NUM_OPS; i++) {
+        int k = rand() % NUM_KEYS;
+        if (rand() % 4 == 0) {
+            m.Erase(k);
+            cur.erase(k);
+        } else {
+            m.Put(k, i);
+            cur[k] = i;
+        }
+        m.Snapshot(i);
+        expected.push_back(cur);
+    }
+
+    for (int i = NUM_OPS; i >= 0; i -= 7) {
+        m.Rollback(i);
+        ASSERT_EQ(expected[i].size(), m.Size());
+        std::map<int, int> contents;
+        int last = -1;
+        m.ForEach([&](const int &k, const int &v) {
+                EXPECT_LT(last, k);
+                last = k;
+                contents[k] = v;
+            });
+        ASSERT_EQ(expected[i], contents);
+    }
+}
+
+TEST(VersionedMap, SequentialKeys)
+{
+    // Integer keys hash to themselves; the treap has to stay
+    // balanced anyway, or the recursive insert runs out of stack.
+    const int NUM_KEYS = 100000;
+
+    VersionedMap<int, int> m;
+    for (int i = 0; i < NUM_KEYS; i++) {
+        m.Put(i, i);
+    }
+    m.Snapshot(1);
+    m.Put(0, -1);
+    m.Put(NUM_KEYS, NUM_KEYS);
+    m.Snapshot(2);
+
+    int v;
+    ASSERT_EQ(NUM_KEYS+1, m.Size());
+    ASSERT_TRUE(m.Get(0, v));
+    EXPECT_EQ(-1, v);
+    ASSERT_TRUE(m.Get(NUM_KEYS/2, v));
+    EXPECT_EQ(NUM_KEYS/2, v);
+
+    m.Rollback(1);
+    ASSERT_EQ(NUM_KEYS, m.Size());
+    ASSERT_TRUE(m.Get(0, v));
+    EXPECT_EQ(0, v);
+    EXPECT_FALSE(m.Contains(NUM_KEYS));
+}
+
+class CounterApp : public VersionedAppReplica<string, int>
+{
+protected:
+    virtual void Execute(opnum_t opnum, const string &op, string &reply) {
+        int v = 0;
+        state.Get(op, v);
+        state.Put(op, v+1);
+        reply = std::to_string(v+1);
+    }
+
+public:
+    int Count(const string &key) {
+        int v = 0;
+        state.Get(key, v);
+        return v;
+    }
+    size_t NumVersions() { return state.NumVersions(); }
+};
+
+TEST(VersionedAppReplica, RollbackAndCommit)
+{
+    CounterApp app;
+    Log log(false);
+    string reply;
+
+    for (opnum_t i = 1; i <= 6; i++) {
+        app.ReplicaUpcall(i, (i % 2) ? "odd" : "even", reply);
+    }
+    EXPECT_EQ("3", reply);
+    EXPECT_EQ(3, app.Count("odd"));
+    EXPECT_EQ(3, app.Count("even"));
+
+    app.CommitUpcall(2);
+    EXPECT_EQ(4, app.NumVersions());
+
+    app.RollbackUpcall(6, 3, RollbackOps(log, 6, 3));
+    EXPECT_EQ(2, app.Count("odd"));
+    EXPECT_EQ(1, app.Count("even"));
+
+    app.ReplicaUpcall(4, "odd", reply);
+    EXPECT_EQ("3", reply);
+}
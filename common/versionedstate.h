@@ -0,0 +1,343 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * versionedstate.h:
+ *   copy-on-write application state with cheap rollback, for
+ *   applications running on speculative replication protocols
+ *
+ * Copyright 2013-2016 Dan R. K. Ports  <drkp@cs.washington.edu>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+#ifndef _COMMON_VERSIONEDSTATE_H_
+#define _COMMON_VERSIONEDSTATE_H_
+
+#include "common/replica.h"
+#include "lib/assert.h"
+#include "lib/viewstamp.h"
+
+#include <deque>
+#include <functional>
+#include <memory>
+
+namespace specpaxos {
+
+/*
+ * A persistent map: every update produces a new version that shares
+ * all unmodified structure with the old one, so keeping old versions
+ * around costs O(log n) per update rather than a copy of the map.
+ *
+ * The map is a treap whose priorities are a hash of the key, so its
+ * shape depends only on its contents. Versions are tagged with the
+ * opnum of the operation that produced them. Rollback(to) restores
+ * the latest version at or before to by swapping the root pointer;
+ * Commit(upto) discards the versions that can no longer be rolled
+ * back to.
+ */
+template <class K, class V>
+class VersionedMap
+{
+    struct Node;
+    typedef std::shared_ptr<const Node> NodePtr;
+
+    struct Node
+    {
+        K key;
+        V value;
+        size_t priority;
+        NodePtr left;
+        NodePtr right;
+
+        Node(const K &key, const V &value, size_t priority,
+             const NodePtr &left, const NodePtr &right)
+            : key(key), value(value), priority(priority),
+              left(left), right(right) { }
+    };
+
+    struct Version
+    {
+        opnum_t opnum;
+        NodePtr root;
+        size_t size;
+    };
+
+public:
+    VersionedMap()
+    {
+        current.opnum = 0;
+        current.size = 0;
+        committed = current;
+    }
+
+    bool
+    Get(const K &key, V &value) const
+    {
+        const Node *n = Find(key);
+        if (n == NULL) {
+            return false;
+        }
+        value = n->value;
+        return true;
+    }
+
+    bool
+    Contains(const K &key) const
+    {
+        return (Find(key) != NULL);
+    }
+
+    void
+    Put(const K &key, const V &value)
+    {
+        if (!Contains(key)) {
+            current.size++;
+        }
+        current.root = Insert(current.root, key, value, Priority(key));
+    }
+
+    void
+    Erase(const K &key)
+    {
+        if (!Contains(key)) {
+            return;
+        }
+        current.size--;
+        current.root = Remove(current.root, key);
+    }
+
+    size_t
+    Size() const
+    {
+        return current.size;
+    }
+
+    // Visit every entry in key order.
+    template <class F> void
+    ForEach(F f) const
+    {
+        Visit(current.root.get(), f);
+    }
+
+    // Record the current contents as the state after operation
+    // opnum. Snapshotting the same opnum twice replaces the older
+    // snapshot.
+    void
+    Snapshot(opnum_t opnum)
+    {
+        ASSERT(opnum >= current.opnum);
+        if (!versions.empty() && (versions.back().opnum == opnum)) {
+            versions.pop_back();
+        }
+        current.opnum = opnum;
+        versions.push_back(current);
+    }
+
+    // Restore the state as of operation to, discarding everything
+    // after it. Restoring the state itself is O(1); the discarded
+    // versions were paid for when they were created.
+    void
+    Rollback(opnum_t to)
+    {
+        ASSERT(to >= committed.opnum);
+        while (!versions.empty() && (versions.back().opnum > to)) {
+            versions.pop_back();
+        }
+        current = versions.empty() ? committed : versions.back();
+    }
+
+    // Operations up to upto will never be rolled back, so drop all
+    // but the newest version at or before it.
+    void
+    Commit(opnum_t upto)
+    {
+        while (!versions.empty() && (versions.front().opnum <= upto)) {
+            committed = versions.front();
+            versions.pop_front();
+        }
+    }
+
+    // Number of versions retained for rollback
+    size_t
+    NumVersions() const
+    {
+        return versions.size();
+    }
+
+private:
+    Version current;
+    Version committed;
+    std::deque<Version> versions;
+
+    const Node *
+    Find(const K &key) const
+    {
+        const Node *n = current.root.get();
+        while (n != NULL) {
+            if (key < n->key) {
+                n = n->left.get();
+            } else if (n->key < key) {
+                n = n->right.get();
+            } else {
+                return n;
+            }
+        }
+        return NULL;
+    }
+
+    // std::hash is the identity on integers, which would make a
+    // treap of sequential keys a linked list; scramble it with the
+    // splitmix64 finalizer.
+    static size_t
+    Priority(const K &key)
+    {
+        uint64_t z = std::hash<K>()(key);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    static NodePtr
+    MakeNode(const K &key, const V &value, size_t priority,
+             const NodePtr &left, const NodePtr &right)
+    {
+        return std::make_shared<const Node>(key, value, priority,
+                                            left, right);
+    }
+
+    static NodePtr
+    Insert(const NodePtr &t, const K &key, const V &value,
+           size_t priority)
+    {
+        if (!t) {
+            return MakeNode(key, value, priority, NULL, NULL);
+        }
+
+        if (key < t->key) {
+            NodePtr l = Insert(t->left, key, value, priority);
+            if (l->priority > t->priority) {
+                // Rotate right
+                return MakeNode(l->key, l->value, l->priority, l->left,
+                                MakeNode(t->key, t->value, t->priority,
+                                         l->right, t->right));
+            }
+            return MakeNode(t->key, t->value, t->priority, l, t->right);
+        } else if (t->key < key) {
+            NodePtr r = Insert(t->right, key, value, priority);
+            if (r->priority > t->priority) {
+                // Rotate left
+                return MakeNode(r->key, r->value, r->priority,
+                                MakeNode(t->key, t->value, t->priority,
+                                         t->left, r->left),
+                                r->right);
+            }
+            return MakeNode(t->key, t->value, t->priority, t->left, r);
+        } else {
+            return MakeNode(key, value, t->priority, t->left, t->right);
+        }
+    }
+
+    static NodePtr
+    Remove(const NodePtr &t, const K &key)
+    {
+        ASSERT(t);
+        if (key < t->key) {
+            return MakeNode(t->key, t->value, t->priority,
+                            Remove(t->left, key), t->right);
+        } else if (t->key < key) {
+            return MakeNode(t->key, t->value, t->priority,
+                            t->left, Remove(t->right, key));
+        } else {
+            return Merge(t->left, t->right);
+        }
+    }
+
+    static NodePtr
+    Merge(const NodePtr &a, const NodePtr &b)
+    {
+        if (!a) {
+            return b;
+        }
+        if (!b) {
+            return a;
+        }
+        if (a->priority > b->priority) {
+            return MakeNode(a->key, a->value, a->priority,
+                            a->left, Merge(a->right, b));
+        } else {
+            return MakeNode(b->key, b->value, b->priority,
+                            Merge(a, b->left), b->right);
+        }
+    }
+
+    template <class F> static void
+    Visit(const Node *n, F &f)
+    {
+        if (n == NULL) {
+            return;
+        }
+        Visit(n->left.get(), f);
+        f(n->key, n->value);
+        Visit(n->right.get(), f);
+    }
+};
+
+/*
+ * Base class for applications that keep all their state in a
+ * VersionedMap. The application implements Execute; rollback and
+ * commit upcalls are handled here by restoring or discarding
+ * versions, so there is no need to write inverse operations.
+ */
+template <class K = string, class V = string>
+class VersionedAppReplica : public AppReplica
+{
+public:
+    virtual void
+    ReplicaUpcall(opnum_t opnum, const string &str1, string &str2)
+    {
+        Execute(opnum, str1, str2);
+        state.Snapshot(opnum);
+    }
+
+    virtual void
+    RollbackUpcall(opnum_t current, opnum_t to, const RollbackOps &ops)
+    {
+        state.Rollback(to);
+    }
+
+    virtual void
+    CommitUpcall(opnum_t opnum)
+    {
+        state.Commit(opnum);
+    }
+
+protected:
+    // Execute an operation against state
+    virtual void Execute(opnum_t opnum, const string &op,
+                         string &reply) = 0;
+
+    VersionedMap<K, V> state;
+};
+
+} // namespace specpaxos
+
+#endif  /* _COMMON_VERSIONEDSTATE_H_ */
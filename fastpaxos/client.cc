@@ -44,13 +44,10 @@ FastPaxosClient::FastPaxosClient(const Configuration &config,
                    uint64_t clientid)
     : Client(config, transport, clientid)
 {
-    pendingRequest = NULL;
     pendingUnloggedRequest = NULL;
     lastReqId = 0;
+    lastSentReqId = 0;
     
-    requestTimeout = new Timeout(transport, 7000, [this]() {
-            ResendRequest();
-        });
     unloggedRequestTimeout = new Timeout(transport, 1000, [this]() {
             UnloggedRequestTimeoutCallback();
         });
@@ -58,13 +55,13 @@ FastPaxosClient::FastPaxosClient(const Configuration &config,
 
 FastPaxosClient::~FastPaxosClient()
 {
-    if (pendingRequest) {
-        delete pendingRequest;
+    for (auto &kv : pendingRequests) {
+        delete kv.second->timeout;
+        delete kv.second;
     }
     if (pendingUnloggedRequest) {
         delete pendingUnloggedRequest;
     }
-    delete requestTimeout;
     delete unloggedRequestTimeout;
 }
 
@@ -72,16 +69,11 @@ void
 FastPaxosClient::Invoke(const string &request,
                  continuation_t continuation)
 {
-    // XXX Can only handle one pending request for now
-    if (pendingRequest != NULL) {
-        Panic("Client only supports one pending request");
-    }
-
     ++lastReqId;
     uint64_t reqId = lastReqId;
-    pendingRequest = new PendingRequest(request, reqId, continuation);
+    pendingRequests[reqId] = new PendingRequest(request, reqId, continuation);
 
-    SendRequest();
+    SendNewRequests();
 }
 
 void
@@ -114,25 +106,57 @@ FastPaxosClient::InvokeUnlogged(int replicaIdx,
     transport->SendMessageToReplica(this, replicaIdx, reqMsg);
 }
 
+uint64_t
+FastPaxosClient::AckedReqId() const
+{
+    if (pendingRequests.empty()) {
+        return lastReqId;
+    }
+    return pendingRequests.begin()->first - 1;
+}
+
+void
+FastPaxosClient::SendNewRequests()
+{
+    // Send whatever the window allows, oldest first
+    for (auto it = pendingRequests.upper_bound(lastSentReqId);
+         it != pendingRequests.end(); ++it) {
+        if (it->first >= pendingRequests.begin()->first + window) {
+            break;
+        }
+        PendingRequest *req = it->second;
+        uint64_t reqId = req->clientReqId;
+        req->timeout = new Timeout(transport, 7000, [this, reqId]() {
+                ResendRequest(reqId);
+            });
+        lastSentReqId = reqId;
+        SendRequest(req);
+    }
+}
+
 void
-FastPaxosClient::SendRequest()
+FastPaxosClient::SendRequest(const PendingRequest *req)
 {
     proto::RequestMessage reqMsg;
-    reqMsg.mutable_req()->set_op(pendingRequest->request);
+    reqMsg.mutable_req()->set_op(req->request);
     reqMsg.mutable_req()->set_clientid(clientid);
-    reqMsg.mutable_req()->set_clientreqid(pendingRequest->clientReqId);
+    reqMsg.mutable_req()->set_clientreqid(req->clientReqId);
+    reqMsg.mutable_req()->set_ackedreqid(AckedReqId());
     
     // XXX Try sending only to (what we think is) the leader first
     transport->SendMessageToAll(this, reqMsg);
     
-    requestTimeout->Reset();
+    req->timeout->Reset();
 }
 
 void
-FastPaxosClient::ResendRequest()
+FastPaxosClient::ResendRequest(uint64_t clientReqId)
 {
-    Warning("Client timeout; resending request");
-    SendRequest();
+    auto it = pendingRequests.find(clientReqId);
+    ASSERT(it != pendingRequests.end());
+    Warning("Client timeout; resending request " FMT_CLIENTREQID,
+            clientReqId);
+    SendRequest(it->second);
 }
 
 
@@ -160,19 +184,19 @@ FastPaxosClient::HandleReply(const TransportAddress &remote,
                       const proto::ReplyMessage &msg)
 {
     Debug("Client received reply for " FMT_VIEWSTAMP, msg.view(), msg.opnum());
-    if (pendingRequest == NULL) {
-        Debug("Received reply when no request was pending");
-        return;
-    }
-    if (msg.clientreqid() != pendingRequest->clientReqId) {
-        Debug("Received reply for a different request");
+    auto it = pendingRequests.find(msg.clientreqid());
+    if ((it == pendingRequests.end()) ||
+        (it->second->timeout == NULL)) {
+        Debug("Received reply for a request that isn't pending");
         return;
     }
     
-    requestTimeout->Stop();
+    PendingRequest *req = it->second;
+    pendingRequests.erase(it);
+    delete req->timeout;
 
-    PendingRequest *req = pendingRequest;
-    pendingRequest = NULL;
+    // The window might have room for more requests now
+    SendNewRequests();
     
     req->continuation(req->request, msg.reply());
     delete req;
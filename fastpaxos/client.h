@@ -35,6 +35,8 @@
 #include "lib/configuration.h"
 #include "fastpaxos/fastpaxos-proto.pb.h"
 
+#include <map>
+
 namespace specpaxos {
 namespace fastpaxos {
 
@@ -66,18 +68,24 @@ protected:
         uint64_t clientReqId;
         continuation_t continuation;
         timeout_continuation_t timeoutContinuation;
+        // Only set once the request has been sent
+        Timeout *timeout;
         inline PendingRequest(string request, uint64_t clientReqId,
                               continuation_t continuation)
             : request(request), clientReqId(clientReqId),
-              continuation(continuation) { }
+              continuation(continuation), timeout(NULL) { }
     };
-    PendingRequest *pendingRequest;
+    // Requests that haven't completed, whether or not the window
+    // has let us send them yet
+    std::map<uint64_t, PendingRequest *> pendingRequests;
+    uint64_t lastSentReqId;
     PendingRequest *pendingUnloggedRequest;
-    Timeout *requestTimeout;
     Timeout *unloggedRequestTimeout;
 
-    void SendRequest();
-    void ResendRequest();
+    uint64_t AckedReqId() const;
+    void SendNewRequests();
+    void SendRequest(const PendingRequest *req);
+    void ResendRequest(uint64_t clientReqId);
     void HandleReply(const TransportAddress &remote,
                      const proto::ReplyMessage &msg);
     void HandleUnloggedReply(const TransportAddress &remote,
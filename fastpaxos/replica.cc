@@ -55,8 +55,8 @@ FastPaxosReplica::FastPaxosReplica(Configuration config, int myIdx,
                                    AppReplica *app)
     : Replica(config, myIdx, initialize, transport, app),
       log(false),
-      slowPrepareOKQuorum(config.QuorumSize()-1),
-      fastPrepareOKQuorum(config.FastQuorumSize()-1)
+      slowPrepareOKQuorum(config.QuorumSize()-1, config.n),
+      fastPrepareOKQuorum(config.FastQuorumSize()-1, config.n)
 {
     if (!initialize) {
         RPanic("Recovery not implemented");
@@ -118,28 +118,33 @@ FastPaxosReplica::CommitUpTo(opnum_t upto)
         reply.set_view(entry->viewstamp.view);
         reply.set_opnum(entry->viewstamp.opnum);
         reply.set_clientreqid(entry->request.clientreqid());
+        reply.set_clientid(entry->request.clientid());
         
         /* Mark it as committed */
         log.SetStatus(lastCommitted, LOG_STATE_COMMITTED);
+        // Let the application discard any undo state it kept
+        Commit(lastCommitted);
 
         // Store reply in the client table
         ClientTableEntry &cte =
-            clientTable[entry->request.clientid()];
-        if (cte.lastReqId <= entry->request.clientreqid()) {
-            cte.lastReqId = entry->request.clientreqid();
-            cte.replied = true;
-            cte.reply = reply;            
+            clientTable.Lookup(entry->request.clientid(), lastCommitted);
+        uint64_t reqid = entry->request.clientreqid();
+        ClientRequest *cr = cte.Find(reqid);
+        if ((cr == NULL) && !cte.IsStale(reqid)) {
+            cr = &cte.Insert(reqid, entry->request.ackedreqid());
+        }
+        if (cr != NULL) {
+            StoreReply(*cr, reply);
         } else {
-            // We've subsequently prepared another operation from the
-            // same client. So this request must have been completed
-            // at the client, and there's no need to record the
-            // result.
+            // The client has already gotten a reply for this
+            // request, so there's no need to record the result.
         }
         
         /* Send reply */
-        auto iter = clientAddresses.find(entry->request.clientid());
-        if (iter != clientAddresses.end()) {
-            transport->SendMessage(this, *iter->second, reply);
+        const TransportAddress *addr =
+            clientTable.GetAddress(entry->request.clientid());
+        if (addr != NULL) {
+            transport->SendMessage(this, *addr, reply);
         }
     }
 
@@ -224,15 +229,26 @@ FastPaxosReplica::EnterView(view_t newview)
 void
 FastPaxosReplica::UpdateClientTable(const Request &req)
 {
-    ClientTableEntry &entry = clientTable[req.clientid()];
+    ClientTableEntry &entry =
+        clientTable.Lookup(req.clientid(), lastFastPath);
     
-    if (entry.lastReqId >= req.clientreqid()) {
+    if (entry.IsStale(req.clientreqid()) ||
+        (entry.Find(req.clientreqid()) != NULL)) {
         return;
     }
 
-    entry.lastReqId = req.clientreqid();
-    entry.replied = false;
-    entry.reply.Clear();
+    entry.Insert(req.clientreqid(), req.ackedreqid());
+}
+
+void
+FastPaxosReplica::StoreReply(ClientRequest &cr, const ReplyMessage &reply)
+{
+    if (cr.reply) {
+        *cr.reply = reply;
+    } else {
+        cr.reply.reset(new ReplyMessage(reply));
+    }
+    cr.replied = true;
 }
 
 void
@@ -300,29 +316,25 @@ FastPaxosReplica::HandleRequest(const TransportAddress &remote,
     }
     
     // Save the client's address
-    clientAddresses.erase(msg.req().clientid());
-    clientAddresses.insert(
-        std::pair<uint64_t, std::unique_ptr<TransportAddress> >(
-            msg.req().clientid(),
-            std::unique_ptr<TransportAddress>(remote.clone())));
+    clientTable.SetAddress(msg.req().clientid(), remote, lastFastPath);
 
     // Check the client table to see if this is a duplicate request
-    auto kv = clientTable.find(msg.req().clientid());
-    if (kv != clientTable.end()) {
-        const ClientTableEntry &entry = kv->second;
-        if (msg.req().clientreqid() < entry.lastReqId) {
+    const ClientTableEntry *entry = clientTable.Find(msg.req().clientid());
+    if (entry != NULL) {
+        if (entry->IsStale(msg.req().clientreqid())) {
             RNotice("Ignoring stale request");
             return;
         }
-        if (msg.req().clientreqid() == entry.lastReqId) {
+        const ClientRequest *cr = entry->Find(msg.req().clientreqid());
+        if (cr != NULL) {
             // This is a duplicate request. Resend the reply if we
             // have one. We might not have a reply to resend if we're
             // waiting for the other replicas; in that case, just
             // discard the request.
-            if (entry.replied) {
+            if (cr->replied) {
                 RNotice("Received duplicate request; resending reply");
                 if (!(transport->SendMessage(this, remote,
-                                             entry.reply))) {
+                                             *cr->reply))) {
                     RWarning("Failed to resend reply to client");
                 }
                 return;
@@ -411,6 +423,7 @@ FastPaxosReplica::HandleUnloggedRequest(const TransportAddress &remote,
     Debug("Received unlogged request %s", (char *)msg.req().op().c_str());
 
     ExecuteUnlogged(msg.req(), reply);
+    reply.set_clientid(msg.req().clientid());
     
     if (!(transport->SendMessage(this, remote, reply)))
         Warning("Failed to send reply message");
@@ -568,9 +581,7 @@ FastPaxosReplica::HandlePrepareOK(const TransportAddress &remote,
 
     auto &quorum = msg.slowpath() ? slowPrepareOKQuorum : fastPrepareOKQuorum;
 
-    viewstamp_t vs = { msg.view(), msg.opnum() };
-    if (auto msgs =
-        (quorum.AddAndCheckForQuorum(vs, msg.replicaidx(), msg))) {
+    if (quorum.AddAndCheckForQuorum(msg.opnum(), msg.replicaidx())) {
         RDebug("Received quorum of PREPAREOK messages");
         /*
          * We have a quorum of PrepareOK messages for this
@@ -581,9 +592,12 @@ FastPaxosReplica::HandlePrepareOK(const TransportAddress &remote,
          *
          * This also notifies the client of the result.
          */
+        int count = quorum.Count(msg.opnum());
         CommitUpTo(msg.opnum());
+        slowPrepareOKQuorum.SetWatermark(lastCommitted+1);
+        fastPrepareOKQuorum.SetWatermark(lastCommitted+1);
 
-        if (msgs->size() > (unsigned)quorum.NumRequired()) {
+        if (count > quorum.NumRequired()) {
             return;
         }
         
@@ -32,6 +32,7 @@
 #define _FASTPAXOS_REPLICA_H_
 
 #include "lib/configuration.h"
+#include "common/clienttable.h"
 #include "common/log.h"
 #include "common/replica.h"
 #include "common/quorumset.h"
@@ -68,17 +69,19 @@ private:
     proto::PrepareMessage lastPrepare;
     
     Log log;
-    std::map<uint64_t, std::unique_ptr<TransportAddress> > clientAddresses;
-    struct ClientTableEntry
+    struct ClientRequest
     {
-        uint64_t lastReqId;
         bool replied;
-        proto::ReplyMessage reply;
+        // Allocated once we have a reply for the request
+        std::unique_ptr<proto::ReplyMessage> reply;
+
+        ClientRequest() : replied(false) { }
     };
-    std::map<uint64_t, ClientTableEntry> clientTable;
+    typedef RequestWindow<ClientRequest> ClientTableEntry;
+    ClientTable<ClientTableEntry> clientTable;
     
-    QuorumSet<viewstamp_t, proto::PrepareOKMessage> slowPrepareOKQuorum;
-    QuorumSet<viewstamp_t, proto::PrepareOKMessage> fastPrepareOKQuorum;
+    BitmaskQuorumSet<> slowPrepareOKQuorum;
+    BitmaskQuorumSet<> fastPrepareOKQuorum;
 
     Timeout *stateTransferTimeout;
     Timeout *resendPrepareTimeout;
@@ -89,6 +92,7 @@ private:
     void RequestStateTransfer();
     void EnterView(view_t newview);
     void UpdateClientTable(const Request &req);
+    void StoreReply(ClientRequest &cr, const proto::ReplyMessage &reply);
     void ResendPrepare();
     
     void HandleRequest(const TransportAddress &remote,
@@ -0,0 +1,65 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * ewma.h:
+ *   exponentially weighted moving average
+ *
+ * Copyright 2013-2016 Dan R. K. Ports  <drkp@cs.washington.edu>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+
+#ifndef _LIB_EWMA_H_
+#define _LIB_EWMA_H_
+
+#include <stdint.h>
+
+/*
+ * Exponentially weighted moving average of integer samples. Each new
+ * sample counts for 1/8; the sum is kept multiplied by 8 so that
+ * integer division doesn't lose the low bits.
+ */
+class EWMA
+{
+public:
+    EWMA(uint64_t initial = 0) : scaled(initial * WEIGHT) { }
+
+    void
+    Add(uint64_t sample)
+    {
+        scaled = scaled - scaled/WEIGHT + sample;
+    }
+
+    uint64_t
+    Mean() const
+    {
+        return scaled / WEIGHT;
+    }
+
+private:
+    static const uint64_t WEIGHT = 8;
+
+    uint64_t scaled;
+};
+
+#endif  /* _LIB_EWMA_H_ */
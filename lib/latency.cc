@@ -172,6 +172,12 @@ Latency_EndRecType(Latency_t *l, Latency_Frame_t *fr, char type)
     return fr->accum;
 }
 
+void
+Latency_AddType(Latency_t *l, char type, uint64_t ns)
+{
+    LatencyAdd(l, type, ns);
+}
+
 void
 Latency_Pause(Latency_t *l)
 {
@@ -95,6 +95,7 @@ void _Latency_Init(Latency_t *l, const char *name);
 
 void Latency_StartRec(Latency_t *l, Latency_Frame_t *fr);
 uint64_t Latency_EndRecType(Latency_t *l, Latency_Frame_t *fr, char type);
+void Latency_AddType(Latency_t *l, char type, uint64_t ns);
 void Latency_Pause(Latency_t *l);
 void Latency_Resume(Latency_t *l);
 
@@ -134,6 +135,14 @@ Latency_End(Latency_t *l)
     return Latency_EndRec(l, &l->defaultFrame);
 }
 
+// Record a sample that was measured some other way, e.g. an
+// interval that doesn't nest with the others
+static inline void
+Latency_Add(Latency_t *l, uint64_t ns)
+{
+    Latency_AddType(l, '=', ns);
+}
+
 char *LatencyFmtNS(uint64_t ns, char *buf);
 
 
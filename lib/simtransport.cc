@@ -64,6 +64,7 @@ SimulatedTransport::SimulatedTransport()
     lastTimerId = 0;
     vtime = 0;
     processTimers = true;
+    holds = 0;
 }
 
 SimulatedTransport::~SimulatedTransport()
@@ -171,6 +172,8 @@ SimulatedTransport::Run()
     LookupAddresses();
     
     do {
+        RunPosted();
+
         // Process queue
         while (!queue.empty()) {
             QueuedMessage &q = queue.front();
@@ -179,6 +182,13 @@ SimulatedTransport::Run()
             queue.pop_front();
         }
 
+        if (holds > 0) {
+            // Wait for another thread to post something
+            std::unique_lock<std::mutex> l(postLock);
+            postCond.wait(l, [this]() { return !posted.empty(); });
+            continue;
+        }
+
         // If there's a timer, deliver the earliest one only
         if (processTimers && !timers.empty()) {
             auto iter = timers.begin();
@@ -191,7 +201,23 @@ SimulatedTransport::Run()
         
         // ...then retry to see if there are more queued messages to
         // deliver first
-    } while (!queue.empty() || (processTimers && !timers.empty()));
+    } while (RunPosted() || !queue.empty() ||
+             (processTimers && !timers.empty()));
+}
+
+// Returns true if there were any callbacks to run
+bool
+SimulatedTransport::RunPosted()
+{
+    std::deque<timer_callback_t> cbs;
+    {
+        std::lock_guard<std::mutex> l(postLock);
+        cbs.swap(posted);
+    }
+    for (auto &cb : cbs) {
+        cb();
+    }
+    return !cbs.empty();
 }
 
 void
@@ -207,6 +233,33 @@ SimulatedTransport::RemoveFilter(int id)
 }
 
 
+void
+SimulatedTransport::Post(timer_callback_t cb)
+{
+    std::lock_guard<std::mutex> l(postLock);
+    posted.push_back(cb);
+    postCond.notify_one();
+}
+
+void
+SimulatedTransport::Hold()
+{
+    holds++;
+}
+
+void
+SimulatedTransport::Release()
+{
+    ASSERT(holds > 0);
+    holds--;
+}
+
+uint64_t
+SimulatedTransport::Now()
+{
+    return vtime * 1000;
+}
+
 int
 SimulatedTransport::Timer(uint64_t ms, timer_callback_t cb)
 {
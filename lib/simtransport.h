@@ -36,7 +36,9 @@
 
 #include <deque>
 #include <map>
+#include <condition_variable>
 #include <functional>
+#include <mutex>
 
 class SimulatedTransportAddress : public TransportAddress
 {
@@ -73,6 +75,10 @@ public:
     int Timer(uint64_t ms, timer_callback_t cb);
     bool CancelTimer(int id);
     void CancelAllTimers();
+    void Post(timer_callback_t cb);
+    void Hold();
+    void Release();
+    uint64_t Now();
 
 protected:
     bool SendMessageInternal(TransportReceiver *src,
@@ -111,6 +117,15 @@ private:
     int lastTimerId;
     uint64_t vtime;
     bool processTimers;
+    // Callbacks posted by other threads. They don't take any
+    // simulated time: while there are holds outstanding, the
+    // simulation waits for them before firing any timers.
+    std::mutex postLock;
+    std::condition_variable postCond;
+    std::deque<timer_callback_t> posted;
+    int holds;
+
+    bool RunPosted();
 };
 
 #endif  // _LIB_SIMTRANSPORT_H_
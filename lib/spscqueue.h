@@ -0,0 +1,116 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * spscqueue.h:
+ *   bounded lock-free single-producer single-consumer queue
+ *
+ * Copyright 2013-2016 Dan R. K. Ports  <drkp@cs.washington.edu>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+
+#ifndef _LIB_SPSCQUEUE_H_
+#define _LIB_SPSCQUEUE_H_
+
+#include "lib/assert.h"
+
+#include <atomic>
+#include <stddef.h>
+#include <vector>
+
+/*
+ * A fixed-size ring buffer that one thread pushes into and another
+ * pops from, without locks. Each index is written by only one side:
+ * the producer advances tail after storing an item, and the consumer
+ * advances head after taking one. Capacity is rounded up to a power
+ * of two.
+ */
+template <class T>
+class SPSCQueue
+{
+public:
+    SPSCQueue(size_t capacity)
+        : head(0), tail(0)
+    {
+        ASSERT(capacity > 0);
+        size_t n = 1;
+        while (n < capacity) {
+            n *= 2;
+        }
+        slots.resize(n);
+        mask = n-1;
+    }
+
+    size_t
+    Capacity() const
+    {
+        return slots.size();
+    }
+
+    // Producer only. Returns false if the queue is full.
+    bool
+    Push(const T &item)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == slots.size()) {
+            return false;
+        }
+        slots[t & mask] = item;
+        tail.store(t+1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only. Returns false if the queue is empty.
+    bool
+    Pop(T &item)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = slots[h & mask];
+        head.store(h+1, std::memory_order_release);
+        return true;
+    }
+
+    // Either side; only a hint while the other side is active
+    bool
+    Empty() const
+    {
+        return (head.load(std::memory_order_acquire) ==
+                tail.load(std::memory_order_acquire));
+    }
+
+private:
+    static const size_t CACHE_LINE = 64;
+
+    // Pad the two sides' indexes onto separate cache lines
+    std::atomic<size_t> head;
+    char pad1[CACHE_LINE - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> tail;
+    char pad2[CACHE_LINE - sizeof(std::atomic<size_t>)];
+    std::vector<T> slots;
+    size_t mask;
+};
+
+#endif  /* _LIB_SPSCQUEUE_H_ */
@@ -5,7 +5,8 @@ d := $(dir $(lastword $(MAKEFILE_LIST)))
 #
 GTEST_SRCS += $(addprefix $(d), \
 		configuration-test.cc \
-	        simtransport-test.cc)
+	        simtransport-test.cc \
+		spscqueue-test.cc)
 
 PROTOS += $(d)simtransport-testmessage.proto
 
@@ -16,3 +17,7 @@ TEST_BINS += $(d)configuration-test
 $(d)simtransport-test: $(o)simtransport-test.o $(LIB-simtransport) $(o)simtransport-testmessage.o $(GTEST_MAIN)
 
 TEST_BINS += $(d)simtransport-test
+
+$(d)spscqueue-test: $(o)spscqueue-test.o $(LIB-message) $(GTEST_MAIN)
+
+TEST_BINS += $(d)spscqueue-test
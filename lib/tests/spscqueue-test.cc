@@ -0,0 +1,85 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * spscqueue-test.cc:
+ *   test cases for SPSCQueue
+ *
+ * Copyright 2013-2016 Dan R. K. Ports  <drkp@cs.washington.edu>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+
+#include "lib/spscqueue.h"
+
+#include <gtest/gtest.h>
+#include <thread>
+
+TEST(SPSCQueue, Basic)
+{
+    SPSCQueue<int> q(3);
+    int x;
+
+    EXPECT_EQ(4u, q.Capacity());
+    EXPECT_TRUE(q.Empty());
+    EXPECT_FALSE(q.Pop(x));
+
+    // Go around the ring a few times
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < 4; i++) {
+            EXPECT_TRUE(q.Push(round*4 + i));
+        }
+        EXPECT_FALSE(q.Push(100));
+        EXPECT_FALSE(q.Empty());
+
+        for (int i = 0; i < 4; i++) {
+            ASSERT_TRUE(q.Pop(x));
+            EXPECT_EQ(round*4 + i, x);
+        }
+        EXPECT_TRUE(q.Empty());
+        EXPECT_FALSE(q.Pop(x));
+    }
+}
+
+TEST(SPSCQueue, Threads)
+{
+    const int N = 1000000;
+    SPSCQueue<int> q(64);
+
+    std::thread producer([&]() {
+            for (int i = 0; i < N; i++) {
+                while (!q.Push(i)) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+
+    for (int i = 0; i < N; i++) {
+        int x;
+        while (!q.Pop(x)) {
+            std::this_thread::yield();
+        }
+        ASSERT_EQ(i, x);
+    }
+    producer.join();
+    EXPECT_TRUE(q.Empty());
+}
@@ -31,6 +31,8 @@
 #include "lib/assert.h"
 #include "lib/transport.h"
 
+#include <time.h>
+
 TransportReceiver::~TransportReceiver()
 {
     delete this->myAddress;
@@ -48,6 +50,16 @@ TransportReceiver::GetAddress()
     return *(this->myAddress);
 }
 
+uint64_t
+Transport::Now()
+{
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
+        PPanic("Failed to get CLOCK_MONOTONIC");
+    }
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 Timeout::Timeout(Transport *transport, uint64_t ms, timer_callback_t cb)
     : transport(transport), ms(ms), cb(cb)
 {
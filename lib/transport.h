@@ -72,6 +72,10 @@ public:
     virtual void Register(TransportReceiver *receiver,
                           const specpaxos::Configuration &config,
                           int replicaIdx) = 0;
+    // Stop delivering messages to receiver, e.g. because it is
+    // being destroyed. Only needed by transports that can outlive
+    // their receivers.
+    virtual void Unregister(TransportReceiver *receiver) { }
     virtual bool SendMessage(TransportReceiver *src, const TransportAddress &dst,
                              const Message &m) = 0;
     virtual bool SendMessageToReplica(TransportReceiver *src, int replicaIdx, const Message &m) = 0;
@@ -79,6 +83,18 @@ public:
     virtual int Timer(uint64_t ms, timer_callback_t cb) = 0;
     virtual bool CancelTimer(int id) = 0;
     virtual void CancelAllTimers() = 0;
+    // Run cb on the thread running the transport, as soon as
+    // possible. Unlike everything else here, this may be called from
+    // any thread.
+    virtual void Post(timer_callback_t cb) = 0;
+    // Another thread owes us a Post() until the matching Release().
+    // A simulated transport waits for it rather than moving time
+    // forward; real ones don't need to know.
+    virtual void Hold() { }
+    virtual void Release() { }
+    // Microseconds on a monotonic clock that runs at the same rate
+    // as timers (simulated time, for a simulated transport)
+    virtual uint64_t Now();
 };
 
 class Timeout
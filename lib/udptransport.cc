@@ -222,6 +222,11 @@ UDPTransport::UDPTransport(double dropRate, double reorderRate,
     for (event *x : signalEvents) {
         event_add(x, NULL);
     }
+
+    // Posting from other threads relies on the base being
+    // notifiable, i.e. on evthread_make_base_notifiable above
+    postEvent = event_new(libeventBase, -1, EV_PERSIST,
+                          PostCallback, this);
 }
 
 UDPTransport::~UDPTransport()
@@ -719,6 +724,29 @@ UDPTransport::OnTimer(UDPTransportTimerInfo *info)
     delete info;
 }
 
+void
+UDPTransport::Post(timer_callback_t cb)
+{
+    {
+        std::lock_guard<std::mutex> l(postLock);
+        posted.push_back(cb);
+    }
+    event_active(postEvent, EV_TIMEOUT, 0);
+}
+
+void
+UDPTransport::OnPosted()
+{
+    std::vector<timer_callback_t> cbs;
+    {
+        std::lock_guard<std::mutex> l(postLock);
+        cbs.swap(posted);
+    }
+    for (auto &cb : cbs) {
+        cb();
+    }
+}
+
 void
 UDPTransport::SocketCallback(evutil_socket_t fd, short what, void *arg)
 {
@@ -739,6 +767,13 @@ UDPTransport::TimerCallback(evutil_socket_t fd, short what, void *arg)
     info->transport->OnTimer(info);
 }
 
+void
+UDPTransport::PostCallback(evutil_socket_t fd, short what, void *arg)
+{
+    UDPTransport *transport = (UDPTransport *)arg;
+    transport->OnPosted();
+}
+
 void
 UDPTransport::LogCallback(int severity, const char *msg)
 {
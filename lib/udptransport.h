@@ -40,6 +40,7 @@
 
 #include <map>
 #include <list>
+#include <mutex>
 #include <vector>
 #include <unordered_map>
 #include <random>
@@ -74,6 +75,7 @@ public:
     int Timer(uint64_t ms, timer_callback_t cb);
     bool CancelTimer(int id);
     void CancelAllTimers();
+    void Post(timer_callback_t cb);
     
 private:
     struct UDPTransportTimerInfo
@@ -101,6 +103,10 @@ private:
     event_base *libeventBase;
     std::vector<event *> listenerEvents;
     std::vector<event *> signalEvents;
+    // Activated by other threads to run posted callbacks
+    event *postEvent;
+    std::mutex postLock;
+    std::vector<timer_callback_t> posted;
     std::map<int, TransportReceiver*> receivers; // fd -> receiver
     std::map<TransportReceiver*, int> fds; // receiver -> fd
     std::map<const specpaxos::Configuration *, int> multicastFds;
@@ -129,10 +135,13 @@ private:
                                *canonicalConfig);
     void OnReadable(int fd);
     void OnTimer(UDPTransportTimerInfo *info);
+    void OnPosted();
     static void SocketCallback(evutil_socket_t fd,
                                short what, void *arg);
     static void TimerCallback(evutil_socket_t fd,
                               short what, void *arg);
+    static void PostCallback(evutil_socket_t fd,
+                             short what, void *arg);
     static void LogCallback(int severity, const char *msg);
     static void FatalCallback(int err);
     static void SignalCallback(evutil_socket_t fd,
@@ -1,7 +1,7 @@
 d := $(dir $(lastword $(MAKEFILE_LIST)))
 
 SRCS += $(addprefix $(d), \
-	client.cc txnstore.cc server.cc \
+	client.cc placement.cc txnstore.cc server.cc replica.cc \
 	lockstore.cc lockserver.cc kvstore.cc \
 	benchClient.cc versionedKVStore.cc occstore.cc)
 
@@ -10,16 +10,25 @@ PROTOS += $(addprefix $(d), \
 
 LIB-kvstore := $(o)kvstore.o
 
-LIB-stores := $(o)lockserver.o $(o)versionedKVStore.o
+LIB-stores := $(o)lockserver.o $(o)versionedKVStore.o $(LIB-hash)
 
 OBJS-ni-store := $(o)server.o $(o)txnstore.o $(o)lockstore.o $(o)occstore.o
 
-OBJS-ni-client := $(o)request.o $(o)client.o \
+OBJS-ni-occstore := $(o)occstore.o $(o)txnstore.o $(LIB-stores) $(LIB-message)
+
+OBJS-ni-lockstore := $(o)lockstore.o $(o)txnstore.o $(LIB-kvstore) \
+  $(LIB-stores) $(LIB-message)
+
+LIB-placement := $(o)placement.o $(LIB-hash) $(LIB-message)
+
+OBJS-ni-client := $(o)request.o $(o)client.o $(LIB-placement) \
   $(OBJS-spec-client) $(OBJS-vr-client) $(OBJS-fastpaxos-client) $(LIB-udptransport)
 
 $(d)benchClient: $(OBJS-ni-client) $(o)benchClient.o
 
-$(d)replica: $(o)request.o $(OBJS-ni-store) $(LIB-kvstore) $(LIB-stores) \
+$(d)replica: $(o)replica.o $(o)request.o $(OBJS-ni-store) $(LIB-kvstore) $(LIB-stores) \
 	$(OBJS-spec-replica) $(OBJS-vr-replica) $(OBJS-fastpaxos-replica) $(LIB-udptransport)
 
 BINS += $(d)benchClient $(d)replica
+
+include $(d)tests/Rules.mk
@@ -28,9 +28,16 @@ main(int argc, char **argv)
     int nKeys = 100;
 
     nistore::Proto mode = nistore::PROTO_UNKNOWN;
+    bool locking = false;
+    bool unloggedReads = false;
+    int tsBatch = nistore::Client::DEFAULT_TS_BATCH;
+    bool hlc = false;
+    bool rangePlacement = false;
+    const char *shardMapPath = NULL;
+    const char *newShardMapPath = NULL;
 
     int opt;
-    while ((opt = getopt(argc, argv, "c:d:N:l:w:k:f:m:e:s:")) != -1) {
+    while ((opt = getopt(argc, argv, "c:d:N:l:w:k:f:m:e:s:ub:HP:M:W:")) != -1) {
         switch (opt) {
         case 'c': // Configuration path
         { 
@@ -121,14 +128,67 @@ main(int argc, char **argv)
             break;
         }
 
+        case 'u': // Send GETs unlogged, validating them at commit
+        {
+            unloggedReads = true;
+            break;
+        }
+
+        case 'b': // Timestamps to lease from the tss at once
+        {
+            char *strtolPtr;
+            tsBatch = strtoul(optarg, &strtolPtr, 10);
+            if ((*optarg == '\0') || (*strtolPtr != '\0') || (tsBatch <= 0))
+            {
+                fprintf(stderr,
+                        "option -b requires a numeric arg\n");
+                exit(0);
+            }
+            break;
+        }
+
+        case 'H': // Take timestamps from a hybrid logical clock
+        {
+            hlc = true;
+            break;
+        }
+
+        case 'P': // Key placement [hash/range]
+        {
+            if (strcasecmp(optarg, "hash") == 0) {
+                rangePlacement = false;
+            } else if (strcasecmp(optarg, "range") == 0) {
+                rangePlacement = true;
+            } else {
+                fprintf(stderr, "unknown placement '%s'\n", optarg);
+                exit(0);
+            }
+            break;
+        }
+
+        case 'M': // Shard map to read, for range placement
+        {
+            shardMapPath = optarg;
+            break;
+        }
+
+        case 'W': // Where to write the shard map, with the hottest
+                  // range split, for range placement
+        {
+            newShardMapPath = optarg;
+            break;
+        }
+
         case 'm': // Mode to run in [spec/vr/...]
         {
             if (strcasecmp(optarg, "spec-l") == 0) {
                 mode = nistore::PROTO_SPEC;
+                locking = true;
             } else if (strcasecmp(optarg, "spec-occ") == 0) {
                 mode = nistore::PROTO_SPEC;
             } else if (strcasecmp(optarg, "vr-l") == 0) {
                 mode = nistore::PROTO_VR;
+                locking = true;
             } else if (strcasecmp(optarg, "vr-occ") == 0) {
                 mode = nistore::PROTO_VR;
             } else if (strcasecmp(optarg, "fast-occ") == 0) {
@@ -149,7 +209,10 @@ main(int argc, char **argv)
         exit(0);
     }
 
-    nistore::Client client(mode, configPath, nShards);
+    if (unloggedReads && locking) {
+        fprintf(stderr, "option -u requires an OCC mode\n");
+        exit(0);
+    }
 
     // Read in the keys from a file and populate the key-value store.
     ifstream in;
@@ -164,6 +227,31 @@ main(int argc, char **argv)
     }
     in.close();
 
+    if ((shardMapPath || newShardMapPath) && !rangePlacement) {
+        fprintf(stderr, "options -M and -W require -P range\n");
+        exit(0);
+    }
+
+    // Without a shard map, give each shard an even share of the keys.
+    nistore::Placement *placement;
+    nistore::RangePlacement *ranges = NULL;
+    if (!rangePlacement) {
+        placement = new nistore::HashPlacement(nShards);
+    } else if (shardMapPath) {
+        ifstream mapStream(shardMapPath);
+        if (!mapStream) {
+            fprintf(stderr, "Could not read shard map from: %s\n",
+                    shardMapPath);
+            exit(0);
+        }
+        placement = ranges = new nistore::RangePlacement(nShards, mapStream);
+    } else {
+        placement = ranges = new nistore::RangePlacement(nShards, keys);
+    }
+
+    nistore::Client client(mode, configPath, nShards, unloggedReads,
+                           tsBatch, hlc, placement);
+
     
     struct timeval t0, t1, t2, t3, t4;
 
@@ -178,6 +266,8 @@ main(int argc, char **argv)
     double beginLatency = 0.0;
     int commitCount = 0;
     double commitLatency = 0.0;
+    vector<uint64_t> shardLoad(nShards, 0); // Operations on each shard.
+    map<string, uint64_t> keyLoad; // Operations on each key.
 
     gettimeofday(&t0, NULL);
     srand(t0.tv_sec + t0.tv_usec);
@@ -201,6 +291,9 @@ main(int argc, char **argv)
             key = keys[r];
             */
 
+            shardLoad[placement->KeyToShard(key)]++;
+            keyLoad[key]++;
+
             if (rand() % 100 < wPer) {
                 //value = random_string();
                 gettimeofday(&t3, NULL);
@@ -248,6 +341,24 @@ main(int argc, char **argv)
     printf("# Get: %d, %lf\n", getCount, getLatency/getCount);
     printf("# Put: %d, %lf\n", putCount, putLatency/putCount);
     printf("# Commit: %d, %lf\n", commitCount, commitLatency/commitCount);
+
+    // Skew is the busiest shard's load over the mean shard load.
+    uint64_t totalLoad = 0, maxLoad = 0;
+    for (int i = 0; i < nShards; i++) {
+        printf("# Shard_Load: %d, %" PRIu64 "\n", i, shardLoad[i]);
+        totalLoad += shardLoad[i];
+        maxLoad = max(maxLoad, shardLoad[i]);
+    }
+    printf("# Load_Skew: %lf\n",
+           totalLoad ? (double)maxLoad * nShards / totalLoad : 1.0);
+
+    if (newShardMapPath) {
+        if (!ranges->SplitHottest(keyLoad)) {
+            fprintf(stderr, "No range worth splitting\n");
+        }
+        ofstream mapStream(newShardMapPath);
+        ranges->Write(mapStream);
+    }
     
     exit(0);
     return 0;
@@ -9,11 +9,21 @@
 
 #include "nistore/client.h"
 
+#include <future>
+#include <memory>
+
 namespace nistore {
 
-Client::Client(Proto mode, string configPath, int nShards)
-    : transport(0.0, 0.0, 0)
+Client::Client(Proto mode, string configPath, int nShards,
+               bool unloggedReads, unsigned int tsBatch, bool hlc,
+               const Placement *shardPlacement)
+    : unlogged_reads(unloggedReads), placement(shardPlacement),
+      own_placement(false), ts_batch(tsBatch), use_hlc(hlc),
+      transport(0.0, 0.0, 0), ts_next(0), ts_end(0), ts_requested(false),
+      hlc_last(0), hlc_unsynced(0)
 {
+    ASSERT(ts_batch > 0);
+
     // Initialize all state here;
     struct timeval t1;
     gettimeofday(&t1, NULL);
@@ -21,8 +31,15 @@ Client::Client(Proto mode, string configPath, int nShards)
     client_id = rand();
 
     nshards = nShards;
+    if (placement == NULL) {
+        placement = new HashPlacement(nshards);
+        own_placement = true;
+    }
+    ASSERT(placement->NumShards() == nshards);
     shard.reserve(nshards);
-    op_pending = false;
+    unlogged_queue.resize(nshards);
+    last_txn = 0;
+    current_txn = 0;
 
     Debug("Initializing NiStore client with id [%lu]", client_id);
 
@@ -36,6 +53,7 @@ Client::Client(Proto mode, string configPath, int nShards)
     }
     specpaxos::Configuration tssConfig(tssConfigStream);
     tss = new specpaxos::vr::VRClient(tssConfig, &transport);
+    tss->SetWindow(SHARD_WINDOW);
     /*
     switch (mode) {
         case PROTO_VR:
@@ -61,20 +79,23 @@ Client::Client(Proto mode, string configPath, int nShards)
             exit(0);
         }
         specpaxos::Configuration shardConfig(shardConfigStream);
+        // Spread unlogged reads over the replicas.
+        read_replica.push_back(rand() % shardConfig.n);
 
         switch (mode) {
             case PROTO_VR:
-                shard[i] = new specpaxos::vr::VRClient(shardConfig, &transport);
+                shard.push_back(new specpaxos::vr::VRClient(shardConfig, &transport));
                 break;
             case PROTO_SPEC:
-                shard[i] = new specpaxos::spec::SpecClient(shardConfig, &transport);
+                shard.push_back(new specpaxos::spec::SpecClient(shardConfig, &transport));
                 break;
             case PROTO_FAST:
-                shard[i] = new specpaxos::fastpaxos::FastPaxosClient(shardConfig, &transport);
+                shard.push_back(new specpaxos::fastpaxos::FastPaxosClient(shardConfig, &transport));
                 break;
             default:
                 NOT_REACHABLE();
         }
+        shard[i]->SetWindow(SHARD_WINDOW);
     }
 
     /* Run the transport in a new thread. */
@@ -86,6 +107,9 @@ Client::Client(Proto mode, string configPath, int nShards)
 Client::~Client()
 {
     // TODO: Consider killing transport and associated thread.
+    if (own_placement) {
+        delete placement;
+    }
 }
 
 /* Runs the transport event loop. */
@@ -95,377 +119,633 @@ Client::run_client()
     transport.Run();
 }
 
-/* Sends BEGIN to a single shard indexed by i. */
+Client::Transaction &
+Client::getTxn(uint64_t txnid)
+{
+    auto it = txns.find(txnid);
+    if (it == txns.end()) {
+        Panic("Unknown transaction %" PRIu64, txnid);
+    }
+    return it->second;
+}
+
+/* Begins a transaction and returns its ID. All operations passed that
+ * ID before a commit or abort are part of this transaction. */
+uint64_t
+Client::BeginAsync()
+{
+    // Transaction IDs are unique across clients, so a shard can
+    // tell concurrent transactions from the same client apart.
+    uint64_t txnid = ((uint64_t)client_id << 32) | ++last_txn;
+    Debug("BEGIN Transaction %" PRIu64, txnid);
+
+    transport.Post([=]() {
+        Transaction &txn = txns[txnid];
+        txn.id = txnid;
+    });
+    return txnid;
+}
+
+/* Reads the value corresponding to the supplied key. */
 void
-Client::send_begin(unsigned int i)
+Client::GetAsync(uint64_t txnid, const string &key, get_callback_t cb)
 {
-    Debug("[shard %d] Sending BEGIN", i);
-    string request_str;
-    Request request;
-    request.set_op(Request::BEGIN);
-    request.set_txnid(client_id);
-    request.SerializeToString(&request_str);
+    transport.Post([=]() {
+        Transaction &txn = getTxn(txnid);
+        int i = key_to_shard(key);
+
+        // Read your own writes out of the write buffer.
+        auto w = txn.write_set.find(i);
+        if (w != txn.write_set.end()) {
+            auto kv = w->second.find(key);
+            if (kv != w->second.end()) {
+                cb(true, kv->second);
+                return;
+            }
+        }
 
-    transport.Timer(0, [=]() {
-        shard[i]->Invoke(request_str, 
-                         bind(&Client::beginCallback,
-                              this, i,
-                              placeholders::_1,
-                              placeholders::_2));
+        txn.participants.insert(i);
+
+        if (unlogged_reads) {
+            // Repeat earlier reads rather than seeing a newer
+            // version, which would fail validation anyway.
+            auto r = txn.read_set.find(i);
+            if (r != txn.read_set.end()) {
+                auto kv = r->second.find(key);
+                if (kv != r->second.end()) {
+                    cb(true, kv->second.second);
+                    return;
+                }
+            }
+
+            if (!txn.reading[i].insert(key).second) {
+                for (auto &read : unlogged_queue[i]) {
+                    if ((read.txnid == txnid) && (read.key == key)) {
+                        read.cbs.push_back(cb);
+                        return;
+                    }
+                }
+                NOT_REACHABLE();
+            }
+
+            UnloggedRead read;
+            read.txnid = txnid;
+            read.key = key;
+            read.cbs.push_back(cb);
+            unlogged_queue[i].push_back(read);
+            if (unlogged_queue[i].size() == 1) {
+                send_unlogged_get(i);
+            }
+            return;
+        }
+
+        txn.logged.insert(i);
+        send_get(txn, i, key, cb);
     });
 }
-  
 
-/* Begins a transaction. All subsequent operations before a commit() or
- * abort() are part of this transaction.
- *
- * Return a TID for the transaction.
- */
+/* Reads several keys at once, sending the reads for all of them
+ * before waiting for any. */
 void
-Client::Begin()
+Client::MultiGetAsync(uint64_t txnid, const vector<string> &keys,
+                      multiget_callback_t cb)
+{
+    struct State {
+        size_t outstanding;
+        bool ok;
+        map<string, string> values;
+    };
+    auto state = make_shared<State>();
+    state->outstanding = keys.size();
+    state->ok = true;
+
+    if (keys.empty()) {
+        transport.Post([=]() { cb(true, state->values); });
+        return;
+    }
+
+    for (const string &key : keys) {
+        GetAsync(txnid, key, [=](bool ok, const string &value) {
+                if (ok) {
+                    state->values[key] = value;
+                } else {
+                    state->ok = false;
+                }
+                if (--state->outstanding == 0) {
+                    cb(state->ok, state->values);
+                }
+            });
+    }
+}
+
+/* Sets the value corresponding to the supplied key. The write is
+ * buffered locally and sent to the shard along with PREPARE. */
+void
+Client::PutAsync(uint64_t txnid, const string &key, const string &value)
+{
+    transport.Post([=]() {
+        Transaction &txn = getTxn(txnid);
+        int i = key_to_shard(key);
+
+        Debug("[shard %d] Buffering PUT [%s]", i, key.c_str());
+        txn.participants.insert(i);
+        txn.write_set[i][key] = value;
+    });
+}
+
+/* Attempts to commit the transaction. */
+void
+Client::CommitAsync(uint64_t txnid, commit_callback_t cb)
+{
+    transport.Post([=]() {
+        Transaction &txn = getTxn(txnid);
+        txn.commit_cb = cb;
+
+        if (txn.participants.empty()) {
+            // Nothing to commit
+            finish(txnid, true);
+            return;
+        }
+
+        if (txn.participants.size() == 1) {
+            // No need for 2 Phase Commit
+            send_prepare_commit(txn);
+        } else {
+            send_prepare(txn);
+        }
+    });
+}
+
+/* Aborts the transaction. */
+void
+Client::AbortAsync(uint64_t txnid, abort_callback_t cb)
 {
-    // Initialize all transaction variables.
-    Debug("BEGIN Transaction");
-    op_pending = true;
-    all_participants.clear();
-    yes_participants.clear();
+    transport.Post([=]() {
+        Transaction &txn = getTxn(txnid);
+        ASSERT(!txn.preparing);
+        txn.abort_cb = cb;
+
+        // Only shards we sent logged operations to know about the
+        // transaction.
+        send_abort(txn, txn.logged);
+    });
+}
 
-    // Nothing else to do, return.
+/* Blocking API */
+
+void
+Client::Begin()
+{
+    current_txn = BeginAsync();
 }
 
-/* Returns the value corresponding to the supplied key. */
 bool
 Client::Get(const string &key, string &value)
 {
-    // Contact the appropriate shard to get the value.
-    unique_lock<mutex> lk(cv_m);
+    auto p = make_shared<promise<pair<bool, string> > >();
+    future<pair<bool, string> > f = p->get_future();
+    GetAsync(current_txn, key, [p](bool ok, const string &v) {
+            p->set_value(make_pair(ok, v));
+        });
+
+    pair<bool, string> r = f.get();
+    value = r.second;
+    return r.first;
+}
 
-    int i = key_to_shard(key);
+bool
+Client::MultiGet(const vector<string> &keys, map<string, string> &values)
+{
+    auto p = make_shared<promise<pair<bool, map<string, string> > > >();
+    future<pair<bool, map<string, string> > > f = p->get_future();
+    MultiGetAsync(current_txn, keys,
+                  [p](bool ok, const map<string, string> &v) {
+            p->set_value(make_pair(ok, v));
+        });
+
+    pair<bool, map<string, string> > r = f.get();
+    values = std::move(r.second);
+    return r.first;
+}
+
+void
+Client::Put(const string &key, const string &value)
+{
+    PutAsync(current_txn, key, value);
+}
 
-    // If needed, add this shard to set of participants and send BEGIN.
-    if (all_participants.find(i) == all_participants.end()) {
-        all_participants.insert(i);
-        send_begin(i);
+bool
+Client::Commit()
+{
+    auto p = make_shared<promise<bool> >();
+    future<bool> f = p->get_future();
+    CommitAsync(current_txn, [p](bool committed) {
+            p->set_value(committed);
+        });
+    return f.get();
+}
 
-        // Wait for reply from the shard.
-        Debug("[shard %d] Waiting for BEGIN reply", i);
-        cv.wait(lk);
-        Debug("[shard %d] BEGIN reply received", i);
-    }
+void
+Client::Abort()
+{
+    auto p = make_shared<promise<void> >();
+    future<void> f = p->get_future();
+    AbortAsync(current_txn, [p]() { p->set_value(); });
+    f.get();
+}
 
-    // Send the GET operation to appropriate shard.
+/* Sends a logged GET to shard i. */
+void
+Client::send_get(Transaction &txn, int i, const string &key,
+                 get_callback_t cb)
+{
     Debug("[shard %d] Sending GET [%s]", i, key.c_str());
     string request_str;
     Request request;
     request.set_op(Request::GET);
-    request.set_txnid(client_id);
+    request.set_txnid(txn.id);
     request.set_arg0(key);
     request.SerializeToString(&request_str);
 
-    transport.Timer(0, [=]() {
-        shard[i]->Invoke(request_str,
-                          bind(&Client::getCallback,
-                          this, i,
+    shard[i]->Invoke(request_str,
+                     bind(&Client::getCallback,
+                          this, txn.id, i, cb,
                           placeholders::_1,
                           placeholders::_2));
-    });
-
-    // Wait for reply from shard.
-    Debug("[shard %d] Waiting for GET reply", i);
-    cv.wait(lk);
-    Debug("[shard %d] GET reply received", i);
-
-    // Reply from shard should be available in "replica_reply".
-    value = replica_reply;
-    return status;
 }
 
-/* Sets the value corresponding to the supplied key. */
+/* Sends the unlogged GET at the head of shard i's queue. */
 void
-Client::Put(const string &key, const string &value)
+Client::send_unlogged_get(int i)
 {
-    // Contact the appropriate shard to set the value.
-    unique_lock<mutex> lk(cv_m);
-
-    int i = key_to_shard(key);
-
-    // If needed, add this shard to set of participants and send BEGIN.
-    if (all_participants.find(i) == all_participants.end()) {
-        all_participants.insert(i);
-        send_begin(i);
+    ASSERT(!unlogged_queue[i].empty());
+    UnloggedRead &read = unlogged_queue[i].front();
 
-        // Wait for reply from the shard.
-        Debug("[shard %d] Waiting for BEGIN reply", i);
-        cv.wait(lk);
-        Debug("[shard %d] BEGIN reply received", i);
-    }
-
-    Debug("[shard %d] Sending PUT [%s]", i, key.c_str());
+    Debug("[shard %d] Sending unlogged GET [%s]", i, read.key.c_str());
     string request_str;
     Request request;
-    request.set_op(Request::PUT);
-    request.set_txnid(client_id);
-    request.set_arg0(key);
-    request.set_arg1(value);
+    request.set_op(Request::GET);
+    request.set_txnid(read.txnid);
+    request.set_arg0(read.key);
     request.SerializeToString(&request_str);
 
-    transport.Timer(0, [=]() {
-        shard[i]->Invoke(request_str,
-                          bind(&Client::putCallback,
-                          this, i,
-                          placeholders::_1,
-                          placeholders::_2));
-    });
+    shard[i]->InvokeUnlogged(read_replica[i], request_str,
+                             bind(&Client::unloggedGetCallback,
+                                  this, i,
+                                  placeholders::_1,
+                                  placeholders::_2),
+                             bind(&Client::unloggedGetTimeout,
+                                  this, i,
+                                  placeholders::_1));
+}
 
-    // Wait for reply from shard.
-    Debug("[shard %d] Waiting for PUT reply", i);
-    cv.wait(lk);
-    Debug("[shard %d] PUT reply received", i);
+/* Builds a PREPARE or PREPARE_COMMIT request for shard i, with the
+ * transaction's buffered writes and the versions it read there. */
+void
+Client::build_prepare(Transaction &txn, int i, Request::Operation op,
+                      string &request_str)
+{
+    Request request;
+    request.set_op(op);
+    request.set_txnid(txn.id);
+    for (auto &kv : txn.write_set[i]) {
+        Request::Write *w = request.add_writes();
+        w->set_key(kv.first);
+        w->set_value(kv.second);
+    }
+    for (auto &kv : txn.read_set[i]) {
+        Request::Read *r = request.add_reads();
+        r->set_key(kv.first);
+        r->set_timestamp(kv.second.first);
+    }
+    request.SerializeToString(&request_str);
 
-    // PUT operation should have suceeded. Return.
+    Debug("[shard %d] Sending prepare with %d reads, %d writes",
+          i, request.reads_size(), request.writes_size());
 }
 
-/* Attempts to commit the ongoing transaction. */
-bool
-Client::Commit()
+/* Implementing 2 Phase Commit: sends PREPARE to every participant,
+ * and asks the tss for a timestamp at the same time. */
+void
+Client::send_prepare(Transaction &txn)
 {
-    // Implementing 2 Phase Commit
-
-    // 1. Send commit-prepare to all shards.
-    {
-        unique_lock<mutex> lk(cv_m);
+    Debug("PREPARE Transaction %" PRIu64, txn.id);
+    txn.preparing = true;
+    txn.status = true;
+    txn.outstanding = txn.participants.size();
 
-        Debug("PREPARE Transaction");
+    for (int i : txn.participants) {
         string request_str;
-        Request request;
-        request.set_op(Request::PREPARE);
-        request.set_txnid(client_id);
-        request.SerializeToString(&request_str);
-        
-        nreplies = 0;
-        status = true;
-
-        for (set<int>::iterator it = all_participants.begin(); 
-              it != all_participants.end(); it++) {
-            Debug("[shard %d] Sending prepare", *it);
-            transport.Timer(0, [=]() {
-                shard[*it]->Invoke(request_str,
-                                    bind(&Client::prepareCallback,
-                                    this, *it,
-                                    placeholders::_1,
-                                    placeholders::_2));
-            });
+        build_prepare(txn, i, Request::PREPARE, request_str);
+        shard[i]->Invoke(request_str,
+                         bind(&Client::prepareCallback,
+                              this, txn.id, i,
+                              placeholders::_1,
+                              placeholders::_2));
+    }
+
+    // Each shard votes with the earliest timestamp it can commit at,
+    // and the transaction commits everywhere at the latest of those
+    // and its own, so the timestamp doesn't have to wait for the
+    // votes.
+    get_timestamp(txn);
+}
+
+/* Gives the transaction a commit timestamp, now if one is at hand,
+ * or else once the tss leases more. */
+void
+Client::get_timestamp(Transaction &txn)
+{
+    if (use_hlc) {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        observe_timestamp(now.tv_sec * 1000000ULL + now.tv_usec);
+        txn.have_ts = true;
+        txn.timestamp = ++hlc_last;
+        if (++hlc_unsynced >= ts_batch) {
+            request_timestamps();
         }
+        return;
+    }
 
-        // 2. Wait for reply from all shards. (abort on timeout)
-        Debug("Waiting for PREPARE replies");
-        cv.wait(lk);
-        Debug("All PREPARE replies received");
+    if (ts_waiting.empty() && (ts_next < ts_end)) {
+        txn.have_ts = true;
+        txn.timestamp = ts_next++;
+        return;
     }
+    ts_waiting.push_back(txn.id);
+    request_timestamps();
+}
 
-    // 3. If all votes YES, send commit to all shards.
-    if (nreplies == all_participants.size() && status == true) {
-        // Get a timestamp from the tss
-        {
-            unique_lock<mutex> lk(cv_m);
+/* Asks the tss for a range of timestamps, or, with a hybrid logical
+ * clock, to sync the clock. Only one request is outstanding at once. */
+void
+Client::request_timestamps()
+{
+    if (ts_requested) {
+        return;
+    }
+    ts_requested = true;
 
-            Debug("Sending request to TSS");
-            transport.Timer(0, [=]() {
-                tss->Invoke("", bind(&Client::tssCallback, this,
-                                      placeholders::_1,
-                                      placeholders::_2));
-            });
+    string request;
+    if (use_hlc) {
+        hlc_unsynced = 0;
+        request = "1 " + to_string(hlc_last);
+    } else {
+        uint64_t count = max((uint64_t)ts_batch, (uint64_t)ts_waiting.size());
+        request = to_string(count);
+    }
 
-            Debug("Waiting for TSS reply");
-            cv.wait(lk);
-            Debug("TSS reply received");
-        }
-        long ts = stol(replica_reply, NULL, 10);
-
-        // Send Commit to all shards
-        {
-            unique_lock<mutex> lk(cv_m);
-
-            Debug("COMMIT Transaction");
-            string request_str;
-            Request request;
-            request.set_op(Request::COMMIT);
-            request.set_txnid(client_id);
-            request.set_arg0(to_string(ts));
-            request.SerializeToString(&request_str);
-
-            nreplies = 0;
-            for (set<int>::iterator it = all_participants.begin(); 
-                  it != all_participants.end(); it++) {
-                Debug("[shard %d] Sending commit", *it);
-                transport.Timer(0, [=]() {
-                    shard[*it]->Invoke(request_str,
-                                        bind(&Client::commitCallback,
-                                        this, *it,
-                                        placeholders::_1,
-                                        placeholders::_2));
-                });
-            }
+    Debug("Sending request to TSS [%s]", request.c_str());
+    tss->Invoke(request, bind(&Client::tssCallback, this,
+                              placeholders::_1,
+                              placeholders::_2));
+}
 
-            // Wait for commit to succeed.
-            Debug("Waiting for COMMIT replies");
-            cv.wait(lk);
-            Debug("All COMMIT replies received");
-        }
-        return true;
+/* Moves the hybrid logical clock past a timestamp seen elsewhere. */
+void
+Client::observe_timestamp(uint64_t ts)
+{
+    if (ts > hlc_last) {
+        hlc_last = ts;
     }
-
-    // 4. If not, send abort to all shards.
-    Abort();
-    return false;
 }
 
-/* Aborts the ongoing transaction. */
+/* Commits a transaction with a single participant in one round,
+ * letting the shard pick the timestamp. */
 void
-Client::Abort()
+Client::send_prepare_commit(Transaction &txn)
 {
-    // Send abort to all shards.
-    unique_lock<mutex> lk(cv_m);
+    ASSERT(txn.participants.size() == 1);
+    int i = *txn.participants.begin();
+
+    Debug("PREPARE AND COMMIT Transaction %" PRIu64, txn.id);
+    txn.preparing = true;
 
-    Debug("ABORT Transaction");
+    string request_str;
+    build_prepare(txn, i, Request::PREPARE_COMMIT, request_str);
+    shard[i]->Invoke(request_str,
+                     bind(&Client::prepareCommitCallback,
+                          this, txn.id, i,
+                          placeholders::_1,
+                          placeholders::_2));
+}
+
+/* Sends COMMIT at timestamp ts to every participant. */
+void
+Client::send_commit(Transaction &txn, uint64_t ts)
+{
+    Debug("COMMIT Transaction %" PRIu64, txn.id);
     string request_str;
     Request request;
-    request.set_op(Request::ABORT);
-    request.set_txnid(client_id);
+    request.set_op(Request::COMMIT);
+    request.set_txnid(txn.id);
+    request.set_arg0(to_string(ts));
     request.SerializeToString(&request_str);
 
-    nreplies = 0;
-    int aborts_sent = 0;
-    for (set<int>::iterator it = all_participants.begin(); 
-          it != all_participants.end(); it++) {
-        if (yes_participants.find(*it) != yes_participants.end()) {
-            aborts_sent++;
-            Debug("[shard %d] Sending abort", *it);
-            transport.Timer(0, [=]() {
-                shard[*it]->Invoke(request_str,
-                                    bind(&Client::abortCallback,
-                                    this, *it,
-                                    placeholders::_1,
-                                    placeholders::_2));
-            });
-        }
+    txn.outstanding = txn.participants.size();
+    for (int i : txn.participants) {
+        Debug("[shard %d] Sending commit", i);
+        shard[i]->Invoke(request_str,
+                         bind(&Client::commitCallback,
+                              this, txn.id, i,
+                              placeholders::_1,
+                              placeholders::_2));
     }
+}
 
-    if (aborts_sent == 0)
+/* Sends ABORT to the targets, finishing the transaction once they
+ * have all replied. */
+void
+Client::send_abort(Transaction &txn, const set<int> &targets)
+{
+    Debug("ABORT Transaction %" PRIu64, txn.id);
+    if (targets.empty()) {
+        finish(txn.id, false);
         return;
+    }
 
-    // Wait for reply from shard.
-    Debug("Waiting for ABORT replies");
-    cv.wait(lk);
-    Debug("All ABORT replies received");
+    string request_str;
+    Request request;
+    request.set_op(Request::ABORT);
+    request.set_txnid(txn.id);
+    request.SerializeToString(&request_str);
+
+    txn.outstanding = targets.size();
+    for (int i : targets) {
+        Debug("[shard %d] Sending abort", i);
+        shard[i]->Invoke(request_str,
+                         bind(&Client::abortCallback,
+                              this, txn.id, i,
+                              placeholders::_1,
+                              placeholders::_2));
+    }
 }
 
-/* Callback from a shard replica on begin operation completion. */
+/* Forget the transaction and tell the caller how it ended. */
 void
-Client::beginCallback(const int index, const string &request_str, const string &reply_str)
+Client::finish(uint64_t txnid, bool committed)
 {
-    // BEGIN always returns success, so no need to check reply.
-    lock_guard<mutex> lock(cv_m);
-    Debug("[shard %d] BEGIN callback", index);
-
-    cv.notify_all();
+    auto it = txns.find(txnid);
+    ASSERT(it != txns.end());
+    commit_callback_t commit_cb = std::move(it->second.commit_cb);
+    abort_callback_t abort_cb = std::move(it->second.abort_cb);
+    txns.erase(it);
+
+    if (commit_cb) {
+        commit_cb(committed);
+    } else if (abort_cb) {
+        abort_cb();
+    }
 }
 
 /* Callback from a shard replica on get operation completion. */
 void
-Client::getCallback(const int index, const string &request_str, const string &reply_str)
+Client::getCallback(uint64_t txnid, int index, get_callback_t cb,
+                    const string &request_str, const string &reply_str)
 {
-    lock_guard<mutex> lock(cv_m);
-
-    // Copy reply to "replica_reply".
     Reply reply;
     reply.ParseFromString(reply_str);
     Debug("[shard %d] GET callback [%d]", index, reply.status());
 
-    if (reply.status() >= 0) {
-        status = true;
-        replica_reply = reply.value();
-    } else {
-        status = false;
-    }
-    
-    // Wake up thread waiting for the reply.
-    cv.notify_all();
+    cb(reply.status() >= 0, reply.value());
 }
 
-/* Callback from a shard replica on put operation completion. */
+/* Callback from a shard replica on unlogged get completion. */
 void
-Client::putCallback(const int index, const string &request_str, const string &reply_str)
+Client::unloggedGetCallback(int index, const string &request_str,
+                            const string &reply_str)
 {
-    lock_guard<mutex> lock(cv_m);
+    UnloggedRead read = std::move(unlogged_queue[index].front());
+    unlogged_queue[index].pop_front();
+    if (!unlogged_queue[index].empty()) {
+        send_unlogged_get(index);
+    }
 
-    // PUTs always returns success, so no need to check reply.
     Reply reply;
     reply.ParseFromString(reply_str);
-    Debug("[shard %d] PUT callback [%d]", index, reply.status());
+    Debug("[shard %d] Unlogged GET callback [%d]", index, reply.status());
+
+    bool ok = (reply.status() >= 0);
+    auto it = txns.find(read.txnid);
+    if (it != txns.end()) {
+        it->second.reading[index].erase(read.key);
+        if (ok) {
+            // Remember the version so the shard can validate it.
+            it->second.read_set[index][read.key] =
+                make_pair(reply.timestamp(), reply.value());
+            observe_timestamp(reply.timestamp());
+        }
+    }
+    for (auto &cb : read.cbs) {
+        cb(ok, reply.value());
+    }
+}
 
-    // Wake up thread waiting for the reply.
-    cv.notify_all();
+/* The replica didn't answer an unlogged get; treat it as a failed
+ * read. */
+void
+Client::unloggedGetTimeout(int index, const string &request_str)
+{
+    Warning("[shard %d] Unlogged GET timed out", index);
+
+    UnloggedRead read = std::move(unlogged_queue[index].front());
+    unlogged_queue[index].pop_front();
+    if (!unlogged_queue[index].empty()) {
+        send_unlogged_get(index);
+    }
+
+    auto it = txns.find(read.txnid);
+    if (it != txns.end()) {
+        it->second.reading[index].erase(read.key);
+    }
+    for (auto &cb : read.cbs) {
+        cb(false, "");
+    }
 }
 
 /* Callback from a shard replica on prepare operation completion. */
 void
-Client::prepareCallback(const int index, const string &request_str, const string &reply_str)
+Client::prepareCallback(uint64_t txnid, int index,
+                        const string &request_str, const string &reply_str)
 {
-    lock_guard<mutex> lock(cv_m);
-    Debug("[shard %d] PREPARE callback str: %s", index, reply_str.c_str());
+    Transaction &txn = getTxn(txnid);
 
     Reply reply;
     reply.ParseFromString(reply_str);
     Debug("[shard %d] PREPARE callback [%d]", index, reply.status());
 
-    // If "NO" vote, set commit decision = false, and wake up the
-    // prepare call waiting for replies.
+    // If "NO" vote, set commit decision = false.
     if (reply.status() < 0) {
-        status = false;
+        txn.status = false;
     } else {
-        yes_participants.insert(index);
+        txn.yes_participants.insert(index);
+        txn.min_ts = max(txn.min_ts, reply.timestamp());
+        observe_timestamp(reply.timestamp());
     }
 
-    // Increment number of replies. If nreplies == nshards, all replies
-    // have been received, so wake up the prepare call.
-    nreplies++;
-    if (nreplies == all_participants.size()) {
-        cv.notify_all();
+    if (--txn.outstanding > 0) {
+        return;
+    }
+
+    if (txn.status) {
+        // All votes YES: commit, once we have a timestamp.
+        if (txn.have_ts) {
+            send_commit(txn, max(txn.timestamp, txn.min_ts));
+        }
+    } else {
+        // Otherwise, abort at the shards that prepared; the others
+        // already aborted.
+        send_abort(txn, txn.yes_participants);
     }
 }
 
-/* Callback from a shard replica on commit operation completion. */
+/* Callback from a shard replica on prepare-and-commit completion. A
+ * shard that can't prepare aborts the transaction itself. */
 void
-Client::commitCallback(const int index, const string &request_str, const string &reply_str)
+Client::prepareCommitCallback(uint64_t txnid, int index,
+                              const string &request_str,
+                              const string &reply_str)
 {
-    lock_guard<mutex> lock(cv_m);
+    Reply reply;
+    reply.ParseFromString(reply_str);
+    Debug("[shard %d] PREPARE_COMMIT callback [%d]", index, reply.status());
+    if (reply.has_timestamp()) {
+        observe_timestamp(reply.timestamp());
+    }
 
+    finish(txnid, reply.status() >= 0);
+}
+
+/* Callback from a shard replica on commit operation completion. */
+void
+Client::commitCallback(uint64_t txnid, int index,
+                       const string &request_str, const string &reply_str)
+{
     // COMMITs always succeed.
     Reply reply;
     reply.ParseFromString(reply_str);
     Debug("[shard %d] COMMIT callback [%d]", index, reply.status());
 
-    nreplies++;
-    if (nreplies == all_participants.size()) {
-        cv.notify_all();
+    Transaction &txn = getTxn(txnid);
+    if (--txn.outstanding == 0) {
+        finish(txnid, true);
     }
 }
 
 /* Callback from a shard replica on abort operation completion. */
 void
-Client::abortCallback(const int index, const string &request_str, const string &reply_str)
+Client::abortCallback(uint64_t txnid, int index,
+                      const string &request_str, const string &reply_str)
 {
-    lock_guard<mutex> lock(cv_m);
-
     // ABORTs always succeed.
     Reply reply;
     reply.ParseFromString(reply_str);
     Debug("[shard %d] ABORT callback [%d]", index, reply.status());
 
-    nreplies++;
-    if (nreplies == yes_participants.size()) {
-        cv.notify_all();
+    Transaction &txn = getTxn(txnid);
+    if (--txn.outstanding == 0) {
+        finish(txnid, false);
     }
 }
 
@@ -473,27 +753,47 @@ Client::abortCallback(const int index, const string &request_str, const string &
 void
 Client::tssCallback(const string &request, const string &reply)
 {
-    lock_guard<mutex> lock(cv_m);
     Debug("TSS callback [%s]", reply.c_str());
+    ts_requested = false;
 
-    // Copy reply to "replica_reply".
-    replica_reply = reply;
-    
-    // Wake up thread waiting for the reply.
-    cv.notify_all();
+    uint64_t first = stoull(reply, NULL, 10);
+    if (use_hlc) {
+        observe_timestamp(first);
+        return;
+    }
+
+    ts_next = first;
+    ts_end = first + stoull(request, NULL, 10);
+
+    while (!ts_waiting.empty() && (ts_next < ts_end)) {
+        uint64_t txnid = ts_waiting.front();
+        ts_waiting.pop_front();
+
+        auto it = txns.find(txnid);
+        if (it == txns.end()) {
+            // Some shard voted NO, and the transaction is already over.
+            continue;
+        }
+
+        Transaction &txn = it->second;
+        txn.have_ts = true;
+        txn.timestamp = ts_next++;
+        if ((txn.outstanding == 0) && txn.status) {
+            // Every shard has voted YES.
+            send_commit(txn, max(txn.timestamp, txn.min_ts));
+        }
+    }
+
+    if (!ts_waiting.empty()) {
+        request_timestamps();
+    }
 }
 
 /* Takes a key and returns which shard the key is stored in. */
-long
+int
 Client::key_to_shard(const string &key)
 {
-    unsigned long hash = 0;
-    const char* str = key.c_str();
-    for (unsigned int i = 0; i < key.length(); i++) {
-        hash = hash << 1 ^ str[i];
-    }
-
-    return (hash % nshards);
+    return placement->KeyToShard(key);
 }
 
 } // namespace nistore
@@ -18,15 +18,20 @@
 #include "spec/client.h"
 #include "vr/client.h"
 #include "fastpaxos/client.h"
+#include "nistore/placement.h"
 #include "nistore/request.pb.h"
 
 #include <iostream>
 #include <cstdlib>
 #include <string>
-#include <mutex>
-#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <functional>
 #include <thread>
 #include <set>
+#include <map>
+#include <unordered_map>
+#include <vector>
 
 namespace nistore {
 
@@ -42,54 +47,156 @@ enum Proto {
 class Client
 {
 public:
-    /* Constructor needs path to shard configs and number of shards. */
-    Client(Proto mode, string configPath, int nshards);
+    typedef function<void (bool, const string &)> get_callback_t;
+    typedef function<void (bool, const map<string, string> &)> multiget_callback_t;
+    typedef function<void (bool)> commit_callback_t;
+    typedef function<void ()> abort_callback_t;
+
+    /* Constructor needs path to shard configs and number of shards.
+     * With unloggedReads, GETs are sent to one replica of the shard
+     * without being logged, and the versions read are validated at
+     * commit; this requires OCC on the servers.
+     *
+     * Commit timestamps are leased from the timestamp server tsBatch
+     * at a time. With hlc, the client instead takes them from a
+     * hybrid logical clock, and only syncs the clock with the
+     * timestamp server once every tsBatch commits.
+     *
+     * Keys are mapped to shards by shardPlacement, which must
+     * outlive the client; without one, keys are placed by hash. */
+    Client(Proto mode, string configPath, int nshards,
+           bool unloggedReads = false,
+           unsigned int tsBatch = DEFAULT_TS_BATCH, bool hlc = false,
+           const Placement *shardPlacement = NULL);
     ~Client();
 
-    /* API Calls for NiStore. */
+    /* Asynchronous API. Any number of transactions can be in
+     * progress at once, each named by the ID BeginAsync returns.
+     * These may be called from any thread; callbacks run on the
+     * transport thread. Puts are buffered until commit, so they
+     * need no callback. */
+    uint64_t BeginAsync();
+    void GetAsync(uint64_t txnid, const string &key, get_callback_t cb);
+    // Reads all the keys in parallel; ok only if every read was.
+    void MultiGetAsync(uint64_t txnid, const vector<string> &keys,
+                       multiget_callback_t cb);
+    void PutAsync(uint64_t txnid, const string &key, const string &value);
+    void CommitAsync(uint64_t txnid, commit_callback_t cb);
+    void AbortAsync(uint64_t txnid, abort_callback_t cb);
+
+    /* Blocking API for one transaction at a time, built on the
+     * asynchronous one. Don't call these from a callback. */
     void Begin();
     bool Get(const string &key, string &value);
+    bool MultiGet(const vector<string> &keys, map<string, string> &values);
     void Put(const string &key, const string &value);
     bool Commit();
     void Abort();
 
+    static const unsigned int DEFAULT_TS_BATCH = 1000;
+
 private:
+    // Requests each shard client may have outstanding at once.
+    static const uint64_t SHARD_WINDOW = 64;
+
     long client_id; // Unique ID for this client.
     long nshards; // Number of shards in niStore
+    bool unlogged_reads; // Whether to send GETs unlogged.
+    const Placement *placement; // Which shard stores each key.
+    bool own_placement; // Whether placement is ours to delete.
+    unsigned int ts_batch; // Timestamps to lease from the tss at once.
+    bool use_hlc; // Whether to take timestamps from a local clock.
+    atomic<uint64_t> last_txn; // Sequence number of last transaction.
+    uint64_t current_txn; // Transaction of the blocking API.
 
     UDPTransport transport; // Transport used by paxos client proxies.
     thread *clientTransport; // Thread running the transport event loop.
 
     vector<specpaxos::Client *> shard; // List of shard client proxies.
+    vector<int> read_replica; // Replica of each shard for unlogged GETs.
     specpaxos::Client *tss; // Timestamp server shard.
 
-    mutex cv_m; // Synchronize access to all state in this class and cv.
-    condition_variable cv; // To block api calls till a replica reply.
-
-    /* Transaction specific variables. */
-    bool op_pending; // True if a transaction is ongoing.
-    bool status; // Whether to commit transaction & reply status.
-    unsigned int nreplies; // Number of replies received back in 2PC.
-    set<int> all_participants; // Participants in ongoing transaction.
-    set<int> yes_participants; // Participants who replies YES.
-    string replica_reply; // Reply back from a shard.
+    /* Everything below is only touched on the transport thread. */
+
+    struct Transaction {
+        uint64_t id;
+        set<int> participants; // Shards read from or written to.
+        set<int> logged; // Shards holding state from logged GETs.
+        set<int> yes_participants; // Participants who replied YES.
+        bool preparing; // Whether PREPARE has been sent.
+        bool status; // Whether to commit transaction.
+        unsigned int outstanding; // Replies awaited in this phase.
+        bool have_ts; // Whether the tss has replied.
+        uint64_t timestamp; // Timestamp from the tss.
+        uint64_t min_ts; // Latest of the YES votes' earliest timestamps.
+        map<int, map<string, string> > write_set; // Buffered writes, by shard.
+        // Versions and values read with unlogged GETs, by shard.
+        map<int, map<string, pair<uint64_t, string> > > read_set;
+        // Keys with an unlogged GET queued or in flight, by shard.
+        map<int, set<string> > reading;
+        commit_callback_t commit_cb;
+        abort_callback_t abort_cb;
+
+        Transaction() : id(0), preparing(false), status(true),
+                        outstanding(0), have_ts(false), timestamp(0),
+                        min_ts(0) { };
+    };
+    unordered_map<uint64_t, Transaction> txns;
+
+    // Unlogged GETs waiting for their turn; a shard client can only
+    // have one outstanding.
+    // Reads of a key the transaction is already reading share its
+    // GET, so they all see the same version.
+    struct UnloggedRead {
+        uint64_t txnid;
+        string key;
+        vector<get_callback_t> cbs;
+    };
+    vector<deque<UnloggedRead> > unlogged_queue;
+
+    // Leased timestamps not used yet, [ts_next, ts_end).
+    uint64_t ts_next;
+    uint64_t ts_end;
+    // Whether a request to the tss is outstanding.
+    bool ts_requested;
+    // Transactions waiting for a timestamp.
+    deque<uint64_t> ts_waiting;
+    // Last timestamp taken from or seen by the hybrid logical clock,
+    // and how many have been taken since it was synced.
+    uint64_t hlc_last;
+    unsigned int hlc_unsynced;
 
     /* Private helper functions. */
     void run_client(); // Runs the transport event loop.
-    void send_begin(unsigned int); // Sends BEGIN message to shard[i].
+    Transaction &getTxn(uint64_t txnid);
+    void send_get(Transaction &txn, int i, const string &key,
+                  get_callback_t cb);
+    void send_unlogged_get(int i);
+    void build_prepare(Transaction &txn, int i, Request::Operation op,
+                       string &request_str);
+    void get_timestamp(Transaction &txn);
+    void request_timestamps();
+    void observe_timestamp(uint64_t ts);
+    void send_prepare(Transaction &txn);
+    void send_prepare_commit(Transaction &txn);
+    void send_commit(Transaction &txn, uint64_t ts);
+    void send_abort(Transaction &txn, const set<int> &targets);
+    void finish(uint64_t txnid, bool committed);
 
     /* Callbacks for hearing back from a shard for an operation. */
-    void beginCallback(const int, const string &, const string &);
-    void getCallback(const int, const string &, const string &);
-    void putCallback(const int, const string &, const string &);
-    void prepareCallback(const int, const string &, const string &);
-    void commitCallback(const int, const string &, const string &);
-    void abortCallback(const int, const string &, const string &);
+    void getCallback(uint64_t, int, get_callback_t,
+                     const string &, const string &);
+    void unloggedGetCallback(int, const string &, const string &);
+    void unloggedGetTimeout(int, const string &);
+    void prepareCallback(uint64_t, int, const string &, const string &);
+    void prepareCommitCallback(uint64_t, int, const string &, const string &);
+    void commitCallback(uint64_t, int, const string &, const string &);
+    void abortCallback(uint64_t, int, const string &, const string &);
 
     void tssCallback(const string &request, const string &reply);
 
-    // Sharding logic: Given key, generates a number b/w 0 to nshards-1
-    long key_to_shard(const string &key);
+    // Sharding logic: Given key, returns a number b/w 0 to nshards-1
+    int key_to_shard(const string &key);
 };
 
 } // namespace nistore
@@ -47,6 +47,7 @@ KVStore::remove(const string &key, string &value)
         return false;
     } 
 
+    value = store[key].back();
     store[key].pop_back();
     return true;
 }
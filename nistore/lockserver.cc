@@ -9,13 +9,17 @@
 
 #include "nistore/lockserver.h"
 #include "lib/assert.h"
+#include "lib/hash.h"
 #include "lib/message.h"
 #include <cinttypes>
 
 namespace nistore {
 using namespace std;
 
+static const size_t INITIAL_CAPACITY = 1024;
+
 LockServer::LockServer()
+    : table(INITIAL_CAPACITY), count(0), freeWaiters(NONE), clock(0)
 {
     readers = 0;
     writers = 0;
@@ -24,145 +28,404 @@ LockServer::LockServer()
 LockServer::~LockServer() { }
 
 bool
-LockServer::Waiter::checkTimeout(const struct timeval &now)
+LockServer::Lock::isHolder(uint64_t id) const
 {
-    if (now.tv_sec > waitTime.tv_sec) {
-        return true;
-    } else {
-        ASSERT(now.tv_usec > waitTime.tv_usec && now.tv_sec == waitTime.tv_sec);
-        
-        if (now.tv_usec - waitTime.tv_usec > LOCK_WAIT_TIMEOUT)
+    for (uint32_t i = 0; i < nholders && i < INLINE_HOLDERS; i++) {
+        if (holders[i] == id) {
             return true;
+        }
+    }
+    for (uint64_t h : moreHolders) {
+        if (h == id) {
+            return true;
+        }
     }
     return false;
 }
-    
+
 void
-LockServer::Lock::waitForLock(uint64_t requester, bool write)
+LockServer::Lock::addHolder(uint64_t id)
 {
-    if (waiters.find(requester) != waiters.end()) {
-        // Already waiting
+    if (isHolder(id)) {
         return;
     }
-
-    Debug("[%" PRIu64 "] Adding me to the queue ...", requester);
-    // Otherwise
-    waiters[requester] = Waiter(write);
-    waitQ.push(requester);
+    if (nholders < INLINE_HOLDERS) {
+        holders[nholders] = id;
+    } else {
+        moreHolders.push_back(id);
+    }
+    nholders++;
 }
 
 bool
-LockServer::Lock::tryAcquireLock(uint64_t requester, bool write)
+LockServer::Lock::removeHolder(uint64_t id)
 {
-    if (waitQ.size() == 0) {
-        return true;
+    for (size_t i = 0; i < moreHolders.size(); i++) {
+        if (moreHolders[i] == id) {
+            moreHolders[i] = moreHolders.back();
+            moreHolders.pop_back();
+            nholders--;
+            return true;
+        }
     }
-
-    Debug("[%" PRIu64 "] Trying to get lock for %d", requester, (int)write);
-    struct timeval now;
-    uint64_t w = waitQ.front();
-    
-    gettimeofday(&now, NULL);
-    // prune old requests out of the wait queue
-    while (waiters[w].checkTimeout(now)) {
-        waiters.erase(w);
-        waitQ.pop();
-
-        // if everyone else was old ...
-        if (waitQ.size() == 0) {
+    for (uint32_t i = 0; i < nholders && i < INLINE_HOLDERS; i++) {
+        if (holders[i] == id) {
+            // fill the hole from the end of the inline array or,
+            // if it spilled over, from the overflow list
+            if (!moreHolders.empty()) {
+                holders[i] = moreHolders.back();
+                moreHolders.pop_back();
+            } else {
+                holders[i] = holders[nholders-1];
+            }
+            nholders--;
             return true;
         }
+    }
+    return false;
+}
+
+/* Index of the slot for key: the one holding it, or else the empty
+ * one where it would go. */
+size_t
+LockServer::lookup(const string &key, uint32_t h) const
+{
+    size_t mask = table.size() - 1;
+    size_t i;
+    for (i = h & mask; table[i].used; i = (i+1) & mask) {
+        if ((table[i].hash == h) && (table[i].key == key)) {
+            break;
+        }
+    }
+    return i;
+}
 
-        w = waitQ.front();
-        ASSERT(waiters.find(w) != waiters.end());
+LockServer::Lock *
+LockServer::find(const string &key)
+{
+    Lock &l = table[lookup(key, ::hash(key.data(), key.size(), 0))];
+    return l.used ? &l : NULL;
+}
+
+LockServer::Lock &
+LockServer::findOrInsert(const string &key)
+{
+    uint32_t h = ::hash(key.data(), key.size(), 0);
+    size_t i = lookup(key, h);
+    if (table[i].used) {
+        return table[i];
     }
 
-    if (waitQ.front() == requester) {
-        // this lock is being reserved for the requester
-        waitQ.pop();
-        ASSERT(waiters.find(requester) != waiters.end());
-        ASSERT(waiters[requester].write == write);
-        waiters.erase(requester);
-        return true;
+    // Keep the load factor under 1/2
+    if ((count+1)*2 > table.size()) {
+        rebuild();
+        i = lookup(key, h);
+    }
+
+    Lock &l = table[i];
+    l.used = true;
+    l.hash = h;
+    l.key = key;
+    count++;
+    return l;
+}
+
+/* Remove a free lock, shifting back any entries that were displaced
+ * past its slot so lookups never need tombstones. */
+void
+LockServer::erase(Lock &l)
+{
+    ASSERT(l.used && l.isFree());
+    ASSERT(l.nholders == 0);
+
+    size_t mask = table.size() - 1;
+    size_t i = &l - &table[0];
+    table[i] = Lock();
+    count--;
+
+    for (size_t j = (i+1) & mask; table[j].used; j = (j+1) & mask) {
+        size_t home = table[j].hash & mask;
+        // Leave entries whose home slot lies cyclically in (i, j]
+        bool stays = (i <= j) ? ((home > i) && (home <= j))
+                              : ((home > i) || (home <= j));
+        if (!stays) {
+            table[i] = std::move(table[j]);
+            table[j] = Lock();
+            i = j;
+        }
+    }
+}
+
+/* Drop expired waiters and any locks that leaves free, then resize
+ * the table to fit what is left, doubling it if it is still too
+ * full. Also trims waitingOn down to the queues still holding each
+ * requester. */
+void
+LockServer::rebuild()
+{
+    size_t live = 0;
+    waitingOn.clear();
+    for (Lock &l : table) {
+        if (!l.used) {
+            continue;
+        }
+        pruneWaiters(l);
+        if (!l.isFree()) {
+            live++;
+        }
+        for (uint32_t w = l.waitHead; w != NONE; w = waiters[w].next) {
+            waitingOn[waiters[w].requester].push_back(l.key);
+        }
+    }
+
+    size_t capacity = INITIAL_CAPACITY;
+    while ((live+1)*4 > capacity) {
+        capacity *= 2;
+    }
+
+    if (live < count) {
+        Debug("Reclaiming %zu unused locks", count-live);
+    }
+
+    vector<Lock> old(capacity);
+    old.swap(table);
+    count = 0;
+    for (Lock &l : old) {
+        if (!l.used || l.isFree()) {
+            continue;
+        }
+        table[lookup(l.key, l.hash)] = std::move(l);
+        count++;
+    }
+    ASSERT(count == live);
+}
+
+void
+LockServer::journalState(Lock &l, uint64_t requester)
+{
+    Change c;
+    c.kind = Change::STATE;
+    c.op = clock;
+    c.key = l.key;
+    c.requester = requester;
+    c.state = l.state;
+    c.held = l.isHolder(requester);
+    c.readers = readers;
+    c.writers = writers;
+    journal.push_back(std::move(c));
+}
+
+void
+LockServer::journalDequeue(Lock &l, uint32_t w, uint32_t pos)
+{
+    Change c;
+    c.kind = Change::DEQUEUE;
+    c.op = clock;
+    c.key = l.key;
+    c.requester = waiters[w].requester;
+    c.expires = waiters[w].expires;
+    c.write = waiters[w].write;
+    c.pos = pos;
+    journal.push_back(std::move(c));
+}
+
+/* Link a new waiter into the queue so that pos waiters are ahead of
+ * it. */
+void
+LockServer::insertWaiter(Lock &l, uint32_t pos, uint64_t requester,
+                         uint64_t expires, bool write)
+{
+    ASSERT(pos <= l.nwaiting);
+
+    uint32_t w;
+    if (freeWaiters != NONE) {
+        w = freeWaiters;
+        freeWaiters = waiters[w].next;
     } else {
-        // otherwise, add me to the list
-        waitForLock(requester, write);
+        w = waiters.size();
+        waiters.push_back(Waiter());
+    }
+
+    Waiter &n = waiters[w];
+    n.requester = requester;
+    n.expires = expires;
+    n.write = write;
+
+    if (pos == 0) {
+        n.next = l.waitHead;
+        l.waitHead = w;
+    } else {
+        uint32_t prev = l.waitHead;
+        for (uint32_t i = 1; i < pos; i++) {
+            prev = waiters[prev].next;
+        }
+        n.next = waiters[prev].next;
+        waiters[prev].next = w;
+    }
+    if (n.next == NONE) {
+        l.waitTail = w;
+    }
+    l.nwaiting++;
+    waitingOn[requester].push_back(l.key);
+}
+
+void
+LockServer::unlinkWaiter(Lock &l, uint32_t prev, uint32_t w)
+{
+    if (prev == NONE) {
+        l.waitHead = waiters[w].next;
+    } else {
+        waiters[prev].next = waiters[w].next;
+    }
+    if (l.waitTail == w) {
+        l.waitTail = prev;
+    }
+    l.nwaiting--;
+
+    waiters[w].next = freeWaiters;
+    freeWaiters = w;
+}
+
+void
+LockServer::waitForLock(Lock &l, uint64_t requester, bool write)
+{
+    for (uint32_t w = l.waitHead; w != NONE; w = waiters[w].next) {
+        if (waiters[w].requester == requester) {
+            // Already waiting
+            return;
+        }
+    }
+
+    Debug("[%" PRIu64 "] Adding me to the queue ...", requester);
+    Change c;
+    c.kind = Change::ENQUEUE;
+    c.op = clock;
+    c.key = l.key;
+    c.requester = requester;
+    journal.push_back(std::move(c));
+
+    insertWaiter(l, l.nwaiting, requester, clock + LOCK_WAIT_TIMEOUT, write);
+}
+
+void
+LockServer::popWaiter(Lock &l)
+{
+    uint32_t w = l.waitHead;
+    ASSERT(w != NONE);
+    journalDequeue(l, w, 0);
+    unlinkWaiter(l, NONE, w);
+}
+
+/* Unlink the requester's waiter from anywhere in the queue. Returns
+ * false if it wasn't waiting. */
+bool
+LockServer::removeWaiter(Lock &l, uint64_t requester)
+{
+    uint32_t prev = NONE;
+    uint32_t pos = 0;
+    uint32_t w;
+    for (w = l.waitHead; w != NONE; prev = w, w = waiters[w].next, pos++) {
+        if (waiters[w].requester == requester) {
+            break;
+        }
+    }
+    if (w == NONE) {
         return false;
     }
+
+    journalDequeue(l, w, pos);
+    unlinkWaiter(l, prev, w);
+    return true;
+}
+
+// prune old requests out of the front of the wait queue
+void
+LockServer::pruneWaiters(Lock &l)
+{
+    while ((l.waitHead != NONE) && (waiters[l.waitHead].expires < clock)) {
+        popWaiter(l);
+    }
 }
 
 bool
-LockServer::Lock::isWriteNext()
+LockServer::tryAcquireLock(Lock &l, uint64_t requester, bool write)
 {
-    if (waitQ.size() == 0) return false;
+    pruneWaiters(l);
+    if (l.waitHead == NONE) {
+        return true;
+    }
 
-    struct timeval now;
-    uint64_t w = waitQ.front();
-    
-    gettimeofday(&now, NULL);
-    // prune old requests out of the wait queue
-    while (waiters[w].checkTimeout(now)) {
-        waiters.erase(w);
-        waitQ.pop();
-
-        // if everyone else was old ...
-        if (waitQ.size() == 0) {
-            return false;
-        }
+    Debug("[%" PRIu64 "] Trying to get lock for %d", requester, (int)write);
 
-        w = waitQ.front();
-        ASSERT(waiters.find(w) != waiters.end());
+    if (waiters[l.waitHead].requester == requester) {
+        // this lock is being reserved for the requester
+        ASSERT(waiters[l.waitHead].write == write);
+        popWaiter(l);
+        return true;
+    } else {
+        // otherwise, add me to the list
+        waitForLock(l, requester, write);
+        return false;
     }
+}
 
-    ASSERT(waiters.find(waitQ.front()) != waiters.end());
-    return waiters[waitQ.front()].write;
+bool
+LockServer::isWriteNext(Lock &l)
+{
+    pruneWaiters(l);
+    return (l.waitHead != NONE) && waiters[l.waitHead].write;
 }
 
 bool
-LockServer::lockForRead(const string &lock, uint64_t requester)
+LockServer::lockForRead(const string &lock, uint64_t requester,
+                        uint64_t now)
 {
-    Lock &l = locks[lock];
-    Debug("Lock for Read: %s [%" PRIu64 " %" PRIu64 " %lu %lu]", lock.c_str(),
-    readers, writers, l.holders.size(), l.waiters.size());
+    clock = now;
+    Lock &l = findOrInsert(lock);
+    Debug("Lock for Read: %s [%" PRIu64 " %" PRIu64 " %u %u]", lock.c_str(),
+    readers, writers, l.nholders, l.nwaiting);
 
     switch (l.state) {
     case UNLOCKED:
         // if you are next in the queue
-        if (l.tryAcquireLock(requester, false)) {
+        if (tryAcquireLock(l, requester, false)) {
             Debug("[%" PRIu64 "] I have acquired the read lock!", requester);
+            journalState(l, requester);
             l.state = LOCKED_FOR_READ;
-            ASSERT(l.holders.size() == 0);
-            l.holders.insert(requester);
+            ASSERT(l.nholders == 0);
+            l.addHolder(requester);
             readers++;
             return true;
         }
         return false;
     case LOCKED_FOR_READ:
         // if you already hold this lock
-        if (l.holders.find(requester) != l.holders.end()) {
+        if (l.isHolder(requester)) {
             return true;
         }
 
         // There is a write waiting, let's give up the lock
-        if (l.isWriteNext()) {
+        if (isWriteNext(l)) {
 	    Debug("[%" PRIu64 "] Waiting on lock because there is a pending write request", requester);
-            l.waitForLock(requester, false);
+            waitForLock(l, requester, false);
             return false;
         }
 
-        l.holders.insert(requester);
+        journalState(l, requester);
+        l.addHolder(requester);
         readers++;
         return true;
     case LOCKED_FOR_WRITE:
     case LOCKED_FOR_READ_WRITE:
-        if (l.holders.count(requester) > 0) {
+        if (l.isHolder(requester)) {
+            journalState(l, requester);
             l.state = LOCKED_FOR_READ_WRITE;
             readers++;
             return true;
         }
-        ASSERT(l.holders.size() == 1);
-        Debug("Locked for write, held by %" PRIu64 "", *(l.holders.begin())); 
-        l.waitForLock(requester, false);
+        ASSERT(l.nholders == 1);
+        Debug("Locked for write, held by %" PRIu64 "", l.firstHolder());
+        waitForLock(l, requester, false);
         return false;
     }
     NOT_REACHABLE();
@@ -170,46 +433,50 @@ LockServer::lockForRead(const string &lock, uint64_t requester)
 }
 
 bool
-LockServer::lockForWrite(const string &lock, uint64_t requester)
+LockServer::lockForWrite(const string &lock, uint64_t requester,
+                         uint64_t now)
 {
-    Lock &l = locks[lock];
+    clock = now;
+    Lock &l = findOrInsert(lock);
 
-    Debug("Lock for Write: %s [%" PRIu64 " %" PRIu64 " %lu %lu]", lock.c_str(),
-    readers, writers, l.holders.size(), l.waiters.size());
+    Debug("Lock for Write: %s [%" PRIu64 " %" PRIu64 " %u %u]", lock.c_str(),
+    readers, writers, l.nholders, l.nwaiting);
 
     switch (l.state) {
     case UNLOCKED:
         // Got it!
-        if (l.tryAcquireLock(requester, true)) {
+        if (tryAcquireLock(l, requester, true)) {
             Debug("[%" PRIu64 "] I have acquired the write lock!", requester);
+            journalState(l, requester);
             l.state = LOCKED_FOR_WRITE;
-            ASSERT(l.holders.size() == 0);
-            l.holders.insert(requester);
+            ASSERT(l.nholders == 0);
+            l.addHolder(requester);
             writers++;
             return true;
         }
         return false;
     case LOCKED_FOR_READ:
-        if (l.holders.size() == 1 && l.holders.count(requester) > 0) {
+        if (l.nholders == 1 && l.isHolder(requester)) {
             // if there is one holder of this read lock and it is the
             // requester, then upgrade the lock
+            journalState(l, requester);
             l.state = LOCKED_FOR_READ_WRITE;
             writers++;
             return true;
         }
 
-        Debug("Locked for read by%s%lu other people", l.holders.count(requester) > 0 ? "you" : "", l.holders.size());
-        l.waitForLock(requester, true);
+        Debug("Locked for read by%s%u other people", l.isHolder(requester) ? "you" : "", l.nholders);
+        waitForLock(l, requester, true);
         return false;
     case LOCKED_FOR_WRITE:
     case LOCKED_FOR_READ_WRITE:
-        ASSERT(l.holders.size() == 1);
-        if (l.holders.count(requester) > 0) {
+        ASSERT(l.nholders == 1);
+        if (l.isHolder(requester)) {
             return true;
         }
 
-        Debug("Held by %" PRIu64 " for %s", *(l.holders.begin()), (l.state == LOCKED_FOR_WRITE) ? "write" : "read-write" );
-        l.waitForLock(requester, true);
+        Debug("Held by %" PRIu64 " for %s", l.firstHolder(), (l.state == LOCKED_FOR_WRITE) ? "write" : "read-write" );
+        waitForLock(l, requester, true);
         return false;
     }
     NOT_REACHABLE();
@@ -217,69 +484,177 @@ LockServer::lockForWrite(const string &lock, uint64_t requester)
 }
 
 void
-LockServer::releaseForRead(const string &lock, uint64_t holder)
+LockServer::releaseForRead(const string &lock, uint64_t holder,
+                           uint64_t now)
 {
-    if (locks.find(lock) == locks.end()) {
+    clock = now;
+    Lock *l = find(lock);
+    if (l == NULL) {
         return;
     }
-    
-    Lock &l = locks[lock];
 
-    if (l.holders.count(holder) == 0) {
+    if (!l->isHolder(holder)) {
         Warning("[%" PRIu64 "] Releasing unheld read lock: %s", holder, lock.c_str());
         return;
     }
 
-    switch (l.state) {
+    switch (l->state) {
     case UNLOCKED:
     case LOCKED_FOR_WRITE:
         return;
     case LOCKED_FOR_READ:
+        journalState(*l, holder);
         readers--;
-        if (l.holders.erase(holder) < 1) {
-            Warning("[%" PRIu64 "] Releasing unheld read lock: %s", holder, lock.c_str()); 
-        }
-        if (l.holders.empty()) {
-            l.state = UNLOCKED;
+        l->removeHolder(holder);
+        if (l->nholders == 0) {
+            l->state = UNLOCKED;
+            pruneWaiters(*l);
+            if (l->isFree()) {
+                erase(*l);
+            }
         }
 	return;
     case LOCKED_FOR_READ_WRITE:
+        journalState(*l, holder);
         readers--;
-        l.state = LOCKED_FOR_WRITE;
+        l->state = LOCKED_FOR_WRITE;
         return;
     }
 }
 
 void
-LockServer::releaseForWrite(const string &lock, uint64_t holder)
+LockServer::releaseForWrite(const string &lock, uint64_t holder,
+                            uint64_t now)
 {
-    if (locks.find(lock) == locks.end()) {
+    clock = now;
+    Lock *l = find(lock);
+    if (l == NULL) {
         return;
     }
 
-    Lock &l = locks[lock];
-
-    if (l.holders.count(holder) == 0) {
+    if (!l->isHolder(holder)) {
         Warning("[%" PRIu64 "] Releasing unheld write lock: %s", holder, lock.c_str());
         return;
     }
 
-    switch (l.state) {
+    switch (l->state) {
     case UNLOCKED:
     case LOCKED_FOR_READ:
         return;
     case LOCKED_FOR_WRITE:
+        journalState(*l, holder);
         writers--;
-        l.holders.erase(holder);
-        ASSERT(l.holders.size() == 0);
-        l.state = UNLOCKED;
+        l->removeHolder(holder);
+        ASSERT(l->nholders == 0);
+        l->state = UNLOCKED;
+        pruneWaiters(*l);
+        if (l->isFree()) {
+            erase(*l);
+        }
         return;
     case LOCKED_FOR_READ_WRITE:
+        journalState(*l, holder);
         writers--;
-        l.state = LOCKED_FOR_READ;
-        ASSERT(l.holders.size() == 1);
+        l->state = LOCKED_FOR_READ;
+        ASSERT(l->nholders == 1);
         return;
     }
 }
 
+void
+LockServer::cancelWait(const string &lock, uint64_t requester,
+                       uint64_t now)
+{
+    clock = now;
+    Lock *l = find(lock);
+    if ((l == NULL) || !removeWaiter(*l, requester)) {
+        return;
+    }
+
+    Debug("[%" PRIu64 "] Leaving the queue for %s", requester, lock.c_str());
+    if (l->isFree()) {
+        erase(*l);
+    }
+}
+
+void
+LockServer::cancelWaits(uint64_t requester, uint64_t now)
+{
+    auto it = waitingOn.find(requester);
+    if (it == waitingOn.end()) {
+        return;
+    }
+
+    vector<string> keys = std::move(it->second);
+    waitingOn.erase(it);
+    for (const string &key : keys) {
+        cancelWait(key, requester, now);
+    }
+}
+
+/* Put back one change. The lock may have been erased since, so it is
+ * recreated if need be, and erased again if the change leaves it
+ * free. */
+void
+LockServer::undo(const Change &c)
+{
+    Lock &l = findOrInsert(c.key);
+
+    switch (c.kind) {
+    case Change::STATE:
+    {
+        l.state = c.state;
+        bool holds = l.isHolder(c.requester);
+        if (c.held && !holds) {
+            l.addHolder(c.requester);
+        } else if (!c.held && holds) {
+            l.removeHolder(c.requester);
+        }
+        readers = c.readers;
+        writers = c.writers;
+        break;
+    }
+    case Change::ENQUEUE:
+    {
+        // Later changes are already undone, so it is still last
+        uint32_t prev = NONE;
+        uint32_t w = l.waitHead;
+        ASSERT(w != NONE);
+        while (waiters[w].next != NONE) {
+            prev = w;
+            w = waiters[w].next;
+        }
+        ASSERT(waiters[w].requester == c.requester);
+        unlinkWaiter(l, prev, w);
+        break;
+    }
+    case Change::DEQUEUE:
+        insertWaiter(l, c.pos, c.requester, c.expires, c.write);
+        break;
+    }
+
+    if (l.isFree()) {
+        erase(l);
+    }
+}
+
+void
+LockServer::rollback(uint64_t op)
+{
+    // Growing the table mustn't expire anyone while it is put back
+    clock = 0;
+    while (!journal.empty() && (journal.back().op >= op)) {
+        undo(journal.back());
+        journal.pop_back();
+    }
+}
+
+void
+LockServer::commit(uint64_t op)
+{
+    while (!journal.empty() && (journal.front().op <= op)) {
+        journal.pop_front();
+    }
+}
+
 } // namespace nistore
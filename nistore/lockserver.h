@@ -12,20 +12,25 @@
 
 #include <unistd.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <deque>
+#include <string>
 #include <unordered_map>
 #include <vector>
-#include <fstream>
-#include <iostream>
-#include <unordered_set>
-#include <queue>
-#include <sys/time.h>
-#include <map>
 
 namespace nistore {
 using namespace std;
 
-#define LOCK_WAIT_TIMEOUT 5000
+/* How long a waiter keeps its place in a lock's queue without
+ * retrying, counted in operations of the replicated log rather than
+ * wall-clock time so that every replica expires the same waiters. */
+#define LOCK_WAIT_TIMEOUT 1000
 
+/* Lock table: an open-addressing hash table from key to lock, with
+ * entries removed as soon as a lock is free and no one is waiting for
+ * it, so the table only grows with the number of locks in use. The
+ * first few holders of a lock are stored inline; waiters are kept in
+ * a shared pool and linked into per-lock FIFO queues. */
 class LockServer
 {
 
@@ -33,10 +38,28 @@ public:
     LockServer();
     ~LockServer();
 
-    bool lockForRead(const string &lock, uint64_t requester);
-    bool lockForWrite(const string &lock, uint64_t requester);
-    void releaseForRead(const string &lock, uint64_t holder);
-    void releaseForWrite(const string &lock, uint64_t holder);
+    /* now is the opnum of the operation asking for the lock. A
+     * requester that can't have the lock is queued for it, and gets
+     * it ahead of later requesters if it asks again within
+     * LOCK_WAIT_TIMEOUT operations. */
+    bool lockForRead(const string &lock, uint64_t requester, uint64_t now);
+    bool lockForWrite(const string &lock, uint64_t requester, uint64_t now);
+    void releaseForRead(const string &lock, uint64_t holder, uint64_t now);
+    void releaseForWrite(const string &lock, uint64_t holder, uint64_t now);
+    // Give up the requester's place in the queue for lock
+    void cancelWait(const string &lock, uint64_t requester, uint64_t now);
+    // Give up all of the requester's places in lock queues
+    void cancelWaits(uint64_t requester, uint64_t now);
+
+    /* Every change to the table is journaled under the operation
+     * that made it. rollback undoes the changes made at op and
+     * later, newest first, leaving the table exactly as it was
+     * before op; commit forgets the changes made at op and earlier,
+     * which will never be rolled back. */
+    void rollback(uint64_t op);
+    void commit(uint64_t op);
+
+    size_t numLocks() const { return count; };
 
 private:
     enum LockState {
@@ -46,39 +69,100 @@ private:
 	LOCKED_FOR_READ_WRITE
     };
 
+    static const uint32_t NONE = UINT32_MAX;
+    static const size_t INLINE_HOLDERS = 4;
+
     struct Waiter {
+        uint64_t requester;
+        // logical time after which the waiter is dropped
+        uint64_t expires;
+        uint32_t next;
         bool write;
-        struct timeval waitTime;
-
-        Waiter() {write = false;}
-        Waiter(bool w) {
-            gettimeofday(&waitTime, NULL);
-            write = w;
-        }
+    };
 
-        bool checkTimeout(const struct timeval &now);
+    /* One change to a lock: the lock's state and whether requester
+     * held it, before it was locked or released; a waiter joining
+     * the tail of the queue; or a waiter leaving the queue from
+     * position pos, whether it was granted its reservation, expired
+     * or gave up its place. */
+    struct Change {
+        enum Kind { STATE, ENQUEUE, DEQUEUE } kind;
+        uint64_t op;
+        string key;
+        uint64_t requester;
+        LockState state;
+        bool held;
+        uint64_t readers;
+        uint64_t writers;
+        uint64_t expires;
+        bool write;
+        uint32_t pos;
     };
 
     struct Lock {
+        bool used;
         LockState state;
-        unordered_set<uint64_t> holders;
-        queue<uint64_t> waitQ;
-        map<uint64_t, Waiter> waiters;
-
-        Lock() {
-            state = UNLOCKED;
+        uint32_t hash;
+        string key;
+
+        // holders[0..min(nholders, INLINE_HOLDERS)), then moreHolders
+        uint32_t nholders;
+        uint64_t holders[INLINE_HOLDERS];
+        vector<uint64_t> moreHolders;
+
+        // indexes into waiters
+        uint32_t waitHead;
+        uint32_t waitTail;
+        uint32_t nwaiting;
+
+        Lock() : used(false), state(UNLOCKED), hash(0), nholders(0),
+                 waitHead(NONE), waitTail(NONE), nwaiting(0) { };
+
+        bool isHolder(uint64_t id) const;
+        void addHolder(uint64_t id);
+        bool removeHolder(uint64_t id);
+        uint64_t firstHolder() const { return holders[0]; };
+        bool isFree() const {
+            return (state == UNLOCKED) && (waitHead == NONE);
         };
-        void waitForLock(uint64_t requester, bool write);
-        bool tryAcquireLock(uint64_t requester, bool write);
-        bool isWriteNext();
     };
-	
 
-    /* Global store which keep key -> (timestamp, value) list. */
-    unordered_map<string, Lock> locks;
+    vector<Lock> table;
+    size_t count;
+    vector<Waiter> waiters;
+    uint32_t freeWaiters;
+
+    // opnum of the operation changing the table
+    uint64_t clock;
+    // Locks each requester has been queued for; may also name
+    // queues it has since left, until the next rebuild
+    unordered_map<uint64_t, vector<string> > waitingOn;
 
     uint64_t readers;
     uint64_t writers;
+
+    // changes not yet committed, oldest first
+    deque<Change> journal;
+
+    size_t lookup(const string &key, uint32_t h) const;
+    Lock *find(const string &key);
+    Lock &findOrInsert(const string &key);
+    void erase(Lock &l);
+    void rebuild();
+
+    void journalState(Lock &l, uint64_t requester);
+    void journalDequeue(Lock &l, uint32_t w, uint32_t pos);
+    void insertWaiter(Lock &l, uint32_t pos, uint64_t requester,
+                      uint64_t expires, bool write);
+    void unlinkWaiter(Lock &l, uint32_t prev, uint32_t w);
+    void undo(const Change &c);
+
+    void waitForLock(Lock &l, uint64_t requester, bool write);
+    void pruneWaiters(Lock &l);
+    void popWaiter(Lock &l);
+    bool removeWaiter(Lock &l, uint64_t requester);
+    bool tryAcquireLock(Lock &l, uint64_t requester, bool write);
+    bool isWriteNext(Lock &l);
 };
 
 } // namespace nistore
@@ -38,52 +38,22 @@ LockStore::getTxn(uint64_t id)
     return running[id];
 }
 
-LockStore::Transaction
-LockStore::getRetiredTxn(opnum_t op, uint64_t id, RetiredState state)
-{
-    pair<opnum_t,RetiredTxn> t = retired.back();
-    RetiredTxn rTxn = t.second;
-
-    ASSERT(t.first == op);
-    ASSERT(rTxn.txn.id == id);
-    ASSERT(rTxn.state == state);
-
-    retired.pop_back();
-    return rTxn.txn;
-}
-
 /*
  * Used on commit and abort for second phase of 2PL
  */
 void
-LockStore::dropLocks(const Transaction &txn)
+LockStore::dropLocks(const Transaction &txn, opnum_t op)
 {
     for (auto &write : txn.writeSet) {
-	locks.releaseForWrite(write.first, txn.id);
+	locks.releaseForWrite(write.first, txn.id, op);
     }
 
     for (auto &read : txn.readSet) {
-	locks.releaseForRead(read.first, txn.id);
-    }
-}
-    
-/*
- * This is only used for rollback. Should be able to pick up all locks
- * again bacause we were holding them before.
- */
-void
-LockStore::getLocks(const Transaction &txn)
-{
-    bool ret;
-    for (auto &write : txn.writeSet) {
-	ret = locks.lockForWrite(write.first, txn.id);
-	ASSERT(ret);
+	locks.releaseForRead(read.first, txn.id, op);
     }
 
-    for (auto &read : txn.readSet) {
-	ret = locks.lockForRead(read.first, txn.id);
-	ASSERT(ret);
-    }
+    // and don't hold up anyone behind a lock we were waiting for
+    locks.cancelWaits(txn.id, op);
 }
 
 void
@@ -104,7 +74,8 @@ LockStore::unbegin(uint64_t id)
 }
 
 int
-LockStore::get(uint64_t id, const string &key, string &value)
+LockStore::get(uint64_t id, const string &key, string &value,
+               opnum_t op)
 {
     Debug("[%" PRIu64 "] GET %s", id, key.c_str());
 
@@ -130,7 +101,7 @@ LockStore::get(uint64_t id, const string &key, string &value)
             txn.readSet[key]++;
         } else {
             // grab the lock
-            if (locks.lockForRead(key, id)) {
+            if (locks.lockForRead(key, id, op)) {
                 txn.readSet[key] = 1;
                 return 0;
             } else {
@@ -141,25 +112,34 @@ LockStore::get(uint64_t id, const string &key, string &value)
     }
 }
 
+/*
+ * Undo operations run newest first, so the transaction is just as the
+ * operation left it. Whatever the operation did to the locks --
+ * taking one, joining or leaving a queue -- is undone from the lock
+ * server's journal.
+ */
 void
-LockStore::unget(uint64_t id, const string &key)
+LockStore::unget(uint64_t id, const string &key, opnum_t op)
 {
     Debug("[%" PRIu64 "] UNDO GET %s", id, key.c_str());
 
     if (running.find(id) != running.end()) {
 	Transaction &txn = running[id];
-
-	// if we find this in the read set
-	if (txn.readSet.find(key) != txn.readSet.end()) {
-	    int &read = txn.readSet[key];
-	    if (read > 1) {
-		read--;
+	string value;
+
+	// a self-read or a read of a missing key changed nothing
+	if ((txn.writeSet.find(key) == txn.writeSet.end()) &&
+	    store.get(key, value)) {
+	    auto read = txn.readSet.find(key);
+	    if (read == txn.readSet.end()) {
+		// the read only queued us for the lock
+	    } else if (read->second > 1) {
+		read->second--;
 	    } else {
-		txn.readSet.erase(key);
-		locks.releaseForRead(key, id);
+		txn.readSet.erase(read);
 	    }
 	}
-	// we may not find the read if it was a self-read, etc.
+	locks.rollback(op);
     } else {
 	// we should find the transaction
 	NOT_REACHABLE();
@@ -167,12 +147,13 @@ LockStore::unget(uint64_t id, const string &key)
 }
 
 int
-LockStore::put(uint64_t id, const string &key, const string &value)
+LockStore::put(uint64_t id, const string &key, const string &value,
+               opnum_t op)
 {
     Debug("[%" PRIu64 "] PUT %s %s", id, key.c_str(), value.c_str());
     Transaction &txn = getTxn(id);
 
-    if (locks.lockForWrite(key, id)) {
+    if (locks.lockForWrite(key, id, op)) {
 	// record the write
 	txn.writeSet[key].push_back(value);
 	return 0;
@@ -182,7 +163,8 @@ LockStore::put(uint64_t id, const string &key, const string &value)
 }
 
 void
-LockStore::unput(uint64_t id, const string &key, const string &value)
+LockStore::unput(uint64_t id, const string &key, const string &value,
+                 opnum_t op)
 {
     Debug("[%" PRIu64 "] UNDO PUT %s %s", id, key.c_str(), value.c_str());
 
@@ -193,47 +175,112 @@ LockStore::unput(uint64_t id, const string &key, const string &value)
 	if (writes.back() == value) {
 	    writes.pop_back();
 	    if (writes.empty()) {
-		locks.releaseForWrite(key, id);
+		running[id].writeSet.erase(key);
 	    }
 	} else {
 	    NOT_REACHABLE();
 	}
-    } else {
+    } else if (running.find(id) == running.end()) {
 	NOT_REACHABLE();
     }
+    // otherwise the put didn't get the lock, but may have queued us
+    // for it
+    locks.rollback(op);
 }
 
+/*
+ * Unlogged reads don't take locks, and KVStore keeps no versions to
+ * validate them against at prepare, so they aren't supported with
+ * locking.
+ */
 int
-LockStore::prepare(uint64_t id, opnum_t op)
+LockStore::getVersion(const string &key, string &value, uint64_t &timestamp)
+{
+    Warning("Unlogged reads are not supported with locking");
+    return -1;
+}
+
+int
+LockStore::prepare(uint64_t id, const ReadList &reads,
+                   const WriteList &writes, uint64_t &timestamp,
+                   opnum_t op)
 {    
     Debug("[%" PRIu64 "] START PREPARE", id);
 
-    if (running.find(id) == running.end()) {
+    if (running.find(id) == running.end() &&
+        reads.empty() && writes.empty()) {
         Warning("Could not find transaction [%" PRIu64 "] to prepare", id);
         return -1;
-    } else {
-        Transaction txn = running[id];
+    }
 
-        running.erase(id);
-        prepared[id] = txn;
-        Debug("[%" PRIu64 "] PREPARED TO COMMIT", id);
-        return 0;
+    // the client may only have written to this shard, in which case
+    // it never sent BEGIN
+    Transaction &txn = getTxn(id);
+
+    if (!reads.empty()) {
+        Warning("[%" PRIu64 "] Can't validate unlogged reads with locking", id);
+        abortTxn(id, op);
+        return -1;
+    }
+
+    // lock the buffered writes; if we can't get them all, give back
+    // the ones we did get and abort
+    for (size_t i = 0; i < writes.size(); i++) {
+        if (txn.writeSet.find(writes[i].first) != txn.writeSet.end()) {
+            continue;
+        }
+        if (!locks.lockForWrite(writes[i].first, id, op)) {
+            Debug("[%" PRIu64 "] ABORT could not lock key:%s",
+                  id, writes[i].first.c_str());
+            for (size_t j = 0; j < i; j++) {
+                if (txn.writeSet.find(writes[j].first) == txn.writeSet.end()) {
+                    locks.releaseForWrite(writes[j].first, id, op);
+                }
+            }
+            abortTxn(id, op);
+            return -1;
+        }
+    }
+
+    for (auto &write : writes) {
+        txn.writeSet[write.first].push_back(write.second);
     }
+
+    prepared[id] = std::move(txn);
+    running.erase(id);
+    timestamp = 0;
+    Debug("[%" PRIu64 "] PREPARED TO COMMIT", id);
+    return 0;
 }
 
 void
-LockStore::unprepare(uint64_t id, opnum_t op)
+LockStore::unprepare(uint64_t id, const ReadList &reads,
+                     const WriteList &writes, opnum_t op)
 {
     if (prepared.find(id) != prepared.end()) {
-        // revert back to running
-        running[id] = prepared[id];
+        // revert back to running, dropping the writes that came
+        // with the prepare
+        Transaction txn = std::move(prepared[id]);
         prepared.erase(id);
-    } else {
+        for (auto w = writes.rbegin(); w != writes.rend(); w++) {
+            auto k = txn.writeSet.find(w->first);
+            ASSERT(k != txn.writeSet.end());
+            ASSERT(k->second.back() == w->second);
+            k->second.pop_back();
+            if (k->second.empty()) {
+                txn.writeSet.erase(k);
+            }
+        }
+        running[id] = std::move(txn);
+    } else if (retired.last(op, id) != NULL) {
         // this transaction was aborted during prepare
         // revert back to running
-        Transaction txn = getRetiredTxn(op, id, ABORTED_RUNNING);
-        running[id] = txn;
+        Transaction txn = retired.restore(op, id, ABORTED_RUNNING);
+        running[id] = std::move(txn);
     }
+    // give up the locks the prepare took, and take back any it
+    // dropped in aborting
+    locks.rollback(op);
 }
 
 void
@@ -242,23 +289,48 @@ LockStore::commit(uint64_t id, uint64_t timestamp, opnum_t op)
     Debug("[%" PRIu64 "] COMMIT", id);
     ASSERT(prepared.find(id) != prepared.end());
 
-    Transaction txn = prepared[id];
+    Transaction &txn = prepared[id];
 
     ASSERT(txn.id == id);
 
 
-    for (auto write : txn.writeSet) {
+    for (auto &write : txn.writeSet) {
         bool ret = store.put(write.first, // key
 			     write.second.back()); // value
         ASSERT(ret);
     }
 
     //drop locks
-    dropLocks(txn);
+    dropLocks(txn, op);
 
-    RetiredTxn rTxn(txn, COMMITTED);
+    retired.retire(op, id, txn, COMMITTED);
     prepared.erase(id);
-    retired.push_back(make_pair(op, rTxn));
+}
+
+/*
+ * KVStore keeps no versions, so the timestamp doesn't matter.
+ */
+int
+LockStore::prepareCommit(uint64_t id, const ReadList &reads,
+                         const WriteList &writes, uint64_t &timestamp,
+                         opnum_t op)
+{
+    int status = prepare(id, reads, writes, timestamp, op);
+    if (status == 0) {
+        commit(id, timestamp, op);
+    }
+    return status;
+}
+
+void
+LockStore::unprepareCommit(uint64_t id, const ReadList &reads,
+                           const WriteList &writes, opnum_t op)
+{
+    auto *t = retired.last(op, id);
+    if ((t != NULL) && (t->state == COMMITTED)) {
+        uncommit(id, 0, op);
+    }
+    unprepare(id, reads, writes, op);
 }
 
 void
@@ -267,9 +339,9 @@ LockStore::uncommit(uint64_t id, uint64_t timestamp, opnum_t op)
     // do some uncommit stuff
     Debug("[%" PRIu64 "] UNDO COMMIT", id);
 
-    Transaction txn = getRetiredTxn(op, id, COMMITTED);
+    Transaction txn = retired.restore(op, id, COMMITTED);
 
-    for (auto write : txn.writeSet) {
+    for (auto &write : txn.writeSet) {
         string val;
 	bool ret = store.remove(write.first, val);
 	ASSERT(ret);
@@ -277,29 +349,23 @@ LockStore::uncommit(uint64_t id, uint64_t timestamp, opnum_t op)
     }
 
     // pick up all dropped locks
-    getLocks(txn);
+    locks.rollback(op);
 
     ASSERT(prepared.find(id) == prepared.end());
-    prepared[id] = txn;
+    prepared[id] = std::move(txn);
 }
 
 void
 LockStore::abortTxn(uint64_t id, opnum_t op)
 {
     Debug("[%" PRIu64 "] ABORT", id);
-    Transaction txn;
-
     if (running.find(id) != running.end()) {
-	txn = running[id];
-	dropLocks(txn);
-        RetiredTxn rTxn(txn, ABORTED_RUNNING);
-        retired.push_back(make_pair(op, rTxn));
+	dropLocks(running[id], op);
+        retired.retire(op, id, running[id], ABORTED_RUNNING);
         running.erase(id);
     } else if (prepared.find(id) != prepared.end()) {
-	txn = prepared[id];
-	dropLocks(txn);
-        RetiredTxn rTxn(txn, ABORTED_PREPARED);
-        retired.push_back(make_pair(op, rTxn));
+	dropLocks(prepared[id], op);
+        retired.retire(op, id, prepared[id], ABORTED_PREPARED);
         prepared.erase(id);
     } else {
         NOT_REACHABLE();
@@ -311,34 +377,31 @@ LockStore::unabort(uint64_t id, opnum_t op)
 {
     Debug("[%" PRIu64 "] UNDO ABORT", id);
 
-    pair<opnum_t,RetiredTxn> t = retired.back();
-    RetiredTxn rTxn = t.second;
+    auto *t = retired.last(op, id);
+    ASSERT(t != NULL);
+    RetiredState state = t->state;
+    ASSERT(state == ABORTED_PREPARED || state == ABORTED_RUNNING);
+    Transaction txn = retired.restore(op, id, state);
 
-    ASSERT(t.first == op);
-    ASSERT(rTxn.txn.id == id);
-    ASSERT(rTxn.state == ABORTED_PREPARED || rTxn.state == ABORTED_RUNNING);
+    // pick up all of the dropped locks again, and the places in
+    // lock queues it gave up
+    locks.rollback(op);
 
-    if (rTxn.state == ABORTED_PREPARED) {
+    if (state == ABORTED_PREPARED) {
         ASSERT(prepared.find(id) == prepared.end());
-        prepared[id] = rTxn.txn;
-    } else if (rTxn.state == ABORTED_RUNNING) {
+        prepared[id] = std::move(txn);
+    } else if (state == ABORTED_RUNNING) {
         ASSERT(running.find(id) == running.end());
         // revert transaction state back to running 
-        running[id] = rTxn.txn;
+        running[id] = std::move(txn);
     }
-
-    // pick up all of the dropped locks again
-    getLocks(rTxn.txn);
-
-    retired.pop_back();
 }
 
 void
 LockStore::specCommit(opnum_t op)
 {
-    while ((!retired.empty()) && (retired.front().first <= op)) {
-        retired.pop_front();
-    }
+    retired.prune(op);
+    locks.commit(op);
 }
 
 } // namespace nistore
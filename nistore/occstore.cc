@@ -10,6 +10,9 @@
 #include "lib/assert.h"
 #include "lib/message.h"
 
+// Garbage-collect old versions every GC_INTERVAL operations
+#define GC_INTERVAL 1024
+
 namespace nistore {
 
 using namespace std;
@@ -21,36 +24,49 @@ OCCStore::Transaction::operator==(const Transaction &t)
 }
 
 OCCStore::OCCStore() :
-   store() { }
+   store(), lastGC(0) { }
 OCCStore::~OCCStore() { }
 
-set<string>
-OCCStore::getPreparedWrites()
+// Move txn into the prepared set
+void
+OCCStore::addPrepared(uint64_t id, Transaction &txn)
 {
-    // gather up the set of all writes that we are currently prepared for
-    set<string> writes;
-    for (auto &t : prepared) {
-        for (auto &write : t.second.writeSet) {
-            writes.insert(write.first);
-        }
+    ASSERT(prepared.find(id) == prepared.end());
+    for (auto &read : txn.readSet) {
+        preparedKeys[read.first].reads++;
+    }
+    for (auto &write : txn.writeSet) {
+        preparedKeys[write.first].writes++;
     }
-    return writes;
+    prepared[id] = std::move(txn);
 }
 
-set<string>
-OCCStore::getPreparedReadWrites()
+// Take a transaction out of the prepared set
+OCCStore::Transaction
+OCCStore::removePrepared(uint64_t id)
 {
-    // gather up the set of all writes that we are currently prepared for
-    set<string> readwrites;
-    for (auto &t : prepared) {
-        for (auto &write : t.second.writeSet) {
-            readwrites.insert(write.first);
+    auto it = prepared.find(id);
+    ASSERT(it != prepared.end());
+    Transaction txn = std::move(it->second);
+    prepared.erase(it);
+
+    for (auto &read : txn.readSet) {
+        auto k = preparedKeys.find(read.first);
+        ASSERT(k != preparedKeys.end());
+        ASSERT(k->second.reads > 0);
+        if ((--k->second.reads == 0) && (k->second.writes == 0)) {
+            preparedKeys.erase(k);
         }
-        for (auto &read : t.second.readSet) {
-            readwrites.insert(read.first);
+    }
+    for (auto &write : txn.writeSet) {
+        auto k = preparedKeys.find(write.first);
+        ASSERT(k != preparedKeys.end());
+        ASSERT(k->second.writes > 0);
+        if ((--k->second.writes == 0) && (k->second.reads == 0)) {
+            preparedKeys.erase(k);
         }
     }
-    return readwrites;
+    return txn;
 }
 
 // Gets the running transaction. Creates one if there isn't one for this client
@@ -67,21 +83,6 @@ OCCStore::getTxn(uint64_t id)
     return running[id];
 }
 
-OCCStore::Transaction
-OCCStore::getRetiredTxn(opnum_t op, uint64_t id, RetiredState state)
-{
-    pair<opnum_t,RetiredTxn> t = retired.back();
-    RetiredTxn rTxn = t.second;
-
-    ASSERT(t.first == op);
-    ASSERT(rTxn.txn.id == id);
-    ASSERT(rTxn.state == state);
-
-    retired.pop_back();
-    return rTxn.txn;
-}
-
-    
 void
 OCCStore::begin(uint64_t id)
 {
@@ -100,7 +101,8 @@ OCCStore::unbegin(uint64_t id)
 }
 
 int
-OCCStore::get(uint64_t id, const string &key, string &value)
+OCCStore::get(uint64_t id, const string &key, string &value,
+              opnum_t op)
 {
     Debug("[%" PRIu64 "] GET %s", id, key.c_str());
 
@@ -141,7 +143,7 @@ OCCStore::get(uint64_t id, const string &key, string &value)
 }
 
 void
-OCCStore::unget(uint64_t id, const string &key)
+OCCStore::unget(uint64_t id, const string &key, opnum_t op)
 {
     Debug("[%" PRIu64 "] UNDO GET %s", id, key.c_str());
 
@@ -160,7 +162,8 @@ OCCStore::unget(uint64_t id, const string &key)
 }
 
 int
-OCCStore::put(uint64_t id, const string &key, const string &value)
+OCCStore::put(uint64_t id, const string &key, const string &value,
+              opnum_t op)
 {
     Debug("[%" PRIu64 "] PUT %s %s", id, key.c_str(), value.c_str());
     Transaction &txn = getTxn(id);
@@ -171,7 +174,8 @@ OCCStore::put(uint64_t id, const string &key, const string &value)
 }
 
 void
-OCCStore::unput(uint64_t id, const string &key, const string &value)
+OCCStore::unput(uint64_t id, const string &key, const string &value,
+                opnum_t op)
 {
     Debug("[%" PRIu64 "] UNDO PUT %s %s", id, key.c_str(), value.c_str());
     Transaction &txn = getTxn(id);
@@ -184,77 +188,144 @@ OCCStore::unput(uint64_t id, const string &key, const string &value)
 }
 
 int
-OCCStore::prepare(uint64_t id, opnum_t op)
+OCCStore::getVersion(const string &key, string &value, uint64_t &timestamp)
+{
+    Debug("GET VERSION %s", key.c_str());
+
+    pair<uint64_t, string> val;
+    if (!store.get(key, val)) {
+        return -1;
+    }
+    timestamp = val.first;
+    value = val.second;
+    return 0;
+}
+
+int
+OCCStore::prepare(uint64_t id, const ReadList &reads,
+                  const WriteList &writes, uint64_t &timestamp, opnum_t op)
 {    
     Debug("[%" PRIu64 "] START PREPARE", id);
 
-    if (running.find(id) == running.end()) {
-        Notice("Could not find transaction [%" PRIu64 "] to prepare", id);
-        return -1;
-    } else {
-        Transaction txn = running[id];
+    auto it = running.find(id);
+    if (it == running.end()) {
+        if (reads.empty() && writes.empty()) {
+            Notice("Could not find transaction [%" PRIu64 "] to prepare", id);
+            return -1;
+        }
+        // the client never sent a logged operation to this shard, so
+        // never sent BEGIN
+        it = running.insert(make_pair(id, Transaction(id))).first;
+    }
 
-        // do OCC checks
-        set<string> pWrites = getPreparedWrites();
-        set<string> pRW = getPreparedReadWrites();
+    Transaction &txn = it->second;
+    // unlogged reads are validated just like logged ones, except
+    // that if the client saw two versions of a key, one of them
+    // can't be current
+    bool mismatch = false;
+    for (auto &read : reads) {
+        auto r = txn.readSet.find(read.first);
+        if (r == txn.readSet.end()) {
+            txn.readSet[read.first] = make_pair(read.second, 1);
+        } else {
+            mismatch |= (r->second.first != read.second);
+            r->second.second++;
+        }
+    }
+    for (auto &write : writes) {
+        txn.writeSet[write.first].push_back(write.second);
+    }
 
-        // check for conflicts with the read set
-        for (auto read : txn.readSet) {
-            pair<uint64_t, string> cur;
-	    bool ret = store.get(read.first, cur);
+    if (mismatch) {
+        Debug("[%" PRIu64 "] ABORT read two versions", id);
+        abortTxn(id, op);
+        return -1;
+    }
 
-	    ASSERT(ret);
+    // do OCC checks; abortTxn invalidates txn, so return
+    // right after calling it
 
-            // if this key has been written since we read it, abort
-            if (cur.first != read.second.first) {
-                Debug("[%" PRIu64 "] ABORT rw conflict key:%s",
-                        id, read.first.c_str());
+    // check for conflicts with the read set
+    for (auto &read : txn.readSet) {
+        pair<uint64_t, string> cur;
+        bool ret = store.get(read.first, cur);
 
-                abortTxn(id, op);
-                return -1;
-            }
+        // if this key has been written (or, after a rollback,
+        // removed) since we read it, abort
+        if (!ret || (cur.first != read.second.first)) {
+            Debug("[%" PRIu64 "] ABORT rw conflict key:%s",
+                    id, read.first.c_str());
 
-            //if there is a pending write for this key, abort
-            if (pWrites.find(read.first) != pWrites.end()) {
-                Debug("[%" PRIu64 "] ABORT rw conflict w/ prepared key:%s",
-                        id, read.first.c_str());
-                abortTxn(id, op);
-                return -1;
-            }
+            abortTxn(id, op);
+            return -1;
         }
 
-        // check for conflicts with the write set
-        for (auto write : txn.writeSet) {
-            //if there is a pending read or write for this key, abort
-            if (pRW.find(write.first) != pRW.end()) {
-                Debug("[%" PRIu64 "] ABORT ww conflict w/ prepared key:%s", 
-                        id, write.first.c_str());
-                abortTxn(id, op);
-                return -1;
-            }
+        //if there is a pending write for this key, abort
+        auto k = preparedKeys.find(read.first);
+        if ((k != preparedKeys.end()) && (k->second.writes > 0)) {
+            Debug("[%" PRIu64 "] ABORT rw conflict w/ prepared key:%s",
+                    id, read.first.c_str());
+            abortTxn(id, op);
+            return -1;
         }
+    }
 
-        // Otherwise, prepare this transaction for commit
-        running.erase(id);
-        prepared[id] = txn;
-        Debug("[%" PRIu64 "] PREPARED TO COMMIT", id);
-        return 0;
+    // check for conflicts with the write set
+    for (auto &write : txn.writeSet) {
+        //if there is a pending read or write for this key, abort
+        if (preparedKeys.find(write.first) != preparedKeys.end()) {
+            Debug("[%" PRIu64 "] ABORT ww conflict w/ prepared key:%s", 
+                    id, write.first.c_str());
+            abortTxn(id, op);
+            return -1;
+        }
     }
+
+    // Otherwise, prepare this transaction for commit. Its keys can't
+    // get new versions while it is prepared, so the earliest
+    // timestamp it can commit at stays the same until it does.
+    timestamp = minTimestamp(txn);
+    addPrepared(id, txn);
+    running.erase(it);
+    Debug("[%" PRIu64 "] PREPARED TO COMMIT", id);
+    return 0;
 }
 
 void
-OCCStore::unprepare(uint64_t id, opnum_t op)
+OCCStore::unprepare(uint64_t id, const ReadList &reads,
+                    const WriteList &writes, opnum_t op)
 {
+    Transaction txn;
     if (prepared.find(id) != prepared.end()) {
-        // revert back to running
-        running[id] = prepared[id];
-        prepared.erase(id);
-    } else {
+        txn = removePrepared(id);
+    } else if (retired.last(op, id) != NULL) {
         // this transaction was aborted during prepare
-        // revert back to running
-        Transaction txn = getRetiredTxn(op, id, ABORTED_RUNNING);
-        running[id] = txn;
+        txn = retired.restore(op, id, ABORTED_RUNNING);
+    } else {
+        // there was nothing to prepare
+        return;
     }
+
+    // take back the reads and writes that came with the prepare
+    for (auto w = writes.rbegin(); w != writes.rend(); w++) {
+        auto k = txn.writeSet.find(w->first);
+        ASSERT(k != txn.writeSet.end());
+        ASSERT(k->second.back() == w->second);
+        k->second.pop_back();
+        if (k->second.empty()) {
+            txn.writeSet.erase(k);
+        }
+    }
+    for (auto r = reads.rbegin(); r != reads.rend(); r++) {
+        auto k = txn.readSet.find(r->first);
+        ASSERT(k != txn.readSet.end());
+        if (--k->second.second == 0) {
+            txn.readSet.erase(k);
+        }
+    }
+
+    // revert back to running
+    running[id] = std::move(txn);
 }
 
 void
@@ -263,20 +334,65 @@ OCCStore::commit(uint64_t id, uint64_t timestamp, opnum_t op)
     Debug("[%" PRIu64 "] COMMIT", id);
     ASSERT(prepared.find(id) != prepared.end());
 
-    Transaction txn = prepared[id];
+    Transaction txn = removePrepared(id);
 
     ASSERT(txn.id == id);
 
-    for (auto write : txn.writeSet) {
+    ASSERT(timestamp >= minTimestamp(txn));
+    txn.timestamp = timestamp;
+    for (auto &write : txn.writeSet) {
         bool ret = store.put(write.first, // key
                 write.second.back(), // value
-                timestamp); // timestamp
+                txn.timestamp); // timestamp
         ASSERT(ret);
     }
 
-    RetiredTxn rTxn(txn, COMMITTED);
-    prepared.erase(id);
-    retired.push_back(make_pair(op, rTxn));
+    retired.retire(op, id, txn, COMMITTED);
+}
+
+/*
+ * The versions of a key have to be in commit order, and a
+ * transaction's timestamp should follow everything it saw, so it
+ * can't commit before just past the newest version it read or
+ * overwrites.
+ */
+uint64_t
+OCCStore::minTimestamp(const Transaction &txn)
+{
+    uint64_t timestamp = 0;
+    for (auto &read : txn.readSet) {
+        timestamp = max(timestamp, read.second.first + 1);
+    }
+    for (auto &write : txn.writeSet) {
+        pair<uint64_t, string> cur;
+        if (store.get(write.first, cur)) {
+            timestamp = max(timestamp, cur.first + 1);
+        }
+    }
+    return timestamp;
+}
+
+int
+OCCStore::prepareCommit(uint64_t id, const ReadList &reads,
+                        const WriteList &writes, uint64_t &timestamp,
+                        opnum_t op)
+{
+    int status = prepare(id, reads, writes, timestamp, op);
+    if (status == 0) {
+        commit(id, timestamp, op);
+    }
+    return status;
+}
+
+void
+OCCStore::unprepareCommit(uint64_t id, const ReadList &reads,
+                          const WriteList &writes, opnum_t op)
+{
+    auto *t = retired.last(op, id);
+    if ((t != NULL) && (t->state == COMMITTED)) {
+        uncommit(id, t->txn.timestamp, op);
+    }
+    unprepare(id, reads, writes, op);
 }
 
 void
@@ -285,18 +401,17 @@ OCCStore::uncommit(uint64_t id, uint64_t timestamp, opnum_t op)
     // do some uncommit stuff
     Debug("[%" PRIu64 "] UNDO COMMIT", id);
 
-    Transaction txn = getRetiredTxn(op, id, COMMITTED);
+    Transaction txn = retired.restore(op, id, COMMITTED);
 
-    for (auto write : txn.writeSet) {
+    for (auto &write : txn.writeSet) {
         pair<uint64_t, string> val;
 	bool ret = store.remove(write.first, val);
 	ASSERT(ret);
-        ASSERT(val.first == timestamp);
+        ASSERT(val.first == txn.timestamp);
         ASSERT(val.second == write.second.back());
     }
 
-    ASSERT(prepared.find(id) == prepared.end());
-    prepared[id] = txn;
+    addPrepared(id, txn);
 }
 
 void
@@ -304,15 +419,13 @@ OCCStore::abortTxn(uint64_t id, opnum_t op)
 {
     Debug("[%" PRIu64 "] ABORT", id);
 
-    if (running.find(id) != running.end()) {
-        RetiredTxn txn(running[id], ABORTED_RUNNING);
-        retired.push_back(make_pair(op, txn));
-        running.erase(id);
+    auto it = running.find(id);
+    if (it != running.end()) {
+        retired.retire(op, id, it->second, ABORTED_RUNNING);
+        running.erase(it);
     } else if (prepared.find(id) != prepared.end()) {
-        RetiredTxn txn(prepared[id], ABORTED_PREPARED);
-        retired.push_back(make_pair(op, txn));
-        prepared.erase(id);
-        //ASSERT(found);
+        Transaction txn = removePrepared(id);
+        retired.retire(op, id, txn, ABORTED_PREPARED);
     } else {
         NOT_REACHABLE();
     }
@@ -323,31 +436,60 @@ OCCStore::unabort(uint64_t id, opnum_t op)
 {
     Debug("[%" PRIu64 "] UNDO ABORT", id);
 
-    pair<opnum_t,RetiredTxn> t = retired.back();
-    RetiredTxn rTxn = t.second;
+    auto *t = retired.last(op, id);
+    ASSERT(t != NULL);
+    RetiredState state = t->state;
+    ASSERT(state == ABORTED_PREPARED || state == ABORTED_RUNNING);
+    Transaction txn = retired.restore(op, id, state);
 
-    ASSERT(t.first == op);
-    ASSERT(rTxn.txn.id == id);
-    ASSERT(rTxn.state == ABORTED_PREPARED || rTxn.state == ABORTED_RUNNING);
-
-    if (rTxn.state == ABORTED_PREPARED) {
-        ASSERT(prepared.find(id) == prepared.end());
-        prepared[id] = rTxn.txn;
-    } else if (rTxn.state == ABORTED_RUNNING) {
+    if (state == ABORTED_PREPARED) {
+        addPrepared(id, txn);
+    } else if (state == ABORTED_RUNNING) {
         ASSERT(running.find(id) == running.end());
         // revert transaction state back to running 
-        running[id] = rTxn.txn;
+        running[id] = std::move(txn);
     }
-
-    retired.pop_back();
 }
 
 void
 OCCStore::specCommit(opnum_t op)
 {
-    while ((!retired.empty()) && (retired.front().first <= op)) {
-        retired.pop_front();
+    retired.prune(op);
+
+    if (op >= lastGC + GC_INTERVAL) {
+        store.gc(gcTimestamp());
+        lastGC = op;
+    }
+}
+
+// Oldest version timestamp that must survive garbage collection:
+// the oldest that any transaction has read and might read again,
+// including ones that a rollback could bring back, and the versions
+// that speculative commits overwrote, which come back if the commit
+// is rolled back
+uint64_t
+OCCStore::gcTimestamp()
+{
+    uint64_t oldest = UINT64_MAX;
+    auto check = [&oldest](const Transaction &txn) {
+        for (auto &read : txn.readSet) {
+            oldest = min(oldest, read.second.first);
+        }
+    };
+
+    for (auto &t : running) {
+        check(t.second);
     }
+    for (auto &t : prepared) {
+        check(t.second);
+    }
+    retired.forEach([&](const decltype(retired)::Entry &e) {
+            check(e.txn);
+            if ((e.state == COMMITTED) && (e.txn.timestamp > 0)) {
+                oldest = min(oldest, e.txn.timestamp - 1);
+            }
+        });
+    return oldest;
 }
 
 } // namespace nistore
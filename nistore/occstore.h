@@ -11,6 +11,7 @@
 #define _NI_OCC_STORE_H_
 
 #include "nistore/versionedKVStore.h"
+#include "nistore/retired.h"
 #include "nistore/txnstore.h"
 #include "lib/viewstamp.h"
 #include <vector>
@@ -32,23 +33,42 @@ public:
     // begin a transaction
     virtual void begin(uint64_t id);
     // add key to read set
-    virtual int get(uint64_t id, const string &key, string &value);
+    virtual int get(uint64_t id, const string &key, string &value,
+                    opnum_t op);
     // add key to write set
-    virtual int put(uint64_t id, const string &key, const string &value);
-    // check whether we can commit or abort this transaction
-    // and lock the read/write set
-    virtual int prepare(uint64_t id, opnum_t op);
-    // commit the transaction
+    virtual int put(uint64_t id, const string &key, const string &value,
+                    opnum_t op);
+    // read the latest version of key outside of any transaction
+    virtual int getVersion(const string &key, string &value,
+                           uint64_t &timestamp);
+    // add the unlogged reads to the read set and the buffered
+    // writes to the write set, then check whether we can commit or
+    // abort this transaction and lock the read/write set; a YES vote
+    // comes with the earliest timestamp the transaction can commit at
+    virtual int prepare(uint64_t id, const ReadList &reads,
+                        const WriteList &writes, uint64_t &timestamp,
+                        opnum_t op);
+    // commit the transaction at timestamp, no earlier than the one
+    // every participant's prepare returned
     virtual void commit(uint64_t id, uint64_t timestamp, opnum_t op);
+    // prepare and, if that succeeds, commit at a timestamp chosen
+    // here, for transactions with no other participants
+    virtual int prepareCommit(uint64_t id, const ReadList &reads,
+                              const WriteList &writes,
+                              uint64_t &timestamp, opnum_t op);
     // abort a running transaction
     virtual void abortTxn(uint64_t id, opnum_t op);
 
     // undo operations from Spec Paxos
     virtual void unbegin(uint64_t id);
-    virtual void unget(uint64_t id, const string &key);
-    virtual void unput(uint64_t id, const string &key, const string &value);
-    virtual void unprepare(uint64_t id, opnum_t op);
+    virtual void unget(uint64_t id, const string &key, opnum_t op);
+    virtual void unput(uint64_t id, const string &key, const string &value,
+                       opnum_t op);
+    virtual void unprepare(uint64_t id, const ReadList &reads,
+                           const WriteList &writes, opnum_t op);
     virtual void uncommit(uint64_t id, uint64_t timestamp, opnum_t op);
+    virtual void unprepareCommit(uint64_t id, const ReadList &reads,
+                                 const WriteList &writes, opnum_t op);
     virtual void unabort(uint64_t id, opnum_t op);
 
     // upcall from Spec Paxos to clean up
@@ -62,6 +82,8 @@ private:
     // may be running or prepared
     struct Transaction {
         uint64_t id;
+        // timestamp the transaction committed at, once it has
+        uint64_t timestamp;
         // map between key and timestamp at
         // which the read happened and how
         // many times this key has been read
@@ -69,8 +91,8 @@ private:
         // map between key and value(s)
         map<string, list<string>> writeSet;
 
-        Transaction() : id(0) { };
-        Transaction(uint64_t i) : id(i) { };
+        Transaction() : id(0), timestamp(0) { };
+        Transaction(uint64_t i) : id(i), timestamp(0) { };
 
         bool operator== (const Transaction &t);
     };
@@ -81,22 +103,28 @@ private:
         ABORTED_RUNNING
     };
 
-    struct RetiredTxn {
-        Transaction txn;
-        RetiredState state;
+    // number of prepared transactions that have read
+    // and written each key
+    struct PreparedKey {
+        int reads;
+        int writes;
 
-        RetiredTxn(Transaction t, RetiredState s) : 
-            txn(t), state(s) { };
+        PreparedKey() : reads(0), writes(0) { };
     };
 
     map<uint64_t,Transaction> running;
+    // only change through addPrepared/removePrepared,
+    // which keep preparedKeys up to date
     map<uint64_t,Transaction> prepared;
-    list<pair<opnum_t,RetiredTxn>> retired;
+    unordered_map<string,PreparedKey> preparedKeys;
+    RetiredTxns<Transaction,RetiredState> retired;
+    opnum_t lastGC;
 
-    set<string> getPreparedWrites();
-    set<string> getPreparedReadWrites();
+    void addPrepared(uint64_t id, Transaction &txn);
+    Transaction removePrepared(uint64_t id);
     Transaction& getTxn(uint64_t id);
-    Transaction getRetiredTxn(opnum_t op, uint64_t id, RetiredState state);
+    uint64_t gcTimestamp();
+    uint64_t minTimestamp(const Transaction &txn);
 };
 
 } // namespace nistore
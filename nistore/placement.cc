@@ -0,0 +1,214 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+// vim: set ts=4 sw=4:
+/***********************************************************************
+ *
+ * nistore/placement.cc:
+ *   Mapping of keys to shards
+ *
+ **********************************************************************/
+
+#include "nistore/placement.h"
+#include "lib/assert.h"
+#include "lib/hash.h"
+
+#include <algorithm>
+
+namespace nistore {
+
+HashPlacement::HashPlacement(int nshards)
+    : Placement(nshards)
+{
+    ASSERT(nshards > 0);
+}
+
+int
+HashPlacement::KeyToShard(const string &key) const
+{
+    uint64_t h = ((uint64_t)::hash(key.data(), key.size(), 0) << 32) |
+        ::hash(key.data(), key.size(), 1);
+    return JumpConsistentHash(h, nshards);
+}
+
+/* Lamping and Veach, "A Fast, Minimal Memory, Consistent Hash
+ * Algorithm". */
+int
+HashPlacement::JumpConsistentHash(uint64_t key, int nbuckets)
+{
+    int64_t b = -1, j = 0;
+    while (j < nbuckets) {
+        b = j;
+        key = key * 2862933555777941757ULL + 1;
+        j = (b + 1) * (double(1LL << 31) / double((key >> 33) + 1));
+    }
+    return b;
+}
+
+RangePlacement::RangePlacement(int nshards, vector<string> sample)
+    : Placement(nshards)
+{
+    ASSERT(nshards > 0);
+
+    sort(sample.begin(), sample.end());
+    sample.erase(unique(sample.begin(), sample.end()), sample.end());
+
+    ranges.push_back(Range{"", 0});
+    for (int i = 1; i < nshards; i++) {
+        size_t at = sample.size() * i / nshards;
+        if ((at == 0) || (at >= sample.size()) ||
+            (sample[at] <= ranges.back().start)) {
+            // Too few sample keys to give this shard a range.
+            continue;
+        }
+        ranges.push_back(Range{sample[at], i});
+    }
+}
+
+RangePlacement::RangePlacement(int nshards, istream &in)
+    : Placement(nshards)
+{
+    string line;
+    while (getline(in, line)) {
+        if (line.empty()) {
+            continue;
+        }
+        size_t sp = line.find(' ');
+        if (sp == string::npos) {
+            Panic("Bad shard map line: %s", line.c_str());
+        }
+        Range r;
+        r.shard = atoi(line.substr(0, sp).c_str());
+        r.start = line.substr(sp+1);
+        if ((r.shard < 0) || (r.shard >= nshards)) {
+            Panic("Shard map names shard %d of %d", r.shard, nshards);
+        }
+        if (ranges.empty() ? !r.start.empty()
+                           : (r.start <= ranges.back().start)) {
+            Panic("Shard map is out of order at: %s", line.c_str());
+        }
+        ranges.push_back(r);
+    }
+
+    if (ranges.empty()) {
+        Panic("Empty shard map");
+    }
+}
+
+size_t
+RangePlacement::findRange(const string &key) const
+{
+    // Last range starting at or before key.
+    size_t lo = 0, hi = ranges.size();
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (ranges[mid].start <= key) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+int
+RangePlacement::KeyToShard(const string &key) const
+{
+    return ranges[findRange(key)].shard;
+}
+
+void
+RangePlacement::Split(const string &at, int shard)
+{
+    ASSERT((shard >= 0) && (shard < nshards));
+
+    size_t i = findRange(at);
+    if (ranges[i].start == at) {
+        ranges[i].shard = shard;
+    } else {
+        ranges.insert(ranges.begin() + ++i, Range{at, shard});
+    }
+
+    // Merge with neighbours on the same shard.
+    if ((i + 1 < ranges.size()) && (ranges[i+1].shard == shard)) {
+        ranges.erase(ranges.begin() + i + 1);
+    }
+    if ((i > 0) && (ranges[i-1].shard == shard)) {
+        ranges.erase(ranges.begin() + i);
+    }
+}
+
+bool
+RangePlacement::SplitHottest(const map<string, uint64_t> &load)
+{
+    vector<uint64_t> rangeLoad(ranges.size(), 0);
+    vector<uint64_t> shardLoad(nshards, 0);
+    for (auto &kv : load) {
+        size_t i = findRange(kv.first);
+        rangeLoad[i] += kv.second;
+        shardLoad[ranges[i].shard] += kv.second;
+    }
+
+    // The hottest range on the busiest shard.
+    int busy = max_element(shardLoad.begin(), shardLoad.end()) -
+        shardLoad.begin();
+    int cold = min_element(shardLoad.begin(), shardLoad.end()) -
+        shardLoad.begin();
+    size_t hot = 0;
+    for (size_t i = 0; i < ranges.size(); i++) {
+        if ((ranges[i].shard == busy) &&
+            ((ranges[hot].shard != busy) || (rangeLoad[i] > rangeLoad[hot]))) {
+            hot = i;
+        }
+    }
+    if ((rangeLoad[hot] == 0) || (cold == busy)) {
+        return false;
+    }
+
+    // Move enough of the range to even out its shard and the cold
+    // one, splitting just before or just after the key that gets the
+    // part moved closest to that.
+    uint64_t total = rangeLoad[hot];
+    uint64_t excess = shardLoad[busy] - shardLoad[cold];
+    uint64_t move = min(total, excess) / 2;
+    if (move == 0) {
+        return false;
+    }
+    uint64_t keep = total - move;
+
+    auto it = load.lower_bound(ranges[hot].start);
+    uint64_t below = 0;
+    while (below + it->second < keep) {
+        below += it->second;
+        ++it;
+    }
+    uint64_t w = it->second;
+    auto after = next(it);
+
+    string at;
+    uint64_t best = total;
+    if (below > 0) {
+        best = keep - below;
+        at = it->first;
+    }
+    if ((after != load.end()) && (findRange(after->first) == hot) &&
+        (below + w < total) && (below + w - keep < best)) {
+        best = below + w - keep;
+        at = after->first;
+    }
+    if (at.empty()) {
+        // The range's load is all on one key.
+        return false;
+    }
+
+    Split(at, cold);
+    return true;
+}
+
+void
+RangePlacement::Write(ostream &out) const
+{
+    for (auto &r : ranges) {
+        out << r.shard << " " << r.start << "\n";
+    }
+}
+
+} // namespace nistore
@@ -0,0 +1,89 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+// vim: set ts=4 sw=4:
+/***********************************************************************
+ *
+ * nistore/placement.h:
+ *   Mapping of keys to shards
+ *
+ **********************************************************************/
+
+#ifndef _NI_PLACEMENT_H_
+#define _NI_PLACEMENT_H_
+
+#include <stdint.h>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace nistore {
+
+using namespace std;
+
+/* Decides which shard stores each key. Every client of a store has to
+ * use the same placement. */
+class Placement
+{
+public:
+    Placement(int nshards) : nshards(nshards) { };
+    virtual ~Placement() { };
+
+    int NumShards() const { return nshards; };
+    virtual int KeyToShard(const string &key) const = 0;
+
+protected:
+    int nshards;
+};
+
+/* Hashes keys with lookup3 and spreads the hashes with jump consistent
+ * hashing, so that going from n to n+1 shards only moves 1/(n+1) of
+ * the keys. */
+class HashPlacement : public Placement
+{
+public:
+    HashPlacement(int nshards);
+
+    int KeyToShard(const string &key) const;
+
+    static int JumpConsistentHash(uint64_t key, int nbuckets);
+};
+
+/* Splits the key space into ranges, ordered by their first key, each
+ * stored on one shard. A shard can hold any number of ranges, so load
+ * can be moved by splitting a hot range and handing part of it to
+ * another shard. */
+class RangePlacement : public Placement
+{
+public:
+    // Ranges holding about the same number of the sample keys.
+    RangePlacement(int nshards, vector<string> sample);
+    // Reads a shard map written by Write.
+    RangePlacement(int nshards, istream &in);
+
+    int KeyToShard(const string &key) const;
+
+    size_t NumRanges() const { return ranges.size(); };
+    // Stores the keys from at up to the next range on shard.
+    void Split(const string &at, int shard);
+    /* Given the load on each key, splits the range with the most
+     * load in half by load and moves the upper half to the least
+     * loaded shard. Returns false if there is nothing worth
+     * splitting. */
+    bool SplitHottest(const map<string, uint64_t> &load);
+    // One range per line: the shard, a space, then its first key.
+    void Write(ostream &out) const;
+
+private:
+    struct Range {
+        string start;
+        int shard;
+    };
+    // Sorted by start; the first range starts at "".
+    vector<Range> ranges;
+
+    size_t findRange(const string &key) const;
+};
+
+} // namespace nistore
+
+#endif /* _NI_PLACEMENT_H_ */
@@ -0,0 +1,101 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+// vim: set ts=4 sw=4:
+/***********************************************************************
+ *
+ * nistore/retired.h:
+ *   Committed and aborted transactions kept around for rollback
+ *
+ **********************************************************************/
+
+#ifndef _NI_RETIRED_H_
+#define _NI_RETIRED_H_
+
+#include "lib/assert.h"
+#include "lib/viewstamp.h"
+#include <deque>
+#include <utility>
+
+namespace nistore {
+
+using namespace std;
+
+/* Transactions retired (committed or aborted) by each operation, in
+ * operation order, kept until that operation commits in case it is
+ * rolled back. Rollback undoes operations newest first, so the
+ * transaction an undo is looking for is always the newest one. */
+template <class TXN, class STATE>
+class RetiredTxns
+{
+public:
+    struct Entry {
+        opnum_t op;
+        uint64_t id;
+        STATE state;
+        TXN txn;
+    };
+
+    // Operation op retired txn, which is moved from
+    void
+    retire(opnum_t op, uint64_t id, TXN &txn, STATE state)
+    {
+        ASSERT(entries.empty() || (entries.back().op <= op));
+        entries.push_back(Entry());
+        Entry &e = entries.back();
+        e.op = op;
+        e.id = id;
+        e.state = state;
+        e.txn = std::move(txn);
+    }
+
+    // The transaction operation op retired, if it was the last one
+    // to retire anything
+    Entry *
+    last(opnum_t op, uint64_t id)
+    {
+        if (entries.empty() ||
+            (entries.back().op != op) || (entries.back().id != id)) {
+            return NULL;
+        }
+        return &entries.back();
+    }
+
+    // Take back the transaction that op retired, which must be the
+    // newest one
+    TXN
+    restore(opnum_t op, uint64_t id, STATE state)
+    {
+        Entry *e = last(op, id);
+        ASSERT(e != NULL);
+        ASSERT(e->state == state);
+        TXN txn = std::move(e->txn);
+        entries.pop_back();
+        return txn;
+    }
+
+    // Operations up to op have committed, so nothing they retired
+    // will come back
+    void
+    prune(opnum_t op)
+    {
+        while (!entries.empty() && (entries.front().op <= op)) {
+            entries.pop_front();
+        }
+    }
+
+    size_t size() const { return entries.size(); };
+
+    template <class F> void
+    forEach(F f) const
+    {
+        for (const Entry &e : entries) {
+            f(e);
+        }
+    }
+
+private:
+    deque<Entry> entries;
+};
+
+} // namespace nistore
+
+#endif /* _NI_RETIRED_H_ */
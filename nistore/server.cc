@@ -13,6 +13,33 @@ namespace nistore {
 
 using namespace specpaxos;
 
+Server::Server(bool locking)
+{
+    if (locking) {
+        store = new LockStore();
+    } else {
+        store = new OCCStore();
+    }
+}
+
+Server::~Server()
+{
+    delete store;
+}
+
+static void
+getReadsWrites(const Request &request, ReadList &reads, WriteList &writes)
+{
+    reads.reserve(request.reads_size());
+    for (const auto &r : request.reads()) {
+        reads.push_back(make_pair(r.key(), r.timestamp()));
+    }
+    writes.reserve(request.writes_size());
+    for (const auto &w : request.writes()) {
+        writes.push_back(make_pair(w.key(), w.value()));
+    }
+}
+
 void
 Server::ReplicaUpcall(opnum_t opnum, const string &str1, string &str2)
 {
@@ -25,36 +52,61 @@ Server::ReplicaUpcall(opnum_t opnum, const string &str1, string &str2)
     switch (request.op()) {
 
     case Request::BEGIN:
-        store.begin(request.txnid());
+        store->begin(request.txnid());
         reply.set_status(0);
         break;
 
     case Request::GET:
     {
         string val;
-        status = store.get(request.txnid(), request.arg0(), val);
+        status = store->get(request.txnid(), request.arg0(), val, opnum);
         reply.set_value(val);            
         break;
     }
 
     case Request::PUT:
-        status = store.put(request.txnid(), request.arg0(), request.arg1());
+        status = store->put(request.txnid(), request.arg0(), request.arg1(),
+                            opnum);
         break;
 
     case Request::PREPARE:
-        status = store.prepare(request.txnid(), opnum);
+    {
+        ReadList reads;
+        WriteList writes;
+        uint64_t timestamp = 0;
+        getReadsWrites(request, reads, writes);
+        status = store->prepare(request.txnid(), reads, writes,
+                                timestamp, opnum);
+        if (status == 0) {
+            reply.set_timestamp(timestamp);
+        }
         break;
+    }
 
     case Request::COMMIT:
     {
         long timestamp = stol(request.arg0());
-        store.commit(request.txnid(), timestamp, opnum);
+        store->commit(request.txnid(), timestamp, opnum);
         status = 0;
         break;
     }
 
+    case Request::PREPARE_COMMIT:
+    {
+        ReadList reads;
+        WriteList writes;
+        uint64_t timestamp = 0;
+        getReadsWrites(request, reads, writes);
+        status = store->prepareCommit(request.txnid(), reads, writes,
+                                      timestamp, opnum);
+        if (status == 0) {
+            reply.set_timestamp(timestamp);
+        }
+        break;
+    }
+
     case Request::ABORT:
-        store.abortTxn(request.txnid(), opnum);
+        store->abortTxn(request.txnid(), opnum);
         status = 0;
 	break;
 	
@@ -66,41 +118,57 @@ Server::ReplicaUpcall(opnum_t opnum, const string &str1, string &str2)
 }
 
 void
-Server::RollbackUpcall(opnum_t current, opnum_t to, const std::map<opnum_t, string> &opMap)
+Server::RollbackUpcall(opnum_t current, opnum_t to, const specpaxos::RollbackOps &ops)
 {
-    for (auto rit = opMap.rbegin(); rit != opMap.rend(); rit++) {
-        Request request;
-        opnum_t opnum = rit->first;
+    // Undo operations newest first
+    Request request;
+    for (const auto &x : ops) {
+        opnum_t opnum = x.opnum;
 
-        request.ParseFromString(rit->second);
+        request.ParseFromString(x.op);
 
         switch (request.op()) {
 
         case Request::BEGIN:
-            store.unbegin(request.txnid());
+            store->unbegin(request.txnid());
             break;
 
         case Request::GET:
-            store.unget(request.txnid(), request.arg0());
+            store->unget(request.txnid(), request.arg0(), opnum);
             break;
 
         case Request::PUT:
-            store.unput(request.txnid(), request.arg0(), request.arg1());
+            store->unput(request.txnid(), request.arg0(), request.arg1(),
+                          opnum);
             break;
 
         case Request::PREPARE:
-            store.unprepare(request.txnid(), opnum);
+        {
+            ReadList reads;
+            WriteList writes;
+            getReadsWrites(request, reads, writes);
+            store->unprepare(request.txnid(), reads, writes, opnum);
             break;
+        }
 
         case Request::COMMIT:
         {
             long timestamp = stol(request.arg0());
-            store.uncommit(request.txnid(), timestamp, opnum);
+            store->uncommit(request.txnid(), timestamp, opnum);
+            break;
+        }
+
+        case Request::PREPARE_COMMIT:
+        {
+            ReadList reads;
+            WriteList writes;
+            getReadsWrites(request, reads, writes);
+            store->unprepareCommit(request.txnid(), reads, writes, opnum);
             break;
         }
 
         case Request::ABORT:
-            store.unabort(request.txnid(), opnum);
+            store->unabort(request.txnid(), opnum);
             break;
 
         default:
@@ -112,151 +180,32 @@ Server::RollbackUpcall(opnum_t current, opnum_t to, const std::map<opnum_t, stri
 void
 Server::CommitUpcall(opnum_t opnum)
 {
-    store.specCommit(opnum);
+    store->specCommit(opnum);
 }
 
-}
-
-static void Usage(const char *progName)
-{
-    fprintf(stderr, "usage: %s -c conf-file -i replica-index\n",
-            progName);
-    exit(1);
-}
-
-int
-main(int argc, char **argv)
+/* Serve a GET of the latest version of a key without going through
+ * the log; the client has the version validated when it prepares. */
+void
+Server::UnloggedUpcall(const string &str1, string &str2)
 {
-    int index = -1;
-    const char *configPath = NULL;
-    enum {
-        PROTO_UNKNOWN,
-        PROTO_VR_LOCKING,
-        PROTO_SPEC_LOCKING,
-        PROTO_VR_OCC,
-        PROTO_SPEC_OCC,
-        PROTO_FAST_OCC,
-    } proto = PROTO_UNKNOWN;
-
-  // Parse arguments
-    int opt;
-    while ((opt = getopt(argc, argv, "c:i:m:")) != -1) {
-        switch (opt) {
-            case 'c':
-                configPath = optarg;
-                break;
-
-            case 'i':
-            {
-                char *strtolPtr;
-                index = strtoul(optarg, &strtolPtr, 10);
-                if ((*optarg == '\0') || (*strtolPtr != '\0') || (index < 0))
-                {
-                    fprintf(stderr,
-                            "option -i requires a numeric arg\n");
-                    Usage(argv[0]);
-                }
-                break;
-            }
-
-            case 'm':
-            {
-                if (strcasecmp(optarg, "vr-l") == 0) {
-                    proto = PROTO_VR_LOCKING;
-                } else if (strcasecmp(optarg, "spec-l") == 0) {
-                    proto = PROTO_SPEC_LOCKING;
-                } else if (strcasecmp(optarg, "vr-occ") == 0) {
-                    proto = PROTO_VR_OCC;
-                } else if (strcasecmp(optarg, "spec-occ") == 0) {
-                    proto = PROTO_SPEC_OCC;
-                } else if (strcasecmp(optarg, "fast-occ") == 0) {
-                    proto = PROTO_FAST_OCC;
-                } else {
-                    fprintf(stderr, "unknown mode '%s'\n", optarg);
-                    Usage(argv[0]);
-                }
-                break;
-            }
-
-            default:
-                fprintf(stderr, "Unknown argument %s\n", argv[optind]);
-                break;
-        }
-    }
-
-    if (!configPath) {
-        fprintf(stderr, "option -c is required\n");
-        Usage(argv[0]);
-    }
-
-    if (index == -1) {
-        fprintf(stderr, "option -i is required\n");
-        Usage(argv[0]);
-    }
-
-    if (proto == PROTO_UNKNOWN) {
-        fprintf(stderr, "option -m is required\n");
-        Usage(argv[0]);
-    }
+    Request request;
+    Reply reply;
 
-    // Load configuration
-    std::ifstream configStream(configPath);
-    if (configStream.fail()) {
-        fprintf(stderr, "unable to read configuration file: %s\n",
-                configPath);
-        Usage(argv[0]);
-    }
-    specpaxos::Configuration config(configStream);
+    request.ParseFromString(str1);
 
-    if (index >= config.n) {
-        fprintf(stderr, "replica index %d is out of bounds; "
-                "only %d replicas defined\n", index, config.n);
-        Usage(argv[0]);
+    if (request.op() != Request::GET) {
+        Panic("Unrecognized unlogged operation.");
     }
 
-    UDPTransport transport(0.0, 0.0, 0);
-
-    specpaxos::Replica *replica;
-    nistore::Server server;
-    switch (proto) {
-        case PROTO_VR_LOCKING:
-        case PROTO_VR_OCC:
-            if (PROTO_VR_LOCKING) {
-                server = nistore::Server(true);
-            } else {
-                server = nistore::Server(false);
-            }
-
-            replica = new specpaxos::vr::VRReplica(config, index, true,
-                                                   &transport, 1, &server);
-            break;
-
-        case PROTO_SPEC_LOCKING:
-        case PROTO_SPEC_OCC:
-            if (PROTO_SPEC_LOCKING) {
-                server = nistore::Server(true);
-            } else {
-                server = nistore::Server(false);
-            }
-
-            replica = new specpaxos::spec::SpecReplica(config, index, true, &transport, &server);
-            break;
-
-        case PROTO_FAST_OCC:
-            server = nistore::Server(false);
-
-            replica = new specpaxos::fastpaxos::FastPaxosReplica(config, index, true,
-                                                                 &transport, &server);
-
-            break;
-
-        default:
-            NOT_REACHABLE();
+    string val;
+    uint64_t timestamp = 0;
+    int status = store->getVersion(request.arg0(), val, timestamp);
+    reply.set_status(status);
+    if (status == 0) {
+        reply.set_value(val);
+        reply.set_timestamp(timestamp);
     }
-    
-    (void)replica;              // silence warning
-    transport.Run();
-
-    return 0;
+    reply.SerializeToString(&str2);
 }
 
+}
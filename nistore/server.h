@@ -28,16 +28,16 @@ class Server : public specpaxos::AppReplica
 {
 public:
     // set up the store
-    Server() {store = OCCStore(); };
-    Server(bool locking) {locking ? store = LockStore() : OCCStore();};
-    ~Server() { };
+    Server(bool locking = false);
+    ~Server();
     void ReplicaUpcall(opnum_t opnum, const string &str1, string &str2);
-    void RollbackUpcall(opnum_t current, opnum_t to, const std::map<opnum_t, string> &opMap);
+    void RollbackUpcall(opnum_t current, opnum_t to, const specpaxos::RollbackOps &ops);
     void CommitUpcall(opnum_t opnum);
+    void UnloggedUpcall(const string &str1, string &str2);
 
 private:
     // data store
-    TxnStore store;
+    TxnStore *store;
 
     struct Operation
     {
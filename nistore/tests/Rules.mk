@@ -0,0 +1,41 @@
+d := $(dir $(lastword $(MAKEFILE_LIST)))
+
+GTEST_SRCS += $(addprefix $(d), \
+		versionedkvstore-test.cc \
+		occstore-test.cc \
+		lockstore-test.cc \
+		lockserver-test.cc \
+		placement-test.cc \
+		retired-test.cc \
+		client-test.cc)
+
+$(d)versionedkvstore-test: $(o)versionedkvstore-test.o \
+	$(LIB-stores) $(LIB-message) $(GTEST_MAIN)
+
+TEST_BINS += $(d)versionedkvstore-test
+
+$(d)occstore-test: $(o)occstore-test.o $(OBJS-ni-occstore) $(GTEST_MAIN)
+
+TEST_BINS += $(d)occstore-test
+
+$(d)lockstore-test: $(o)lockstore-test.o $(OBJS-ni-lockstore) $(GTEST_MAIN)
+
+TEST_BINS += $(d)lockstore-test
+
+$(d)lockserver-test: $(o)lockserver-test.o $(LIB-stores) $(LIB-message) \
+	$(GTEST_MAIN)
+
+TEST_BINS += $(d)lockserver-test
+
+$(d)placement-test: $(o)placement-test.o $(LIB-placement) $(GTEST_MAIN)
+
+TEST_BINS += $(d)placement-test
+
+$(d)retired-test: $(o)retired-test.o $(LIB-message) $(GTEST_MAIN)
+
+TEST_BINS += $(d)retired-test
+
+$(d)client-test: $(o)client-test.o $(OBJS-ni-client) $(OBJS-ni-store) \
+	$(LIB-kvstore) $(LIB-stores) $(OBJS-vr-replica) $(GTEST_MAIN)
+
+TEST_BINS += $(d)client-test
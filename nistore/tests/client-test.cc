@@ -0,0 +1,216 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+// vim: set ts=4 sw=4:
+/***********************************************************************
+ *
+ * nistore/tests/client-test.cc:
+ *   test cases for the asynchronous NiStore client, against two
+ *   OCC shards and a timestamp server replicated with VR over UDP
+ *
+ **********************************************************************/
+
+#include "nistore/client.h"
+#include "nistore/server.h"
+
+#include <gtest/gtest.h>
+#include <chrono>
+#include <fstream>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+using namespace nistore;
+
+static const int NSHARDS = 2;
+static const int NREPLICAS = 3;
+
+// Hands out timestamps the way timeserver does, without undo
+class TestTimeServer : public specpaxos::AppReplica
+{
+public:
+    TestTimeServer() : next(1) { }
+    void ReplicaUpcall(opnum_t opnum, const string &str1, string &str2) {
+        uint64_t count = str1.empty() ? 1 : stoull(str1);
+        str2 = to_string(next);
+        next += std::max(count, (uint64_t)1);
+    }
+private:
+    uint64_t next;
+};
+
+// Starts the servers, once for all the tests, and returns the
+// configuration path prefix to give clients. They run until the
+// test program exits.
+static string
+StartServers()
+{
+    static std::once_flag started;
+    static string prefix;
+    std::call_once(started, []() {
+            char dir[] = "/tmp/nistore-client-test.XXXXXX";
+            ASSERT_NE(nullptr, mkdtemp(dir));
+            prefix = string(dir) + "/shard";
+            int port = 40000 + (getpid() % 2000) * 10;
+
+            UDPTransport *transport = new UDPTransport(0.0, 0.0, 0);
+            for (int g = -1; g < NSHARDS; g++) {
+                string path = prefix + ((g < 0) ? string(".tss")
+                                        : to_string(g)) + ".config";
+                {
+                    std::ofstream f(path);
+                    f << "f " << (NREPLICAS-1)/2 << "\n";
+                    for (int i = 0; i < NREPLICAS; i++) {
+                        f << "replica localhost:" << port++ << "\n";
+                    }
+                }
+                std::ifstream f(path);
+                specpaxos::Configuration config(f);
+                for (int i = 0; i < NREPLICAS; i++) {
+                    specpaxos::AppReplica *app;
+                    if (g < 0) {
+                        app = new TestTimeServer();
+                    } else {
+                        app = new Server(false);
+                    }
+                    new specpaxos::vr::VRReplica(config, i, true,
+                                                 transport, 1, app);
+                }
+            }
+            std::thread([transport]() { transport->Run(); }).detach();
+        });
+    return prefix;
+}
+
+// Waits for a callback's result, failing rather than hanging if it
+// never comes
+template <class T> static T
+Wait(std::future<T> &f)
+{
+    EXPECT_EQ(std::future_status::ready,
+              f.wait_for(std::chrono::seconds(10)));
+    return f.get();
+}
+
+// Unlogged reads may go to a replica that hasn't heard about the
+// latest commits yet; waits until c sees value for key
+static void
+WaitForValue(Client *c, const string &key, const string &value)
+{
+    auto deadline = std::chrono::steady_clock::now() +
+        std::chrono::seconds(10);
+    string v;
+    for (;;) {
+        c->Begin();
+        bool ok = c->Get(key, v);
+        c->Abort();
+        if ((ok && (v == value)) ||
+            (std::chrono::steady_clock::now() > deadline)) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(value, v);
+}
+
+TEST(NiStoreClient, MultiGet)
+{
+    Client *c = new Client(PROTO_VR, StartServers(), NSHARDS);
+    map<string, string> values;
+
+    c->Begin();
+    c->Put("mg-a", "1");
+    c->Put("mg-b", "2");
+    c->Put("mg-c", "3");
+    ASSERT_TRUE(c->Commit());
+
+    c->Begin();
+    ASSERT_TRUE(c->MultiGet({"mg-a", "mg-b", "mg-c"}, values));
+    EXPECT_EQ((map<string, string>{{"mg-a", "1"}, {"mg-b", "2"},
+                                   {"mg-c", "3"}}), values);
+    // One missing key fails the whole read
+    EXPECT_FALSE(c->MultiGet({"mg-a", "mg-missing"}, values));
+    c->Abort();
+    // The client is never destroyed; it has no way to stop its
+    // transport thread
+}
+
+TEST(NiStoreClient, ConcurrentTransactions)
+{
+    Client *c = new Client(PROTO_VR, StartServers(), NSHARDS);
+
+    c->Begin();
+    c->Put("ct-k", "0");
+    ASSERT_TRUE(c->Commit());
+
+    // Two transactions read the same key and write it back; the one
+    // that commits second read a stale version
+    uint64_t t1 = c->BeginAsync();
+    uint64_t t2 = c->BeginAsync();
+    for (uint64_t t : { t1, t2 }) {
+        std::promise<pair<bool, string> > p;
+        std::future<pair<bool, string> > f = p.get_future();
+        c->GetAsync(t, "ct-k", [&p](bool ok, const string &value) {
+                p.set_value(make_pair(ok, value));
+            });
+        pair<bool, string> r = Wait(f);
+        ASSERT_TRUE(r.first);
+        EXPECT_EQ("0", r.second);
+        c->PutAsync(t, "ct-k", to_string(t));
+    }
+
+    std::vector<bool> committed;
+    for (uint64_t t : { t1, t2 }) {
+        std::promise<bool> p;
+        std::future<bool> f = p.get_future();
+        c->CommitAsync(t, [&p](bool ok) { p.set_value(ok); });
+        committed.push_back(Wait(f));
+    }
+    EXPECT_EQ(std::vector<bool>({ true, false }), committed);
+
+    string v;
+    c->Begin();
+    ASSERT_TRUE(c->Get("ct-k", v));
+    EXPECT_EQ(to_string(t1), v);
+    c->Abort();
+}
+
+TEST(NiStoreClient, SharedUnloggedGet)
+{
+    Client *c = new Client(PROTO_VR, StartServers(), NSHARDS, true);
+
+    c->Begin();
+    c->Put("ug-k", "v1");
+    ASSERT_TRUE(c->Commit());
+    WaitForValue(c, "ug-k", "v1");
+
+    // Reads of a key already being read wait for the same GET
+    uint64_t t = c->BeginAsync();
+    std::promise<string> p1, p2;
+    std::promise<pair<bool, map<string, string> > > p3;
+    std::future<string> f1 = p1.get_future(), f2 = p2.get_future();
+    std::future<pair<bool, map<string, string> > > f3 = p3.get_future();
+    c->GetAsync(t, "ug-k", [&p1](bool ok, const string &value) {
+            p1.set_value(ok ? value : "");
+        });
+    c->GetAsync(t, "ug-k", [&p2](bool ok, const string &value) {
+            p2.set_value(ok ? value : "");
+        });
+    c->MultiGetAsync(t, {"ug-k", "ug-k"},
+                     [&p3](bool ok, const map<string, string> &values) {
+            p3.set_value(make_pair(ok, values));
+        });
+    EXPECT_EQ("v1", Wait(f1));
+    EXPECT_EQ("v1", Wait(f2));
+    pair<bool, map<string, string> > r = Wait(f3);
+    EXPECT_TRUE(r.first);
+    EXPECT_EQ((map<string, string>{{"ug-k", "v1"}}), r.second);
+
+    // The version read is validated when the transaction commits
+    c->PutAsync(t, "ug-k", "v2");
+    std::promise<bool> pc;
+    std::future<bool> fc = pc.get_future();
+    c->CommitAsync(t, [&pc](bool ok) { pc.set_value(ok); });
+    EXPECT_TRUE(Wait(fc));
+    WaitForValue(c, "ug-k", "v2");
+}
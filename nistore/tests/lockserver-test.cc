@@ -0,0 +1,153 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+// vim: set ts=4 sw=4:
+/***********************************************************************
+ *
+ * nistore/tests/lockserver-test.cc:
+ *   test cases for the lock server's wait queues
+ *
+ **********************************************************************/
+
+#include "nistore/lockserver.h"
+
+#include <gtest/gtest.h>
+
+using namespace nistore;
+
+TEST(LockServer, CancelledWaiterUnblocks)
+{
+    LockServer l;
+
+    ASSERT_TRUE(l.lockForWrite("k", 1, 1));
+    EXPECT_FALSE(l.lockForWrite("k", 2, 2));
+    EXPECT_FALSE(l.lockForWrite("k", 3, 3));
+    l.releaseForWrite("k", 1, 3);
+
+    // The lock is held for 2, first in the queue
+    EXPECT_FALSE(l.lockForWrite("k", 3, 4));
+
+    l.cancelWaits(2, 4);
+    EXPECT_TRUE(l.lockForWrite("k", 3, 5));
+    l.releaseForWrite("k", 3, 5);
+    EXPECT_EQ(0, l.numLocks());
+}
+
+TEST(LockServer, CancelLastWaiter)
+{
+    LockServer l;
+
+    ASSERT_TRUE(l.lockForRead("k", 1, 1));
+    EXPECT_FALSE(l.lockForWrite("k", 2, 2));
+    EXPECT_FALSE(l.lockForWrite("k", 3, 3));
+
+    // Leaving from the tail of the queue
+    l.cancelWait("k", 3, 3);
+    l.releaseForRead("k", 1, 3);
+    EXPECT_FALSE(l.lockForRead("k", 3, 4));
+    l.cancelWaits(3, 4);
+    l.cancelWaits(2, 4);
+    EXPECT_TRUE(l.lockForRead("k", 3, 5));
+    l.releaseForRead("k", 3, 5);
+
+    // Nothing is left waiting, so the lock goes away when free
+    ASSERT_TRUE(l.lockForWrite("k", 1, 6));
+    EXPECT_FALSE(l.lockForWrite("k", 2, 7));
+    l.releaseForWrite("k", 1, 7);
+    EXPECT_EQ(1, l.numLocks());
+    l.cancelWaits(2, 7);
+    EXPECT_EQ(0, l.numLocks());
+}
+
+TEST(LockServer, WaitExpiresByOpnum)
+{
+    LockServer l;
+
+    ASSERT_TRUE(l.lockForWrite("k", 1, 1));
+    EXPECT_FALSE(l.lockForWrite("k", 2, 2));
+    l.releaseForWrite("k", 1, 2);
+
+    EXPECT_FALSE(l.lockForWrite("k", 3, 2 + LOCK_WAIT_TIMEOUT));
+    l.cancelWaits(3, 2 + LOCK_WAIT_TIMEOUT);
+    EXPECT_TRUE(l.lockForWrite("k", 3, 3 + LOCK_WAIT_TIMEOUT));
+}
+
+TEST(LockServer, RollbackRestoresReservation)
+{
+    LockServer l;
+
+    ASSERT_TRUE(l.lockForWrite("k", 1, 1));
+    EXPECT_FALSE(l.lockForWrite("k", 2, 2));
+    l.releaseForWrite("k", 1, 3);
+    // 2 takes its reservation
+    EXPECT_TRUE(l.lockForWrite("k", 2, 4));
+
+    // and gets it back in the rollback
+    l.rollback(4);
+    EXPECT_FALSE(l.lockForWrite("k", 3, 4));
+    EXPECT_TRUE(l.lockForWrite("k", 2, 5));
+    l.releaseForWrite("k", 2, 5);
+
+    // Back to before 1 took the lock: no one holds it or waits
+    l.rollback(1);
+    EXPECT_EQ(0, l.numLocks());
+    EXPECT_TRUE(l.lockForWrite("k", 3, 1));
+}
+
+TEST(LockServer, RollbackKeepsEarlierWait)
+{
+    LockServer l;
+
+    ASSERT_TRUE(l.lockForRead("k", 1, 1));
+    EXPECT_FALSE(l.lockForWrite("k", 2, 2));
+    // Already waiting, so this request changes nothing...
+    EXPECT_FALSE(l.lockForWrite("k", 2, 3));
+    // ...and rolling it back leaves 2 queued
+    l.rollback(3);
+
+    l.releaseForRead("k", 1, 3);
+    EXPECT_FALSE(l.lockForRead("k", 3, 4));
+    EXPECT_TRUE(l.lockForWrite("k", 2, 5));
+}
+
+TEST(LockServer, RollbackRestoresPrunedWaiters)
+{
+    LockServer l;
+
+    ASSERT_TRUE(l.lockForWrite("k", 1, 1));
+    EXPECT_FALSE(l.lockForWrite("k", 2, 2));
+    EXPECT_FALSE(l.lockForRead("k", 3, 3));
+    l.releaseForWrite("k", 1, 4);
+
+    // 2 and 3 have both expired by now and are pruned
+    EXPECT_TRUE(l.lockForWrite("k", 4, 4 + LOCK_WAIT_TIMEOUT));
+    l.rollback(4 + LOCK_WAIT_TIMEOUT);
+
+    // Before they expire, 2 and then 3 are still ahead of 4
+    EXPECT_FALSE(l.lockForWrite("k", 4, 5));
+    EXPECT_TRUE(l.lockForWrite("k", 2, 6));
+    l.releaseForWrite("k", 2, 7);
+    EXPECT_FALSE(l.lockForWrite("k", 4, 8));
+    EXPECT_TRUE(l.lockForRead("k", 3, 9));
+}
+
+TEST(LockServer, RollbackCancelledWaits)
+{
+    LockServer l;
+
+    ASSERT_TRUE(l.lockForWrite("a", 1, 1));
+    ASSERT_TRUE(l.lockForWrite("b", 1, 2));
+    EXPECT_FALSE(l.lockForWrite("a", 2, 3));
+    EXPECT_FALSE(l.lockForWrite("b", 3, 4));
+    EXPECT_FALSE(l.lockForWrite("b", 2, 5));
+
+    // 2 gives up both places, then that is rolled back
+    l.cancelWaits(2, 6);
+    l.rollback(6);
+
+    // 2 is still next for a, and behind 3 for b
+    l.releaseForWrite("a", 1, 6);
+    l.releaseForWrite("b", 1, 6);
+    EXPECT_FALSE(l.lockForWrite("a", 3, 7));
+    EXPECT_FALSE(l.lockForWrite("b", 2, 8));
+    EXPECT_TRUE(l.lockForWrite("a", 2, 9));
+    EXPECT_TRUE(l.lockForWrite("b", 3, 10));
+}
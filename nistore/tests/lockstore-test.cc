@@ -0,0 +1,200 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+// vim: set ts=4 sw=4:
+/***********************************************************************
+ *
+ * nistore/tests/lockstore-test.cc:
+ *   test cases for the locking transaction store
+ *
+ **********************************************************************/
+
+#include "nistore/lockstore.h"
+
+#include <gtest/gtest.h>
+#include <string>
+
+using namespace nistore;
+
+TEST(LockStore, UncommitWithWaiter)
+{
+    LockStore s;
+
+    ASSERT_EQ(0, s.put(1, "k", "v1", 1));
+    // 2 queues for the lock behind 1
+    EXPECT_EQ(-2, s.put(2, "k", "v2", 2));
+    uint64_t ts;
+    ASSERT_EQ(0, s.prepare(1, ReadList(), WriteList(), ts, 3));
+    s.commit(1, 0, 4);
+
+    // The lock is reserved for 2 now, but rolling back the commit
+    // hands it back to 1 with 2 still first in line
+    s.uncommit(1, 0, 4);
+    s.abortTxn(1, 4);
+    EXPECT_EQ(-2, s.put(3, "k", "v3", 5));
+    ASSERT_EQ(0, s.put(2, "k", "v2", 6));
+}
+
+TEST(LockStore, UngetKeepsEarlierWait)
+{
+    LockStore s;
+    string v;
+    uint64_t ts;
+
+    ASSERT_EQ(0, s.prepareCommit(1, ReadList(), WriteList{{"k", "v1"}},
+                                 ts, 1));
+
+    ASSERT_EQ(0, s.put(2, "k", "v2", 2));
+    EXPECT_EQ(-2, s.get(3, "k", v, 3));
+    // 3 is already waiting; undoing the repeated read mustn't give
+    // up its place
+    EXPECT_EQ(-2, s.get(3, "k", v, 4));
+    s.unget(3, "k", 4);
+
+    s.abortTxn(2, 4);
+    EXPECT_EQ(-2, s.put(4, "k", "v4", 5));
+    ASSERT_EQ(0, s.get(3, "k", v, 6));
+    EXPECT_EQ("v1", v);
+}
+
+TEST(LockStore, UnabortRestoresWaits)
+{
+    LockStore s;
+
+    ASSERT_EQ(0, s.put(1, "k", "v1", 1));
+    EXPECT_EQ(-2, s.put(2, "k", "v2", 2));
+
+    // Aborting 2 gives up its place in the queue, and rolling back
+    // the abort takes it back
+    s.abortTxn(2, 3);
+    s.unabort(2, 3);
+
+    s.abortTxn(1, 3);
+    EXPECT_EQ(-2, s.put(3, "k", "v3", 4));
+    ASSERT_EQ(0, s.put(2, "k", "v2", 5));
+}
+
+TEST(LockStore, UnputAfterQueueing)
+{
+    LockStore s;
+
+    ASSERT_EQ(0, s.put(1, "k", "v1", 1));
+    EXPECT_EQ(-2, s.put(2, "k", "v2", 2));
+    EXPECT_EQ(-2, s.put(2, "k", "v2", 3));
+
+    // Only the put that joined the queue leaves it
+    s.unput(2, "k", "v2", 3);
+    s.abortTxn(1, 3);
+    EXPECT_EQ(-2, s.put(3, "k", "v3", 4));
+
+    s.unput(3, "k", "v3", 4);
+    s.unabort(1, 3);
+    s.unput(2, "k", "v2", 2);
+    s.abortTxn(1, 2);
+    ASSERT_EQ(0, s.put(3, "k", "v3", 3));
+}
+
+TEST(LockStore, PrepareLocksWrites)
+{
+    LockStore s;
+    string v;
+    uint64_t ts;
+
+    // A transaction that only wrote here prepares without a BEGIN,
+    // locking its buffered writes
+    ASSERT_EQ(0, s.prepare(1, ReadList(), WriteList{{"k", "v1"}}, ts, 1));
+    EXPECT_EQ(-2, s.put(2, "k", "v2", 2));
+    s.unput(2, "k", "v2", 2);
+
+    s.commit(1, ts, 2);
+    ASSERT_EQ(0, s.get(2, "k", v, 3));
+    EXPECT_EQ("v1", v);
+}
+
+TEST(LockStore, UnprepareRestoresWrites)
+{
+    LockStore s;
+    string v;
+    uint64_t ts;
+
+    s.begin(1);
+    ASSERT_EQ(0, s.put(1, "k", "v0", 1));
+    WriteList w{{"k", "v1"}, {"j", "v2"}};
+    ASSERT_EQ(0, s.prepare(1, ReadList(), w, ts, 2));
+
+    // Rolling back the prepare drops the writes it brought and the
+    // lock it took, but not the earlier put
+    s.unprepare(1, ReadList(), w, 2);
+    ASSERT_EQ(0, s.put(2, "j", "v3", 2));
+    s.unput(2, "j", "v3", 2);
+    EXPECT_EQ(-2, s.put(2, "k", "v3", 2));
+    s.unput(2, "k", "v3", 2);
+
+    ASSERT_EQ(0, s.prepareCommit(1, ReadList(), WriteList(), ts, 2));
+    ASSERT_EQ(0, s.get(3, "k", v, 3));
+    EXPECT_EQ("v0", v);
+    EXPECT_NE(0, s.get(3, "j", v, 4));
+}
+
+TEST(LockStore, UnprepareAfterWriteConflict)
+{
+    LockStore s;
+    uint64_t ts;
+
+    ASSERT_EQ(0, s.put(2, "b", "v1", 1));
+
+    // 1 locks a, can't lock b and aborts, queued for b
+    WriteList w{{"a", "v2"}, {"b", "v2"}};
+    EXPECT_EQ(-1, s.prepare(1, ReadList(), w, ts, 2));
+    s.unprepare(1, ReadList(), w, 2);
+
+    // Rolled back, 1 neither holds a nor waits for b
+    s.abortTxn(2, 2);
+    ASSERT_EQ(0, s.put(3, "b", "v3", 3));
+    ASSERT_EQ(0, s.put(3, "a", "v3", 4));
+}
+
+TEST(LockStore, UnprepareCommit)
+{
+    LockStore s;
+    string v;
+    uint64_t ts;
+
+    s.begin(1);
+    ASSERT_EQ(0, s.put(1, "k", "v1", 1));
+    WriteList w{{"j", "v2"}};
+    ASSERT_EQ(0, s.prepareCommit(1, ReadList(), w, ts, 2));
+    EXPECT_EQ(0u, ts);
+    ASSERT_EQ(0, s.get(2, "j", v, 3));
+    EXPECT_EQ("v2", v);
+    s.unget(2, "j", 3);
+
+    // Rolled back, 1 is running again with only its put, and holds
+    // only the lock that put took
+    s.unprepareCommit(1, ReadList(), w, 2);
+    EXPECT_EQ(-2, s.put(2, "k", "v3", 2));
+    s.unput(2, "k", "v3", 2);
+    ASSERT_EQ(0, s.put(2, "j", "v3", 2));
+    s.unput(2, "j", "v3", 2);
+    EXPECT_EQ(-1, s.get(2, "j", v, 2));
+
+    ASSERT_EQ(0, s.prepareCommit(1, ReadList(), WriteList(), ts, 3));
+    ASSERT_EQ(0, s.get(2, "k", v, 4));
+    EXPECT_EQ("v1", v);
+    EXPECT_EQ(-1, s.get(2, "j", v, 5));
+}
+
+TEST(LockStore, UnprepareCommitAfterConflict)
+{
+    LockStore s;
+    uint64_t ts;
+
+    ASSERT_EQ(0, s.put(2, "j", "v1", 1));
+
+    // 1 can't lock j, aborts and is queued for it
+    WriteList w{{"j", "v2"}};
+    EXPECT_EQ(-1, s.prepareCommit(1, ReadList(), w, ts, 2));
+    s.unprepareCommit(1, ReadList(), w, 2);
+
+    // Rolled back, it's no longer waiting
+    s.abortTxn(2, 2);
+    ASSERT_EQ(0, s.put(3, "j", "v3", 3));
+}
@@ -0,0 +1,173 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+// vim: set ts=4 sw=4:
+/***********************************************************************
+ *
+ * nistore/tests/occstore-test.cc:
+ *   test cases for the OCC transaction store
+ *
+ **********************************************************************/
+
+#include "nistore/occstore.h"
+
+#include <gtest/gtest.h>
+#include <string>
+
+using namespace nistore;
+
+// Garbage collection runs at most this often, in operations
+static const opnum_t GC_OPS = 1024;
+
+TEST(OCCStore, StaleReadAborts)
+{
+    OCCStore s;
+    uint64_t ts;
+    string v;
+
+    ASSERT_EQ(0, s.prepareCommit(1, ReadList(), WriteList{{"k", "v1"}},
+                                 ts, 1));
+    uint64_t ts1;
+    ASSERT_EQ(0, s.getVersion("k", v, ts1));
+    EXPECT_EQ("v1", v);
+
+    ASSERT_EQ(0, s.prepareCommit(2, ReadList{{"k", ts1}},
+                                 WriteList{{"k", "v2"}}, ts, 2));
+    EXPECT_GT(ts, ts1);
+
+    // Read the version that 2 just overwrote
+    EXPECT_GT(0, s.prepareCommit(3, ReadList{{"k", ts1}},
+                                 WriteList{{"k", "v3"}}, ts, 3));
+    uint64_t ts2;
+    ASSERT_EQ(0, s.getVersion("k", v, ts2));
+    EXPECT_EQ("v2", v);
+}
+
+TEST(OCCStore, UncommitAfterGC)
+{
+    OCCStore s;
+    uint64_t ts;
+    string v;
+
+    WriteList w1{{"k", "v1"}};
+    WriteList w2{{"k", "v2"}};
+    ASSERT_EQ(0, s.prepareCommit(1, ReadList(), w1, ts, 1));
+    ASSERT_EQ(0, s.prepareCommit(2, ReadList(), w2, ts, GC_OPS + 6));
+
+    // Nothing is running, but transaction 2 is still speculative, so
+    // the version it overwrote has to survive
+    s.specCommit(GC_OPS + 5);
+    s.unprepareCommit(2, ReadList(), w2, GC_OPS + 6);
+
+    ASSERT_EQ(0, s.getVersion("k", v, ts));
+    EXPECT_EQ("v1", v);
+}
+
+TEST(OCCStore, PrepareVotesTimestamp)
+{
+    OCCStore s;
+    uint64_t ts, ts1, ts2;
+    string v;
+
+    ASSERT_EQ(0, s.prepareCommit(1, ReadList(), WriteList{{"a", "v1"}},
+                                 ts, 1));
+    ASSERT_EQ(0, s.prepareCommit(2, ReadList(), WriteList{{"b", "v1"}},
+                                 ts, 2));
+    ASSERT_EQ(0, s.prepare(3, ReadList(), WriteList{{"b", "v2"}}, ts, 3));
+    s.commit(3, 100, 4);
+    ASSERT_EQ(0, s.getVersion("a", v, ts1));
+    ASSERT_EQ(0, s.getVersion("b", v, ts2));
+    EXPECT_EQ(100, ts2);
+
+    // The vote is just past the newest version read or overwritten
+    ASSERT_EQ(0, s.prepare(4, ReadList{{"a", ts1}}, WriteList{{"c", "v"}},
+                           ts, 5));
+    EXPECT_EQ(ts1 + 1, ts);
+    ASSERT_EQ(0, s.prepare(5, ReadList{{"a", ts1}}, WriteList{{"b", "v3"}},
+                           ts, 6));
+    EXPECT_EQ(101, ts);
+
+    // Both commit at the timestamp the client picked
+    s.commit(4, 200, 7);
+    s.commit(5, 200, 8);
+    ASSERT_EQ(0, s.getVersion("c", v, ts));
+    EXPECT_EQ(200, ts);
+    ASSERT_EQ(0, s.getVersion("b", v, ts));
+    EXPECT_EQ(200, ts);
+    EXPECT_EQ("v3", v);
+}
+
+TEST(OCCStore, UnloggedReadMismatch)
+{
+    OCCStore s;
+    uint64_t ts, ts1, ts2;
+    string v;
+
+    ASSERT_EQ(0, s.prepareCommit(1, ReadList(), WriteList{{"k", "v1"}},
+                                 ts, 1));
+    ASSERT_EQ(0, s.getVersion("k", v, ts1));
+    s.begin(2);
+    ASSERT_EQ(0, s.get(2, "k", v, 2));
+    ASSERT_EQ(0, s.prepareCommit(3, ReadList(), WriteList{{"k", "v2"}},
+                                 ts, 3));
+    ASSERT_EQ(0, s.getVersion("k", v, ts2));
+
+    // An unlogged read that disagrees with a logged one
+    EXPECT_EQ(-1, s.prepare(2, ReadList{{"k", ts2}}, WriteList(), ts, 4));
+
+    // Two unlogged reads of different versions, even with nothing
+    // logged to check them against
+    EXPECT_EQ(-1, s.prepare(4, ReadList{{"k", ts1}, {"k", ts2}},
+                            WriteList{{"j", "v"}}, ts, 5));
+}
+
+TEST(OCCStore, UnprepareUndoesReads)
+{
+    OCCStore s;
+    uint64_t ts, ts1;
+    string v;
+
+    ASSERT_EQ(0, s.prepareCommit(1, ReadList(), WriteList{{"k", "v1"}},
+                                 ts, 1));
+    ASSERT_EQ(0, s.getVersion("k", v, ts1));
+
+    // The unlogged read of k adds to the count of the logged one
+    s.begin(2);
+    ASSERT_EQ(0, s.get(2, "k", v, 2));
+    ReadList r{{"k", ts1}};
+    WriteList w{{"j", "v2"}};
+    ASSERT_EQ(0, s.prepare(2, r, w, ts, 3));
+    s.unprepare(2, r, w, 3);
+    s.unget(2, "k", 2);
+
+    // so with both undone, 2 no longer depends on k
+    ASSERT_EQ(0, s.prepareCommit(3, ReadList(), WriteList{{"k", "v3"}},
+                                 ts, 2));
+    ASSERT_EQ(0, s.prepare(2, ReadList(), WriteList(), ts, 3));
+    s.commit(2, ts, 4);
+    EXPECT_NE(0, s.getVersion("j", v, ts));
+}
+
+TEST(OCCStore, UnprepareAfterMismatch)
+{
+    OCCStore s;
+    uint64_t ts, ts1, ts2;
+    string v;
+
+    ASSERT_EQ(0, s.prepareCommit(1, ReadList(), WriteList{{"k", "v1"}},
+                                 ts, 1));
+    ASSERT_EQ(0, s.getVersion("k", v, ts1));
+    ASSERT_EQ(0, s.prepareCommit(2, ReadList(), WriteList{{"k", "v2"}},
+                                 ts, 2));
+    ASSERT_EQ(0, s.getVersion("k", v, ts2));
+
+    // Rolling back the abort leaves the transaction running, without
+    // the reads and writes the prepare brought
+    ReadList r{{"k", ts1}, {"k", ts2}};
+    WriteList w{{"j", "v3"}};
+    s.begin(3);
+    EXPECT_EQ(-1, s.prepare(3, r, w, ts, 3));
+    s.unprepare(3, r, w, 3);
+
+    ASSERT_EQ(0, s.prepare(3, ReadList{{"k", ts2}}, WriteList(), ts, 3));
+    s.commit(3, ts, 4);
+    EXPECT_NE(0, s.getVersion("j", v, ts));
+}
@@ -0,0 +1,144 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+// vim: set ts=4 sw=4:
+/***********************************************************************
+ *
+ * nistore/tests/placement-test.cc:
+ *   test cases for mapping keys to shards
+ *
+ **********************************************************************/
+
+#include "nistore/placement.h"
+
+#include <gtest/gtest.h>
+#include <sstream>
+#include <string>
+
+using namespace nistore;
+
+static RangePlacement
+ReadMap(int nshards, const string &map)
+{
+    istringstream in(map);
+    return RangePlacement(nshards, in);
+}
+
+TEST(RangePlacement, SplitMiddle)
+{
+    RangePlacement p = ReadMap(3, "0 \n1 m\n");
+
+    p.Split("f", 2);
+    EXPECT_EQ(3, p.NumRanges());
+    EXPECT_EQ(0, p.KeyToShard("a"));
+    EXPECT_EQ(0, p.KeyToShard("ez"));
+    EXPECT_EQ(2, p.KeyToShard("f"));
+    EXPECT_EQ(2, p.KeyToShard("lz"));
+    EXPECT_EQ(1, p.KeyToShard("m"));
+}
+
+TEST(RangePlacement, SplitAtStart)
+{
+    RangePlacement p = ReadMap(3, "0 \n1 m\n0 t\n");
+
+    // Moves the whole range without adding one
+    p.Split("m", 2);
+    EXPECT_EQ(3, p.NumRanges());
+    EXPECT_EQ(0, p.KeyToShard("a"));
+    EXPECT_EQ(2, p.KeyToShard("m"));
+    EXPECT_EQ(2, p.KeyToShard("sz"));
+    EXPECT_EQ(0, p.KeyToShard("t"));
+}
+
+TEST(RangePlacement, SplitMerges)
+{
+    RangePlacement p = ReadMap(2, "0 \n1 f\n0 m\n");
+
+    // Handing the range back to its neighbours' shard leaves one range
+    p.Split("f", 0);
+    EXPECT_EQ(1, p.NumRanges());
+    EXPECT_EQ(0, p.KeyToShard("a"));
+    EXPECT_EQ(0, p.KeyToShard("g"));
+    EXPECT_EQ(0, p.KeyToShard("z"));
+
+    // Merging with only the range above
+    p = ReadMap(2, "0 \n1 f\n0 m\n");
+    p.Split("h", 0);
+    EXPECT_EQ(3, p.NumRanges());
+    EXPECT_EQ(1, p.KeyToShard("g"));
+    EXPECT_EQ(0, p.KeyToShard("h"));
+    EXPECT_EQ(0, p.KeyToShard("m"));
+}
+
+TEST(RangePlacement, SplitHottest)
+{
+    RangePlacement p(2, {"a", "b", "c", "d", "e", "f", "g", "h"});
+    EXPECT_EQ(0, p.KeyToShard("d"));
+    EXPECT_EQ(1, p.KeyToShard("e"));
+
+    map<string, uint64_t> load = {
+        {"a", 10}, {"b", 10}, {"c", 10}, {"d", 10}, {"e", 1}
+    };
+    ASSERT_TRUE(p.SplitHottest(load));
+    EXPECT_EQ(2, p.NumRanges());
+    EXPECT_EQ(0, p.KeyToShard("b"));
+    EXPECT_EQ(1, p.KeyToShard("c"));
+    EXPECT_EQ(1, p.KeyToShard("e"));
+}
+
+TEST(RangePlacement, SingleKeyHotRange)
+{
+    RangePlacement p(2, {"a", "b"});
+
+    // All of the load is on one key, so no split can move part of it
+    EXPECT_FALSE(p.SplitHottest({{"a", 100}}));
+    EXPECT_EQ(2, p.NumRanges());
+
+    // Nor can it if the key starts its range
+    EXPECT_FALSE(p.SplitHottest({{"b", 100}}));
+    EXPECT_EQ(2, p.NumRanges());
+}
+
+TEST(RangePlacement, WriteRead)
+{
+    RangePlacement p(4, {"a", "c", "e", "g", "i", "k", "m", "o"});
+    p.Split("d", 3);
+    p.Split("n", 0);
+
+    ostringstream out;
+    p.Write(out);
+    RangePlacement q = ReadMap(4, out.str());
+
+    EXPECT_EQ(p.NumRanges(), q.NumRanges());
+    for (char c = 'a'; c <= 'z'; c++) {
+        string key(1, c);
+        EXPECT_EQ(p.KeyToShard(key), q.KeyToShard(key)) << key;
+    }
+
+    ostringstream out2;
+    q.Write(out2);
+    EXPECT_EQ(out.str(), out2.str());
+}
+
+TEST(HashPlacement, AddShard)
+{
+    const int NKEYS = 20000;
+
+    for (int n = 1; n < 8; n++) {
+        HashPlacement before(n), after(n+1);
+        int moved = 0;
+        for (int i = 0; i < NKEYS; i++) {
+            string key = "key" + to_string(i);
+            int from = before.KeyToShard(key);
+            int to = after.KeyToShard(key);
+            ASSERT_GE(from, 0);
+            ASSERT_LT(from, n);
+            if (from != to) {
+                // Keys only move to the new shard
+                EXPECT_EQ(n, to);
+                moved++;
+            }
+        }
+
+        double expected = double(NKEYS) / (n+1);
+        EXPECT_NEAR(expected, moved, expected * 0.1) << n << " shards";
+    }
+}
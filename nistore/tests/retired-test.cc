@@ -0,0 +1,68 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+// vim: set ts=4 sw=4:
+/***********************************************************************
+ *
+ * nistore/tests/retired-test.cc:
+ *   test cases for the retired transaction list
+ *
+ **********************************************************************/
+
+#include "nistore/retired.h"
+
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+using namespace nistore;
+
+enum TestState { COMMITTED, ABORTED };
+typedef RetiredTxns<vector<string>, TestState> Retired;
+
+TEST(RetiredTxns, RestoreNewestFirst)
+{
+    Retired r;
+    vector<string> t1{"a"}, t2{"b", "c"}, t3{"d"};
+
+    // One operation can retire several transactions
+    r.retire(1, 10, t1, COMMITTED);
+    r.retire(2, 20, t2, ABORTED);
+    r.retire(2, 30, t3, COMMITTED);
+    EXPECT_TRUE(t2.empty());
+    EXPECT_EQ(3u, r.size());
+
+    // Only the newest one can be taken back
+    EXPECT_EQ(NULL, r.last(2, 20));
+    EXPECT_EQ(NULL, r.last(3, 30));
+    ASSERT_NE((Retired::Entry *)NULL, r.last(2, 30));
+    EXPECT_EQ(vector<string>{"d"}, r.restore(2, 30, COMMITTED));
+
+    ASSERT_NE((Retired::Entry *)NULL, r.last(2, 20));
+    EXPECT_EQ(ABORTED, r.last(2, 20)->state);
+    EXPECT_EQ((vector<string>{"b", "c"}), r.restore(2, 20, ABORTED));
+
+    EXPECT_EQ(vector<string>{"a"}, r.restore(1, 10, COMMITTED));
+    EXPECT_EQ(0u, r.size());
+    EXPECT_EQ(NULL, r.last(1, 10));
+}
+
+TEST(RetiredTxns, Prune)
+{
+    Retired r;
+    for (opnum_t op = 1; op <= 5; op++) {
+        vector<string> t{std::to_string(op)};
+        r.retire(op, op * 10, t, COMMITTED);
+    }
+
+    r.prune(3);
+    EXPECT_EQ(2u, r.size());
+    vector<opnum_t> left;
+    r.forEach([&](const Retired::Entry &e) { left.push_back(e.op); });
+    EXPECT_EQ((vector<opnum_t>{4, 5}), left);
+
+    // Pruning doesn't touch what can still be rolled back
+    EXPECT_EQ(vector<string>{"5"}, r.restore(5, 50, COMMITTED));
+    EXPECT_EQ(vector<string>{"4"}, r.restore(4, 40, COMMITTED));
+
+    r.prune(10);
+    EXPECT_EQ(0u, r.size());
+}
@@ -0,0 +1,98 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+// vim: set ts=4 sw=4:
+/***********************************************************************
+ *
+ * nistore/tests/versionedkvstore-test.cc:
+ *   test cases for the multiversion key-value store
+ *
+ **********************************************************************/
+
+#include "nistore/versionedKVStore.h"
+
+#include <gtest/gtest.h>
+#include <string>
+
+using namespace nistore;
+
+TEST(VersionedKVStore, OutOfOrderPut)
+{
+    VersionedKVStore s;
+    string v;
+    pair<uint64_t, string> latest;
+
+    EXPECT_FALSE(s.get("k", latest));
+
+    s.put("k", "v3", 3);
+    s.put("k", "v1", 1);
+    s.put("k", "v2", 2);
+    EXPECT_EQ(3, s.numVersions());
+
+    ASSERT_TRUE(s.get("k", latest));
+    EXPECT_EQ(3, latest.first);
+    EXPECT_EQ("v3", latest.second);
+
+    EXPECT_FALSE(s.get("k", 0, v));
+    ASSERT_TRUE(s.get("k", 1, v));
+    EXPECT_EQ("v1", v);
+    ASSERT_TRUE(s.get("k", 2, v));
+    EXPECT_EQ("v2", v);
+    ASSERT_TRUE(s.get("k", 10, v));
+    EXPECT_EQ("v3", v);
+
+    ASSERT_TRUE(s.remove("k", latest));
+    EXPECT_EQ("v3", latest.second);
+    ASSERT_TRUE(s.get("k", latest));
+    EXPECT_EQ("v2", latest.second);
+}
+
+TEST(VersionedKVStore, GC)
+{
+    VersionedKVStore s;
+    string v;
+
+    s.put("a", "a1", 1);
+    s.put("a", "a3", 3);
+    s.put("a", "a2", 2);
+    s.put("b", "b5", 5);
+
+    // Keeps the version visible at 2 and everything after it
+    s.gc(2);
+    EXPECT_EQ(3, s.numVersions());
+    EXPECT_FALSE(s.get("a", 1, v));
+    ASSERT_TRUE(s.get("a", 2, v));
+    EXPECT_EQ("a2", v);
+    ASSERT_TRUE(s.get("b", 5, v));
+
+    // A version older than the GC point can still be added
+    s.put("a", "a0", 0);
+    EXPECT_EQ(4, s.numVersions());
+    s.gc(2);
+    EXPECT_EQ(3, s.numVersions());
+
+    s.gc(UINT64_MAX);
+    EXPECT_EQ(2, s.numVersions());
+    ASSERT_TRUE(s.get("a", 100, v));
+    EXPECT_EQ("a3", v);
+}
+
+TEST(VersionedKVStore, GCAfterGrow)
+{
+    const int NUM_KEYS = 5000;
+    VersionedKVStore s;
+    string v;
+
+    for (int i = 0; i < NUM_KEYS; i++) {
+        s.put(to_string(i), "new", 2);
+        if (i % 2 == 0) {
+            s.put(to_string(i), "old", 1);
+        }
+    }
+    EXPECT_EQ(NUM_KEYS + NUM_KEYS/2, s.numVersions());
+
+    s.gc(2);
+    EXPECT_EQ(NUM_KEYS, s.numVersions());
+    for (int i = 0; i < NUM_KEYS; i++) {
+        ASSERT_TRUE(s.get(to_string(i), 2, v));
+        EXPECT_EQ("new", v);
+    }
+}
@@ -30,40 +30,52 @@ TxnStore::unbegin(uint64_t id)
 }
 
 int
-TxnStore::get(uint64_t id, const string &key, string &value)
+TxnStore::get(uint64_t id, const string &key, string &value,
+              opnum_t op)
 {
     Debug("[%" PRIu64 "] GET %s", id, key.c_str());
     return 0;
 }
 
 void
-TxnStore::unget(uint64_t id, const string &key)
+TxnStore::unget(uint64_t id, const string &key, opnum_t op)
 {
     Debug("[%" PRIu64 "] UNDO GET %s", id, key.c_str());
 }
 
 int
-TxnStore::put(uint64_t id, const string &key, const string &value)
+TxnStore::put(uint64_t id, const string &key, const string &value,
+              opnum_t op)
 {
     Debug("[%" PRIu64 "] PUT %s %s", id, key.c_str(), value.c_str());
     return 0;
 }
 
 void
-TxnStore::unput(uint64_t id, const string &key, const string &value)
+TxnStore::unput(uint64_t id, const string &key, const string &value,
+                opnum_t op)
 {
     Debug("[%" PRIu64 "] UNDO PUT %s %s", id, key.c_str(), value.c_str());
 }
 
 int
-TxnStore::prepare(uint64_t id, opnum_t op)
+TxnStore::getVersion(const string &key, string &value, uint64_t &timestamp)
+{
+    Debug("GET VERSION %s", key.c_str());
+    return 0;
+}
+
+int
+TxnStore::prepare(uint64_t id, const ReadList &reads,
+                  const WriteList &writes, uint64_t &timestamp, opnum_t op)
 {    
     Debug("[%" PRIu64 "] START PREPARE", id);
     return 0;
 }
 
 void
-TxnStore::unprepare(uint64_t id, opnum_t op)
+TxnStore::unprepare(uint64_t id, const ReadList &reads,
+                    const WriteList &writes, opnum_t op)
 {
     Debug("[%" PRIu64 "] UNDO PREPARE", id);
 }
@@ -74,6 +86,22 @@ TxnStore::commit(uint64_t id, uint64_t timestamp, opnum_t op)
     Debug("[%" PRIu64 "] COMMIT", id);
 }
 
+int
+TxnStore::prepareCommit(uint64_t id, const ReadList &reads,
+                        const WriteList &writes, uint64_t &timestamp,
+                        opnum_t op)
+{
+    Debug("[%" PRIu64 "] PREPARE AND COMMIT", id);
+    return 0;
+}
+
+void
+TxnStore::unprepareCommit(uint64_t id, const ReadList &reads,
+                          const WriteList &writes, opnum_t op)
+{
+    Debug("[%" PRIu64 "] UNDO PREPARE AND COMMIT", id);
+}
+
 void
 TxnStore::uncommit(uint64_t id, uint64_t timestamp, opnum_t op)
 {
@@ -13,38 +13,65 @@
 
 #include "lib/viewstamp.h"
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace nistore {
 
 using namespace std;
 
+// (key, timestamp) of the versions a client read with getVersion
+// and sent with PREPARE to be validated
+typedef vector<pair<string, uint64_t> > ReadList;
+// (key, value) pairs that a client buffered and sent with PREPARE
+typedef vector<pair<string, string> > WriteList;
+
 class TxnStore
 {
 public:
 
     TxnStore();
-    ~TxnStore();
+    virtual ~TxnStore();
 
     // begin a transaction
     virtual void begin(uint64_t id);
     // add key to read set
-    virtual int get(uint64_t id, const string &key, string &value);
+    virtual int get(uint64_t id, const string &key, string &value,
+                    opnum_t op);
     // add key to write set
-    virtual int put(uint64_t id, const string &key, const string &value);
-    // check whether we can commit or abort this transaction
-    // and lock the read/write set
-    virtual int prepare(uint64_t id, opnum_t op);
-    // commit the transaction
+    virtual int put(uint64_t id, const string &key, const string &value,
+                    opnum_t op);
+    // read the latest version of key outside of any transaction
+    virtual int getVersion(const string &key, string &value,
+                           uint64_t &timestamp);
+    // add the unlogged reads to the read set and the buffered
+    // writes to the write set, then check whether we can commit or
+    // abort this transaction and lock the read/write set; a YES vote
+    // comes with the earliest timestamp the transaction can commit at
+    virtual int prepare(uint64_t id, const ReadList &reads,
+                        const WriteList &writes, uint64_t &timestamp,
+                        opnum_t op);
+    // commit the transaction at timestamp, no earlier than the one
+    // every participant's prepare returned
     virtual void commit(uint64_t id, uint64_t timestamp, opnum_t op);
+    // prepare and, if that succeeds, commit at a timestamp chosen
+    // here, for transactions with no other participants
+    virtual int prepareCommit(uint64_t id, const ReadList &reads,
+                              const WriteList &writes,
+                              uint64_t &timestamp, opnum_t op);
     // abort a running transaction
     virtual void abortTxn(uint64_t id, opnum_t op);
 
     // undo operations from Spec Paxos
     virtual void unbegin(uint64_t id);
-    virtual void unget(uint64_t id, const string &key);
-    virtual void unput(uint64_t id, const string &key, const string &value);
-    virtual void unprepare(uint64_t id, opnum_t op);
+    virtual void unget(uint64_t id, const string &key, opnum_t op);
+    virtual void unput(uint64_t id, const string &key, const string &value,
+                       opnum_t op);
+    virtual void unprepare(uint64_t id, const ReadList &reads,
+                           const WriteList &writes, opnum_t op);
     virtual void uncommit(uint64_t id, uint64_t timestamp, opnum_t op);
+    virtual void unprepareCommit(uint64_t id, const ReadList &reads,
+                                 const WriteList &writes, opnum_t op);
     virtual void unabort(uint64_t id, opnum_t op);
 
     // upcall from Spec Paxos to clean up
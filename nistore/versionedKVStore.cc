@@ -9,28 +9,84 @@
 
 #include "nistore/versionedKVStore.h"
 #include "lib/assert.h"
+#include "lib/hash.h"
 #include "lib/message.h"
 
+#include <algorithm>
+
 namespace nistore {
 using namespace std;
 
-VersionedKVStore::VersionedKVStore() { }
+static const size_t INITIAL_CAPACITY = 1024;
+
+static bool
+versionBefore(uint64_t timestamp, const pair<uint64_t, string> &v)
+{
+    return timestamp < v.first;
+}
+
+VersionedKVStore::VersionedKVStore()
+    : table(INITIAL_CAPACITY), keys(0), versions(0) { }
     
 VersionedKVStore::~VersionedKVStore() { }
     
+/* Index of the slot for key: the one holding it, or else the empty
+ * one where it would go. */
+size_t
+VersionedKVStore::lookup(const string &key, uint32_t h) const
+{
+    size_t mask = table.size() - 1;
+    size_t i;
+    for (i = h & mask; table[i].used; i = (i+1) & mask) {
+        if ((table[i].hash == h) && (table[i].key == key)) {
+            break;
+        }
+    }
+    return i;
+}
+
+VersionedKVStore::Entry *
+VersionedKVStore::find(const string &key)
+{
+    uint32_t h = ::hash(key.data(), key.size(), 0);
+    Entry &e = table[lookup(key, h)];
+    if (!e.used || e.versions.empty()) {
+        return NULL;
+    }
+    return &e;
+}
+
+/* Double the table, keeping the load factor under 1/2 */
+void
+VersionedKVStore::grow()
+{
+    vector<Entry> old(table.size() * 2);
+    old.swap(table);
+    multi.clear();
+    for (Entry &e : old) {
+        if (!e.used) {
+            continue;
+        }
+        size_t i = lookup(e.key, e.hash);
+        table[i] = std::move(e);
+        table[i].inMulti = (table[i].versions.size() > 1);
+        if (table[i].inMulti) {
+            multi.push_back(i);
+        }
+    }
+}
 
 /* Returns the most recent value and timestamp for given key.
  * Error if key does not exist. */
 bool 
 VersionedKVStore::get(const string &key, pair<uint64_t, string> &value)
 {
-    // check for existence of key in store
-    if (store.find(key) == store.end()) {
+    Entry *e = find(key);
+    if (e == NULL) {
         return false;
-    } else {
-	value = store[key].front();
-        return true;
     }
+    value = e->versions.back();
+    return true;
 }
     
 /* Returns the value valid at given timestamp.
@@ -38,64 +94,88 @@ VersionedKVStore::get(const string &key, pair<uint64_t, string> &value)
 bool
 VersionedKVStore::get(const string &key, uint64_t timestamp, string &value)
 {
-    // check for existence of key in store
-    if (store.find(key) == store.end()) {
+    Entry *e = find(key);
+    if (e == NULL) {
+        return false;
+    }
+
+    // Latest version at or before timestamp
+    auto it = upper_bound(e->versions.begin(), e->versions.end(),
+                          timestamp, versionBefore);
+    if (it == e->versions.begin()) {
         return false;
-    } else {
-        list<pair<uint64_t, string> >::iterator it = store[key].begin();
-        while (it != store[key].end()) {
-            if ( timestamp >= (*it).first ) {
-                value = (*it).second;
-                return true;
-            }
-            it++;
-        }
     }
-    return false;
+    value = (it-1)->second;
+    return true;
 }
 
 bool
 VersionedKVStore::put(const string &key, const string &value, uint64_t timestamp)
 {
-    // Key does not exist. Create a list and an entry.
-    if (store.find(key) == store.end()) {
-        list<pair<uint64_t, string> > l;
-        l.push_front(make_pair(timestamp, value));
-        store[key] = l;
-        return true;
-    } 
+    if ((keys+1)*2 > table.size()) {
+        grow();
+    }
 
-    // Key exists, add it to list of values if newer timestamp.
-    if (timestamp > store[key].front().first) {
-        store[key].push_front(make_pair(timestamp, value));
-        return true;
-    } else {
-        // newer version exists, insert older version
-        list<pair<uint64_t, string> >::iterator it = store[key].begin();
-        while (it != store[key].end()) {
-            if ( timestamp > (*it).first ) {
-                store[key].insert(it, make_pair(timestamp, value));
-                return true;
-            }
-            it++;
-        }
-        return true;
+    uint32_t h = ::hash(key.data(), key.size(), 0);
+    size_t i = lookup(key, h);
+    Entry &e = table[i];
+    if (!e.used) {
+        e.used = true;
+        e.hash = h;
+        e.key = key;
+        keys++;
     }
 
-    return false;
+    if (e.versions.empty() || (timestamp > e.versions.back().first)) {
+        e.versions.push_back(make_pair(timestamp, value));
+    } else {
+        // newer version exists, insert older version behind any
+        // others with the same timestamp
+        auto it = lower_bound(e.versions.begin(), e.versions.end(),
+                              make_pair(timestamp, string()));
+        e.versions.insert(it, make_pair(timestamp, value));
+    }
+    versions++;
+    if ((e.versions.size() > 1) && !e.inMulti) {
+        e.inMulti = true;
+        multi.push_back(i);
+    }
+    return true;
 }
 
 /* Delete the latest version of this key. */
 bool
 VersionedKVStore::remove(const string &key, pair<uint64_t, string> &value)
 {
-    if (store.find(key) == store.end()) {
+    Entry *e = find(key);
+    if (e == NULL) {
         return false;
     } 
 
-    value = store[key].front();
-    store[key].pop_front();
+    value = std::move(e->versions.back());
+    e->versions.pop_back();
+    versions--;
     return true;
 }
 
+void
+VersionedKVStore::gc(uint64_t timestamp)
+{
+    size_t kept = 0;
+    for (size_t i : multi) {
+        vector<Version> &v = table[i].versions;
+        auto it = upper_bound(v.begin(), v.end(), timestamp, versionBefore);
+        if (it - v.begin() > 1) {
+            versions -= (it - v.begin()) - 1;
+            v.erase(v.begin(), it-1);
+        }
+        if (v.size() > 1) {
+            multi[kept++] = i;
+        } else {
+            table[i].inMulti = false;
+        }
+    }
+    multi.resize(kept);
+}
+
 } // namespace nistore
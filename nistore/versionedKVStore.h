@@ -12,15 +12,19 @@
 
 #include <unistd.h>
 #include <stdlib.h>
-#include <unordered_map>
+#include <stdint.h>
+#include <string>
+#include <utility>
 #include <vector>
-#include <fstream>
-#include <iostream>
-#include <list>
 
 namespace nistore {
 using namespace std;
 
+/* Multiversion store: an open-addressing hash table from key to the
+ * key's versions, kept oldest first in one vector so that reads at a
+ * timestamp are a binary search. Each operation hashes the key once.
+ * Old versions stay around until gc() is told that no one will read
+ * them any more. */
 class VersionedKVStore
 {
 
@@ -33,9 +37,35 @@ public:
     bool put(const string &key, const string &value, uint64_t timestamp);
     bool remove(const string &key, pair<uint64_t, string> &value);
 
+    /* Drop every version that isn't visible at or after timestamp,
+     * i.e. all but the latest version at or before it. */
+    void gc(uint64_t timestamp);
+    size_t numVersions() const { return versions; };
+
 private:
-    /* Global store which keep key -> (timestamp, value) list. */
-    unordered_map<string, list<pair<uint64_t, string> > > store;
+    typedef pair<uint64_t, string> Version;
+
+    struct Entry {
+        bool used;
+        bool inMulti;
+        uint32_t hash;
+        string key;
+        /* sorted by timestamp, oldest first */
+        vector<Version> versions;
+
+        Entry() : used(false), inMulti(false), hash(0) { };
+    };
+
+    vector<Entry> table;
+    size_t keys;
+    size_t versions;
+    /* Indexes of the entries that might have more than one version,
+     * which are all gc() needs to look at */
+    vector<size_t> multi;
+
+    size_t lookup(const string &key, uint32_t h) const;
+    Entry *find(const string &key);
+    void grow();
 };
 
 } // namespace nistore
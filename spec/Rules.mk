@@ -1,7 +1,7 @@
 d := $(dir $(lastword $(MAKEFILE_LIST)))
 
 SRCS += $(addprefix $(d), \
-	replica.cc client.cc)
+	replica.cc client.cc sync.cc)
 
 PROTOS += $(addprefix $(d), \
 	    spec-proto.proto)
@@ -10,7 +10,10 @@ OBJS-spec-client := $(o)client.o $(o)spec-proto.o \
                     $(OBJS-client) $(LIB-message) \
                     $(LIB-configuration)
 
+OBJS-spec-sync := $(o)sync.o $(LIB-message)
+
 OBJS-spec-replica := $(o)replica.o $(o)spec-proto.o \
+                     $(OBJS-spec-sync) \
                      $(OBJS-replica) $(LIB-message) \
                      $(LIB-configuration) $(LIB-latency)
 
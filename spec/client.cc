@@ -34,8 +34,11 @@
 #include "lib/message.h"
 #include "lib/transport.h"
 #include "spec/client.h"
+#include "spec/digest.h"
 #include "spec/spec-proto.pb.h"
 
+#include <algorithm>
+
 namespace specpaxos {
 namespace spec {
 
@@ -48,45 +51,40 @@ SpecClient::SpecClient(const Configuration &config,
       speculativeReplyQuorum(config.FastQuorumSize())
 {
     lastReqId = 0;
+    lastSentReqId = 0;
     view = 0;
-    pendingRequest = NULL;
     pendingUnloggedRequest = NULL;
     
-    requestTimeout = new Timeout(transport, 7000, [this]() {
-            Warning("Client timed out; resending request");
-            ResendRequest();
-        });
     unloggedRequestTimeout = new Timeout(transport, 1000, [this]() {
             UnloggedRequestTimeoutCallback();
         });
+    batchTimeout = new Timeout(transport, 1, [this]() {
+            FlushBatch();
+        });
 }
 
 SpecClient::~SpecClient()
 {
-    if (pendingRequest) {
-        delete pendingRequest;
+    for (auto &kv : pendingRequests) {
+        delete kv.second->timeout;
+        delete kv.second;
     }
     if (pendingUnloggedRequest) {
         delete pendingUnloggedRequest;
     }
-    delete requestTimeout;
     delete unloggedRequestTimeout;
+    delete batchTimeout;
 }
 
 void
 SpecClient::Invoke(const string &request,
                    continuation_t continuation)
 {
-    // XXX Can only handle one pending request for now
-    if (pendingRequest != NULL) {
-        Panic("Client only supports one pending request");
-    }
-
     ++lastReqId;
     uint64_t reqId = lastReqId;
-    pendingRequest = new PendingRequest(request, reqId, continuation);
+    pendingRequests[reqId] = new PendingRequest(request, reqId, continuation);
 
-    SendRequest();
+    SendNewRequests();
 }
 
 void
@@ -121,22 +119,105 @@ SpecClient::InvokeUnlogged(int replicaIdx,
 
 
 void
-SpecClient::SendRequest()
+SpecClient::SetBatching(uint32_t maxOps, uint64_t maxDelay)
+{
+    Client::SetBatching(maxOps, maxDelay);
+    FlushBatch();
+    // Timers only have millisecond resolution
+    batchTimeout->SetTimeout(std::max<uint64_t>((maxDelay+999)/1000, 1));
+}
+
+uint64_t
+SpecClient::AckedReqId() const
+{
+    if (pendingRequests.empty()) {
+        return lastReqId;
+    }
+    return pendingRequests.begin()->first - 1;
+}
+
+void
+SpecClient::SendNewRequests()
+{
+    // Send whatever the window allows, oldest first
+    for (auto it = pendingRequests.upper_bound(lastSentReqId);
+         it != pendingRequests.end(); ++it) {
+        if (it->first >= pendingRequests.begin()->first + window) {
+            break;
+        }
+        PendingRequest *req = it->second;
+        uint64_t reqId = req->clientReqId;
+        req->timeout = new Timeout(transport, 7000, [this, reqId]() {
+                ResendRequest(reqId);
+            });
+        lastSentReqId = reqId;
+        if (batchOps > 1) {
+            BatchRequest(req);
+        } else {
+            SendRequest(req);
+        }
+    }
+}
+
+void
+SpecClient::FillRequest(const PendingRequest *req, Request *r) const
+{
+    r->set_op(req->request);
+    r->set_clientid(clientid);
+    r->set_clientreqid(req->clientReqId);
+    r->set_ackedreqid(AckedReqId());
+}
+
+void
+SpecClient::SendRequest(const PendingRequest *req)
 {
     RequestMessage reqMsg;
-    reqMsg.mutable_req()->set_op(pendingRequest->request);
-    reqMsg.mutable_req()->set_clientid(clientid);
-    reqMsg.mutable_req()->set_clientreqid(pendingRequest->clientReqId);
+    FillRequest(req, reqMsg.mutable_req());
     
     transport->SendMessageToAll(this, reqMsg);
     
-    requestTimeout->Reset();
+    req->timeout->Reset();
+}
+
+void
+SpecClient::BatchRequest(const PendingRequest *req)
+{
+    FillRequest(req, batch.add_req());
+    req->timeout->Reset();
+
+    if (batch.req_size() >= (int)batchOps) {
+        FlushBatch();
+    } else if (!batchTimeout->Active()) {
+        batchTimeout->Start();
+    }
 }
 
 void
-SpecClient::ResendRequest()
+SpecClient::FlushBatch()
 {
-    SendRequest();
+    batchTimeout->Stop();
+
+    if (batch.req_size() == 0) {
+        return;
+    } else if (batch.req_size() == 1) {
+        RequestMessage reqMsg;
+        *reqMsg.mutable_req() = batch.req(0);
+        transport->SendMessageToAll(this, reqMsg);
+    } else {
+        Debug("Sending batch of %d requests", batch.req_size());
+        transport->SendMessageToAll(this, batch);
+    }
+    batch.Clear();
+}
+
+void
+SpecClient::ResendRequest(uint64_t clientReqId)
+{
+    auto it = pendingRequests.find(clientReqId);
+    ASSERT(it != pendingRequests.end());
+    Warning("Client timed out; resending request " FMT_CLIENTREQID,
+            clientReqId);
+    SendRequest(it->second);
 }
 
 
@@ -147,6 +228,7 @@ SpecClient::ReceiveMessage(const TransportAddress &remote,
 {
     static RequestMessage reqMsg;
     static SpeculativeReplyMessage reply;
+    static SpeculativeReplyBatchMessage replyBatch;
     static UnloggedReplyMessage unloggedReply;
     
     if (type == reqMsg.GetTypeName()) {
@@ -155,6 +237,9 @@ SpecClient::ReceiveMessage(const TransportAddress &remote,
     } else if (type == reply.GetTypeName()) {
         reply.ParseFromString(data);
         HandleReply(remote, reply);
+    } else if (type == replyBatch.GetTypeName()) {
+        replyBatch.ParseFromString(data);
+        HandleReplyBatch(remote, replyBatch);
     } else if (type == unloggedReply.GetTypeName()) {
         unloggedReply.ParseFromString(data);
         HandleUnloggedReply(remote, unloggedReply);
@@ -164,17 +249,19 @@ SpecClient::ReceiveMessage(const TransportAddress &remote,
 }
 
 void
-SpecClient::CompleteOperation(const SpeculativeReplyMessage &msg)
+SpecClient::CompleteOperation(PendingRequest *req,
+                              const SpeculativeReplyMessage &msg)
 {
     // Now we've got n-e matching responses. We can consider
     // the operation complete.
-    requestTimeout->Stop();
+    pendingRequests.erase(req->clientReqId);
+    delete req->timeout;
+    speculativeReplyQuorum.Clear(req->clientReqId);
 
-    PendingRequest *req = pendingRequest;
-    pendingRequest = NULL;
-    speculativeReplyQuorum.Clear();
+    // The window might have room for more requests now
+    SendNewRequests();
 
-    Debug("Completed operation " FMT_OPNUM, req->clientReqId);
+    Debug("Completed operation " FMT_CLIENTREQID, req->clientReqId);
     req->continuation(req->request, msg.reply());
     delete req;
 }
@@ -183,15 +270,13 @@ void
 SpecClient::HandleReply(const TransportAddress &remote,
                         const SpeculativeReplyMessage &msg)
 {
-    if (pendingRequest == NULL) {
-        Debug("Received reply when no request was pending");
-        return;
-    }
-
-    if (msg.clientreqid() != pendingRequest->clientReqId) {
-        Debug("Received reply for a different request");
+    auto it = pendingRequests.find(msg.clientreqid());
+    if ((it == pendingRequests.end()) ||
+        (it->second->timeout == NULL)) {
+        Debug("Received reply for a request that isn't pending");
         return;
     }
+    PendingRequest *req = it->second;
 
     Debug("Client received %s reply from replica %d",
           msg.committed() ? "non-speculative" : "speculative",
@@ -203,8 +288,8 @@ SpecClient::HandleReply(const TransportAddress &remote,
         view = msg.view();
     }
 
-    if (msg.committed()) {
-        CompleteOperation(msg);
+    if (msg.committed() && msg.has_reply()) {
+        CompleteOperation(req, msg);
         return;
     }
     
@@ -214,22 +299,50 @@ SpecClient::HandleReply(const TransportAddress &remote,
                                                     msg)) {
         /*
          * We now have a quorum of at least n-e responses. Do they
-         * match?
+         * match? Replicas might have sent only a digest of the
+         * result, so we need at least one full reply to check the
+         * digests against.
          */
-        int matching = 0;
+        const SpeculativeReplyMessage *full = NULL;
+        for (auto &kv : *msgs) {
+            if ((kv.second.loghash() == msg.loghash()) &&
+                kv.second.has_reply()) {
+                full = &kv.second;
+                break;
+            }
+        }
+        string digest;
+        if (full != NULL) {
+            digest = ReplyDigest(full->reply());
+        }
 
+        int matching = 0;
         for (auto &kv : *msgs) {
-            if (kv.second.loghash() == msg.loghash()) {
-                matching++;
-                ASSERT(kv.second.clientreqid() == msg.clientreqid());
-                ASSERT(kv.second.view() == msg.view());
-                ASSERT(kv.second.opnum() == msg.opnum());
-                ASSERT(kv.second.reply() == msg.reply());
+            if (kv.second.loghash() != msg.loghash()) {
+                continue;
             }
+            ASSERT(kv.second.clientreqid() == msg.clientreqid());
+            ASSERT(kv.second.view() == msg.view());
+            ASSERT(kv.second.opnum() == msg.opnum());
+            if (kv.second.has_reply()) {
+                ASSERT(kv.second.reply() == full->reply());
+            } else if ((full != NULL) &&
+                       (kv.second.replydigest() != digest)) {
+                Warning("Reply digest from replica %d doesn't match",
+                        kv.first);
+                continue;
+            }
+            matching++;
         }
 
-        if (matching >= config.FastQuorumSize()) {
-            CompleteOperation(msg);
+        if ((matching >= config.FastQuorumSize()) && (full == NULL)) {
+            Debug("Have a matching quorum of digests for "
+                  FMT_CLIENTREQID "; waiting for the full reply",
+                  msg.clientreqid());
+        } else if (matching >= config.FastQuorumSize()) {
+            // Completing the operation clears the quorum set
+            SpeculativeReplyMessage reply = *full;
+            CompleteOperation(req, reply);
         } else {
             // XXX This gets triggered if there are n-e responses and
             // they don't all match.
@@ -247,6 +360,15 @@ SpecClient::HandleReply(const TransportAddress &remote,
     }
 }
 
+void
+SpecClient::HandleReplyBatch(const TransportAddress &remote,
+                             const SpeculativeReplyBatchMessage &msg)
+{
+    for (const SpeculativeReplyMessage &reply : msg.reply()) {
+        HandleReply(remote, reply);
+    }
+}
+
 void
 SpecClient::HandleUnloggedReply(const TransportAddress &remote,
                               const proto::UnloggedReplyMessage &msg)
@@ -36,6 +36,8 @@
 #include "common/quorumset.h"
 #include "spec/spec-proto.pb.h"
 
+#include <map>
+
 namespace specpaxos {
 namespace spec {
         
@@ -53,6 +55,7 @@ public:
                                 continuation_t continuation,
                                 timeout_continuation_t timeoutContinuation = nullptr,
                                 uint32_t timeout = DEFAULT_UNLOGGED_OP_TIMEOUT);
+    virtual void SetBatching(uint32_t maxOps, uint64_t maxDelay);
     virtual void ReceiveMessage(const TransportAddress &remote,
                         const string &type, const string &data);
 
@@ -67,22 +70,37 @@ protected:
         uint64_t clientReqId;
         continuation_t continuation;
         timeout_continuation_t timeoutContinuation;
+        // Only set once the request has been sent
+        Timeout *timeout;
         inline PendingRequest(string request, uint64_t clientReqId,
                               continuation_t continuation)
             : request(request), clientReqId(clientReqId),
-              continuation(continuation) { }
+              continuation(continuation), timeout(NULL) { }
     };
-    PendingRequest *pendingRequest;
+    // Requests that haven't completed, whether or not the window
+    // has let us send them yet
+    std::map<uint64_t, PendingRequest *> pendingRequests;
+    uint64_t lastSentReqId;
+    // Requests waiting to go out in the next batch
+    proto::RequestBatchMessage batch;
+    Timeout *batchTimeout;
     PendingRequest *pendingUnloggedRequest;
-    Timeout *requestTimeout;
     Timeout *unloggedRequestTimeout;
-    QuorumSet<int, proto::SpeculativeReplyMessage> speculativeReplyQuorum;
+    QuorumSet<uint64_t, proto::SpeculativeReplyMessage> speculativeReplyQuorum;
 
-    void SendRequest();
-    void ResendRequest();
-    void CompleteOperation(const proto::SpeculativeReplyMessage &msg);
+    uint64_t AckedReqId() const;
+    void SendNewRequests();
+    void FillRequest(const PendingRequest *req, Request *r) const;
+    void SendRequest(const PendingRequest *req);
+    void BatchRequest(const PendingRequest *req);
+    void FlushBatch();
+    void ResendRequest(uint64_t clientReqId);
+    void CompleteOperation(PendingRequest *req,
+                           const proto::SpeculativeReplyMessage &msg);
     void HandleReply(const TransportAddress &remote,
                      const proto::SpeculativeReplyMessage &msg);
+    void HandleReplyBatch(const TransportAddress &remote,
+                          const proto::SpeculativeReplyBatchMessage &msg);
     void HandleUnloggedReply(const TransportAddress &remote,
                              const proto::UnloggedReplyMessage &msg);
     void UnloggedRequestTimeoutCallback();
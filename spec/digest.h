@@ -0,0 +1,53 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * spec/digest.h:
+ *   digests of speculative replies, so that most replicas can send
+ *   a digest instead of the whole result
+ *
+ * Copyright 2013-2016 Dan R. K. Ports  <drkp@cs.washington.edu>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+
+#ifndef _SPEC_DIGEST_H_
+#define _SPEC_DIGEST_H_
+
+#include <openssl/sha.h>
+#include <string>
+
+namespace specpaxos {
+namespace spec {
+
+inline std::string
+ReplyDigest(const std::string &reply)
+{
+    unsigned char out[SHA_DIGEST_LENGTH];
+    SHA1((const unsigned char *)reply.data(), reply.size(), out);
+    return std::string((char *)out, SHA_DIGEST_LENGTH);
+}
+
+} // namespace specpaxos::spec
+} // namespace specpaxos
+
+#endif  /* _SPEC_DIGEST_H_ */
@@ -28,11 +28,10 @@
  *
  **********************************************************************/
 
-#define SYNC_TIMEOUT_MS            1000
-#define SYNC_TIMEOUT_REQUESTS      10000
 #define VIEW_CHANGE_TIMEOUT_MS     5000
 
 #include "common/replica.h"
+#include "spec/digest.h"
 #include "spec/replica.h"
 #include "spec/spec-proto.pb.h"
 
@@ -85,9 +84,35 @@ using namespace specpaxos::spec::proto;
 SpecReplica::SpecReplica(Configuration config, int myIdx,
                          bool initialize,
                          Transport *transport, AppReplica *app)
+    : SpecReplica(config, myIdx, initialize, transport,
+                  new SyncPolicy(), app)
+{
+}
+
+SpecReplica::SpecReplica(Configuration config, int myIdx,
+                         bool initialize,
+                         Transport *transport, SyncPolicy *syncPolicy,
+                         AppReplica *app, bool digestReplies,
+                         bool execThread)
     : Replica(config, myIdx, initialize, transport, app),
       log(true),
-      syncReplyQuorum(config.FastQuorumSize()-1),
+      digestReplies(digestReplies),
+      execThread(execThread ? new ExecThread(transport, app) : NULL),
+      executeSeq(0),
+      // A client's session can only be dropped once its requests
+      // are committed; until then we might need it to roll back the
+      // client table.
+      clientTable(ClientTable<ClientTableEntry>::DEFAULT_MAX_IDLE,
+                  [this](uint64_t clientid, const ClientTableEntry &e) {
+                      bool committed = true;
+                      e.ForEach([&](uint64_t reqid, opnum_t opnum) {
+                              if (opnum > lastCommitted) {
+                                  committed = false;
+                              }
+                          });
+                      return committed;
+                  }),
+      syncReplyQuorum(config.FastQuorumSize()-1, config.n),
       startViewChangeQuorum(config.QuorumSize()-1),
       doViewChangeQuorum(config.QuorumSize()),
       inViewQuorum(config.QuorumSize()-1)
@@ -105,12 +130,22 @@ SpecReplica::SpecReplica(Configuration config, int myIdx,
     this->needFillDVC = 0;
     this->pendingSync = 0;
     this->lastSync = 0;
+    this->syncPolicy = syncPolicy;
+    this->syncInFlight = 0;
+    this->syncStart = 0;
+
+    if (execThread) {
+        Notice("Executing operations on a separate thread");
+    }
     
     this->syncTimeout = new Timeout(transport,
-                                    SYNC_TIMEOUT_MS,
+                                    syncPolicy->Heartbeat() / 1000,
                                     [this]() {
             SendSync();
         });
+    this->commitSyncTimeout = new Timeout(transport, 1, [this]() {
+            SendSync();
+        });
     this->failedSyncTimeout = new Timeout(transport,
                                           VIEW_CHANGE_TIMEOUT_MS,
                                           [&]() {
@@ -127,19 +162,28 @@ SpecReplica::SpecReplica(Configuration config, int myIdx,
     _Latency_Init(&reconciliationLatency, "reconciliation");
     _Latency_Init(&mergeLatency, "merge");
     _Latency_Init(&requestLatency, "request");
+    _Latency_Init(&commitLagLatency, "commitlag");
+    _Latency_Init(&syncLatency, "sync");
 
     EnterView(0);
 }
 
 SpecReplica::~SpecReplica()
 {
+    // Stop the execution thread before anything its completions use
+    delete execThread;
+
     Latency_Dump(&requestLatency);
     Latency_Dump(&reconciliationLatency);
     Latency_Dump(&mergeLatency);
+    Latency_Dump(&commitLagLatency);
+    Latency_Dump(&syncLatency);
     
     delete syncTimeout;
+    delete commitSyncTimeout;
     delete failedSyncTimeout;
     delete viewChangeTimeout;
+    delete syncPolicy;
 }
 
 bool
@@ -153,6 +197,7 @@ SpecReplica::CommitUpTo(opnum_t upto)
 {
     RNotice("Committing up to " FMT_OPNUM, upto);
 
+    uint64_t now = transport->Now();
     while (lastCommitted < upto) {
         lastCommitted++;
         
@@ -161,9 +206,29 @@ SpecReplica::CommitUpTo(opnum_t upto)
         if (!success) {
             RPanic("Entry not found in log");
         }
+
+        ASSERT(!execTimes.empty());
+        Latency_Add(&commitLagLatency, (now - execTimes.front()) * 1000);
+        execTimes.pop_front();
+    }
+
+    if ((syncInFlight != 0) && (lastCommitted >= syncInFlight)) {
+        syncPolicy->SyncCompleted(now - syncStart);
+        Latency_Add(&syncLatency, (now - syncStart) * 1000);
+        syncInFlight = 0;
     }
 
-    Commit(upto);
+    // Sync replies for anything before the last committed operation
+    // can no longer matter. (We keep the last committed one itself:
+    // an idle leader still needs a quorum for it to maintain the
+    // failed sync timeout.)
+    syncReplyQuorum.SetWatermark(lastCommitted);
+
+    if (execThread != NULL) {
+        execThread->Commit(upto);
+    } else {
+        Commit(upto);
+    }
 }
 
 void
@@ -183,47 +248,77 @@ SpecReplica::RollbackTo(opnum_t backto)
         const LogEntry *entry = log.Find(i);
         ASSERT(entry != NULL);
         
-        ClientTableEntry &cte = clientTable[entry->request.clientid()];
-        ASSERT(cte.lastReqOpnum == entry->viewstamp.opnum);
-        cte.lastReqOpnum = entry->prevClientReqOpnum;
-        if (cte.lastReqOpnum > 0) {
-            const LogEntry *oldEntry = log.Find(cte.lastReqOpnum);
-            ASSERT(oldEntry != NULL);
-            RDebug("Rolling back client table entry for " FMT_CLIENTID " from " FMT_CLIENTREQID " to " FMT_CLIENTREQID,
-                    entry->request.clientid(),
-                    cte.lastReqId,
-                    oldEntry->request.clientreqid());
-            cte.lastReqId = oldEntry->request.clientreqid();
-        } else {
-            cte.lastReqId = 0;
+        ClientTableEntry *cte = clientTable.Find(entry->request.clientid());
+        ASSERT(cte != NULL);
+        uint64_t reqid = entry->request.clientreqid();
+        const opnum_t *reqOpnum = cte->Find(reqid);
+        // The request might also be in the log at an earlier opnum,
+        // or be stale because the client has since completed it,
+        // in which case there's nothing to undo.
+        if ((reqOpnum != NULL) && (*reqOpnum == i)) {
+            RDebug("Rolling back client table entry for " FMT_CLIENTID
+                   " request " FMT_CLIENTREQID,
+                   entry->request.clientid(), reqid);
+            cte->Erase(reqid);
         }
     }
 
-    Rollback(lastSpeculative, backto, log);
-    
+    if (execThread != NULL) {
+        // Completions for the operations we're undoing may still
+        // come in; they no longer have a log entry to update
+        executing.erase(executing.upper_bound(backto), executing.end());
+        execThread->Rollback(lastSpeculative, backto, log);
+    } else {
+        Rollback(lastSpeculative, backto, log);
+    }
 
     log.RemoveAfter(backto+1);
+    syncPolicy->RolledBack(lastSpeculative - backto);
+    execTimes.resize(backto - lastCommitted);
     lastSpeculative = backto;
 }
     
 void
 SpecReplica::UpdateClientTable(const Request &req,
                                LogEntry &logEntry,
-                               const SpeculativeReplyMessage &reply)
+                               const SpeculativeReplyMessage *reply)
 {
-    ClientTableEntry &entry = clientTable[req.clientid()];
+    ClientTableEntry &entry =
+        clientTable.Lookup(req.clientid(), logEntry.viewstamp.opnum);
 
-    ASSERT(entry.lastReqId <= req.clientreqid());
-
-    logEntry.prevClientReqOpnum = entry.lastReqOpnum;
-    logEntry.replyMessage = new SpeculativeReplyMessage(reply);
+    if (reply != NULL) {
+        logEntry.replyMessage = new SpeculativeReplyMessage(*reply);
+    }
 
-    if (entry.lastReqId == req.clientreqid()) {
+    if (entry.IsStale(req.clientreqid()) ||
+        (entry.Find(req.clientreqid()) != NULL)) {
         return;
     }
 
-    entry.lastReqId = req.clientreqid();
-    entry.lastReqOpnum = logEntry.viewstamp.opnum;
+    entry.Insert(req.clientreqid(), req.ackedreqid()) =
+        logEntry.viewstamp.opnum;
+}
+
+// Note that opnum has been handed to the execution thread, returning
+// the sequence number to give FinishExecuting
+uint64_t
+SpecReplica::StartExecuting(opnum_t opnum)
+{
+    executing[opnum] = ++executeSeq;
+    return executeSeq;
+}
+
+// Note that opnum has been executed, returning whether its log
+// entry is still the one that was submitted
+bool
+SpecReplica::FinishExecuting(opnum_t opnum, uint64_t seq)
+{
+    auto it = executing.find(opnum);
+    if ((it == executing.end()) || (it->second != seq)) {
+        return false;
+    }
+    executing.erase(it);
+    return true;
 }
 
 void
@@ -231,6 +326,7 @@ SpecReplica::ReceiveMessage(const TransportAddress &remote,
                             const string &type, const string &data)
 {
     static RequestMessage request;
+    static RequestBatchMessage requestBatch;
     static UnloggedRequestMessage unloggedRequest;
     static SyncMessage sync;
     static SyncReplyMessage syncReply;
@@ -245,6 +341,9 @@ SpecReplica::ReceiveMessage(const TransportAddress &remote,
     if (type == request.GetTypeName()) {
         request.ParseFromString(data);
         HandleRequest(remote, request);
+    } else if (type == requestBatch.GetTypeName()) {
+        requestBatch.ParseFromString(data);
+        HandleRequestBatch(remote, requestBatch);
     } else if (type == unloggedRequest.GetTypeName()) {
         unloggedRequest.ParseFromString(data);
         HandleUnloggedRequest(remote, unloggedRequest);
@@ -290,42 +389,80 @@ void
 SpecReplica::HandleRequest(const TransportAddress &remote,
                            const RequestMessage &msg)
 {
+    std::shared_ptr<ReplyBatch> batch = std::make_shared<ReplyBatch>();
+    ExecuteRequest(remote, msg.req(), batch);
+    FinishBatch(batch);
+}
+
+void
+SpecReplica::HandleRequestBatch(const TransportAddress &remote,
+                                const RequestBatchMessage &msg)
+{
+    // The requests are executed back to back, so they get
+    // consecutive opnums, and all their replies go back in one
+    // message
+    std::shared_ptr<ReplyBatch> batch = std::make_shared<ReplyBatch>();
+    for (const Request &req : msg.req()) {
+        ExecuteRequest(remote, req, batch);
+    }
+    FinishBatch(batch);
+}
+
+// Send the replies in batch, unless some of them are still being
+// executed, in which case the last one to complete sends them
+void
+SpecReplica::FinishBatch(const std::shared_ptr<ReplyBatch> &batch)
+{
+    batch->sealed = true;
+    if (batch->executing == 0) {
+        SendReplies(*batch->remote, batch->replies);
+    }
+}
+
+// Speculatively execute a request, adding the reply to batch
+void
+SpecReplica::ExecuteRequest(const TransportAddress &remote,
+                            const Request &req,
+                            const std::shared_ptr<ReplyBatch> &batch)
+{
+    SpeculativeReplyBatchMessage &replies = batch->replies;
+    if (!batch->remote) {
+        batch->remote.reset(remote.clone());
+    }
     viewstamp_t v;
 
     Latency_Start(&requestLatency);
 
     // Save the client's address
-    clientAddresses.erase(msg.req().clientid());
-    clientAddresses.insert(
-        std::pair<uint64_t, std::unique_ptr<TransportAddress> >(
-            msg.req().clientid(),
-            std::unique_ptr<TransportAddress>(remote.clone())));
+    clientTable.SetAddress(req.clientid(), remote, lastSpeculative);
 
     // Check the client table to see if this is a duplicate request
-    auto kv = clientTable.find(msg.req().clientid());
-    if (kv != clientTable.end()) {
-        const ClientTableEntry &entry = kv->second;
-        if (msg.req().clientreqid() < entry.lastReqId) {
+    const ClientTableEntry *entry = clientTable.Find(req.clientid());
+    if (entry != NULL) {
+        if (entry->IsStale(req.clientreqid())) {
             RNotice("Ignoring stale request");
             Latency_EndType(&requestLatency, 's');
             return;
         }
-        if (msg.req().clientreqid() == entry.lastReqId) {
+        const opnum_t *reqOpnum = entry->Find(req.clientreqid());
+        if (reqOpnum != NULL) {
             // This is a duplicate request. Resend the reply.
             RNotice("Received duplicate request from client " FMT_CLIENTID "; resending reply",
-                    msg.req().clientid());
-            const LogEntry *le = log.Find(entry.lastReqOpnum);
+                    req.clientid());
+            const LogEntry *le = log.Find(*reqOpnum);
             ASSERT(le != NULL);
             SpeculativeReplyMessage *reply =
                 (SpeculativeReplyMessage *) le->replyMessage;
-            ASSERT(reply != NULL);
+            if (reply == NULL) {
+                // Still executing; the reply goes out when it's done
+                ASSERT(execThread != NULL);
+                Latency_EndType(&requestLatency, 'r');
+                return;
+            }
             if (le->state == LOG_STATE_COMMITTED) {
                 reply->set_committed(true);
             }
-            if (!(transport->SendMessage(this, remote,
-                                         *reply))) {
-                RWarning("Failed to resend reply to client");
-            }
+            *replies.add_reply() = *reply;
             Latency_EndType(&requestLatency, 'r');
             return;
         }
@@ -333,6 +470,8 @@ SpecReplica::HandleRequest(const TransportAddress &remote,
 
     // Make sure we're not doing a view change
     if (status != STATUS_NORMAL) {
+        RequestMessage msg;
+        *msg.mutable_req() = req;
         pendingRequests.push_back(
             std::pair<TransportAddress*, RequestMessage>(remote.clone(),
                                                          msg));
@@ -343,15 +482,19 @@ SpecReplica::HandleRequest(const TransportAddress &remote,
 
     /* Assign it an opnum */
     ++this->lastSpeculative;
+    uint64_t now = transport->Now();
+    execTimes.push_back(now);
+    syncPolicy->RequestArrived(now);
     v.view = this->view;
     v.opnum = this->lastSpeculative;
 
     RDebug("Received REQUEST (" FMT_CLIENTID ", " FMT_CLIENTREQID "), speculatively executing as "
           FMT_VIEWSTAMP,
-          msg.req().clientid(), msg.req().clientreqid(), VA_VIEWSTAMP(v));
+          req.clientid(), req.clientreqid(), VA_VIEWSTAMP(v));
 
-    SpeculativeReplyMessage reply;
-    reply.set_clientreqid(msg.req().clientreqid());
+    SpeculativeReplyMessage &reply = *replies.add_reply();
+    reply.set_clientreqid(req.clientreqid());
+    reply.set_clientid(req.clientid());
     reply.set_view(v.view);
     reply.set_opnum(v.opnum);
     reply.set_replicaidx(myIdx);
@@ -359,17 +502,30 @@ SpecReplica::HandleRequest(const TransportAddress &remote,
     
     /* Add the request to my log and speculatively execute it */
     LogEntry &newEntry =
-        log.Append(v, msg.req(), LOG_STATE_SPECULATIVE);
-    Execute(v.opnum, msg.req(), reply);
-
+        log.Append(v, req, LOG_STATE_SPECULATIVE);
     reply.set_loghash(log.LastHash());
-    
-    if (!(transport->SendMessage(this, remote, reply))) {
-        RWarning("Failed to send speculative reply");
+    if (execThread != NULL) {
+        int idx = replies.reply_size() - 1;
+        uint64_t seq = StartExecuting(v.opnum);
+        batch->executing++;
+        execThread->Execute(v.opnum, req.op(),
+                            [this, batch, idx, seq](const string &res) {
+                SpeculativeReplyMessage &reply =
+                    *batch->replies.mutable_reply(idx);
+                reply.set_reply(res);
+                if (FinishExecuting(reply.opnum(), seq)) {
+                    log.Find(reply.opnum())->replyMessage =
+                        new SpeculativeReplyMessage(reply);
+                }
+                if ((--batch->executing == 0) && batch->sealed) {
+                    SendReplies(*batch->remote, batch->replies);
+                }
+            });
+        UpdateClientTable(req, newEntry, NULL);
+    } else {
+        Execute(v.opnum, req, reply);
+        UpdateClientTable(req, newEntry, &reply);
     }
-
-    // Update the client table
-    UpdateClientTable(msg.req(), newEntry, reply);
     
     Latency_End(&requestLatency);
 
@@ -379,11 +535,43 @@ SpecReplica::HandleRequest(const TransportAddress &remote,
         SendSyncReply(pendingSync);
     }
 
-    // Check whether we need to send a sync based on number of
-    // requests, if we are the leader
-    if (AmLeader() &&
-        (v.opnum >= (lastSync + SYNC_TIMEOUT_REQUESTS))) {
-        SendSync();
+    ScheduleSync();
+}
+
+// Replace the result in a reply with its digest, unless we are the
+// replica that is supposed to send it in full. Committed results
+// always go out in full, since the client can use those on their
+// own.
+void
+SpecReplica::DigestReply(SpeculativeReplyMessage &reply) const
+{
+    if (!digestReplies || AmLeader() || reply.committed()) {
+        return;
+    }
+    reply.set_replydigest(ReplyDigest(reply.reply()));
+    reply.clear_reply();
+}
+
+void
+SpecReplica::SendReplies(const TransportAddress &remote,
+                         SpeculativeReplyBatchMessage &replies)
+{
+    // The log has its own copies of these replies
+    for (SpeculativeReplyMessage &reply : *replies.mutable_reply()) {
+        DigestReply(reply);
+    }
+
+    bool ok;
+    if (replies.reply_size() == 0) {
+        return;
+    } else if (replies.reply_size() == 1) {
+        ok = transport->SendMessage(this, remote, replies.reply(0));
+    } else {
+        replies.set_clientid(replies.reply(0).clientid());
+        ok = transport->SendMessage(this, remote, replies);
+    }
+    if (!ok) {
+        RWarning("Failed to send speculative reply");
     }
 }
 
@@ -402,7 +590,23 @@ SpecReplica::HandleUnloggedRequest(const TransportAddress &remote,
     
     Debug("Received unlogged request %s", (char *)msg.req().op().c_str());
 
+    if (execThread != NULL) {
+        // Run it after the operations already handed off
+        std::shared_ptr<TransportAddress> addr(remote.clone());
+        uint64_t clientid = msg.req().clientid();
+        execThread->ExecuteUnlogged(msg.req().op(),
+                                    [this, addr, clientid](const string &res) {
+                UnloggedReplyMessage reply;
+                reply.set_reply(res);
+                reply.set_clientid(clientid);
+                if (!(transport->SendMessage(this, *addr, reply)))
+                    Warning("Failed to send reply message");
+            });
+        return;
+    }
+
     ExecuteUnlogged(msg.req(), reply);
+    reply.set_clientid(msg.req().clientid());
     
     if (!(transport->SendMessage(this, remote, reply)))
         Warning("Failed to send reply message");
@@ -420,6 +624,11 @@ SpecReplica::SendSync()
     ASSERT(status == STATUS_NORMAL);
 
     lastSync = lastSpeculative;
+    commitSyncTimeout->Stop();
+    if ((syncInFlight == 0) && (lastSpeculative > lastCommitted)) {
+        syncInFlight = lastSpeculative;
+        syncStart = transport->Now();
+    }
     
     if (lastSpeculative == lastCommittedSent) {
         // Nothing to do.
@@ -442,6 +651,32 @@ SpecReplica::SendSync()
     }
 }
 
+// Called by the leader whenever it executes an operation or a sync
+// round commits, to decide whether it's time for another one
+void
+SpecReplica::ScheduleSync()
+{
+    if (!AmLeader() || (status != STATUS_NORMAL) ||
+        (lastSpeculative <= lastSync)) {
+        return;
+    }
+
+    if (lastSpeculative >= lastSync + syncPolicy->OpsThreshold()) {
+        SendSync();
+    } else if ((syncInFlight != 0) || commitSyncTimeout->Active()) {
+        // We'll get another chance when that sync commits or the
+        // timeout goes off
+    } else {
+        uint64_t delay = syncPolicy->SyncDelay();
+        if (delay == 0) {
+            SendSync();
+        } else {
+            commitSyncTimeout->SetTimeout((delay + 999) / 1000);
+            commitSyncTimeout->Start();
+        }
+    }
+}
+
 void
 SpecReplica::HandleSync(const TransportAddress &remote,
                         const SyncMessage &msg)
@@ -559,10 +794,9 @@ SpecReplica::HandleSyncReply(const TransportAddress &remote,
     ASSERT(msg.lastspeculative() <= lastSpeculative);
     
     // Check if we have a quorum
-    if (auto msgs =
-        syncReplyQuorum.AddAndCheckForQuorum(msg.lastspeculative(),
+    if (syncReplyQuorum.AddAndCheckForQuorum(msg.lastspeculative(),
                                              msg.replicaidx(),
-                                             msg)) {
+                                             msg.lastspeculativehash())) {
         failedSyncTimeout->Reset();
 
         // If we've already committed everything the other replicas
@@ -576,11 +810,11 @@ SpecReplica::HandleSyncReply(const TransportAddress &remote,
         // We have a quorum of n-e responses. Now to find out if
         // there are n-e *matching* responses...
         std::multimap<string, int> hashes;
-        for (auto kv : *msgs) {
-            hashes.insert(std::pair<string,int>(
-                              kv.second.lastspeculativehash(),
-                              kv.first));
-        }
+        syncReplyQuorum.ForEach(msg.lastspeculative(),
+                                [&](int idx, const string &hash) {
+                                    hashes.insert(std::pair<string,int>(
+                                                      hash, idx));
+                                });
         // We need to include our hash too, it's not part of the
         // quorumset
         const LogEntry *entry = log.Find(msg.lastspeculative());
@@ -607,6 +841,7 @@ SpecReplica::HandleSyncReply(const TransportAddress &remote,
             }
 
             CommitUpTo(msg.lastspeculative());
+            ScheduleSync();
         } else {
             // XXX Should we wait to see if another matching request
             // could make this a matching quorum?
@@ -638,6 +873,8 @@ SpecReplica::EnterView(view_t newview)
         syncTimeout->Stop();
         failedSyncTimeout->Stop();
     }
+    commitSyncTimeout->Stop();
+    syncInFlight = 0;
 
     syncReplyQuorum.Clear();
     startViewChangeQuorum.Clear();
@@ -678,6 +915,7 @@ SpecReplica::StartViewChange(view_t newview)
 
     viewChangeTimeout->Reset();
     syncTimeout->Stop();
+    commitSyncTimeout->Stop();
     failedSyncTimeout->Stop();
 
 
@@ -1266,29 +1504,56 @@ SpecReplica::InstallLog(const std::vector<LogEntry> &entries)
                 VA_VIEWSTAMP(newEntry->viewstamp));
         
         lastSpeculative++;
+        execTimes.push_back(transport->Now());
         LogEntry &installedEntry = 
             log.Append(newEntry->viewstamp, newEntry->request,
                        LOG_STATE_SPECULATIVE);
-        Execute(newEntry->viewstamp.opnum, newEntry->request, reply);
 
         // Prepare a reply to send to the client. Send it to the
         // client if we know the address. Either way, put it in the
         // client table so we have it available if the client
         // retries.
         reply.set_clientreqid(newEntry->request.clientreqid());
+        reply.set_clientid(newEntry->request.clientid());
         reply.set_view(newEntry->viewstamp.view);
         reply.set_opnum(newEntry->viewstamp.opnum);
         reply.set_replicaidx(myIdx);
         reply.set_loghash(log.LastHash());
         reply.set_committed(newEntry->state == LOG_STATE_COMMITTED);
 
-        auto addr = clientAddresses.find(newEntry->request.clientid());
-        if (addr != clientAddresses.end()) {
-            if (!(transport->SendMessage(this, *(addr->second), reply))) {
-                RWarning("Failed to send speculative reply");
+        if (execThread != NULL) {
+            uint64_t seq = StartExecuting(reply.opnum());
+            execThread->Execute(reply.opnum(), newEntry->request.op(),
+                                [this, reply, seq](const string &res) {
+                    SpeculativeReplyMessage sent = reply;
+                    sent.set_reply(res);
+                    if (FinishExecuting(sent.opnum(), seq)) {
+                        log.Find(sent.opnum())->replyMessage =
+                            new SpeculativeReplyMessage(sent);
+                    }
+                    const TransportAddress *addr =
+                        clientTable.GetAddress(sent.clientid());
+                    if (addr != NULL) {
+                        DigestReply(sent);
+                        if (!(transport->SendMessage(this, *addr, sent))) {
+                            RWarning("Failed to send speculative reply");
+                        }
+                    }
+                });
+            UpdateClientTable(newEntry->request, installedEntry, NULL);
+        } else {
+            Execute(newEntry->viewstamp.opnum, newEntry->request, reply);
+            const TransportAddress *addr =
+                clientTable.GetAddress(newEntry->request.clientid());
+            if (addr != NULL) {
+                SpeculativeReplyMessage sent = reply;
+                DigestReply(sent);
+                if (!(transport->SendMessage(this, *addr, sent))) {
+                    RWarning("Failed to send speculative reply");
+                }
             }
+            UpdateClientTable(newEntry->request, installedEntry, &reply);
         }
-        UpdateClientTable(newEntry->request, installedEntry, reply);
 
         ASSERT(log.LastHash() == newEntry->hash);
     }
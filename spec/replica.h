@@ -33,11 +33,15 @@
 
 #include "lib/configuration.h"
 #include "lib/latency.h"
+#include "common/clienttable.h"
+#include "common/execthread.h"
 #include "common/log.h"
 #include "common/replica.h"
 #include "common/quorumset.h"
 #include "spec/spec-proto.pb.h"
+#include "spec/sync.h"
 
+#include <deque>
 #include <map>
 #include <memory>
 #include <set>
@@ -49,13 +53,20 @@ class LogMergeTest;
 namespace specpaxos {
 namespace spec {
 
-#define FMT_CLIENTREQID "%" PRIu64
-
 class SpecReplica : public Replica
 {
 public:
     SpecReplica(Configuration config, int myIdx, bool initialize,
                 Transport *transport, AppReplica *app);
+    // Takes ownership of syncPolicy. With digestReplies, only the
+    // leader sends clients the result of a speculative operation;
+    // the others send a digest of it. With execThread, operations
+    // are executed and rolled back on a separate thread
+    // (common/execthread.h).
+    SpecReplica(Configuration config, int myIdx, bool initialize,
+                Transport *transport, SyncPolicy *syncPolicy,
+                AppReplica *app, bool digestReplies = false,
+                bool execThread = false);
     ~SpecReplica();
     
     void ReceiveMessage(const TransportAddress &remote,
@@ -70,43 +81,76 @@ private:
     opnum_t lastSpeculative;
     opnum_t pendingSync;
     opnum_t lastSync;
+    bool digestReplies;
+    SyncPolicy *syncPolicy;
+    // NULL if we execute operations ourselves
+    ExecThread *execThread;
+    // Operations handed to execThread that haven't completed yet,
+    // each with the sequence number it was submitted under. An
+    // operation that is rolled back and replaced by another at the
+    // same opnum gets a new one, so a late completion for the old
+    // one can be recognized.
+    std::map<opnum_t, uint64_t> executing;
+    uint64_t executeSeq;
+    // The sync round whose cost we are measuring, if any: the last
+    // operation it covers and when it was sent
+    opnum_t syncInFlight;
+    uint64_t syncStart;
+    // When each operation after lastCommitted was executed, for
+    // measuring commit lag
+    std::deque<uint64_t> execTimes;
     view_t sentDoViewChange;
     view_t needFillDVC;
-    std::map<uint64_t, std::unique_ptr<TransportAddress> > clientAddresses;
-    struct ClientTableEntry
-    {
-        uint64_t lastReqId;
-        // We need the opnum to identify the correct entry in the
-        // log. What we really want is the SpeculativeReplyMessage
-        // corresponding to the last request, but we need to stuff
-        // that in the log instead of keeping it here -- in order to
-        // keep this up to date even if we roll back the log.
-        opnum_t lastReqOpnum;
-    };
-    std::map<uint64_t, ClientTableEntry> clientTable;
+    // For each of the client's requests, the opnum at which it is
+    // in the log. What we really want is the SpeculativeReplyMessage,
+    // but we need to stuff that in the log instead of keeping it
+    // here -- in order to keep this up to date even if we roll back
+    // the log.
+    typedef RequestWindow<opnum_t> ClientTableEntry;
+    ClientTable<ClientTableEntry> clientTable;
     std::list<std::pair<TransportAddress *,
                         proto::RequestMessage> > pendingRequests;
+    // Replies to the requests in one REQUEST or REQUESTBATCH
+    // message, sent once all of them have been executed
+    struct ReplyBatch
+    {
+        std::unique_ptr<TransportAddress> remote;
+        proto::SpeculativeReplyBatchMessage replies;
+        // Operations still running on execThread
+        int executing;
+        // All the requests have been handed out
+        bool sealed;
+        ReplyBatch() : executing(0), sealed(false) { }
+    };
     
-    QuorumSet<opnum_t, proto::SyncReplyMessage> syncReplyQuorum;
+    BitmaskQuorumSet<string> syncReplyQuorum;
     QuorumSet<view_t, proto::StartViewChangeMessage> startViewChangeQuorum;
     QuorumSet<view_t, proto::DoViewChangeMessage> doViewChangeQuorum;
     QuorumSet<view_t, proto::InViewMessage> inViewQuorum;
 
     Timeout *syncTimeout;
+    Timeout *commitSyncTimeout;
     Timeout *failedSyncTimeout;
     Timeout *viewChangeTimeout;
 
     Latency_t reconciliationLatency;
     Latency_t mergeLatency;
     Latency_t requestLatency;
+    Latency_t commitLagLatency;
+    Latency_t syncLatency;
     
     bool AmLeader() const;
     void SendSync();
+    void ScheduleSync();
     void CommitUpTo(opnum_t upto);
     void RollbackTo(opnum_t backto);
+    // A NULL reply is added to the log entry when the operation
+    // completes
     void UpdateClientTable(const Request &req,
                            LogEntry &entry,
-                           const proto::SpeculativeReplyMessage &reply);
+                           const proto::SpeculativeReplyMessage *reply);
+    uint64_t StartExecuting(opnum_t opnum);
+    bool FinishExecuting(opnum_t opnum, uint64_t seq);
     void EnterView(view_t newview);
     void StartViewChange(view_t newview);
     void MergeLogs(view_t newView, opnum_t maxStart,
@@ -116,9 +160,17 @@ private:
     void SendFillDVCGapMessage(int replicaIdx, view_t view);
     void NeedFillDVCGap(view_t view);
     void SendSyncReply(opnum_t opnum);
+    void ExecuteRequest(const TransportAddress &remote, const Request &req,
+                        const std::shared_ptr<ReplyBatch> &batch);
+    void FinishBatch(const std::shared_ptr<ReplyBatch> &batch);
+    void DigestReply(proto::SpeculativeReplyMessage &reply) const;
+    void SendReplies(const TransportAddress &remote,
+                     proto::SpeculativeReplyBatchMessage &replies);
     
     void HandleRequest(const TransportAddress &remote,
                        const proto::RequestMessage &msg);
+    void HandleRequestBatch(const TransportAddress &remote,
+                            const proto::RequestBatchMessage &msg);
     void HandleUnloggedRequest(const TransportAddress &remote,
                                const proto::UnloggedRequestMessage &msg);
     void HandleSync(const TransportAddress &remote,
@@ -0,0 +1,126 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * spec/sync.cc:
+ *   runtime control of how often the SpecPaxos leader synchronizes
+ *
+ * Copyright 2013-2016 Dan R. K. Ports  <drkp@cs.washington.edu>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+
+#include "spec/sync.h"
+
+#include "lib/assert.h"
+#include "lib/message.h"
+
+#include <algorithm>
+#include <inttypes.h>
+
+namespace specpaxos {
+namespace spec {
+
+const uint64_t SyncPolicy::DEFAULT_TARGET_LATENCY;
+const opnum_t SyncPolicy::DEFAULT_MAX_OPS;
+const uint64_t SyncPolicy::DEFAULT_HEARTBEAT;
+
+SyncPolicy::SyncPolicy(uint64_t targetLatency, opnum_t maxOps,
+                       uint64_t heartbeat)
+    : targetLatency(targetLatency), maxOps(maxOps),
+      minOps(std::max((opnum_t)1, maxOps/64)),
+      heartbeat(heartbeat), opsThreshold(maxOps),
+      lastArrival(0), interarrival(targetLatency), syncCost(0)
+{
+    ASSERT(maxOps >= 1);
+    ASSERT(heartbeat >= 1000);
+}
+
+void
+SyncPolicy::RequestArrived(uint64_t now)
+{
+    if (lastArrival != 0) {
+        // Anything longer than the target latency just means we're
+        // idle; don't let it swamp the average
+        interarrival.Add(std::min(now - lastArrival, targetLatency));
+    }
+    lastArrival = now;
+}
+
+void
+SyncPolicy::SyncCompleted(uint64_t cost)
+{
+    syncCost.Add(std::min(cost, heartbeat));
+    opsThreshold = std::min(maxOps, opsThreshold + minOps);
+}
+
+void
+SyncPolicy::RolledBack(opnum_t ops)
+{
+    if (ops == 0) {
+        return;
+    }
+    opsThreshold = std::max(minOps, opsThreshold/2);
+    Notice("Rolled back %" PRIu64 " operations; syncing at least every "
+           "%" PRIu64 " operations", ops, opsThreshold);
+}
+
+uint64_t
+SyncPolicy::SyncDelay() const
+{
+    uint64_t cost = MeanSyncCost();
+    if (cost >= targetLatency) {
+        return 0;
+    }
+    uint64_t budget = targetLatency - cost;
+    if (MeanInterarrival() >= budget) {
+        return 0;
+    }
+    return budget;
+}
+
+opnum_t
+SyncPolicy::OpsThreshold() const
+{
+    return opsThreshold;
+}
+
+uint64_t
+SyncPolicy::Heartbeat() const
+{
+    return heartbeat;
+}
+
+uint64_t
+SyncPolicy::MeanInterarrival() const
+{
+    return interarrival.Mean();
+}
+
+uint64_t
+SyncPolicy::MeanSyncCost() const
+{
+    return syncCost.Mean();
+}
+
+} // namespace specpaxos::spec
+} // namespace specpaxos
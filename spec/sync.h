@@ -0,0 +1,107 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * spec/sync.h:
+ *   runtime control of how often the SpecPaxos leader synchronizes
+ *
+ * Copyright 2013-2016 Dan R. K. Ports  <drkp@cs.washington.edu>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+
+#ifndef _SPEC_SYNC_H_
+#define _SPEC_SYNC_H_
+
+#include "lib/ewma.h"
+#include "lib/viewstamp.h"
+
+#include <stdint.h>
+
+namespace specpaxos {
+namespace spec {
+
+/*
+ * Decides when the leader sends SYNC. Speculative operations only
+ * commit once a sync round covering them completes, so an
+ * operation's commit lag is however long the leader waits before
+ * syncing plus the time the round itself takes.
+ *
+ * Once an operation is executed that no SYNC covers yet, the leader
+ * waits SyncDelay() and then syncs. The delay is whatever is left of
+ * targetLatency after the observed cost of a sync round. If fewer
+ * than one more request is expected within that delay, there is
+ * nothing to amortize the sync over, so it goes out right away.
+ * Only one such round is outstanding at a time; the next one is
+ * scheduled when it commits.
+ *
+ * Independently, the leader syncs after OpsThreshold() operations,
+ * which bounds how much speculative work a reconciliation can
+ * throw away. The threshold is halved each time a view change rolls
+ * operations back, and creeps back up towards maxOps with every
+ * sync that commits.
+ *
+ * An idle leader still syncs every Heartbeat() so the other
+ * replicas know it is alive.
+ *
+ * All times are in microseconds.
+ */
+class SyncPolicy
+{
+public:
+    SyncPolicy(uint64_t targetLatency = DEFAULT_TARGET_LATENCY,
+               opnum_t maxOps = DEFAULT_MAX_OPS,
+               uint64_t heartbeat = DEFAULT_HEARTBEAT);
+
+    // Called for every operation the replica executes
+    void RequestArrived(uint64_t now);
+    // A sync round took cost from sending SYNC to committing
+    void SyncCompleted(uint64_t cost);
+    // A view change rolled back ops speculative operations
+    void RolledBack(opnum_t ops);
+
+    uint64_t SyncDelay() const;
+    opnum_t OpsThreshold() const;
+    uint64_t Heartbeat() const;
+
+    uint64_t MeanInterarrival() const;
+    uint64_t MeanSyncCost() const;
+
+    static const uint64_t DEFAULT_TARGET_LATENCY = 10000;
+    static const opnum_t DEFAULT_MAX_OPS = 10000;
+    static const uint64_t DEFAULT_HEARTBEAT = 1000000;
+
+private:
+    uint64_t targetLatency;
+    opnum_t maxOps;
+    opnum_t minOps;
+    uint64_t heartbeat;
+    opnum_t opsThreshold;
+    uint64_t lastArrival;
+    EWMA interarrival;
+    EWMA syncCost;
+};
+
+} // namespace specpaxos::spec
+} // namespace specpaxos
+
+#endif  /* _SPEC_SYNC_H_ */
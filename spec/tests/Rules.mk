@@ -1,6 +1,6 @@
 d := $(dir $(lastword $(MAKEFILE_LIST)))
 
-GTEST_SRCS += $(d)spec-test.cc $(d)merge-test.cc
+GTEST_SRCS += $(d)spec-test.cc $(d)merge-test.cc $(d)sync-test.cc
 PROTOS += $(d)merge-test-case.proto
 
 $(d)spec-test: $(o)spec-test.o \
@@ -13,4 +13,8 @@ $(d)merge-test: $(o)merge-test.o $(o)merge-test-case.o \
 	$(LIB-simtransport) \
 	$(GTEST_MAIN)
 
-TEST_BINS += $(d)merge-test $(d)spec-test 
+$(d)sync-test: $(o)sync-test.o \
+	$(OBJS-spec-sync) \
+	$(GTEST_MAIN)
+
+TEST_BINS += $(d)merge-test $(d)spec-test $(d)sync-test
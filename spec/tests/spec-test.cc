@@ -37,12 +37,15 @@
 #include "common/log.h"
 #include "common/replica.h"
 #include "spec/client.h"
+#include "spec/digest.h"
 #include "spec/replica.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <vector>
 #include <sstream>
+#include <set>
+#include <thread>
 #include <gtest/gtest.h>
 
 static string replicaLastOp;
@@ -63,10 +66,17 @@ public:
     virtual void ReplicaUpcall(opnum_t opnum, const string &req, string &reply) {
         ops.push_back(req);
         reply = "reply: " + req;
+        threads.insert(std::this_thread::get_id());
     }
     
-    virtual void RollbackUpcall(opnum_t from, opnum_t to, const std::map<opnum_t, string> &rollbackops) {
-        for (opnum_t x = from; x > to; x--) {
+    virtual void RollbackUpcall(opnum_t from, opnum_t to, const RollbackOps &rollbackops) {
+        rollbacks++;
+        threads.insert(std::this_thread::get_id());
+        ASSERT_EQ(from-to, rollbackops.size());
+        opnum_t x = from;
+        for (const auto &op : rollbackops) {
+            EXPECT_EQ(x--, op.opnum);
+            EXPECT_EQ(ops.back(), op.op);
             ops.pop_back();
         }
     }
@@ -77,7 +87,9 @@ public:
     }
     std::vector<string> ops;
     std::vector<string> unloggedOps;
-    
+    int rollbacks = 0;
+    // Threads the upcalls ran on
+    std::set<std::thread::id> threads;
 };
 
 class SpecTest : public testing::Test
@@ -90,6 +102,10 @@ protected:
     Configuration *config;
     std::vector<string> replies;
     int requestNum;
+    bool digestReplies;
+    bool execThread;
+
+    SpecTest() : digestReplies(false), execThread(false) { }
     
     virtual void SetUp() {
         std::vector<ReplicaAddress> replicaAddrs =
@@ -104,7 +120,14 @@ protected:
         
         for (int i = 0; i < config->n; i++) {
             apps.push_back(new SpecTestApp());
-            replicas.push_back(new SpecReplica(*config, i, true, transport, apps[i]));
+            if (digestReplies || execThread) {
+                replicas.push_back(new SpecReplica(*config, i, true, transport,
+                                                   new SyncPolicy(), apps[i],
+                                                   digestReplies,
+                                                   execThread));
+            } else {
+                replicas.push_back(new SpecReplica(*config, i, true, transport, apps[i]));
+            }
         }
 
         client = new SpecClient(*config, transport);
@@ -149,6 +172,24 @@ protected:
     }
 };
 
+class SpecDigestTest : public SpecTest
+{
+protected:
+    virtual void SetUp() {
+        digestReplies = true;
+        SpecTest::SetUp();
+    }
+};
+
+class SpecExecThreadTest : public SpecTest
+{
+protected:
+    virtual void SetUp() {
+        execThread = true;
+        SpecTest::SetUp();
+    }
+};
+
 TEST_F(SpecTest, OneOp)
 {
     auto upcall = [this](const string &req, const string &reply) {
@@ -179,6 +220,21 @@ TEST_F(SpecTest, OneOp)
     }
 }
 
+TEST_F(SpecTest, CommitLag)
+{
+    // At low load the leader should sync as soon as it executes an
+    // operation, not wait for the next heartbeat
+    transport->Timer(50, [&]() {
+            const LogEntry *entry = replicas[0]->log.Find(1);
+            ASSERT_NE(nullptr, entry);
+            EXPECT_EQ(LOG_STATE_COMMITTED, entry->state);
+            transport->CancelAllTimers();
+        });
+
+    ClientSendNext([](const string &req, const string &reply) { });
+    transport->Run();
+}
+
 TEST_F(SpecTest, Unlogged)
 {
     auto upcall = [this](const string &req, const string &reply) {
@@ -276,6 +332,190 @@ TEST_F(SpecTest, ManyOps)
     }
 }
 
+TEST_F(SpecTest, Windowed)
+{
+    const int NUM_OPS = 20;
+    client->SetWindow(4);
+
+    int completed = 0;
+    Client::continuation_t upcall = [&](const string &req, const string &reply) {
+        EXPECT_EQ(reply, "reply: "+req);
+        completed++;
+    };
+
+    // 5 seconds should give synchronization enough time to finish...
+    transport->Timer(5000, [&]() {
+            transport->CancelAllTimers();
+        });
+
+    for (int i = 0; i < NUM_OPS; i++) {
+        ClientSendNext(upcall);
+    }
+    transport->Run();
+
+    EXPECT_EQ(NUM_OPS, completed);
+    for (int i = 0; i < config->n; i++) {
+        EXPECT_EQ(NUM_OPS, apps[i]->ops.size());
+        for (int j = 0; j < NUM_OPS; j++) {
+            const LogEntry *entry = replicas[i]->log.Find(j+1);
+            ASSERT_NE(nullptr, entry);
+            EXPECT_EQ(LOG_STATE_COMMITTED, entry->state);
+        }
+    }
+}
+
+TEST_F(SpecTest, ClientBatching)
+{
+    const int NUM_OPS = 32;
+    const int BATCH = 8;
+    client->SetWindow(2*BATCH);
+    client->SetBatching(BATCH, 2000);
+
+    int completed = 0;
+    Client::continuation_t upcall = [&](const string &req, const string &reply) {
+        EXPECT_EQ(reply, "reply: "+req);
+        completed++;
+    };
+
+    // Count the request and reply messages exchanged with replica 0
+    int requestMsgs = 0;
+    int replyMsgs = 0;
+    transport->AddFilter(10, [&](TransportReceiver *src, int srcIdx,
+                                 TransportReceiver *dst, int dstIdx,
+                                 Message &m, uint64_t &delay) {
+                             if ((dstIdx == 0) &&
+                                 ((m.GetTypeName() ==
+                                   proto::RequestMessage().GetTypeName()) ||
+                                  (m.GetTypeName() ==
+                                   proto::RequestBatchMessage().GetTypeName()))) {
+                                 requestMsgs++;
+                             }
+                             if ((srcIdx == 0) &&
+                                 ((m.GetTypeName() ==
+                                   proto::SpeculativeReplyMessage().GetTypeName()) ||
+                                  (m.GetTypeName() ==
+                                   proto::SpeculativeReplyBatchMessage().GetTypeName()))) {
+                                 replyMsgs++;
+                             }
+                             return true;
+                         });
+
+    // 5 seconds should give synchronization enough time to finish...
+    transport->Timer(5000, [&]() {
+            transport->CancelAllTimers();
+        });
+
+    for (int i = 0; i < NUM_OPS; i++) {
+        ClientSendNext(upcall);
+    }
+    transport->Run();
+
+    EXPECT_EQ(NUM_OPS, completed);
+    EXPECT_LE(requestMsgs, NUM_OPS/BATCH + 1);
+    EXPECT_LE(replyMsgs, NUM_OPS/BATCH + 1);
+    for (int i = 0; i < config->n; i++) {
+        EXPECT_EQ(NUM_OPS, apps[i]->ops.size());
+        for (int j = 0; j < NUM_OPS; j++) {
+            const LogEntry *entry = replicas[i]->log.Find(j+1);
+            ASSERT_NE(nullptr, entry);
+            EXPECT_EQ(LOG_STATE_COMMITTED, entry->state);
+        }
+    }
+}
+
+TEST_F(SpecDigestTest, ManyOps)
+{
+    int completed = 0;
+    Client::continuation_t upcall = [&](const string &req, const string &reply) {
+        EXPECT_EQ(req, LastRequestOp());
+        EXPECT_EQ(reply, "reply: "+LastRequestOp());
+        completed++;
+
+        if (requestNum < 9) {
+            ClientSendNext(upcall);
+        }
+    };
+
+    // Only the leader should send the client whole results
+    int full = 0, digests = 0;
+    transport->AddFilter(10, [&](TransportReceiver *src, int srcIdx,
+                                 TransportReceiver *dst, int dstIdx,
+                                 Message &m, uint64_t &delay) {
+                             if (m.GetTypeName() !=
+                                 proto::SpeculativeReplyMessage().GetTypeName()) {
+                                 return true;
+                             }
+                             auto &r = dynamic_cast<proto::SpeculativeReplyMessage &>(m);
+                             if (srcIdx == 0) {
+                                 EXPECT_TRUE(r.has_reply());
+                                 full++;
+                             } else {
+                                 EXPECT_FALSE(r.has_reply());
+                                 EXPECT_EQ(ReplyDigest("reply: "+LastRequestOp()),
+                                           r.replydigest());
+                                 digests++;
+                             }
+                             return true;
+                         });
+
+    transport->Timer(5000, [&]() {
+            transport->CancelAllTimers();
+        });
+
+    ClientSendNext(upcall);
+    transport->Run();
+
+    EXPECT_EQ(10, completed);
+    EXPECT_EQ(10, full);
+    EXPECT_EQ(40, digests);
+    for (int i = 0; i < config->n; i++) {
+        EXPECT_EQ(10, apps[i]->ops.size());
+        for (int j = 0; j < 10; j++) {
+            const LogEntry *entry = replicas[i]->log.Find(j+1);
+            ASSERT_NE(nullptr, entry);
+            EXPECT_EQ(LOG_STATE_COMMITTED, entry->state);
+        }
+    }
+}
+
+TEST_F(SpecDigestTest, MissingFullReply)
+{
+    int completed = 0;
+    auto upcall = [&](const string &req, const string &reply) {
+        EXPECT_EQ(req, LastRequestOp());
+        EXPECT_EQ(reply, "reply: "+LastRequestOp());
+        completed++;
+    };
+
+    // Drop the leader's first reply. A quorum of digests is no use
+    // on its own, so the client has to wait for the retry.
+    bool dropped = false;
+    transport->AddFilter(10, [&](TransportReceiver *src, int srcIdx,
+                                 TransportReceiver *dst, int dstIdx,
+                                 Message &m, uint64_t &delay) {
+                             if ((srcIdx == 0) && !dropped &&
+                                 (m.GetTypeName() ==
+                                  proto::SpeculativeReplyMessage().GetTypeName())) {
+                                 dropped = true;
+                                 return false;
+                             }
+                             return true;
+                         });
+
+    transport->Timer(100, [&]() {
+            EXPECT_EQ(0, completed);
+        });
+    transport->Timer(10000, [&]() {
+            transport->CancelAllTimers();
+        });
+
+    ClientSendNext(upcall);
+    transport->Run();
+
+    EXPECT_TRUE(dropped);
+    EXPECT_EQ(1, completed);
+}
+
 TEST_F(SpecTest, FailedReplica)
 {
     Client::continuation_t upcall = [&](const string &req, const string &reply) {
@@ -457,6 +697,94 @@ TEST_F(SpecTest, Conflict)
     }
 }
 
+TEST_F(SpecExecThreadTest, ManyOps)
+{
+    const int NUM_OPS = 10;
+    string unloggedReply;
+    Client::continuation_t upcall = [&](const string &req, const string &reply) {
+        EXPECT_EQ(req, LastRequestOp());
+        EXPECT_EQ(reply, "reply: "+LastRequestOp());
+
+        if (requestNum < NUM_OPS-1) {
+            ClientSendNext(upcall);
+        } else {
+            // Goes through the same queue, so it sees every
+            // operation the replica has executed
+            client->InvokeUnlogged(0, "unlogged",
+                                   [&](const string &req, const string &reply) {
+                                       unloggedReply = reply;
+                                   });
+        }
+    };
+
+    transport->Timer(5000, [&]() {
+            transport->CancelAllTimers();
+        });
+
+    ClientSendNext(upcall);
+    // Doesn't return until the execution threads are idle
+    transport->Run();
+
+    EXPECT_EQ("unlreply: unlogged", unloggedReply);
+    EXPECT_EQ(std::vector<string>({ "unlogged" }), apps[0]->unloggedOps);
+    for (int i = 0; i < config->n; i++) {
+        ASSERT_EQ(NUM_OPS, apps[i]->ops.size());
+        for (int j = 0; j < NUM_OPS; j++) {
+            EXPECT_EQ(RequestOp(j), apps[i]->ops[j]);
+            const LogEntry *entry = replicas[i]->log.Find(j+1);
+            ASSERT_NE(nullptr, entry);
+            EXPECT_EQ(LOG_STATE_COMMITTED, entry->state);
+            ASSERT_NE(nullptr, entry->replyMessage);
+        }
+        EXPECT_EQ(0u, apps[i]->threads.count(std::this_thread::get_id()));
+    }
+}
+
+TEST_F(SpecExecThreadTest, Conflict)
+{
+    // As in SpecTest.Conflict, two of the replicas execute the
+    // operations in the wrong order and have to roll back, which
+    // they must do on the execution thread with the operations that
+    // were in their logs at the time
+    Client::continuation_t upcall = [&](const string &req, const string &reply) {
+    };
+    SpecClient otherClient(*config, transport);
+
+    transport->AddFilter(10, [=](TransportReceiver *src, int srcIdx,
+                                TransportReceiver *dst, int dstIdx,
+                                Message &m, uint64_t &delay) {
+                             if ((src == client) &&
+                                 (dstIdx < 2)) {
+                                 delay = 100;
+                             }
+                             return true;
+                         });
+
+    client->Invoke("A", upcall);
+    transport->Timer(10, [&]() {
+        otherClient.Invoke("B", upcall);
+    });
+    transport->Timer(15000, [&]() {
+            transport->CancelAllTimers();
+        });
+
+    transport->Run();
+
+    int rollbacks = 0;
+    for (int i = 0; i < config->n; i++) {
+        ASSERT_EQ(2, apps[i]->ops.size());
+        EXPECT_EQ(apps[0]->ops, apps[i]->ops);
+        EXPECT_EQ(0u, apps[i]->threads.count(std::this_thread::get_id()));
+        for (opnum_t j = 1; j <= 2; j++) {
+            const LogEntry *entry = replicas[i]->log.Find(j);
+            ASSERT_NE(nullptr, entry);
+            EXPECT_EQ(apps[i]->ops[j-1], entry->request.op());
+        }
+        rollbacks += apps[i]->rollbacks;
+    }
+    EXPECT_LT(0, rollbacks);
+}
+
 TEST_F(SpecTest, ImmediatelyFailedLeader)
 {
     Client::continuation_t upcall = [&](const string &req, const string &reply) {
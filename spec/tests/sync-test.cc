@@ -0,0 +1,99 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * sync-test.cc:
+ *   test cases for the SpecPaxos sync policy
+ *
+ * Copyright 2013-2016 Dan R. K. Ports  <drkp@cs.washington.edu>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+
+#include "spec/sync.h"
+
+#include <gtest/gtest.h>
+
+using namespace specpaxos::spec;
+
+TEST(SyncPolicy, LowLoad)
+{
+    SyncPolicy p(10000, 6400);
+
+    // One request every 50 ms: there's nothing to wait for, so sync
+    // right away
+    for (uint64_t t = 1; t < 1000000; t += 50000) {
+        p.RequestArrived(t);
+    }
+    EXPECT_EQ(10000, p.MeanInterarrival());
+    EXPECT_EQ(0, p.SyncDelay());
+    EXPECT_EQ(6400, p.OpsThreshold());
+    EXPECT_EQ(SyncPolicy::DEFAULT_HEARTBEAT, p.Heartbeat());
+}
+
+TEST(SyncPolicy, HighLoad)
+{
+    SyncPolicy p(10000, 6400);
+
+    // One request every 50 us: wait out the whole target latency
+    for (uint64_t t = 1; t < 100000; t += 50) {
+        p.RequestArrived(t);
+    }
+    EXPECT_EQ(50, p.MeanInterarrival());
+    EXPECT_EQ(10000, p.SyncDelay());
+
+    // ...less however long a sync round takes
+    for (int i = 0; i < 100; i++) {
+        p.SyncCompleted(4000);
+    }
+    EXPECT_EQ(4000, p.MeanSyncCost());
+    EXPECT_EQ(6000, p.SyncDelay());
+
+    // If syncs take longer than the target, don't wait at all
+    for (int i = 0; i < 100; i++) {
+        p.SyncCompleted(20000);
+    }
+    EXPECT_EQ(0, p.SyncDelay());
+}
+
+TEST(SyncPolicy, Rollback)
+{
+    SyncPolicy p(10000, 6400);
+
+    EXPECT_EQ(6400, p.OpsThreshold());
+    p.RolledBack(0);
+    EXPECT_EQ(6400, p.OpsThreshold());
+    p.RolledBack(10);
+    EXPECT_EQ(3200, p.OpsThreshold());
+    for (int i = 0; i < 10; i++) {
+        p.RolledBack(10);
+    }
+    EXPECT_EQ(100, p.OpsThreshold());
+
+    // Clean syncs slowly raise it again
+    p.SyncCompleted(100);
+    EXPECT_EQ(200, p.OpsThreshold());
+    for (int i = 0; i < 100; i++) {
+        p.SyncCompleted(100);
+    }
+    EXPECT_EQ(6400, p.OpsThreshold());
+}
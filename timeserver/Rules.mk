@@ -1,8 +1,12 @@
 d := $(dir $(lastword $(MAKEFILE_LIST)))
 
-SRCS += $(addprefix $(d), timeserver.cc)
+SRCS += $(addprefix $(d), timeserver.cc replica.cc)
 
-$(d)replica: $(o)timeserver.o $(OBJS-fastpaxos-replica) \
+OBJS-timeserver := $(o)timeserver.o
+
+$(d)replica: $(o)replica.o $(OBJS-timeserver) $(OBJS-fastpaxos-replica) \
   $(OBJS-spec-replica) $(OBJS-vr-replica) $(LIB-udptransport)
 
 BINS += $(d)replica
+
+include $(d)tests/Rules.mk
@@ -0,0 +1,9 @@
+d := $(dir $(lastword $(MAKEFILE_LIST)))
+
+GTEST_SRCS += $(addprefix $(d), \
+		timeserver-test.cc)
+
+$(d)timeserver-test: $(o)timeserver-test.o $(OBJS-timeserver) \
+	$(OBJS-replica) $(LIB-message) $(GTEST_MAIN)
+
+TEST_BINS += $(d)timeserver-test
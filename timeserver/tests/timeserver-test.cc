@@ -0,0 +1,97 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+// vim: set ts=4 sw=4:
+/***********************************************************************
+ *
+ * timeserver/tests/timeserver-test.cc:
+ *   test cases for timestamp ranges and their rollback
+ *
+ **********************************************************************/
+
+#include "timeserver/timeserver.h"
+
+#include <gtest/gtest.h>
+
+static string
+Request(TimeStampServer &s, opnum_t opnum, const string &req)
+{
+    string reply;
+    s.ReplicaUpcall(opnum, req, reply);
+    return reply;
+}
+
+static void
+Rollback(TimeStampServer &s, opnum_t current, opnum_t to)
+{
+    specpaxos::Log log(false);
+    specpaxos::RollbackOps ops(log, current, to);
+    s.RollbackUpcall(current, to, ops);
+}
+
+TEST(TimeStampServer, Ranges)
+{
+    TimeStampServer s;
+
+    EXPECT_EQ("1", Request(s, 1, ""));
+    // 2..11
+    EXPECT_EQ("2", Request(s, 2, "10"));
+    EXPECT_EQ("12", Request(s, 3, "1"));
+    // A zero count still gets one timestamp
+    EXPECT_EQ("13", Request(s, 4, "0"));
+    EXPECT_EQ("14", Request(s, 5, ""));
+}
+
+TEST(TimeStampServer, ClockJumps)
+{
+    TimeStampServer s;
+
+    EXPECT_EQ("1", Request(s, 1, "5"));
+    // 1001..1005
+    EXPECT_EQ("1001", Request(s, 2, "5 1000"));
+    EXPECT_EQ("1006", Request(s, 3, "1"));
+
+    // A clock behind the counter doesn't move it back
+    EXPECT_EQ("1007", Request(s, 4, "2 10"));
+    EXPECT_EQ("1009", Request(s, 5, ""));
+}
+
+TEST(TimeStampServer, RollbackSeveralOps)
+{
+    TimeStampServer s;
+
+    EXPECT_EQ("1", Request(s, 1, "10"));
+    EXPECT_EQ("11", Request(s, 2, "1"));
+    EXPECT_EQ("1001", Request(s, 3, "5 1000"));
+    EXPECT_EQ("1006", Request(s, 4, "3"));
+    EXPECT_EQ("2001", Request(s, 5, "1 2000"));
+
+    // The counter goes back to what it was before op 3, undoing
+    // both clock jumps
+    Rollback(s, 5, 2);
+    EXPECT_EQ("12", Request(s, 3, "2"));
+    EXPECT_EQ("14", Request(s, 4, ""));
+
+    // Rolling back to the last op is a no-op
+    Rollback(s, 4, 4);
+    EXPECT_EQ("15", Request(s, 5, ""));
+}
+
+TEST(TimeStampServer, CommitPrunes)
+{
+    TimeStampServer s;
+
+    EXPECT_EQ("1", Request(s, 1, ""));
+    EXPECT_EQ("2", Request(s, 2, "10"));
+    EXPECT_EQ("1001", Request(s, 3, "5 1000"));
+    EXPECT_EQ("1006", Request(s, 4, "1"));
+
+    s.CommitUpcall(2);
+
+    // Only the ops after the commit point are undone
+    Rollback(s, 4, 2);
+    EXPECT_EQ("12", Request(s, 3, "1"));
+
+    // Rolling back past a committed op can't bring back its range
+    s.CommitUpcall(3);
+    Rollback(s, 3, 0);
+    EXPECT_EQ("13", Request(s, 4, ""));
+}
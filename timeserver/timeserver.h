@@ -16,10 +16,16 @@
 #include "vr/replica.h"
 #include "fastpaxos/replica.h"
 
+#include <deque>
 #include <string>
+#include <utility>
 
 using namespace std;
 
+/* Each operation asks for a range of timestamps, as "count" or
+ * "count clock", and gets back the first one. With a clock, the
+ * server's counter is first moved up to it, so that clients keeping
+ * hybrid logical clocks stay close to each other. */
 class TimeStampServer : public specpaxos::AppReplica
 {
 public:
@@ -27,11 +33,17 @@ public:
     ~TimeStampServer();
 
     void ReplicaUpcall(opnum_t opnum, const string &str1, string &str2);
-    void RollbackUpcall(opnum_t current, opnum_t to, const std::map<opnum_t, string> &opMap);
+    void RollbackUpcall(opnum_t current, opnum_t to, const specpaxos::RollbackOps &ops);
     void CommitUpcall(opnum_t op);
 private:
-    long ts;
-    string newTimeStamp();
+    // Last timestamp handed out.
+    uint64_t ts;
+    // Value of ts before each uncommitted operation, so a rollback
+    // can restore it; a clock makes the counter jump, so the ranges
+    // alone aren't enough to undo an operation.
+    deque<pair<opnum_t, uint64_t> > undo;
+
+    uint64_t newTimeStamps(uint64_t count, uint64_t clock);
 
 };
 #endif /* _TIME_SERVER_H_ */
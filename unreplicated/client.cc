@@ -43,14 +43,15 @@ UnreplicatedClient::UnreplicatedClient(const Configuration &config,
                                        uint64_t clientid)
     : Client(config, transport, clientid)
 {
-    pendingRequest = NULL;
     pendingUnloggedRequest = NULL;
+    lastReqId = 0;
+    lastSentReqId = 0;
 }
 
 UnreplicatedClient::~UnreplicatedClient()
 {
-    if (pendingRequest) {
-        delete pendingRequest;
+    for (auto &kv : pendingRequests) {
+        delete kv.second;
     }
     if (pendingUnloggedRequest) {
         delete pendingUnloggedRequest;
@@ -61,21 +62,30 @@ void
 UnreplicatedClient::Invoke(const string &request,
                            continuation_t continuation)
 {
-    // XXX Can only handle one pending request for now
-    if (pendingRequest != NULL) {
-        Panic("Client only supports one pending request");
-    }
+    pendingRequests[++lastReqId] = new PendingRequest(request, continuation);
 
-    pendingRequest = new PendingRequest(request, continuation);
+    SendNewRequests();
+}
 
-    proto::RequestMessage reqMsg;
-    reqMsg.mutable_req()->set_op(pendingRequest->request);
-    reqMsg.mutable_req()->set_clientid(clientid);
-    reqMsg.mutable_req()->set_clientreqid(0);
-    
-    // Unreplicated: just send to replica 0
-    transport->SendMessageToReplica(this, 0, reqMsg);
-    
+void
+UnreplicatedClient::SendNewRequests()
+{
+    // Send whatever the window allows, oldest first
+    for (auto it = pendingRequests.upper_bound(lastSentReqId);
+         it != pendingRequests.end(); ++it) {
+        if (it->first >= pendingRequests.begin()->first + window) {
+            break;
+        }
+        lastSentReqId = it->first;
+
+        proto::RequestMessage reqMsg;
+        reqMsg.mutable_req()->set_op(it->second->request);
+        reqMsg.mutable_req()->set_clientid(clientid);
+        reqMsg.mutable_req()->set_clientreqid(it->first);
+
+        // Unreplicated: just send to replica 0
+        transport->SendMessageToReplica(this, 0, reqMsg);
+    }
 }
 
 void
@@ -128,14 +138,19 @@ void
 UnreplicatedClient::HandleReply(const TransportAddress &remote,
                                 const proto::ReplyMessage &msg)
 {
-    if (pendingRequest == NULL) {
-        Warning("Received reply when no request was pending");
+    auto it = pendingRequests.find(msg.clientreqid());
+    if ((it == pendingRequests.end()) || (it->first > lastSentReqId)) {
+        Warning("Received reply for a request that isn't pending");
+        return;
     }
 
     Debug("Client received reply");
 
-    PendingRequest *req = pendingRequest;
-    pendingRequest = NULL;
+    PendingRequest *req = it->second;
+    pendingRequests.erase(it);
+
+    // The window might have room for more requests now
+    SendNewRequests();
     
     req->continuation(req->request, msg.reply());
     delete req;
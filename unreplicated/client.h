@@ -36,6 +36,8 @@
 #include "lib/configuration.h"
 #include "unreplicated/unreplicated-proto.pb.h"
 
+#include <map>
+
 namespace specpaxos {
 namespace unreplicated {
     
@@ -63,9 +65,16 @@ protected:
         inline PendingRequest(string request, continuation_t continuation)
             : request(request), continuation(continuation) { }
     };
-    PendingRequest *pendingRequest;
+    // Requests that haven't completed, whether or not the window
+    // has let us send them yet. There are no retries, so a request
+    // has been sent iff its ID is at most lastSentReqId.
+    std::map<uint64_t, PendingRequest *> pendingRequests;
+    uint64_t lastReqId;
+    uint64_t lastSentReqId;
     PendingRequest *pendingUnloggedRequest;
 
+    void SendNewRequests();
+
     void HandleReply(const TransportAddress &remote,
                      const proto::ReplyMessage &msg);
     void HandleUnloggedReply(const TransportAddress &remote,
@@ -49,12 +49,20 @@ UnreplicatedReplica::HandleRequest(const TransportAddress &remote,
 
     Debug("Received request %s", (char *)msg.req().op().c_str());
 
-    Execute(0, msg.req(), reply);
+    // Number operations in the order they run, as the replicated
+    // protocols do, since applications count opnums to expire state
+    ++lastOp;
+    Execute(lastOp, msg.req(), reply);
+    // Nothing is ever rolled back, so the application can discard
+    // any undo state right away
+    Commit(lastOp);
 
-    // The protocol defines these as required, even if they're not
+    // The protocol defines the view as required, even if it's not
     // meaningful.
     reply.set_view(0);
-    reply.set_opnum(0);
+    reply.set_opnum(lastOp);
+    reply.set_clientreqid(msg.req().clientreqid());
+    reply.set_clientid(msg.req().clientid());
 
     if (!(transport->SendMessage(this, remote, reply)))
         Warning("Failed to send reply message");
@@ -69,6 +77,7 @@ UnreplicatedReplica::HandleUnloggedRequest(const TransportAddress &remote,
     Debug("Received unlogged request %s", (char *)msg.req().op().c_str());
 
     ExecuteUnlogged(msg.req(), reply);
+    reply.set_clientid(msg.req().clientid());
     
     if (!(transport->SendMessage(this, remote, reply)))
         Warning("Failed to send reply message");
@@ -79,7 +88,7 @@ UnreplicatedReplica::UnreplicatedReplica(Configuration config,
                                          bool initialize,
                                          Transport *transport,
                                          AppReplica *app)
-    : Replica(config, myIdx, initialize, transport, app)
+    : Replica(config, myIdx, initialize, transport, app), lastOp(0)
 {
     if (!initialize) {
         Panic("Recovery does not make sense for unreplicated mode");
@@ -48,6 +48,8 @@ public:
                         const string &type, const string &data);
 
 private:
+    opnum_t lastOp;
+
     void HandleRequest(const TransportAddress &remote,
                        const proto::RequestMessage &msg);
     void HandleUnloggedRequest(const TransportAddress &remote,
@@ -116,3 +116,72 @@ TEST(Unreplicated, Unlogged)
     EXPECT_EQ(clientLastOp, "test2");
     EXPECT_EQ(clientLastReply, "unlreply: test2");
 }
+
+TEST(Unreplicated, Windowed)
+{
+    std::vector<ReplicaAddress> replicaAddrs =
+        { { "localhost", "12345" } };
+    Configuration c(1, 0, replicaAddrs);
+    
+    SimulatedTransport transport;
+    UnrepTestApp app;
+
+    UnreplicatedReplica replica(c, 0, true, &transport, &app);
+    UnreplicatedClient client(c, &transport);
+    client.SetWindow(4);
+
+    std::vector<string> replies;
+    for (int i = 0; i < 10; i++) {
+        client.Invoke(std::to_string(i),
+                      [&](const string &req, const string &reply) {
+                          EXPECT_EQ("reply: " + req, reply);
+                          replies.push_back(req);
+                      });
+    }
+
+    transport.Run();
+
+    ASSERT_EQ(10, replies.size());
+    for (int i = 0; i < 10; i++) {
+        EXPECT_EQ(std::to_string(i), replies[i]);
+    }
+}
+
+TEST(Unreplicated, Opnums)
+{
+    std::vector<ReplicaAddress> replicaAddrs =
+        { { "localhost", "12345" } };
+    Configuration c(1, 0, replicaAddrs);
+
+    SimulatedTransport transport;
+
+    // Applications that count operations, like the transaction
+    // stores' garbage collection, need each op to get its own opnum
+    class OpnumApp : public AppReplica {
+    public:
+        std::vector<opnum_t> executed;
+        std::vector<opnum_t> committed;
+
+        void ReplicaUpcall(opnum_t opnum, const string &req,
+                           string &reply) {
+            executed.push_back(opnum);
+            reply = "reply: " + req;
+        }
+        void CommitUpcall(opnum_t opnum) {
+            committed.push_back(opnum);
+        }
+    } app;
+
+    UnreplicatedReplica replica(c, 0, true, &transport, &app);
+    UnreplicatedClient client(c, &transport);
+
+    for (int i = 0; i < 3; i++) {
+        client.Invoke(std::to_string(i),
+                      [&](const string &req, const string &reply) { });
+        transport.Run();
+    }
+
+    std::vector<opnum_t> expected = { 1, 2, 3 };
+    EXPECT_EQ(expected, app.executed);
+    EXPECT_EQ(expected, app.committed);
+}
@@ -1,7 +1,7 @@
 d := $(dir $(lastword $(MAKEFILE_LIST)))
 
 SRCS += $(addprefix $(d), \
-	replica.cc client.cc)
+	replica.cc client.cc batching.cc)
 
 PROTOS += $(addprefix $(d), \
 	    vr-proto.proto)
@@ -10,7 +10,10 @@ OBJS-vr-client := $(o)client.o $(o)vr-proto.o \
                    $(OBJS-client) $(LIB-message) \
                    $(LIB-configuration)
 
+OBJS-vr-batching := $(o)batching.o $(LIB-message)
+
 OBJS-vr-replica := $(o)replica.o $(o)vr-proto.o \
+                   $(OBJS-vr-batching) \
                    $(OBJS-replica) $(LIB-message) \
                    $(LIB-configuration) $(LIB-latency)
 
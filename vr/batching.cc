@@ -0,0 +1,136 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * vr/batching.cc:
+ *   policies for deciding when the VR leader closes a batch
+ *
+ * Copyright 2013-2016 Dan R. K. Ports  <drkp@cs.washington.edu>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+
+#include "vr/batching.h"
+
+#include "lib/assert.h"
+
+#include <algorithm>
+#include <inttypes.h>
+
+namespace specpaxos {
+namespace vr {
+
+const uint64_t FixedBatchPolicy::DEFAULT_MAX_DELAY;
+
+FixedBatchPolicy::FixedBatchPolicy(size_t batchSize, uint64_t maxDelay)
+    : batchSize(batchSize), maxDelay(maxDelay)
+{
+    ASSERT(batchSize >= 1);
+    if (batchSize > 1) {
+        Notice("Batching enabled; batch size %zu", batchSize);
+    }
+}
+
+bool
+FixedBatchPolicy::ShouldClose(const BatchState &batch) const
+{
+    if (batch.ops == 0) {
+        return false;
+    }
+    return ((batch.ops >= batchSize) ||
+            (batch.inFlight < batch.pipelineDepth));
+}
+
+uint64_t
+FixedBatchPolicy::MaxDelay() const
+{
+    return maxDelay;
+}
+
+AdaptiveBatchPolicy::AdaptiveBatchPolicy(size_t maxOps, size_t maxBytes,
+                                         uint64_t targetLatency,
+                                         uint64_t maxDelay)
+    : maxOps(maxOps), maxBytes(maxBytes),
+      targetLatency(targetLatency), maxDelay(maxDelay),
+      lastArrival(0), interarrival(targetLatency)
+{
+    ASSERT(maxOps >= 1);
+    ASSERT(maxBytes >= 1);
+    Notice("Adaptive batching enabled; at most %zu requests, %zu bytes, "
+           "target latency %" PRIu64 " us", maxOps, maxBytes, targetLatency);
+}
+
+void
+AdaptiveBatchPolicy::RequestArrived(uint64_t now)
+{
+    if (lastArrival != 0) {
+        // Don't let a long idle period swamp the average; anything
+        // longer than the delay we're willing to add is "idle"
+        interarrival.Add(std::min(now - lastArrival,
+                                  std::max(targetLatency, maxDelay)));
+    }
+    lastArrival = now;
+}
+
+size_t
+AdaptiveBatchPolicy::TargetOps() const
+{
+    uint64_t mean = MeanInterarrival();
+    if (mean == 0) {
+        return maxOps;
+    }
+    return std::max((size_t)1,
+                    std::min(maxOps, (size_t)(targetLatency / mean)));
+}
+
+uint64_t
+AdaptiveBatchPolicy::MeanInterarrival() const
+{
+    return interarrival.Mean();
+}
+
+bool
+AdaptiveBatchPolicy::ShouldClose(const BatchState &batch) const
+{
+    if (batch.ops == 0) {
+        return false;
+    }
+    if ((batch.ops >= maxOps) || (batch.bytes >= maxBytes)) {
+        return true;
+    }
+    if (batch.inFlight >= batch.pipelineDepth) {
+        return false;
+    }
+    if (batch.inFlight == 0) {
+        return true;
+    }
+    return (batch.ops >= TargetOps());
+}
+
+uint64_t
+AdaptiveBatchPolicy::MaxDelay() const
+{
+    return maxDelay;
+}
+
+} // namespace specpaxos::vr
+} // namespace specpaxos
@@ -0,0 +1,123 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * vr/batching.h:
+ *   policies for deciding when the VR leader closes a batch
+ *
+ * Copyright 2013-2016 Dan R. K. Ports  <drkp@cs.washington.edu>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+
+#ifndef _VR_BATCHING_H_
+#define _VR_BATCHING_H_
+
+#include "lib/ewma.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace specpaxos {
+namespace vr {
+
+// The open batch, as seen by a BatchPolicy
+struct BatchState
+{
+    size_t ops;                 // requests in the open batch
+    size_t bytes;               // total size of those requests
+    size_t inFlight;            // batches prepared but not committed
+    size_t pipelineDepth;       // how many may be in flight at once
+};
+
+/*
+ * Decides when the leader sends out the requests it has accumulated
+ * as a PREPARE. The leader asks ShouldClose after each new request
+ * and each time a batch commits, and closes the batch regardless
+ * after MaxDelay microseconds.
+ *
+ * All times are in microseconds.
+ */
+class BatchPolicy
+{
+public:
+    virtual ~BatchPolicy() { }
+    // Called for every request added to the open batch
+    virtual void RequestArrived(uint64_t now) { }
+    virtual bool ShouldClose(const BatchState &batch) const = 0;
+    virtual uint64_t MaxDelay() const = 0;
+};
+
+/*
+ * The original policy: send a batch as soon as there is room in the
+ * pipeline, otherwise wait until it has batchSize requests.
+ */
+class FixedBatchPolicy : public BatchPolicy
+{
+public:
+    FixedBatchPolicy(size_t batchSize,
+                     uint64_t maxDelay = DEFAULT_MAX_DELAY);
+    bool ShouldClose(const BatchState &batch) const;
+    uint64_t MaxDelay() const;
+
+    static const uint64_t DEFAULT_MAX_DELAY = 300000;
+
+private:
+    size_t batchSize;
+    uint64_t maxDelay;
+};
+
+/*
+ * Sizes batches from the observed request arrival rate. If nothing
+ * is in flight, there is no throughput to be gained by waiting, so
+ * the batch is sent right away; at low load every request goes out
+ * on its own. Otherwise the batch waits for as many requests as are
+ * expected to arrive within targetLatency, capped by maxOps and
+ * maxBytes.
+ */
+class AdaptiveBatchPolicy : public BatchPolicy
+{
+public:
+    AdaptiveBatchPolicy(size_t maxOps, size_t maxBytes,
+                        uint64_t targetLatency, uint64_t maxDelay);
+    void RequestArrived(uint64_t now);
+    bool ShouldClose(const BatchState &batch) const;
+    uint64_t MaxDelay() const;
+
+    // Number of requests the policy would like in a batch at the
+    // current arrival rate
+    size_t TargetOps() const;
+    uint64_t MeanInterarrival() const;
+
+private:
+    size_t maxOps;
+    size_t maxBytes;
+    uint64_t targetLatency;
+    uint64_t maxDelay;
+    uint64_t lastArrival;
+    EWMA interarrival;
+};
+
+} // namespace specpaxos::vr
+} // namespace specpaxos
+
+#endif  /* _VR_BATCHING_H_ */
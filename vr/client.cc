@@ -36,6 +36,8 @@
 #include "vr/client.h"
 #include "vr/vr-proto.pb.h"
 
+#include <algorithm>
+
 namespace specpaxos {
 namespace vr {
 
@@ -44,44 +46,53 @@ VRClient::VRClient(const Configuration &config,
                    uint64_t clientid)
     : Client(config, transport, clientid)
 {
-    pendingRequest = NULL;
     pendingUnloggedRequest = NULL;
+    view = 0;
     lastReqId = 0;
+    lastSentReqId = 0;
     
-    requestTimeout = new Timeout(transport, 7000, [this]() {
-            ResendRequest();
-        });
     unloggedRequestTimeout = new Timeout(transport, 1000, [this]() {
             UnloggedRequestTimeoutCallback();
         });
+    batchTimeout = new Timeout(transport, 1, [this]() {
+            FlushBatch();
+        });
 }
 
 VRClient::~VRClient()
 {
-    if (pendingRequest) {
-        delete pendingRequest;
+    for (auto &kv : pendingRequests) {
+        delete kv.second->timeout;
+        delete kv.second;
     }
     if (pendingUnloggedRequest) {
         delete pendingUnloggedRequest;
     }
-    delete requestTimeout;
     delete unloggedRequestTimeout;
+    delete batchTimeout;
 }
 
 void
 VRClient::Invoke(const string &request,
                  continuation_t continuation)
 {
-    // XXX Can only handle one pending request for now
-    if (pendingRequest != NULL) {
-        Panic("Client only supports one pending request");
-    }
+    ++lastReqId;
+    uint64_t reqId = lastReqId;
+    pendingRequests[reqId] = new PendingRequest(request, reqId, continuation);
 
+    SendNewRequests();
+}
+
+void
+VRClient::InvokeReadOnly(const string &request,
+                         continuation_t continuation)
+{
     ++lastReqId;
     uint64_t reqId = lastReqId;
-    pendingRequest = new PendingRequest(request, reqId, continuation);
+    pendingRequests[reqId] = new PendingRequest(request, reqId,
+                                                continuation, true);
 
-    SendRequest();
+    SendNewRequests();
 }
 
 void
@@ -115,24 +126,123 @@ VRClient::InvokeUnlogged(int replicaIdx,
 }
 
 void
-VRClient::SendRequest()
+VRClient::SetBatching(uint32_t maxOps, uint64_t maxDelay)
+{
+    Client::SetBatching(maxOps, maxDelay);
+    FlushBatch();
+    // Timers only have millisecond resolution
+    batchTimeout->SetTimeout(std::max<uint64_t>((maxDelay+999)/1000, 1));
+}
+
+uint64_t
+VRClient::AckedReqId() const
+{
+    if (pendingRequests.empty()) {
+        return lastReqId;
+    }
+    return pendingRequests.begin()->first - 1;
+}
+
+void
+VRClient::SendNewRequests()
+{
+    // Send whatever the window allows, oldest first
+    for (auto it = pendingRequests.upper_bound(lastSentReqId);
+         it != pendingRequests.end(); ++it) {
+        if (it->first >= pendingRequests.begin()->first + window) {
+            break;
+        }
+        PendingRequest *req = it->second;
+        uint64_t reqId = req->clientReqId;
+        req->timeout = new Timeout(transport, 7000, [this, reqId]() {
+                ResendRequest(reqId);
+            });
+        lastSentReqId = reqId;
+        if (req->readOnly) {
+            SendReadOnlyRequest(req);
+        } else if (batchOps > 1) {
+            BatchRequest(req);
+        } else {
+            SendRequest(req);
+        }
+    }
+}
+
+void
+VRClient::FillRequest(const PendingRequest *req, Request *r) const
+{
+    r->set_op(req->request);
+    r->set_clientid(clientid);
+    r->set_clientreqid(req->clientReqId);
+    r->set_ackedreqid(AckedReqId());
+}
+
+void
+VRClient::SendRequest(const PendingRequest *req)
 {
     proto::RequestMessage reqMsg;
-    reqMsg.mutable_req()->set_op(pendingRequest->request);
-    reqMsg.mutable_req()->set_clientid(clientid);
-    reqMsg.mutable_req()->set_clientreqid(pendingRequest->clientReqId);
+    FillRequest(req, reqMsg.mutable_req());
     
     // XXX Try sending only to (what we think is) the leader first
     transport->SendMessageToAll(this, reqMsg);
     
-    requestTimeout->Reset();
+    req->timeout->Reset();
 }
 
+// Read-only requests go only to the leader, which can answer them on
+// its own if it holds a lease. If that doesn't work out, the retry
+// goes to everyone as an ordinary request.
 void
-VRClient::ResendRequest()
+VRClient::SendReadOnlyRequest(const PendingRequest *req)
 {
-    Warning("Client timeout; resending request");
-    SendRequest();
+    proto::ReadOnlyRequestMessage reqMsg;
+    FillRequest(req, reqMsg.mutable_req());
+
+    transport->SendMessageToReplica(this, config.GetLeaderIndex(view),
+                                    reqMsg);
+
+    req->timeout->Reset();
+}
+
+void
+VRClient::BatchRequest(const PendingRequest *req)
+{
+    FillRequest(req, batch.add_req());
+    req->timeout->Reset();
+
+    if (batch.req_size() >= (int)batchOps) {
+        FlushBatch();
+    } else if (!batchTimeout->Active()) {
+        batchTimeout->Start();
+    }
+}
+
+void
+VRClient::FlushBatch()
+{
+    batchTimeout->Stop();
+
+    if (batch.req_size() == 0) {
+        return;
+    } else if (batch.req_size() == 1) {
+        proto::RequestMessage reqMsg;
+        *reqMsg.mutable_req() = batch.req(0);
+        transport->SendMessageToAll(this, reqMsg);
+    } else {
+        Debug("Sending batch of %d requests", batch.req_size());
+        transport->SendMessageToAll(this, batch);
+    }
+    batch.Clear();
+}
+
+void
+VRClient::ResendRequest(uint64_t clientReqId)
+{
+    auto it = pendingRequests.find(clientReqId);
+    ASSERT(it != pendingRequests.end());
+    Warning("Client timeout; resending request " FMT_CLIENTREQID,
+            clientReqId);
+    SendRequest(it->second);
 }
 
 
@@ -142,11 +252,15 @@ VRClient::ReceiveMessage(const TransportAddress &remote,
                          const string &data)
 {
     static proto::ReplyMessage reply;
+    static proto::ReplyBatchMessage replyBatch;
     static proto::UnloggedReplyMessage unloggedReply;
     
     if (type == reply.GetTypeName()) {
         reply.ParseFromString(data);
         HandleReply(remote, reply);
+    } else if (type == replyBatch.GetTypeName()) {
+        replyBatch.ParseFromString(data);
+        HandleReplyBatch(remote, replyBatch);
     } else if (type == unloggedReply.GetTypeName()) {
         unloggedReply.ParseFromString(data);
         HandleUnloggedReply(remote, unloggedReply);
@@ -159,26 +273,39 @@ void
 VRClient::HandleReply(const TransportAddress &remote,
                       const proto::ReplyMessage &msg)
 {
-    if (pendingRequest == NULL) {
-        Warning("Received reply when no request was pending");
-        return;
-    }
-    if (msg.clientreqid() != pendingRequest->clientReqId) {
-        Warning("Received reply for a different request");
+    auto it = pendingRequests.find(msg.clientreqid());
+    if ((it == pendingRequests.end()) ||
+        (it->second->timeout == NULL)) {
+        Debug("Received reply for a request that isn't pending");
         return;
     }
 
     Debug("Client received reply");
 
-    requestTimeout->Stop();
+    if (msg.view() > (uint64_t)view) {
+        view = msg.view();
+    }
 
-    PendingRequest *req = pendingRequest;
-    pendingRequest = NULL;
+    PendingRequest *req = it->second;
+    pendingRequests.erase(it);
+    delete req->timeout;
+
+    // The window might have room for more requests now
+    SendNewRequests();
     
     req->continuation(req->request, msg.reply());
     delete req;
 }
 
+void
+VRClient::HandleReplyBatch(const TransportAddress &remote,
+                           const proto::ReplyBatchMessage &msg)
+{
+    for (const proto::ReplyMessage &reply : msg.reply()) {
+        HandleReply(remote, reply);
+    }
+}
+
 void
 VRClient::HandleUnloggedReply(const TransportAddress &remote,
                               const proto::UnloggedReplyMessage &msg)
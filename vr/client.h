@@ -36,6 +36,8 @@
 #include "lib/configuration.h"
 #include "vr/vr-proto.pb.h"
 
+#include <map>
+
 namespace specpaxos {
 namespace vr {
 
@@ -48,11 +50,14 @@ public:
     virtual ~VRClient();
     virtual void Invoke(const string &request,
                         continuation_t continuation);
+    virtual void InvokeReadOnly(const string &request,
+                                continuation_t continuation);
     virtual void InvokeUnlogged(int replicaIdx,
                                 const string &request,
                                 continuation_t continuation,
                                 timeout_continuation_t timeoutContinuation = nullptr,
                                 uint32_t timeout = DEFAULT_UNLOGGED_OP_TIMEOUT);
+    virtual void SetBatching(uint32_t maxOps, uint64_t maxDelay);
     virtual void ReceiveMessage(const TransportAddress &remote,
                                 const string &type, const string &data);
 
@@ -67,20 +72,38 @@ protected:
         uint64_t clientReqId;
         continuation_t continuation;
         timeout_continuation_t timeoutContinuation;
+        bool readOnly;
+        // Only set once the request has been sent
+        Timeout *timeout;
         inline PendingRequest(string request, uint64_t clientReqId,
-                              continuation_t continuation)
+                              continuation_t continuation,
+                              bool readOnly = false)
             : request(request), clientReqId(clientReqId),
-              continuation(continuation) { }
+              continuation(continuation), readOnly(readOnly),
+              timeout(NULL) { }
     };
-    PendingRequest *pendingRequest;
+    // Requests that haven't completed, whether or not the window
+    // has let us send them yet
+    std::map<uint64_t, PendingRequest *> pendingRequests;
+    uint64_t lastSentReqId;
+    // Requests waiting to go out in the next batch
+    proto::RequestBatchMessage batch;
+    Timeout *batchTimeout;
     PendingRequest *pendingUnloggedRequest;
-    Timeout *requestTimeout;
     Timeout *unloggedRequestTimeout;
 
-    void SendRequest();
-    void ResendRequest();
+    uint64_t AckedReqId() const;
+    void SendNewRequests();
+    void FillRequest(const PendingRequest *req, Request *r) const;
+    void SendRequest(const PendingRequest *req);
+    void SendReadOnlyRequest(const PendingRequest *req);
+    void BatchRequest(const PendingRequest *req);
+    void FlushBatch();
+    void ResendRequest(uint64_t clientReqId);
     void HandleReply(const TransportAddress &remote,
                      const proto::ReplyMessage &msg);
+    void HandleReplyBatch(const TransportAddress &remote,
+                          const proto::ReplyBatchMessage &msg);
     void HandleUnloggedReply(const TransportAddress &remote,
                              const proto::UnloggedReplyMessage &msg);
     void UnloggedRequestTimeoutCallback();
@@ -41,6 +41,12 @@
 #include <algorithm>
 #include <random>
 
+// State transfer and recovery send the log in chunks of at most
+// STATE_TRANSFER_CHUNK_BYTES worth of requests, and at most
+// STATE_TRANSFER_WINDOW chunks before waiting for an acknowledgment.
+#define STATE_TRANSFER_CHUNK_BYTES 16384
+#define STATE_TRANSFER_WINDOW 4
+
 #define RDebug(fmt, ...) Debug("[%d] " fmt, myIdx, ##__VA_ARGS__)
 #define RNotice(fmt, ...) Notice("[%d] " fmt, myIdx, ##__VA_ARGS__)
 #define RWarning(fmt, ...) Warning("[%d] " fmt, myIdx, ##__VA_ARGS__)
@@ -54,11 +60,26 @@ using namespace proto;
 VRReplica::VRReplica(Configuration config, int myIdx,
                      bool initialize,
                      Transport *transport, int batchSize,
-                     AppReplica *app)
+                     AppReplica *app, int pipelineDepth,
+                     bool execThread)
+    : VRReplica(config, myIdx, initialize, transport,
+                new FixedBatchPolicy(batchSize), app, pipelineDepth,
+                execThread)
+{
+}
+
+VRReplica::VRReplica(Configuration config, int myIdx,
+                     bool initialize,
+                     Transport *transport, BatchPolicy *batchPolicy,
+                     AppReplica *app, int pipelineDepth,
+                     bool execThread)
     : Replica(config, myIdx, initialize, transport, app),
-      batchSize(batchSize),
+      batchPolicy(batchPolicy),
+      pipelineDepth(pipelineDepth),
+      execThread(execThread ? new ExecThread(transport, app) : NULL),
       log(false),
-      prepareOKQuorum(config.QuorumSize()-1),
+      lease(config, myIdx),
+      prepareOKQuorum(config.QuorumSize()-1, config.n),
       startViewChangeQuorum(config.QuorumSize()-1),
       doViewChangeQuorum(config.QuorumSize()-1),
       recoveryResponseQuorum(config.QuorumSize())
@@ -69,14 +90,27 @@ VRReplica::VRReplica(Configuration config, int myIdx,
     this->lastCommitted = 0;
     this->lastRequestStateTransferView = 0;
     this->lastRequestStateTransferOpnum = 0;
+    this->stateTransferOpnum = 0;
+    this->stateTransferLastProgress = 0;
+    this->leaseMinCommitted = 0;
     lastBatchEnd = 0;
-    batchComplete = true;
+    openBatchBytes = 0;
 
-    if (batchSize > 1) {
-        Notice("Batching enabled; batch size %d", batchSize);
+    ASSERT(pipelineDepth >= 1);
+    if (pipelineDepth > 1) {
+        Notice("Pipelining enabled; up to %d batches in flight",
+               pipelineDepth);
+    }
+    if (execThread) {
+        Notice("Executing operations on a separate thread");
     }
 
     this->viewChangeTimeout = new Timeout(transport, 5000, [this,myIdx]() {
+            if (lease.Promised(this->transport->Now())) {
+                RNotice("Not starting view change; leader's lease "
+                        "hasn't expired");
+                return;
+            }
             RWarning("Have not heard from leader; starting view change");
             StartViewChange(view+1);
         });
@@ -85,13 +119,26 @@ VRReplica::VRReplica(Configuration config, int myIdx,
         });
     this->stateTransferTimeout = new Timeout(transport, 1000, [this]() {
             this->lastRequestStateTransferView = 0;
-            this->lastRequestStateTransferOpnum = 0;            
+            this->lastRequestStateTransferOpnum = 0;
+            // If a chunked state transfer has stalled, presumably
+            // because a chunk or acknowledgment was lost, resume it
+            // from the last opnum we installed.
+            if ((stateTransferOpnum != 0) &&
+                (stateTransferOpnum == stateTransferLastProgress)) {
+                RequestStateTransfer();
+            }
+            this->stateTransferLastProgress = stateTransferOpnum;
         });
     this->stateTransferTimeout->Start();
     this->resendPrepareTimeout = new Timeout(transport, 500, [this]() {
             ResendPrepare();
         });
-    this->closeBatchTimeout = new Timeout(transport, 300, [this]() {
+    // Timers only have millisecond resolution, so round up
+    uint64_t closeBatchMs = (batchPolicy->MaxDelay() + 999) / 1000;
+    this->closeBatchTimeout = new Timeout(transport,
+                                          std::max(closeBatchMs,
+                                                   (uint64_t)1),
+                                          [this]() {
             CloseBatch();
         });
     this->recoveryTimeout = new Timeout(transport, 5000, [this]() {
@@ -117,6 +164,9 @@ VRReplica::VRReplica(Configuration config, int myIdx,
 
 VRReplica::~VRReplica()
 {
+    // Stop the execution thread before anything its completions use
+    delete execThread;
+
     Latency_Dump(&requestLatency);
     Latency_Dump(&executeAndReplyLatency);
 
@@ -126,6 +176,7 @@ VRReplica::~VRReplica()
     delete resendPrepareTimeout;
     delete closeBatchTimeout;
     delete recoveryTimeout;
+    delete batchPolicy;
     
     for (auto &kv : pendingPrepares) {
         delete kv.first;
@@ -150,6 +201,11 @@ VRReplica::AmLeader() const
 void
 VRReplica::CommitUpTo(opnum_t upto)
 {
+    // Replies to a run of operations from the same client (e.g. a
+    // batch of its requests) go out together
+    ReplyBatchMessage replies;
+    uint64_t repliesClient = 0;
+    
     while (lastCommitted < upto) {
         Latency_Start(&executeAndReplyLatency);
         
@@ -161,40 +217,79 @@ VRReplica::CommitUpTo(opnum_t upto)
             RPanic("Did not find operation " FMT_OPNUM " in log", lastCommitted);
         }
 
-        /* Execute it */
-        RDebug("Executing request " FMT_OPNUM, lastCommitted);
-        ReplyMessage reply;
-        Execute(lastCommitted, entry->request, reply);
-
-        reply.set_view(entry->viewstamp.view);
-        reply.set_opnum(entry->viewstamp.opnum);
-        reply.set_clientreqid(entry->request.clientreqid());
-        
         /* Mark it as committed */
         log.SetStatus(lastCommitted, LOG_STATE_COMMITTED);
 
-        // Store reply in the client table
-        ClientTableEntry &cte =
-            clientTable[entry->request.clientid()];
-        if (cte.lastReqId <= entry->request.clientreqid()) {
-            cte.lastReqId = entry->request.clientreqid();
-            cte.replied = true;
-            cte.reply = reply;            
+        /* Execute it */
+        RDebug("Executing request " FMT_OPNUM, lastCommitted);
+        if (execThread != NULL) {
+            // The reply goes out once the execution thread is done
+            // with it; the log entry may be gone by then
+            viewstamp_t vs = entry->viewstamp;
+            Request req = entry->request;
+            execThread->Execute(lastCommitted, req.op(),
+                                [this, vs, req](const string &res) {
+                    ReplyBatchMessage replies;
+                    uint64_t repliesClient = 0;
+                    ReplyMessage reply;
+                    reply.set_reply(res);
+                    CompleteOperation(vs, req, reply,
+                                      replies, repliesClient);
+                    SendReplies(repliesClient, replies);
+                });
+            execThread->Commit(lastCommitted);
         } else {
-            // We've subsequently prepared another operation from the
-            // same client. So this request must have been completed
-            // at the client, and there's no need to record the
-            // result.
-        }
-        
-        /* Send reply */
-        auto iter = clientAddresses.find(entry->request.clientid());
-        if (iter != clientAddresses.end()) {
-            transport->SendMessage(this, *iter->second, reply);
+            ReplyMessage reply;
+            Execute(lastCommitted, entry->request, reply);
+            // Let the application discard any undo state it kept
+            Commit(lastCommitted);
+            CompleteOperation(entry->viewstamp, entry->request, reply,
+                              replies, repliesClient);
         }
 
         Latency_End(&executeAndReplyLatency);
     }
+
+    SendReplies(repliesClient, replies);
+}
+
+// Store the reply to an executed operation in the client table and
+// add it to replies, first sending out what is there if it is for
+// another client
+void
+VRReplica::CompleteOperation(const viewstamp_t &vs, const Request &req,
+                             ReplyMessage &reply,
+                             ReplyBatchMessage &replies,
+                             uint64_t &repliesClient)
+{
+    reply.set_view(vs.view);
+    reply.set_opnum(vs.opnum);
+    reply.set_clientreqid(req.clientreqid());
+    reply.set_clientid(req.clientid());
+        
+    // Store reply in the client table
+    ClientTableEntry &cte = clientTable.Lookup(req.clientid(), vs.opnum);
+    uint64_t reqid = req.clientreqid();
+    ClientRequest *cr = cte.Find(reqid);
+    if ((cr == NULL) && !cte.IsStale(reqid)) {
+        // We didn't see the request prepared, e.g. because we
+        // got it in a state transfer
+        cr = &cte.Insert(reqid, req.ackedreqid());
+    }
+    if (cr != NULL) {
+        StoreReply(*cr, reply);
+    } else {
+        // The client has already gotten a reply for this
+        // request, so there's no need to record the result.
+    }
+        
+    /* Send reply */
+    if ((replies.reply_size() > 0) && (repliesClient != req.clientid())) {
+        SendReplies(repliesClient, replies);
+        replies.Clear();
+    }
+    repliesClient = req.clientid();
+    *replies.add_reply() = reply;
 }
 
 void
@@ -244,26 +339,35 @@ VRReplica::SendRecoveryMessages()
 }
 
 void
-VRReplica::RequestStateTransfer()
+VRReplica::RequestStateTransfer(const TransportAddress *remote)
 {
+    // If we're in the middle of a state transfer, pick up where we
+    // left off rather than starting again from the last committed
+    // operation.
+    opnum_t from = std::max(lastCommitted, stateTransferOpnum);
+    
     RequestStateTransferMessage m;
     m.set_view(view);
-    m.set_opnum(lastCommitted);
+    m.set_opnum(from);
 
     if ((lastRequestStateTransferOpnum != 0) &&
         (lastRequestStateTransferView == view) &&
-        (lastRequestStateTransferOpnum == lastCommitted)) {
+        (lastRequestStateTransferOpnum == from)) {
         RDebug("Skipping state transfer request " FMT_VIEWSTAMP
-               " because we already requested it", view, lastCommitted);
+               " because we already requested it", view, from);
         return;
     }
     
-    RNotice("Requesting state transfer: " FMT_VIEWSTAMP, view, lastCommitted);
+    RNotice("Requesting state transfer: " FMT_VIEWSTAMP, view, from);
 
     this->lastRequestStateTransferView = view;
-    this->lastRequestStateTransferOpnum = lastCommitted;
+    this->lastRequestStateTransferOpnum = from;
 
-    if (!transport->SendMessageToAll(this, m)) {
+    if (remote != NULL) {
+        if (!transport->SendMessage(this, *remote, m)) {
+            RWarning("Failed to send RequestStateTransfer message");
+        }
+    } else if (!transport->SendMessageToAll(this, m)) {
         RWarning("Failed to send RequestStateTransfer message to all replicas");
     }
 }
@@ -276,10 +380,17 @@ VRReplica::EnterView(view_t newview)
     view = newview;
     status = STATUS_NORMAL;
     lastBatchEnd = lastOp;
-    batchComplete = true;
+    openBatchBytes = 0;
+    inFlightBatches.clear();
+    // Entries installed by a state transfer in the old view might
+    // not survive into the new one
+    stateTransferOpnum = 0;
 
     recoveryTimeout->Stop();
 
+    lease.Clear();
+    leaseMinCommitted = lastOp;
+
     if (AmLeader()) {
         viewChangeTimeout->Stop();
         nullCommitTimeout->Start();
@@ -303,6 +414,7 @@ VRReplica::StartViewChange(view_t newview)
 
     view = newview;
     status = STATUS_VIEW_CHANGE;
+    lease.Clear();
 
     viewChangeTimeout->Reset();
     nullCommitTimeout->Stop();
@@ -325,61 +437,51 @@ VRReplica::SendNullCommit()
     CommitMessage cm;
     cm.set_view(this->view);
     cm.set_opnum(this->lastCommitted);
+    cm.set_leasestart(transport->Now());
 
     ASSERT(AmLeader());
 
     if (!(transport->SendMessageToAll(this, cm))) {
         RWarning("Failed to send null COMMIT message to all replicas");
     }
+    nullCommitTimeout->Reset();
 }
 
 void
 VRReplica::UpdateClientTable(const Request &req)
 {
-    ClientTableEntry &entry = clientTable[req.clientid()];
-
-    ASSERT(entry.lastReqId <= req.clientreqid());
+    ClientTableEntry &entry = clientTable.Lookup(req.clientid(), lastOp);
 
-    if (entry.lastReqId == req.clientreqid()) {
+    if (entry.IsStale(req.clientreqid()) ||
+        (entry.Find(req.clientreqid()) != NULL)) {
         return;
     }
 
-    entry.lastReqId = req.clientreqid();
-    entry.replied = false;
-    entry.reply.Clear();
+    entry.Insert(req.clientreqid(), req.ackedreqid());
 }
 
 void
-VRReplica::ResendPrepare()
+VRReplica::StoreReply(ClientRequest &cr, const ReplyMessage &reply)
 {
-    ASSERT(AmLeader());
-    if (lastOp == lastCommitted) {
-        return;
-    }
-    RNotice("Resending prepare");
-    if (!(transport->SendMessageToAll(this, lastPrepare))) {
-        RWarning("Failed to ressend prepare message to all replicas");
+    if (cr.reply) {
+        *cr.reply = reply;
+    } else {
+        cr.reply.reset(new ReplyMessage(reply));
     }
+    cr.replied = true;
 }
 
 void
-VRReplica::CloseBatch()
+VRReplica::SendPrepare(opnum_t batchStart, opnum_t batchEnd)
 {
-    ASSERT(AmLeader());
-    ASSERT(lastBatchEnd < lastOp);
-
-    opnum_t batchStart = lastBatchEnd+1;
-    
-    RDebug("Sending batched prepare from " FMT_OPNUM
-           " to " FMT_OPNUM,
-           batchStart, lastOp);
-    /* Send prepare messages */
     PrepareMessage p;
     p.set_view(view);
-    p.set_opnum(lastOp);
+    p.set_opnum(batchEnd);
     p.set_batchstart(batchStart);
+    p.set_lastcommitted(lastCommitted);
+    p.set_leasestart(transport->Now());
 
-    for (opnum_t i = batchStart; i <= lastOp; i++) {
+    for (opnum_t i = batchStart; i <= batchEnd; i++) {
         Request *r = p.add_request();
         const LogEntry *entry = log.Find(i);
         ASSERT(entry != NULL);
@@ -387,13 +489,85 @@ VRReplica::CloseBatch()
         ASSERT(entry->viewstamp.opnum == i);
         *r = entry->request;
     }
-    lastPrepare = p;
 
     if (!(transport->SendMessageToAll(this, p))) {
         RWarning("Failed to send prepare message to all replicas");
     }
+    nullCommitTimeout->Reset();
+}
+
+void
+VRReplica::ResendPrepare()
+{
+    ASSERT(AmLeader());
+    if (lastOp == lastCommitted) {
+        return;
+    }
+    if (lastBatchEnd <= lastCommitted) {
+        // Nothing in flight; the open batch will go out when it
+        // closes
+        return;
+    }
+    RNotice("Resending prepare");
+    // With several batches in flight, any of them might have been
+    // lost. Resend each one as it went out, so no PREPARE gets
+    // bigger than a batch.
+    opnum_t batchStart = lastCommitted+1;
+    for (opnum_t batchEnd : inFlightBatches) {
+        if (batchEnd < batchStart) {
+            continue;
+        }
+        SendPrepare(batchStart, batchEnd);
+        batchStart = batchEnd+1;
+    }
+}
+
+BatchState
+VRReplica::OpenBatch() const
+{
+    BatchState b;
+    b.ops = lastOp - lastBatchEnd;
+    b.bytes = openBatchBytes;
+    b.inFlight = inFlightBatches.size();
+    b.pipelineDepth = pipelineDepth;
+    return b;
+}
+
+void
+VRReplica::CloseBatch()
+{
+    ASSERT(AmLeader());
+    ASSERT(lastBatchEnd < lastOp);
+
+    // A follower catching up by state transfer acknowledges each
+    // operation on its own, so batches can commit before they are
+    // sent, or without a quorum for their last operation.
+    while (!inFlightBatches.empty() &&
+           (inFlightBatches.front() <= lastCommitted)) {
+        inFlightBatches.pop_front();
+    }
+    if (inFlightBatches.size() >= (size_t)pipelineDepth) {
+        // The pipeline is full. The batch goes out when one commits,
+        // or else when closeBatchTimeout fires.
+        RDebug("Holding batch; %zu batches in flight",
+               inFlightBatches.size());
+        if (!closeBatchTimeout->Active()) {
+            closeBatchTimeout->Start();
+        }
+        return;
+    }
+
+    opnum_t batchStart = lastBatchEnd+1;
+    
+    RDebug("Sending batched prepare from " FMT_OPNUM
+           " to " FMT_OPNUM,
+           batchStart, lastOp);
+    SendPrepare(batchStart, lastOp);
     lastBatchEnd = lastOp;
-    batchComplete = false;
+    openBatchBytes = 0;
+    if (lastBatchEnd > lastCommitted) {
+        inFlightBatches.push_back(lastBatchEnd);
+    }
     
     resendPrepareTimeout->Reset();
     closeBatchTimeout->Stop();
@@ -404,10 +578,13 @@ VRReplica::ReceiveMessage(const TransportAddress &remote,
                           const string &type, const string &data)
 {
     static RequestMessage request;
+    static RequestBatchMessage requestBatch;
     static UnloggedRequestMessage unloggedRequest;
+    static ReadOnlyRequestMessage readOnlyRequest;
     static PrepareMessage prepare;
     static PrepareOKMessage prepareOK;
     static CommitMessage commit;
+    static CommitOKMessage commitOK;
     static RequestStateTransferMessage requestStateTransfer;
     static StateTransferMessage stateTransfer;
     static StartViewChangeMessage startViewChange;
@@ -419,9 +596,15 @@ VRReplica::ReceiveMessage(const TransportAddress &remote,
     if (type == request.GetTypeName()) {
         request.ParseFromString(data);
         HandleRequest(remote, request);
+    } else if (type == requestBatch.GetTypeName()) {
+        requestBatch.ParseFromString(data);
+        HandleRequestBatch(remote, requestBatch);
     } else if (type == unloggedRequest.GetTypeName()) {
         unloggedRequest.ParseFromString(data);
         HandleUnloggedRequest(remote, unloggedRequest);
+    } else if (type == readOnlyRequest.GetTypeName()) {
+        readOnlyRequest.ParseFromString(data);
+        HandleReadOnlyRequest(remote, readOnlyRequest);
     } else if (type == prepare.GetTypeName()) {
         prepare.ParseFromString(data);
         HandlePrepare(remote, prepare);
@@ -431,6 +614,9 @@ VRReplica::ReceiveMessage(const TransportAddress &remote,
     } else if (type == commit.GetTypeName()) {
         commit.ParseFromString(data);
         HandleCommit(remote, commit);
+    } else if (type == commitOK.GetTypeName()) {
+        commitOK.ParseFromString(data);
+        HandleCommitOK(remote, commitOK);
     } else if (type == requestStateTransfer.GetTypeName()) {
         requestStateTransfer.ParseFromString(data);
         HandleRequestStateTransfer(remote, requestStateTransfer);
@@ -461,6 +647,41 @@ VRReplica::ReceiveMessage(const TransportAddress &remote,
 void
 VRReplica::HandleRequest(const TransportAddress &remote,
                          const RequestMessage &msg)
+{
+    ReplyBatchMessage replies;
+    if (LogRequest(remote, msg.req(), replies)) {
+        RequestsLogged();
+    }
+    SendReplies(remote, replies);
+}
+
+void
+VRReplica::HandleRequestBatch(const TransportAddress &remote,
+                              const RequestBatchMessage &msg)
+{
+    // Log the whole batch before deciding whether to close the
+    // prepare batch, so its requests go out in the same prepare
+    ReplyBatchMessage replies;
+    bool logged = false;
+    for (const Request &req : msg.req()) {
+        if (LogRequest(remote, req, replies)) {
+            logged = true;
+        }
+    }
+    if (logged) {
+        RequestsLogged();
+    }
+    SendReplies(remote, replies);
+}
+
+// Assign the request an opnum and add it to the log, if it is new
+// and we're the leader. Any reply we can send right away (for a
+// duplicate request, or one the application doesn't want
+// replicated) is added to replies instead. Returns true if the
+// request was logged.
+bool
+VRReplica::LogRequest(const TransportAddress &remote, const Request &req,
+                      ReplyBatchMessage &replies)
 {
     viewstamp_t v;
     Latency_Start(&requestLatency);
@@ -468,61 +689,56 @@ VRReplica::HandleRequest(const TransportAddress &remote,
     if (status != STATUS_NORMAL) {
         RNotice("Ignoring request due to abnormal status");
         Latency_EndType(&requestLatency, 'i');
-        return;
+        return false;
     }
 
     if (!AmLeader()) {
         RDebug("Ignoring request because I'm not the leader");
         Latency_EndType(&requestLatency, 'i');
-        return;        
+        return false;
     }
 
     // Save the client's address
-    clientAddresses.erase(msg.req().clientid());
-    clientAddresses.insert(
-        std::pair<uint64_t, std::unique_ptr<TransportAddress> >(
-            msg.req().clientid(),
-            std::unique_ptr<TransportAddress>(remote.clone())));
+    clientTable.SetAddress(req.clientid(), remote, lastOp);
 
     // Check the client table to see if this is a duplicate request
-    auto kv = clientTable.find(msg.req().clientid());
-    if (kv != clientTable.end()) {
-        const ClientTableEntry &entry = kv->second;
-        if (msg.req().clientreqid() < entry.lastReqId) {
+    const ClientTableEntry *entry = clientTable.Find(req.clientid());
+    if (entry != NULL) {
+        if (entry->IsStale(req.clientreqid())) {
             RNotice("Ignoring stale request");
             Latency_EndType(&requestLatency, 's');
-            return;
+            return false;
         }
-        if (msg.req().clientreqid() == entry.lastReqId) {
+        const ClientRequest *cr = entry->Find(req.clientreqid());
+        if (cr != NULL) {
             // This is a duplicate request. Resend the reply if we
             // have one. We might not have a reply to resend if we're
             // waiting for the other replicas; in that case, just
             // discard the request.
-            if (entry.replied) {
+            if (cr->replied) {
                 RNotice("Received duplicate request; resending reply");
-                if (!(transport->SendMessage(this, remote,
-                                             entry.reply))) {
-                    RWarning("Failed to resend reply to client");
-                }
+                *replies.add_reply() = *cr->reply;
                 Latency_EndType(&requestLatency, 'r');
-                return;
+                return false;
             } else {
                 RNotice("Received duplicate request but no reply available; ignoring");
                 Latency_EndType(&requestLatency, 'd');
-                return;
+                return false;
             }
         }
     }
 
     // Update the client table
-    UpdateClientTable(msg.req());
+    UpdateClientTable(req);
 
     // Leader Upcall
     bool replicate = false;
     string res;
-    LeaderUpcall(lastCommitted, msg.req().op(), replicate, res);
-    ClientTableEntry &cte =
-        clientTable[msg.req().clientid()];
+    LeaderUpcall(lastCommitted, req.op(), replicate, res);
+    ClientRequest *cr =
+        clientTable.Lookup(req.clientid(), lastOp)
+        .Find(req.clientreqid());
+    ASSERT(cr != NULL);
 
     // Check whether this request should be committed to replicas
     if (!replicate) {
@@ -532,39 +748,81 @@ VRReplica::HandleRequest(const TransportAddress &remote,
         reply.set_reply(res);
         reply.set_view(0);
         reply.set_opnum(0);
-        reply.set_clientreqid(msg.req().clientreqid());
-        cte.replied = true;
-        cte.reply = reply;
-        transport->SendMessage(this, remote, reply);
+        reply.set_clientreqid(req.clientreqid());
+        reply.set_clientid(req.clientid());
+        StoreReply(*cr, reply);
+        *replies.add_reply() = reply;
         Latency_EndType(&requestLatency, 'f');
-    } else {
-        Request request;
-        request.set_op(res);
-        request.set_clientid(msg.req().clientid());
-        request.set_clientreqid(msg.req().clientreqid());
+        return false;
+    }
+
+    Request request;
+    request.set_op(res);
+    request.set_clientid(req.clientid());
+    request.set_clientreqid(req.clientreqid());
+    request.set_ackedreqid(req.ackedreqid());
     
-        /* Assign it an opnum */
-        ++this->lastOp;
-        v.view = this->view;
-        v.opnum = this->lastOp;
+    /* Assign it an opnum */
+    ++this->lastOp;
+    v.view = this->view;
+    v.opnum = this->lastOp;
 
-        RDebug("Received REQUEST, assigning " FMT_VIEWSTAMP, VA_VIEWSTAMP(v));
+    RDebug("Received REQUEST, assigning " FMT_VIEWSTAMP, VA_VIEWSTAMP(v));
 
-        /* Add the request to my log */
-        log.Append(v, request, LOG_STATE_PREPARED);
+    /* Add the request to my log */
+    log.Append(v, request, LOG_STATE_PREPARED);
+    openBatchBytes += request.ByteSizeLong();
+    batchPolicy->RequestArrived(transport->Now());
 
-        if (batchComplete ||
-            (lastOp - lastBatchEnd+1 > (unsigned int)batchSize)) {
-            CloseBatch();
-        } else {
-            RDebug("Keeping in batch");
-            if (!closeBatchTimeout->Active()) {
-                closeBatchTimeout->Start();
-            }
+    Latency_End(&requestLatency);
+    return true;
+}
+
+// New requests have been added to the open batch; send it out if
+// the batch policy says so.
+void
+VRReplica::RequestsLogged()
+{
+    if (batchPolicy->ShouldClose(OpenBatch())) {
+        CloseBatch();
+    } else {
+        RDebug("Keeping in batch");
+        if (!closeBatchTimeout->Active()) {
+            closeBatchTimeout->Start();
         }
+    }
+
+    nullCommitTimeout->Reset();
+}
+
+void
+VRReplica::SendReplies(const TransportAddress &remote,
+                       ReplyBatchMessage &replies)
+{
+    bool ok;
+    if (replies.reply_size() == 0) {
+        return;
+    } else if (replies.reply_size() == 1) {
+        ok = transport->SendMessage(this, remote, replies.reply(0));
+    } else {
+        replies.set_clientid(replies.reply(0).clientid());
+        ok = transport->SendMessage(this, remote, replies);
+    }
+    if (!ok) {
+        RWarning("Failed to send reply to client");
+    }
+}
 
-        nullCommitTimeout->Reset();
-        Latency_End(&requestLatency);
+// Send replies to clientid, if we know its address
+void
+VRReplica::SendReplies(uint64_t clientid, ReplyBatchMessage &replies)
+{
+    if (replies.reply_size() == 0) {
+        return;
+    }
+    const TransportAddress *addr = clientTable.GetAddress(clientid);
+    if (addr != NULL) {
+        SendReplies(*addr, replies);
     }
 }
 
@@ -583,12 +841,74 @@ VRReplica::HandleUnloggedRequest(const TransportAddress &remote,
     
     Debug("Received unlogged request %s", (char *)msg.req().op().c_str());
 
+    if (execThread != NULL) {
+        // Run it after the operations already handed off
+        std::shared_ptr<TransportAddress> addr(remote.clone());
+        uint64_t clientid = msg.req().clientid();
+        execThread->ExecuteUnlogged(msg.req().op(),
+                                    [this, addr, clientid](const string &res) {
+                UnloggedReplyMessage reply;
+                reply.set_reply(res);
+                reply.set_clientid(clientid);
+                if (!(transport->SendMessage(this, *addr, reply)))
+                    Warning("Failed to send reply message");
+            });
+        return;
+    }
+
     ExecuteUnlogged(msg.req(), reply);
+    reply.set_clientid(msg.req().clientid());
     
     if (!(transport->SendMessage(this, remote, reply)))
         Warning("Failed to send reply message");
 }
 
+void
+VRReplica::HandleReadOnlyRequest(const TransportAddress &remote,
+                                 const ReadOnlyRequestMessage &msg)
+{
+    if (!AmLeader() || (status != STATUS_NORMAL) ||
+        (lastCommitted < leaseMinCommitted) ||
+        !lease.Valid(transport->Now())) {
+        // Fall back to ordering it like any other request
+        RDebug("Can't serve read-only request " FMT_CLIENTREQID
+               " under a lease; logging it", msg.req().clientreqid());
+        RequestMessage req;
+        *req.mutable_req() = msg.req();
+        HandleRequest(remote, req);
+        return;
+    }
+
+    // Our state reflects every operation that has committed, and no
+    // other replica can commit anything until our lease runs out
+    ReplyMessage reply;
+    reply.set_view(view);
+    reply.set_opnum(lastCommitted);
+    reply.set_clientreqid(msg.req().clientreqid());
+    reply.set_clientid(msg.req().clientid());
+
+    if (execThread != NULL) {
+        // The execution thread gets to it after every operation
+        // committed so far, and before any that commit later
+        std::shared_ptr<TransportAddress> addr(remote.clone());
+        execThread->ExecuteUnlogged(msg.req().op(),
+                                    [this, addr, reply](const string &res) {
+                ReplyMessage r(reply);
+                r.set_reply(res);
+                if (!(transport->SendMessage(this, *addr, r))) {
+                    RWarning("Failed to send reply to client");
+                }
+            });
+        return;
+    }
+
+    UnloggedUpcall(msg.req().op(), *reply.mutable_reply());
+
+    if (!(transport->SendMessage(this, remote, reply))) {
+        RWarning("Failed to send reply to client");
+    }
+}
+
 void
 VRReplica::HandlePrepare(const TransportAddress &remote,
                          const PrepareMessage &msg)
@@ -628,11 +948,16 @@ VRReplica::HandlePrepare(const TransportAddress &remote,
         reply.set_view(msg.view());
         reply.set_opnum(msg.opnum());
         reply.set_replicaidx(myIdx);
+        if (msg.has_leasestart()) {
+            lease.Grant(transport->Now());
+            reply.set_leasestart(msg.leasestart());
+        }
         if (!(transport->SendMessageToReplica(this,
                                               configuration.GetLeaderIndex(view),
                                               reply))) {
             RWarning("Failed to send PrepareOK message to leader");
         }
+        CommitUpTo(std::min(msg.lastcommitted(), lastOp));
         return;
     }
 
@@ -661,12 +986,20 @@ VRReplica::HandlePrepare(const TransportAddress &remote,
     reply.set_view(msg.view());
     reply.set_opnum(msg.opnum());
     reply.set_replicaidx(myIdx);
+    if (msg.has_leasestart()) {
+        // Promise not to help elect anyone else for a while
+        lease.Grant(transport->Now());
+        reply.set_leasestart(msg.leasestart());
+    }
     
     if (!(transport->SendMessageToReplica(this,
                                           configuration.GetLeaderIndex(view),
                                           reply))) {
         RWarning("Failed to send PrepareOK message to leader");
     }
+
+    // The leader piggybacks its commit number on the PREPARE
+    CommitUpTo(std::min(msg.lastcommitted(), lastOp));
 }
 
 void
@@ -697,10 +1030,13 @@ VRReplica::HandlePrepareOK(const TransportAddress &remote,
         RWarning("Ignoring PREPAREOK because I'm not the leader");
         return;        
     }
+
+    if (msg.has_leasestart()) {
+        lease.Granted(msg.replicaidx(), msg.leasestart());
+    }
     
-    viewstamp_t vs = { msg.view(), msg.opnum() };
-    if (auto msgs =
-        (prepareOKQuorum.AddAndCheckForQuorum(vs, msg.replicaidx(), msg))) {
+    if (prepareOKQuorum.AddAndCheckForQuorum(msg.opnum(),
+                                             msg.replicaidx())) {
         /*
          * We have a quorum of PrepareOK messages for this
          * opnumber. Execute it and all previous operations.
@@ -710,34 +1046,28 @@ VRReplica::HandlePrepareOK(const TransportAddress &remote,
          *
          * This also notifies the client of the result.
          */
+        int count = prepareOKQuorum.Count(msg.opnum());
         CommitUpTo(msg.opnum());
+        // Nobody will need PREPAREOKs for committed operations again
+        prepareOKQuorum.SetWatermark(lastCommitted+1);
+        // A quorum for a later batch also commits any earlier ones
+        // still waiting for their own
+        while (!inFlightBatches.empty() &&
+               (inFlightBatches.front() <= lastCommitted)) {
+            inFlightBatches.pop_front();
+        }
 
-        if (msgs->size() >= (unsigned)configuration.QuorumSize()) {
+        if (count >= configuration.QuorumSize()) {
             return;
         }
-        
+
         /*
-         * Send COMMIT message to the other replicas.
-         *
-         * This can be done asynchronously, so it really ought to be
-         * piggybacked on the next PREPARE or something.
+         * The other replicas learn about the commit from the next
+         * PREPARE, which carries the commit number, or from the null
+         * COMMIT if the leader goes idle.
          */
-        CommitMessage cm;
-        cm.set_view(this->view);
-        cm.set_opnum(this->lastCommitted);
-
-        if (!(transport->SendMessageToAll(this, cm))) {
-            RWarning("Failed to send COMMIT message to all replicas");
-        }
-
-        nullCommitTimeout->Reset();
-
-        // XXX Adaptive batching -- make this configurable
-        if (lastBatchEnd == msg.opnum()) {
-            batchComplete = true;
-            if  (lastOp > lastBatchEnd) {
-                CloseBatch();
-            }
+        if (batchPolicy->ShouldClose(OpenBatch())) {
+            CloseBatch();
         }
     }
 }
@@ -768,6 +1098,20 @@ VRReplica::HandleCommit(const TransportAddress &remote,
     }
 
     viewChangeTimeout->Reset();
+
+    if (msg.has_leasestart()) {
+        // The leader's heartbeat; renew its lease as a PREPARE would
+        lease.Grant(transport->Now());
+        CommitOKMessage reply;
+        reply.set_view(view);
+        reply.set_replicaidx(myIdx);
+        reply.set_leasestart(msg.leasestart());
+        if (!(transport->SendMessageToReplica(this,
+                                              configuration.GetLeaderIndex(view),
+                                              reply))) {
+            RWarning("Failed to send CommitOK message to leader");
+        }
+    }
     
     if (msg.opnum() <= this->lastCommitted) {
         RDebug("Ignoring COMMIT; already committed that operation");
@@ -783,6 +1127,22 @@ VRReplica::HandleCommit(const TransportAddress &remote,
 }
 
 
+void
+VRReplica::HandleCommitOK(const TransportAddress &remote,
+                          const CommitOKMessage &msg)
+{
+    RDebug("Received COMMITOK <" FMT_VIEW "> from replica %d",
+           msg.view(), msg.replicaidx());
+
+    if ((this->status != STATUS_NORMAL) || (msg.view() != this->view) ||
+        !AmLeader()) {
+        RDebug("Ignoring COMMITOK");
+        return;
+    }
+
+    lease.Granted(msg.replicaidx(), msg.leasestart());
+}
+
 void
 VRReplica::HandleRequestStateTransfer(const TransportAddress &remote,
                                       const RequestStateTransferMessage &msg)
@@ -804,13 +1164,31 @@ VRReplica::HandleRequestStateTransfer(const TransportAddress &remote,
             FMT_VIEWSTAMP,
             msg.view(), msg.opnum(), view, lastCommitted);
 
-    StateTransferMessage reply;
-    reply.set_view(view);
-    reply.set_opnum(lastCommitted);
-    
-    log.Dump(msg.opnum()+1, reply.mutable_entries());
+    // Send the log in bounded chunks, at most one window's worth at a
+    // time. The last chunk of the window asks the receiver to
+    // acknowledge it, which it does by requesting the next window
+    // from wherever it got to.
+    opnum_t from = msg.opnum()+1;
+    for (int i = 0; i < STATE_TRANSFER_WINDOW; i++) {
+        StateTransferMessage reply;
+        reply.set_view(view);
+        reply.set_opnum(lastCommitted);
+
+        opnum_t last = log.DumpChunk(from, STATE_TRANSFER_CHUNK_BYTES,
+                                     reply.mutable_entries());
+        bool more = (last < log.LastOpnum());
+        reply.set_more(more);
+        reply.set_ackrequested(more && (i == STATE_TRANSFER_WINDOW-1));
+
+        if (!(transport->SendMessage(this, remote, reply))) {
+            RWarning("Failed to send StateTransfer message");
+        }
 
-    transport->SendMessage(this, remote, reply);
+        if (!more) {
+            break;
+        }
+        from = last+1;
+    }
 }
 
 void
@@ -824,67 +1202,64 @@ VRReplica::HandleStateTransfer(const TransportAddress &remote,
         return;
     }
     
-    opnum_t oldLastOp = lastOp;
-    
+    // Only install a chunk if it picks up where the part of our log
+    // we know to be up to date leaves off. Anything after that might
+    // be left over from an older view.
+    opnum_t installed = lastCommitted;
+    if (msg.view() == view) {
+        installed = std::max(installed, stateTransferOpnum);
+    }
+    if ((msg.entries_size() > 0) &&
+        (msg.entries(0).opnum() > installed+1)) {
+        // We missed an earlier chunk. Ask the sender to resume from
+        // what we have installed so far.
+        RDebug("Ignoring out-of-order state transfer chunk starting at "
+               FMT_OPNUM, msg.entries(0).opnum());
+        RequestStateTransfer(&remote);
+        return;
+    }
+
     /* Install the new log entries */
-    for (auto newEntry : msg.entries()) {
-        if (newEntry.opnum() <= lastCommitted) {
-            // Already committed this operation; nothing to be done.
-#if PARANOID
-            const LogEntry *entry = log.Find(newEntry.opnum());
-            ASSERT(entry->viewstamp.opnum == newEntry.opnum());
-            ASSERT(entry->viewstamp.view == newEntry.view());
-//          ASSERT(entry->request == newEntry.request());
-#endif
-        } else if (newEntry.opnum() <= lastOp) {
-            // We already have an entry with this opnum, but maybe
-            // it's from an older view?
-            const LogEntry *entry = log.Find(newEntry.opnum());
-            ASSERT(entry->viewstamp.opnum == newEntry.opnum());
-            ASSERT(entry->viewstamp.view <= newEntry.view());
-            
-            if (entry->viewstamp.view == newEntry.view()) {
-                // We already have this operation in our log.
-                ASSERT(entry->state == LOG_STATE_PREPARED);
-#if PARANOID
-//              ASSERT(entry->request == newEntry.request());                
-#endif
-            } else {
-                // Our operation was from an older view, so obviously
-                // it didn't survive a view change. Throw out any
-                // later log entries and replace with this one.
-                ASSERT(entry->state != LOG_STATE_COMMITTED);
-                log.RemoveAfter(newEntry.opnum());
-                lastOp = newEntry.opnum();
-                oldLastOp = lastOp;
-
-                viewstamp_t vs = { newEntry.view(), newEntry.opnum() };
-                log.Append(vs, newEntry.request(), LOG_STATE_PREPARED);
-            }
-        } else {
-            // This is a new operation to us. Add it to the log.
-            ASSERT(newEntry.opnum() == lastOp+1);
-            
-            lastOp++;
-            viewstamp_t vs = { newEntry.view(), newEntry.opnum() };
-            log.Append(vs, newEntry.request(), LOG_STATE_PREPARED);
-        }
+    opnum_t firstNew = lastOp+1;
+    if (msg.entries_size() > 0) {
+        firstNew = log.Install(msg.entries().begin(),
+                               msg.entries().end());
+        lastOp = log.LastOpnum();
     }
-    
 
     if (msg.view() > view) {
         EnterView(msg.view());
     }
 
+    bool progress = false;
+    if (msg.entries_size() > 0) {
+        opnum_t chunkEnd = msg.entries(msg.entries_size()-1).opnum();
+        progress = (chunkEnd > installed);
+        stateTransferOpnum = std::max(stateTransferOpnum, chunkEnd);
+    }
+
     /* Execute committed operations */
-    ASSERT(msg.opnum() <= lastOp);
-    CommitUpTo(msg.opnum());
-    SendPrepareOKs(oldLastOp);
+    CommitUpTo(std::min(msg.opnum(),
+                        std::max(lastCommitted, stateTransferOpnum)));
+    SendPrepareOKs(firstNew);
+
+    if (msg.more()) {
+        // Acknowledge the window, unless this chunk was a duplicate
+        // (e.g. from another replica that also answered our
+        // request), in which case whoever sent the original will
+        // hear from us instead.
+        if (msg.ackrequested() && progress) {
+            RequestStateTransfer(&remote);
+        }
+        return;
+    }
+
+    stateTransferOpnum = 0;
 
     // Process pending prepares
     std::list<std::pair<TransportAddress *, PrepareMessage> >pending = pendingPrepares;
     pendingPrepares.clear();
-    for (auto & msgpair : pendingPrepares) {
+    for (auto & msgpair : pending) {
         RDebug("Processing pending prepare message");
         HandlePrepare(*msgpair.first, msgpair.second);
         delete msgpair.first;
@@ -908,6 +1283,11 @@ VRReplica::HandleStartViewChange(const TransportAddress &remote,
         return;
     }
 
+    if ((status == STATUS_NORMAL) && lease.Promised(transport->Now())) {
+        RNotice("Ignoring STARTVIEWCHANGE; leader's lease hasn't expired");
+        return;
+    }
+
     if ((status != STATUS_VIEW_CHANGE) || (msg.view() > view)) {
         RWarning("Received StartViewChange for view " FMT_VIEW
                  "from replica %d", msg.view(), msg.replicaidx());
@@ -969,6 +1349,11 @@ VRReplica::HandleDoViewChange(const TransportAddress &remote,
         return;
     }
 
+    if ((status == STATUS_NORMAL) && lease.Promised(transport->Now())) {
+        RNotice("Ignoring DOVIEWCHANGE; leader's lease hasn't expired");
+        return;
+    }
+
     if ((status != STATUS_VIEW_CHANGE) || (msg.view() > view)) {
         // It's superfluous to send the StartViewChange messages here,
         // but harmless...
@@ -1136,7 +1521,10 @@ VRReplica::HandleRecovery(const TransportAddress &remote,
     if (AmLeader()) {
         reply.set_lastcommitted(lastCommitted);
         reply.set_lastop(lastOp);
-        log.Dump(0, reply.mutable_entries());
+        // Only send the first chunk of the log; the recovering
+        // replica fetches the rest with a state transfer.
+        log.DumpChunk(0, STATE_TRANSFER_CHUNK_BYTES,
+                      reply.mutable_entries());
     }
 
     if (!(transport->SendMessage(this, remote, reply))) {
@@ -1188,8 +1576,16 @@ VRReplica::HandleRecoveryResponse(const TransportAddress &remote,
         log.Install(leaderResponse->second.entries().begin(),
                     leaderResponse->second.entries().end());        
         EnterView(leaderResponse->second.view());
-        lastOp = leaderResponse->second.lastop();
-        CommitUpTo(leaderResponse->second.lastcommitted());
+        lastOp = log.LastOpnum();
+        CommitUpTo(std::min(leaderResponse->second.lastcommitted(),
+                            lastOp));
+
+        if (lastOp < leaderResponse->second.lastop()) {
+            // The leader only sent us the first chunk of its log;
+            // get the rest with a state transfer.
+            stateTransferOpnum = lastOp;
+            RequestStateTransfer();
+        }
     }
 }
 
@@ -33,11 +33,16 @@
 
 #include "lib/configuration.h"
 #include "lib/latency.h"
+#include "common/clienttable.h"
+#include "common/execthread.h"
+#include "common/lease.h"
 #include "common/log.h"
 #include "common/replica.h"
 #include "common/quorumset.h"
+#include "vr/batching.h"
 #include "vr/vr-proto.pb.h"
 
+#include <deque>
 #include <map>
 #include <memory>
 #include <list>
@@ -50,7 +55,14 @@ class VRReplica : public Replica
 public:
     VRReplica(Configuration config, int myIdx, bool initialize,
               Transport *transport, int batchSize,
-              AppReplica *app);
+              AppReplica *app, int pipelineDepth = 1,
+              bool execThread = false);
+    // Takes ownership of batchPolicy. With execThread, operations
+    // are executed on a separate thread (common/execthread.h).
+    VRReplica(Configuration config, int myIdx, bool initialize,
+              Transport *transport, BatchPolicy *batchPolicy,
+              AppReplica *app, int pipelineDepth = 1,
+              bool execThread = false);
     ~VRReplica();
     
     void ReceiveMessage(const TransportAddress &remote,
@@ -62,25 +74,42 @@ private:
     opnum_t lastOp;
     view_t lastRequestStateTransferView;
     opnum_t lastRequestStateTransferOpnum;
+    opnum_t stateTransferOpnum;
+    opnum_t stateTransferLastProgress;
     uint64_t recoveryNonce;
     std::list<std::pair<TransportAddress *,
                         proto::PrepareMessage> > pendingPrepares;
-    proto::PrepareMessage lastPrepare;
-    int batchSize;
+    BatchPolicy *batchPolicy;
+    // Number of batches the leader will have prepared but not yet
+    // committed before it holds new requests back to build up the
+    // next batch. A full batch is always sent right away.
+    int pipelineDepth;
     opnum_t lastBatchEnd;
-    bool batchComplete;
+    size_t openBatchBytes;
+    // Last opnum of each batch that has been sent out but not yet
+    // committed, oldest first
+    std::deque<opnum_t> inFlightBatches;
+    // NULL if we execute operations ourselves
+    ExecThread *execThread;
     
     Log log;
-    std::map<uint64_t, std::unique_ptr<TransportAddress> > clientAddresses;
-    struct ClientTableEntry
+    struct ClientRequest
     {
-        uint64_t lastReqId;
         bool replied;
-        proto::ReplyMessage reply;
+        // Allocated once we have a reply for the request
+        std::unique_ptr<proto::ReplyMessage> reply;
+
+        ClientRequest() : replied(false) { }
     };
-    std::map<uint64_t, ClientTableEntry> clientTable;
+    typedef RequestWindow<ClientRequest> ClientTableEntry;
+    ClientTable<ClientTableEntry> clientTable;
+
+    LeaderLease lease;
+    // A new leader can't serve reads until it has committed
+    // everything that might have committed in earlier views
+    opnum_t leaseMinCommitted;
     
-    QuorumSet<viewstamp_t, proto::PrepareOKMessage> prepareOKQuorum;
+    BitmaskQuorumSet<> prepareOKQuorum;
     QuorumSet<view_t, proto::StartViewChangeMessage> startViewChangeQuorum;
     QuorumSet<view_t, proto::DoViewChangeMessage> doViewChangeQuorum;
     QuorumSet<uint64_t, proto::RecoveryResponseMessage> recoveryResponseQuorum;
@@ -100,18 +129,35 @@ private:
     void CommitUpTo(opnum_t upto);
     void SendPrepareOKs(opnum_t oldLastOp);
     void SendRecoveryMessages();
-    void RequestStateTransfer();
+    void RequestStateTransfer(const TransportAddress *remote = NULL);
     void EnterView(view_t newview);
     void StartViewChange(view_t newview);
     void SendNullCommit();
     void UpdateClientTable(const Request &req);
+    void StoreReply(ClientRequest &cr, const proto::ReplyMessage &reply);
+    void SendPrepare(opnum_t batchStart, opnum_t batchEnd);
     void ResendPrepare();
+    BatchState OpenBatch() const;
     void CloseBatch();
+    void RequestsLogged();
+    bool LogRequest(const TransportAddress &remote, const Request &req,
+                    proto::ReplyBatchMessage &replies);
+    void SendReplies(const TransportAddress &remote,
+                     proto::ReplyBatchMessage &replies);
+    void SendReplies(uint64_t clientid, proto::ReplyBatchMessage &replies);
+    void CompleteOperation(const viewstamp_t &vs, const Request &req,
+                           proto::ReplyMessage &reply,
+                           proto::ReplyBatchMessage &replies,
+                           uint64_t &repliesClient);
     
     void HandleRequest(const TransportAddress &remote,
                        const proto::RequestMessage &msg);
+    void HandleRequestBatch(const TransportAddress &remote,
+                            const proto::RequestBatchMessage &msg);
     void HandleUnloggedRequest(const TransportAddress &remote,
                                const proto::UnloggedRequestMessage &msg);
+    void HandleReadOnlyRequest(const TransportAddress &remote,
+                               const proto::ReadOnlyRequestMessage &msg);
     
     void HandlePrepare(const TransportAddress &remote,
                        const proto::PrepareMessage &msg);
@@ -119,6 +165,8 @@ private:
                          const proto::PrepareOKMessage &msg);
     void HandleCommit(const TransportAddress &remote,
                       const proto::CommitMessage &msg);
+    void HandleCommitOK(const TransportAddress &remote,
+                        const proto::CommitOKMessage &msg);
     void HandleRequestStateTransfer(const TransportAddress &remote,
                                     const proto::RequestStateTransferMessage &msg);
     void HandleStateTransfer(const TransportAddress &remote,
@@ -1,10 +1,14 @@
 d := $(dir $(lastword $(MAKEFILE_LIST)))
 
-GTEST_SRCS += $(d)vr-test.cc
+GTEST_SRCS += $(d)vr-test.cc $(d)batching-test.cc
 
 $(d)vr-test: $(o)vr-test.o \
-	$(OBJS-vr-replica) $(OBJS-vr-client) \
+	$(OBJS-vr-replica) $(OBJS-vr-client) $(OBJS-clientmux) \
 	$(LIB-simtransport) \
 	$(GTEST_MAIN)
 
-TEST_BINS += $(d)vr-test
+$(d)batching-test: $(o)batching-test.o \
+	$(OBJS-vr-batching) \
+	$(GTEST_MAIN)
+
+TEST_BINS += $(d)vr-test $(d)batching-test
@@ -0,0 +1,123 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * batching-test.cc:
+ *   test cases for VR batching policies
+ *
+ * Copyright 2013-2016 Dan R. K. Ports  <drkp@cs.washington.edu>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+
+#include "vr/batching.h"
+
+#include <gtest/gtest.h>
+
+using namespace specpaxos::vr;
+
+static BatchState
+MakeBatch(size_t ops, size_t inFlight, size_t pipelineDepth = 1,
+          size_t bytes = 0)
+{
+    BatchState b;
+    b.ops = ops;
+    b.bytes = bytes;
+    b.inFlight = inFlight;
+    b.pipelineDepth = pipelineDepth;
+    return b;
+}
+
+TEST(FixedBatchPolicy, Basic)
+{
+    FixedBatchPolicy p(4);
+
+    EXPECT_FALSE(p.ShouldClose(MakeBatch(0, 0)));
+    // Pipeline has room
+    EXPECT_TRUE(p.ShouldClose(MakeBatch(1, 0)));
+    EXPECT_TRUE(p.ShouldClose(MakeBatch(1, 1, 2)));
+    // Pipeline full; wait for a full batch
+    EXPECT_FALSE(p.ShouldClose(MakeBatch(3, 1)));
+    EXPECT_TRUE(p.ShouldClose(MakeBatch(4, 1)));
+    EXPECT_EQ(FixedBatchPolicy::DEFAULT_MAX_DELAY, p.MaxDelay());
+}
+
+TEST(AdaptiveBatchPolicy, LowLoad)
+{
+    AdaptiveBatchPolicy p(64, 65536, 1000, 5000);
+
+    // One request every 10 ms: batches should hold one request
+    for (uint64_t t = 1; t < 1000000; t += 10000) {
+        p.RequestArrived(t);
+    }
+    EXPECT_EQ(1, p.TargetOps());
+    EXPECT_TRUE(p.ShouldClose(MakeBatch(1, 0)));
+    EXPECT_TRUE(p.ShouldClose(MakeBatch(1, 1, 4)));
+}
+
+TEST(AdaptiveBatchPolicy, HighLoad)
+{
+    AdaptiveBatchPolicy p(64, 65536, 1000, 5000);
+
+    // One request every 50 us: a 1 ms budget fits 20 of them
+    for (uint64_t t = 1; t < 100000; t += 50) {
+        p.RequestArrived(t);
+    }
+    EXPECT_EQ(50, p.MeanInterarrival());
+    EXPECT_EQ(20, p.TargetOps());
+
+    // Nothing in flight, so there's no reason to wait
+    EXPECT_TRUE(p.ShouldClose(MakeBatch(1, 0, 4)));
+    // Otherwise wait for a full batch...
+    EXPECT_FALSE(p.ShouldClose(MakeBatch(10, 1, 4)));
+    EXPECT_TRUE(p.ShouldClose(MakeBatch(20, 1, 4)));
+    // ...unless the pipeline is full
+    EXPECT_FALSE(p.ShouldClose(MakeBatch(20, 4, 4)));
+    // but never go past the caps
+    EXPECT_TRUE(p.ShouldClose(MakeBatch(64, 4, 4)));
+    EXPECT_TRUE(p.ShouldClose(MakeBatch(2, 4, 4, 65536)));
+
+    // Even faster arrivals are capped at maxOps
+    for (uint64_t t = 100000; t < 200000; t += 1) {
+        p.RequestArrived(t);
+    }
+    EXPECT_EQ(64, p.TargetOps());
+}
+
+TEST(AdaptiveBatchPolicy, Idle)
+{
+    AdaptiveBatchPolicy p(64, 65536, 1000, 5000);
+
+    for (uint64_t t = 1; t < 100000; t += 50) {
+        p.RequestArrived(t);
+    }
+    EXPECT_EQ(20, p.TargetOps());
+
+    // A long idle period quickly brings batches back down to one
+    // request, rather than making the average meaningless
+    uint64_t t = 100000000;
+    for (int i = 0; i < 16; i++) {
+        p.RequestArrived(t);
+        t += 5000;
+    }
+    EXPECT_EQ(1, p.TargetOps());
+}
@@ -34,6 +34,7 @@
 #include "lib/simtransport.h"
 
 #include "common/client.h"
+#include "common/clientmux.h"
 #include "common/replica.h"
 #include "vr/client.h"
 #include "vr/replica.h"
@@ -41,8 +42,12 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <gtest/gtest.h>
-#include <vector>
+#include <algorithm>
+#include <map>
+#include <set>
 #include <sstream>
+#include <thread>
+#include <vector>
 
 static string replicaLastOp;
 static string clientLastOp;
@@ -53,6 +58,9 @@ using namespace specpaxos;
 using namespace specpaxos::vr;
 using namespace specpaxos::vr::proto;
 
+// How often an idle leader sends a null COMMIT
+static const uint64_t NULL_COMMIT_MS = 1000;
+
 class VRTestApp : public AppReplica
 {
 public:
@@ -108,6 +116,14 @@ protected:
 //            });
     }
 
+    // Followers hear about the last commit from the leader's null
+    // COMMIT, so give that time to go out before stopping
+    virtual void StopAfterCommit() {
+        transport->Timer(NULL_COMMIT_MS + 1, [this]() {
+                transport->CancelAllTimers();
+            });
+    }
+
     virtual string RequestOp(int n) {
         std::ostringstream stream;
         stream << "test: " << n;
@@ -155,7 +171,7 @@ TEST_P(VRTest, OneOp)
         // Not guaranteed that any replicas except the leader have
         // executed this request.
         EXPECT_EQ(apps[0]->ops.back(), req);
-        transport->CancelAllTimers();
+        StopAfterCommit();
     };
     
     ClientSendNext(upcall);
@@ -231,6 +247,19 @@ TEST_P(VRTest, UnloggedTimeout)
 
 TEST_P(VRTest, ManyOps)
 {
+    // Count the leader's COMMITs to replica 1
+    int commits = 0;
+    transport->AddFilter(10, [&](TransportReceiver *src, int srcIdx,
+                                 TransportReceiver *dst, int dstIdx,
+                                 Message &m, uint64_t &delay) {
+                             if ((srcIdx == 0) && (dstIdx == 1) &&
+                                 (m.GetTypeName() ==
+                                  CommitMessage().GetTypeName())) {
+                                 commits++;
+                             }
+                             return true;
+                         });
+
     Client::continuation_t upcall = [&](const string &req, const string &reply) {
         EXPECT_EQ(req, LastRequestOp());
         EXPECT_EQ(reply, "reply: "+LastRequestOp());
@@ -242,13 +271,17 @@ TEST_P(VRTest, ManyOps)
         if (requestNum < 9) {
             ClientSendNext(upcall);
         } else {
-            transport->CancelAllTimers();
+            StopAfterCommit();
         }
     };
     
     ClientSendNext(upcall);
     transport->Run();
 
+    // Each PREPARE carried the previous commit; only the null
+    // COMMIT after the last one goes out on its own
+    EXPECT_LE(commits, 1);
+
     // By now, they all should have executed the last request.
     for (int i = 0; i < config->n; i++) {
         EXPECT_EQ(10, apps[i]->ops.size());
@@ -271,7 +304,7 @@ TEST_P(VRTest, FailedReplica)
         if (requestNum < 9) {
             ClientSendNext(upcall);
         } else {
-            transport->CancelAllTimers();
+            StopAfterCommit();
         }
     };
     
@@ -319,7 +352,7 @@ TEST_P(VRTest, StateTransfer)
         if (requestNum < 9) {
             ClientSendNext(upcall);
         } else {
-            transport->CancelAllTimers();
+            StopAfterCommit();
         }
     };
     
@@ -347,6 +380,69 @@ TEST_P(VRTest, StateTransfer)
 }
 
 
+TEST_P(VRTest, ChunkedStateTransfer)
+{
+    const int NUM_REQS = 200;
+    // Big enough that the lagging replica's missing log has to be
+    // sent in several windows of chunks
+    const string padding(1024, 'x');
+    int stateTransfers = 0;
+    
+    Client::continuation_t upcall = [&](const string &req, const string &reply) {
+        EXPECT_EQ(req, LastRequestOp()+padding);
+        EXPECT_EQ(reply, "reply: "+LastRequestOp()+padding);
+
+        if (requestNum == NUM_REQS-5) {
+            // Restore replica 1, but drop some of the state transfer
+            // chunks sent to it
+            transport->RemoveFilter(10);
+            transport->AddFilter(20, [&](TransportReceiver *src, int srcIdx,
+                                         TransportReceiver *dst, int dstIdx,
+                                         Message &m, uint64_t &delay) {
+                                     if (m.GetTypeName() ==
+                                         StateTransferMessage().GetTypeName()) {
+                                         return ((++stateTransfers % 5) != 0);
+                                     }
+                                     return true;
+                                 });
+        }
+
+        if (requestNum < NUM_REQS-1) {
+            requestNum++;
+            client->Invoke(LastRequestOp()+padding, upcall);
+        } else {
+            transport->Timer(5000, [&]() {
+                    transport->CancelAllTimers();
+                });
+        }
+    };
+
+    requestNum++;
+    client->Invoke(LastRequestOp()+padding, upcall);
+
+    // Drop messages to or from replica 1
+    transport->AddFilter(10, [](TransportReceiver *src, int srcIdx,
+                                TransportReceiver *dst, int dstIdx,
+                                Message &m, uint64_t &delay) {
+                             if ((srcIdx == 1) || (dstIdx == 1)) {
+                                 return false;
+                             }
+                             return true;
+                         });
+    
+    transport->Run();
+
+    // Replica 1 should have caught up, even though the transfer
+    // didn't fit in one message and some chunks were lost
+    EXPECT_GT(stateTransfers, 5);
+    for (int i = 0; i < config->n; i++) {
+        ASSERT_EQ(NUM_REQS, apps[i]->ops.size());
+        for (int j = 0; j < NUM_REQS; j++) {
+            EXPECT_EQ(RequestOp(j)+padding, apps[i]->ops[j]);
+        }
+    }
+}
+
 TEST_P(VRTest, FailedLeader)
 {
     Client::continuation_t upcall = [&](const string &req, const string &reply) {
@@ -367,7 +463,7 @@ TEST_P(VRTest, FailedLeader)
         if (requestNum < 9) {
             ClientSendNext(upcall);
         } else {
-            transport->CancelAllTimers();
+            StopAfterCommit();
         }
     };
     
@@ -393,7 +489,7 @@ TEST_P(VRTest, DroppedReply)
     Client::continuation_t upcall = [&](const string &req, const string &reply) {
         EXPECT_EQ(req, LastRequestOp());
         EXPECT_EQ(reply, "reply: "+LastRequestOp());
-        transport->CancelAllTimers();
+        StopAfterCommit();
         received = true;
     };
 
@@ -429,7 +525,7 @@ TEST_P(VRTest, DroppedReplyThenFailedLeader)
     Client::continuation_t upcall = [&](const string &req, const string &reply) {
         EXPECT_EQ(req, LastRequestOp());
         EXPECT_EQ(reply, "reply: "+LastRequestOp());
-        transport->CancelAllTimers();
+        StopAfterCommit();
         received = true;
     };
 
@@ -473,10 +569,298 @@ TEST_P(VRTest, DroppedReplyThenFailedLeader)
     }
 }
 
+TEST_P(VRTest, LeaseReads)
+{
+    std::vector<string> replies;
+    bool dropCommitOKs = false;
+    Client::continuation_t upcall;
+    auto readNext = [&]() {
+        requestNum++;
+        client->InvokeReadOnly(LastRequestOp(), upcall);
+    };
+    transport->AddFilter(10, [&](TransportReceiver *src, int srcIdx,
+                                 TransportReceiver *dst, int dstIdx,
+                                 Message &m, uint64_t &delay) {
+                             return !(dropCommitOKs &&
+                                      (m.GetTypeName() ==
+                                       CommitOKMessage().GetTypeName()));
+                         });
+    upcall = [&](const string &req, const string &reply) {
+        EXPECT_EQ(req, LastRequestOp());
+        replies.push_back(reply);
+        switch (replies.size()) {
+        case 1:
+            ClientSendNext(upcall);
+            break;
+        case 2:
+            readNext();
+            break;
+        case 3:
+            // Stay idle for longer than the lease; the null COMMITs
+            // keep renewing it
+            transport->Timer(LeaderLease::DEFAULT_DURATION/1000 + 500,
+                             readNext);
+            break;
+        case 4:
+            // Without the followers' acknowledgments, it runs out
+            dropCommitOKs = true;
+            transport->Timer(LeaderLease::DEFAULT_DURATION/1000 + 500,
+                             readNext);
+            break;
+        default:
+            transport->CancelAllTimers();
+        }
+    };
+
+    // The leader doesn't have a lease yet, so the first read gets
+    // logged; once the write commits, the next ones are served from
+    // the leader's state
+    readNext();
+    transport->Run();
+
+    ASSERT_EQ(5, replies.size());
+    EXPECT_EQ("reply: "+RequestOp(0), replies[0]);
+    EXPECT_EQ("reply: "+RequestOp(1), replies[1]);
+    EXPECT_EQ("unlreply: "+RequestOp(2), replies[2]);
+    EXPECT_EQ("unlreply: "+RequestOp(3), replies[3]);
+    EXPECT_EQ("reply: "+RequestOp(4), replies[4]);
+
+    EXPECT_EQ(std::vector<string>({ RequestOp(2), RequestOp(3) }),
+              apps[0]->unloggedOps);
+    EXPECT_EQ(std::vector<string>({ RequestOp(0), RequestOp(1),
+                                    RequestOp(4) }),
+              apps[0]->ops);
+}
+
+TEST_P(VRTest, Windowed)
+{
+    const int NUM_OPS = 50;
+    const int WINDOW = 8;
+    client->SetWindow(WINDOW);
+
+    int completed = 0;
+    Client::continuation_t upcall = [&](const string &req, const string &reply) {
+        EXPECT_EQ(reply, "reply: "+req);
+        if (++completed == NUM_OPS) {
+            StopAfterCommit();
+        }
+    };
+
+    // Drop the first reply to every fifth request, so it has to be
+    // retried while later ones are outstanding. Also check that the
+    // client never has more than WINDOW requests out.
+    std::set<uint64_t> dropped;
+    std::set<uint64_t> replied;
+    transport->AddFilter(10, [&](TransportReceiver *src, int srcIdx,
+                                 TransportReceiver *dst, int dstIdx,
+                                 Message &m, uint64_t &delay) {
+                             ReplyMessage r;
+                             ReplyBatchMessage rb;
+                             RequestMessage q;
+                             if (m.GetTypeName() == r.GetTypeName()) {
+                                 r.CopyFrom(m);
+                                 *rb.add_reply() = r;
+                             } else if (m.GetTypeName() == rb.GetTypeName()) {
+                                 rb.CopyFrom(m);
+                             } else if (m.GetTypeName() == q.GetTypeName()) {
+                                 q.CopyFrom(m);
+                                 uint64_t oldest = 1;
+                                 while (replied.count(oldest)) {
+                                     oldest++;
+                                 }
+                                 EXPECT_LT(q.req().clientreqid(),
+                                           oldest + WINDOW);
+                             }
+
+                             bool drop = false;
+                             for (auto &reply : rb.reply()) {
+                                 if ((reply.clientreqid() % 5 == 0) &&
+                                     dropped.insert(reply.clientreqid()).second) {
+                                     drop = true;
+                                 }
+                             }
+                             if (!drop) {
+                                 for (auto &reply : rb.reply()) {
+                                     replied.insert(reply.clientreqid());
+                                 }
+                             }
+                             return !drop;
+                         });
+
+    for (int i = 0; i < NUM_OPS; i++) {
+        ClientSendNext(upcall);
+    }
+    transport->Run();
+
+    EXPECT_EQ(NUM_OPS, completed);
+    EXPECT_EQ(NUM_OPS/5, dropped.size());
+
+    // Each request should have been executed exactly once
+    for (int i = 0; i < config->n; i++) {
+        EXPECT_EQ(NUM_OPS, apps[i]->ops.size());
+        std::set<string> ops(apps[i]->ops.begin(), apps[i]->ops.end());
+        EXPECT_EQ(NUM_OPS, ops.size());
+    }
+}
+
+TEST_P(VRTest, ClientBatching)
+{
+    const int NUM_OPS = 32;
+    const int BATCH = 8;
+    client->SetWindow(2*BATCH);
+    client->SetBatching(BATCH, 2000);
+
+    int completed = 0;
+    Client::continuation_t upcall = [&](const string &req, const string &reply) {
+        EXPECT_EQ(reply, "reply: "+req);
+        if (++completed == NUM_OPS) {
+            StopAfterCommit();
+        }
+    };
+
+    // Count the request messages that reach the leader, and remember
+    // the contents of each batch
+    int requestMsgs = 0;
+    std::vector<std::vector<string> > batches;
+    transport->AddFilter(10, [&](TransportReceiver *src, int srcIdx,
+                                 TransportReceiver *dst, int dstIdx,
+                                 Message &m, uint64_t &delay) {
+                             RequestMessage q;
+                             RequestBatchMessage qb;
+                             if (dstIdx != 0) {
+                                 return true;
+                             }
+                             if (m.GetTypeName() == q.GetTypeName()) {
+                                 requestMsgs++;
+                             } else if (m.GetTypeName() == qb.GetTypeName()) {
+                                 requestMsgs++;
+                                 qb.CopyFrom(m);
+                                 std::vector<string> ops;
+                                 for (auto &req : qb.req()) {
+                                     ops.push_back(req.op());
+                                 }
+                                 batches.push_back(ops);
+                             }
+                             return true;
+                         });
+
+    for (int i = 0; i < NUM_OPS; i++) {
+        ClientSendNext(upcall);
+    }
+    transport->Run();
+
+    EXPECT_EQ(NUM_OPS, completed);
+    EXPECT_LE(requestMsgs, NUM_OPS/BATCH + 1);
+    EXPECT_FALSE(batches.empty());
+
+    for (int i = 0; i < config->n; i++) {
+        EXPECT_EQ(NUM_OPS, apps[i]->ops.size());
+    }
+
+    // Each batch was logged at consecutive opnums
+    const std::vector<string> &ops = apps[0]->ops;
+    for (auto &b : batches) {
+        auto it = std::find(ops.begin(), ops.end(), b[0]);
+        ASSERT_NE(ops.end(), it);
+        ASSERT_LE(b.size(), (size_t)(ops.end() - it));
+        EXPECT_TRUE(std::equal(b.begin(), b.end(), it));
+    }
+}
+
+TEST_P(VRTest, Multiplexed)
+{
+    const int NUM_SESSIONS = 20;
+    const int OPS_PER_SESSION = 3;
+
+    ClientMux mux(transport, *config);
+    std::vector<VRClient *> sessions;
+    for (int i = 0; i < NUM_SESSIONS; i++) {
+        sessions.push_back(new VRClient(*config, &mux));
+    }
+    EXPECT_EQ(NUM_SESSIONS, mux.NumSessions());
+
+    // Every request should come from the shared endpoint. Drop the
+    // first reply, so one session has to retry on a mux timer.
+    bool dropped = false;
+    transport->AddFilter(10, [&](TransportReceiver *src, int srcIdx,
+                                 TransportReceiver *dst, int dstIdx,
+                                 Message &m, uint64_t &delay) {
+                             if (m.GetTypeName() ==
+                                 RequestMessage().GetTypeName()) {
+                                 EXPECT_EQ(&mux, src);
+                             }
+                             if ((m.GetTypeName() ==
+                                  ReplyMessage().GetTypeName()) &&
+                                 !dropped) {
+                                 dropped = true;
+                                 return false;
+                             }
+                             return true;
+                         });
+
+    std::vector<int> completed(NUM_SESSIONS, 0);
+    int done = 0;
+    std::function<void (int)> sendNext = [&](int i) {
+        std::ostringstream op;
+        op << "session " << i << " op " << completed[i];
+        sessions[i]->Invoke(op.str(),
+                            [&, i](const string &req, const string &reply) {
+                                EXPECT_EQ("reply: "+req, reply);
+                                if (++completed[i] < OPS_PER_SESSION) {
+                                    sendNext(i);
+                                } else if (++done == NUM_SESSIONS) {
+                                    StopAfterCommit();
+                                }
+                            });
+    };
+    for (int i = 0; i < NUM_SESSIONS; i++) {
+        sendNext(i);
+    }
+    transport->Run();
+
+    EXPECT_TRUE(dropped);
+    EXPECT_EQ(NUM_SESSIONS, done);
+    for (int i = 0; i < config->n; i++) {
+        EXPECT_EQ(NUM_SESSIONS*OPS_PER_SESSION, apps[i]->ops.size());
+    }
+
+    for (auto s : sessions) {
+        delete s;
+    }
+    EXPECT_EQ(0, mux.NumSessions());
+}
+
 TEST_P(VRTest, ManyClients)
 {
     const int NUM_CLIENTS = 10;
     const int MAX_REQS = 100;
+    int prepares = 0;
+    int commits = 0;
+    opnum_t lastCommitted = 0;
+
+    // Count the leader's messages to replica 1, and how many
+    // COMMITs actually told it something new
+    transport->AddFilter(10, [&](TransportReceiver *src, int srcIdx,
+                                 TransportReceiver *dst, int dstIdx,
+                                 Message &m, uint64_t &delay) {
+                             if ((srcIdx == 0) && (dstIdx == 1)) {
+                                 if (m.GetTypeName() ==
+                                     PrepareMessage().GetTypeName()) {
+                                     prepares++;
+                                     lastCommitted = std::max(lastCommitted,
+                                         static_cast<PrepareMessage &>(m).lastcommitted());
+                                 } else if (m.GetTypeName() ==
+                                            CommitMessage().GetTypeName()) {
+                                     opnum_t op =
+                                         static_cast<CommitMessage &>(m).opnum();
+                                     if (op > lastCommitted) {
+                                         commits++;
+                                         lastCommitted = op;
+                                     }
+                                 }
+                             }
+                             return true;
+                         });
     
     std::vector<VRClient *> clients;
     std::vector<int> lastReq;
@@ -511,11 +895,274 @@ TEST_P(VRTest, ManyClients)
         }
     }
 
+    // With requests constantly arriving, commits should mostly be
+    // piggybacked on PREPAREs
+    EXPECT_LT(commits, prepares / 2);
+
     for (VRClient *c : clients) {
         delete c;
     }
 }
 
+TEST_P(VRTest, Pipelined)
+{
+    const int NUM_CLIENTS = 6;
+    const int MAX_REQS = 50;
+    const int PIPELINE_DEPTH = 4;
+
+    // Use a separate set of replicas that allow several batches in
+    // flight
+    SimulatedTransport ptransport;
+    std::vector<VRTestApp *> papps;
+    std::vector<VRReplica *> preplicas;
+    for (int i = 0; i < config->n; i++) {
+        papps.push_back(new VRTestApp());
+        preplicas.push_back(new VRReplica(*config, i, true, &ptransport,
+                                          GetParam(), papps[i],
+                                          PIPELINE_DEPTH));
+    }
+
+    // Slow the network down so batches pile up, and keep track of
+    // how many batches replica 1 has been sent but not acknowledged.
+    // Lose a few PREPAREs along the way, and check that resends
+    // repeat the batches as they were first sent.
+    std::set<opnum_t> unacked;
+    size_t maxInFlight = 0;
+    std::map<opnum_t, opnum_t> batchStarts;
+    int prepares = 0;
+    uint64_t dropUntil = 0;
+    bool mismatched = false;
+    ptransport.AddFilter(10, [&](TransportReceiver *src, int srcIdx,
+                                 TransportReceiver *dst, int dstIdx,
+                                 Message &m, uint64_t &delay) {
+                             if ((srcIdx == 0) && (dstIdx == 1) &&
+                                 (m.GetTypeName() ==
+                                  PrepareMessage().GetTypeName())) {
+                                 PrepareMessage &p =
+                                     static_cast<PrepareMessage &>(m);
+                                 auto b = batchStarts.find(p.opnum());
+                                 if (b == batchStarts.end()) {
+                                     batchStarts[p.opnum()] = p.batchstart();
+                                 } else if (b->second != p.batchstart()) {
+                                     mismatched = true;
+                                 }
+                                 unacked.insert(p.opnum());
+                                 maxInFlight = std::max(maxInFlight,
+                                                        unacked.size());
+                             }
+                             if ((srcIdx == 0) && (dstIdx != 0) &&
+                                 (m.GetTypeName() ==
+                                  PrepareMessage().GetTypeName())) {
+                                 // Partway through, lose every PREPARE
+                                 // for a while so the pipeline fills
+                                 // and the leader has to resend
+                                 if (++prepares == 20) {
+                                     dropUntil = ptransport.Now() + 300000;
+                                 }
+                                 if (ptransport.Now() < dropUntil) {
+                                     return false;
+                                 }
+                             }
+                             if ((srcIdx == 1) && (dstIdx == 0) &&
+                                 (m.GetTypeName() ==
+                                  PrepareOKMessage().GetTypeName())) {
+                                 opnum_t op =
+                                     static_cast<PrepareOKMessage &>(m).opnum();
+                                 unacked.erase(unacked.begin(),
+                                               unacked.upper_bound(op));
+                             }
+                             delay = 5;
+                             return true;
+                         });
+
+    std::vector<VRClient *> clients;
+    std::vector<int> lastReq;
+    std::vector<Client::continuation_t> upcalls;
+    for (int i = 0; i < NUM_CLIENTS; i++) {
+        clients.push_back(new VRClient(*config, &ptransport));
+        lastReq.push_back(0);
+        upcalls.push_back([&, i](const string &req, const string &reply) {
+                EXPECT_EQ("reply: "+RequestOp(lastReq[i]), reply);
+                lastReq[i] += 1;
+                if (lastReq[i] < MAX_REQS) {
+                    clients[i]->Invoke(RequestOp(lastReq[i]), upcalls[i]);
+                }
+            });
+        clients[i]->Invoke(RequestOp(lastReq[i]), upcalls[i]);
+    }
+
+    ptransport.Timer(7200000, [&]() {
+            ptransport.CancelAllTimers();
+        });
+
+    ptransport.Run();
+
+    EXPECT_GT(maxInFlight, 1);
+    EXPECT_LE(maxInFlight, PIPELINE_DEPTH);
+    EXPECT_FALSE(mismatched);
+    for (int i = 0; i < config->n; i++) {
+        ASSERT_EQ(NUM_CLIENTS * MAX_REQS, papps[i]->ops.size());
+        for (int j = 0; j < NUM_CLIENTS * MAX_REQS; j++) {
+            ASSERT_EQ(papps[0]->ops[j], papps[i]->ops[j]);
+        }
+    }
+
+    for (VRClient *c : clients) {
+        delete c;
+    }
+    for (VRReplica *r : preplicas) {
+        delete r;
+    }
+    for (VRTestApp *a : papps) {
+        delete a;
+    }
+}
+
+TEST_P(VRTest, ExecThread)
+{
+    const int NUM_CLIENTS = 4;
+    const int MAX_REQS = 25;
+
+    // Replicas that hand operations off to an execution thread
+    class ThreadTestApp : public VRTestApp
+    {
+    public:
+        virtual void ReplicaUpcall(opnum_t opnum, const string &req,
+                                   string &reply) {
+            VRTestApp::ReplicaUpcall(opnum, req, reply);
+            threads.insert(std::this_thread::get_id());
+        }
+        std::set<std::thread::id> threads;
+    };
+    SimulatedTransport ttransport;
+    std::vector<ThreadTestApp *> tapps;
+    std::vector<VRReplica *> treplicas;
+    for (int i = 0; i < config->n; i++) {
+        tapps.push_back(new ThreadTestApp());
+        treplicas.push_back(new VRReplica(*config, i, true, &ttransport,
+                                          GetParam(), tapps[i], 1,
+                                          true));
+    }
+
+    std::vector<VRClient *> clients;
+    std::vector<int> lastReq;
+    std::vector<Client::continuation_t> upcalls;
+    int done = 0;
+    string unloggedReply;
+    for (int i = 0; i < NUM_CLIENTS; i++) {
+        clients.push_back(new VRClient(*config, &ttransport));
+        lastReq.push_back(0);
+        upcalls.push_back([&, i](const string &req, const string &reply) {
+                EXPECT_EQ("reply: "+RequestOp(i*MAX_REQS+lastReq[i]),
+                          reply);
+                lastReq[i] += 1;
+                if (lastReq[i] < MAX_REQS) {
+                    clients[i]->Invoke(RequestOp(i*MAX_REQS+lastReq[i]),
+                                       upcalls[i]);
+                } else if (++done == NUM_CLIENTS) {
+                    // An unlogged request has to see every operation
+                    // the leader has executed
+                    clients[0]->InvokeUnlogged(
+                        0, "unlogged",
+                        [&](const string &req, const string &reply) {
+                            unloggedReply = reply;
+                            ttransport.CancelAllTimers();
+                        });
+                }
+            });
+        clients[i]->Invoke(RequestOp(i*MAX_REQS), upcalls[i]);
+    }
+
+    ttransport.Run();
+
+    // Stop the execution threads before looking at what they did
+    for (VRReplica *r : treplicas) {
+        delete r;
+    }
+
+    EXPECT_EQ("unlreply: unlogged", unloggedReply);
+    EXPECT_EQ(std::vector<string>({ "unlogged" }), tapps[0]->unloggedOps);
+    ASSERT_EQ(NUM_CLIENTS * MAX_REQS, tapps[0]->ops.size());
+    for (int i = 0; i < config->n; i++) {
+        // The others may not have heard about the last commits yet
+        ASSERT_LE(tapps[i]->ops.size(), tapps[0]->ops.size());
+        for (size_t j = 0; j < tapps[i]->ops.size(); j++) {
+            ASSERT_EQ(tapps[0]->ops[j], tapps[i]->ops[j]);
+        }
+        EXPECT_EQ(0u, tapps[i]->threads.count(std::this_thread::get_id()));
+    }
+
+    for (VRClient *c : clients) {
+        delete c;
+    }
+    for (ThreadTestApp *a : tapps) {
+        delete a;
+    }
+}
+
+TEST_P(VRTest, AdaptiveBatching)
+{
+    const int NUM_CLIENTS = 6;
+    const int MAX_REQS = 50;
+
+    SimulatedTransport ptransport;
+    std::vector<VRTestApp *> papps;
+    std::vector<VRReplica *> preplicas;
+    for (int i = 0; i < config->n; i++) {
+        papps.push_back(new VRTestApp());
+        preplicas.push_back(new VRReplica(*config, i, true, &ptransport,
+                                          new AdaptiveBatchPolicy(GetParam(),
+                                                                  65536,
+                                                                  1000, 5000),
+                                          papps[i], 2));
+    }
+    ptransport.AddFilter(10, [&](TransportReceiver *src, int srcIdx,
+                                 TransportReceiver *dst, int dstIdx,
+                                 Message &m, uint64_t &delay) {
+                             delay = 1;
+                             return true;
+                         });
+
+    std::vector<VRClient *> clients;
+    std::vector<int> lastReq;
+    std::vector<Client::continuation_t> upcalls;
+    for (int i = 0; i < NUM_CLIENTS; i++) {
+        clients.push_back(new VRClient(*config, &ptransport));
+        lastReq.push_back(0);
+        upcalls.push_back([&, i](const string &req, const string &reply) {
+                EXPECT_EQ("reply: "+RequestOp(lastReq[i]), reply);
+                lastReq[i] += 1;
+                if (lastReq[i] < MAX_REQS) {
+                    clients[i]->Invoke(RequestOp(lastReq[i]), upcalls[i]);
+                }
+            });
+        clients[i]->Invoke(RequestOp(lastReq[i]), upcalls[i]);
+    }
+
+    ptransport.Timer(7200000, [&]() {
+            ptransport.CancelAllTimers();
+        });
+
+    ptransport.Run();
+
+    for (int i = 0; i < config->n; i++) {
+        ASSERT_EQ(NUM_CLIENTS * MAX_REQS, papps[i]->ops.size());
+        for (int j = 0; j < NUM_CLIENTS * MAX_REQS; j++) {
+            ASSERT_EQ(papps[0]->ops[j], papps[i]->ops[j]);
+        }
+    }
+
+    for (VRClient *c : clients) {
+        delete c;
+    }
+    for (VRReplica *r : preplicas) {
+        delete r;
+    }
+    for (VRTestApp *a : papps) {
+        delete a;
+    }
+}
+
 TEST_P(VRTest, Recovery)
 {
     Client::continuation_t upcall = [&](const string &req, const string &reply) {
@@ -547,7 +1194,7 @@ TEST_P(VRTest, Recovery)
                     ClientSendNext(upcall);
                 });
         } else {
-            transport->CancelAllTimers();
+            StopAfterCommit();
         }
     };
     